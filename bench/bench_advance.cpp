@@ -0,0 +1,79 @@
+#include "bench_helpers.h"
+#include <chrono>
+#include <fakeclock/fakeclock.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+// Latency of advance() depending on the number of armed timers that do not expire. The cost of sleeping threads is
+// measured by BM_advance_with_idle_sleepers.
+
+static void BM_advance_with_armed_timerfds(benchmark::State &state)
+{
+    fakeclock::MasterOfTime master;
+    std::vector<int> fds;
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(24h);
+    for (int i = 0; i < state.range(0); i++)
+    {
+        fds.push_back(timerfd_create(CLOCK_MONOTONIC, 0));
+        timerfd_settime(fds.back(), 0, &value, nullptr);
+    }
+    run_batched(state, 100, [&] { master.advance(1ns); });
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+}
+BENCHMARK(BM_advance_with_armed_timerfds)->RangeMultiplier(10)->Range(1, 10000)->UseManualTime();
+
+static void BM_advance_with_armed_posix_timers(benchmark::State &state)
+{
+    fakeclock::MasterOfTime master;
+    std::vector<timer_t> timers;
+    sigevent sev = {};
+    sev.sigev_notify = SIGEV_NONE;
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(24h);
+    for (int i = 0; i < state.range(0); i++)
+    {
+        timer_t timerid;
+        timer_create(CLOCK_MONOTONIC, &sev, &timerid);
+        timer_settime(timerid, 0, &value, nullptr);
+        timers.push_back(timerid);
+    }
+    run_batched(state, 100, [&] { master.advance(1ns); });
+    for (auto timerid : timers)
+    {
+        timer_delete(timerid);
+    }
+}
+BENCHMARK(BM_advance_with_armed_posix_timers)->RangeMultiplier(10)->Range(1, 10000)->UseManualTime();
+
+/// An advance that fires one periodic timerfd while state.range(0) others stay armed.
+static void BM_advance_firing_one_of_timerfds(benchmark::State &state)
+{
+    fakeclock::MasterOfTime master;
+    std::vector<int> fds;
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(24h);
+    for (int i = 0; i < state.range(0); i++)
+    {
+        fds.push_back(timerfd_create(CLOCK_MONOTONIC, 0));
+        timerfd_settime(fds.back(), 0, &value, nullptr);
+    }
+    int periodic = timerfd_create(CLOCK_MONOTONIC, 0);
+    value.it_value = fakeclock::to_timespec(1us);
+    value.it_interval = fakeclock::to_timespec(1us);
+    timerfd_settime(periodic, 0, &value, nullptr);
+    run_batched(state, 100, [&] { master.advance(1us); });
+    close(periodic);
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+}
+BENCHMARK(BM_advance_firing_one_of_timerfds)->RangeMultiplier(10)->Range(1, 10000)->UseManualTime();
@@ -0,0 +1,99 @@
+#include "bench_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fakeclock/fakeclock.h>
+#include <optional>
+#include <thread>
+#include <time.h>
+using namespace std::chrono_literals;
+
+static constexpr int BATCH = 1000;
+
+static std::optional<fakeclock::MasterOfTime> master;
+static std::atomic<bool> advancing = false;
+static std::thread advancer;
+
+static void take_control(const benchmark::State &)
+{
+    master.emplace();
+}
+
+static void release_control(const benchmark::State &)
+{
+    master.reset();
+}
+
+/// Keeps advancing the clock from a background thread, so that readers race with writers.
+static void take_control_and_advance(const benchmark::State &state)
+{
+    take_control(state);
+    advancing = true;
+    advancer = std::thread([] {
+        while (advancing)
+        {
+            master->advance(1us);
+        }
+    });
+}
+
+static void stop_advancing(const benchmark::State &state)
+{
+    advancing = false;
+    advancer.join();
+    release_control(state);
+}
+
+static void BM_clock_gettime_intercepted(benchmark::State &state)
+{
+    timespec ts;
+    run_batched(state, BATCH, [&] {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        benchmark::DoNotOptimize(ts);
+    });
+}
+BENCHMARK(BM_clock_gettime_intercepted)
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseManualTime()
+    ->Setup(take_control)
+    ->Teardown(release_control);
+BENCHMARK(BM_clock_gettime_intercepted)
+    ->Name("BM_clock_gettime_intercepted_during_advance")
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseManualTime()
+    ->Setup(take_control_and_advance)
+    ->Teardown(stop_advancing);
+
+static constexpr const char *TRACE_PATH = "/tmp/fakeclock_bench_trace";
+static std::optional<fakeclock::TraceRecorder> recorder;
+
+/// Records a trace, to measure what recording adds to each intercepted call.
+static void take_control_and_trace(const benchmark::State &state)
+{
+    take_control(state);
+    recorder.emplace(TRACE_PATH);
+}
+
+static void stop_tracing(const benchmark::State &state)
+{
+    recorder.reset();
+    std::remove(TRACE_PATH);
+    release_control(state);
+}
+
+BENCHMARK(BM_clock_gettime_intercepted)
+    ->Name("BM_clock_gettime_intercepted_traced")
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseManualTime()
+    ->Setup(take_control_and_trace)
+    ->Teardown(stop_tracing);
+
+static void BM_steady_clock_now_intercepted(benchmark::State &state)
+{
+    run_batched(state, BATCH, [] { benchmark::DoNotOptimize(std::chrono::steady_clock::now()); });
+}
+BENCHMARK(BM_steady_clock_now_intercepted)
+    ->ThreadRange(1, std::thread::hardware_concurrency())
+    ->UseManualTime()
+    ->Setup(take_control)
+    ->Teardown(release_control);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <dlfcn.h>
+#include <fakeclock/common.h>
+#include <time.h>
+
+/// Function `name` straight from libc, bypassing the overrides of fakeclock.
+template <typename Fn> Fn *real_libc(const char *name)
+{
+    static void *libc = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    return reinterpret_cast<Fn *>(dlsym(libc, name));
+}
+
+/// Real CLOCK_MONOTONIC, so that measurements are not affected by fakeclock.
+inline std::chrono::nanoseconds real_now()
+{
+    static const auto real_clock_gettime = real_libc<decltype(clock_gettime)>("clock_gettime");
+    timespec ts;
+    real_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return fakeclock::to_duration(ts);
+}
+
+/// Runs `fn` `batch` times per benchmark iteration and reports the real time it took.
+/// Benchmarks using it must be registered with UseManualTime(), because the library's own clock may be faked.
+template <typename Fn> void run_batched(benchmark::State &state, int batch, Fn &&fn)
+{
+    for (auto _ : state)
+    {
+        auto start = real_now();
+        for (int i = 0; i < batch; i++)
+        {
+            fn();
+        }
+        state.SetIterationTime(std::chrono::duration<double>(real_now() - start).count());
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
@@ -0,0 +1,377 @@
+#include "bench_helpers.h"
+#include <chrono>
+#include <cstdint>
+#include <fakeclock/fakeclock.h>
+#include <optional>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+// Per-call cost of the overridden functions. Each benchmark runs with state.range(0) set to one of the modes below,
+// so the overhead of the override can be read off against the libc function it replaces.
+
+namespace
+{
+
+enum Mode
+{
+    REAL = 0,        ///< the libc function, called directly
+    PASSTHROUGH = 1, ///< the override while no MasterOfTime exists
+    INTERCEPTED = 2, ///< the override while time is faked
+};
+
+constexpr int BATCH = 100;
+
+std::optional<fakeclock::MasterOfTime> master;
+
+void setup_mode(const benchmark::State &state)
+{
+    if (state.range(0) == INTERCEPTED)
+    {
+        master.emplace();
+    }
+}
+
+void teardown_mode(const benchmark::State &)
+{
+    master.reset();
+}
+
+/// The libc function in REAL mode, the override otherwise.
+template <typename Fn> Fn *function_for_mode(const benchmark::State &state, Fn *override, const char *name)
+{
+    return state.range(0) == REAL ? real_libc<Fn>(name) : override;
+}
+
+#define FUNCTION_FOR_MODE(state, name) function_for_mode(state, &name, #name)
+
+#define BENCHMARK_MODES(fn)                                                                                            \
+    BENCHMARK(fn)                                                                                                      \
+        ->ArgName("mode")                                                                                              \
+        ->Arg(REAL)                                                                                                    \
+        ->Arg(PASSTHROUGH)                                                                                             \
+        ->Arg(INTERCEPTED)                                                                                             \
+        ->UseManualTime()                                                                                              \
+        ->Setup(setup_mode)                                                                                            \
+        ->Teardown(teardown_mode)
+
+/// For functions that would change the system clock outside of INTERCEPTED mode.
+#define BENCHMARK_INTERCEPTED(fn)                                                                                      \
+    BENCHMARK(fn)->ArgName("mode")->Arg(INTERCEPTED)->UseManualTime()->Setup(setup_mode)->Teardown(teardown_mode)
+
+/// A pipe with a byte in it, so that waits on its read end return at once.
+class ReadablePipe
+{
+  public:
+    ReadablePipe()
+    {
+        if (pipe(fds_) == 0)
+        {
+            char c = 'x';
+            (void)!write(fds_[1], &c, 1);
+        }
+    }
+    ~ReadablePipe()
+    {
+        close(fds_[0]);
+        close(fds_[1]);
+    }
+    int readFd() const
+    {
+        return fds_[0];
+    }
+
+  private:
+    int fds_[2] = {-1, -1};
+};
+
+sigevent no_notification()
+{
+    sigevent sev = {};
+    sev.sigev_notify = SIGEV_NONE;
+    return sev;
+}
+
+} // namespace
+
+static void BM_clock_gettime(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, clock_gettime);
+    timespec ts;
+    run_batched(state, BATCH, [&] {
+        fn(CLOCK_MONOTONIC, &ts);
+        benchmark::DoNotOptimize(ts);
+    });
+}
+BENCHMARK_MODES(BM_clock_gettime);
+
+static void BM_gettimeofday(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, gettimeofday);
+    timeval tv;
+    run_batched(state, BATCH, [&] {
+        fn(&tv, nullptr);
+        benchmark::DoNotOptimize(tv);
+    });
+}
+BENCHMARK_MODES(BM_gettimeofday);
+
+static void BM_time(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, time);
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(nullptr)); });
+}
+BENCHMARK_MODES(BM_time);
+
+static void BM_clock_settime(benchmark::State &state)
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    run_batched(state, BATCH, [&] { clock_settime(CLOCK_REALTIME, &ts); });
+}
+BENCHMARK_INTERCEPTED(BM_clock_settime);
+
+static void BM_settimeofday(benchmark::State &state)
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    run_batched(state, BATCH, [&] { settimeofday(&tv, nullptr); });
+}
+BENCHMARK_INTERCEPTED(BM_settimeofday);
+
+static void BM_nanosleep_zero(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, nanosleep);
+    timespec zero = {0, 0};
+    run_batched(state, BATCH, [&] { fn(&zero, nullptr); });
+}
+BENCHMARK_MODES(BM_nanosleep_zero);
+
+static void BM_clock_nanosleep_zero(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, clock_nanosleep);
+    timespec zero = {0, 0};
+    run_batched(state, BATCH, [&] { fn(CLOCK_MONOTONIC, 0, &zero, nullptr); });
+}
+BENCHMARK_MODES(BM_clock_nanosleep_zero);
+
+static void BM_usleep_zero(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, usleep);
+    run_batched(state, BATCH, [&] { fn(0); });
+}
+BENCHMARK_MODES(BM_usleep_zero);
+
+static void BM_sleep_zero(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, sleep);
+    run_batched(state, BATCH, [&] { fn(0); });
+}
+BENCHMARK_MODES(BM_sleep_zero);
+
+static void BM_poll_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, poll);
+    ReadablePipe pipe;
+    pollfd pfd = {pipe.readFd(), POLLIN, 0};
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(&pfd, 1, 1000)); });
+}
+BENCHMARK_MODES(BM_poll_ready);
+
+static void BM_ppoll_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, ppoll);
+    ReadablePipe pipe;
+    pollfd pfd = {pipe.readFd(), POLLIN, 0};
+    timespec timeout = {1, 0};
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(&pfd, 1, &timeout, nullptr)); });
+}
+BENCHMARK_MODES(BM_ppoll_ready);
+
+static void BM_select_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, select);
+    ReadablePipe pipe;
+    run_batched(state, BATCH, [&] {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(pipe.readFd(), &readfds);
+        timeval timeout = {1, 0};
+        benchmark::DoNotOptimize(fn(pipe.readFd() + 1, &readfds, nullptr, nullptr, &timeout));
+    });
+}
+BENCHMARK_MODES(BM_select_ready);
+
+static void BM_pselect_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, pselect);
+    ReadablePipe pipe;
+    timespec timeout = {1, 0};
+    run_batched(state, BATCH, [&] {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(pipe.readFd(), &readfds);
+        benchmark::DoNotOptimize(fn(pipe.readFd() + 1, &readfds, nullptr, nullptr, &timeout, nullptr));
+    });
+}
+BENCHMARK_MODES(BM_pselect_ready);
+
+static void BM_epoll_wait_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, epoll_wait);
+    ReadablePipe pipe;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, pipe.readFd(), &event);
+    epoll_event received;
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(epfd, &received, 1, 1000)); });
+    close(epfd);
+}
+BENCHMARK_MODES(BM_epoll_wait_ready);
+
+static void BM_epoll_pwait_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, epoll_pwait);
+    ReadablePipe pipe;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, pipe.readFd(), &event);
+    epoll_event received;
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(epfd, &received, 1, 1000, nullptr)); });
+    close(epfd);
+}
+BENCHMARK_MODES(BM_epoll_pwait_ready);
+
+#if __GLIBC_PREREQ(2, 35)
+static void BM_epoll_pwait2_ready(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, epoll_pwait2);
+    ReadablePipe pipe;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, pipe.readFd(), &event);
+    epoll_event received;
+    timespec timeout = {1, 0};
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(epfd, &received, 1, &timeout, nullptr)); });
+    close(epfd);
+}
+BENCHMARK_MODES(BM_epoll_pwait2_ready);
+#endif
+
+static void BM_timerfd_create_close(benchmark::State &state)
+{
+    auto create = FUNCTION_FOR_MODE(state, timerfd_create);
+    auto close_fd = FUNCTION_FOR_MODE(state, close);
+    run_batched(state, BATCH, [&] { close_fd(create(CLOCK_MONOTONIC, 0)); });
+}
+BENCHMARK_MODES(BM_timerfd_create_close);
+
+static void BM_timerfd_settime(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, timerfd_settime);
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1h);
+    run_batched(state, BATCH, [&] { fn(fd, 0, &value, nullptr); });
+    close(fd);
+}
+BENCHMARK_MODES(BM_timerfd_settime);
+
+static void BM_timerfd_gettime(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, timerfd_gettime);
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1h);
+    timerfd_settime(fd, 0, &value, nullptr);
+    run_batched(state, BATCH, [&] {
+        fn(fd, &value);
+        benchmark::DoNotOptimize(value);
+    });
+    close(fd);
+}
+BENCHMARK_MODES(BM_timerfd_gettime);
+
+static void BM_timerfd_read_not_expired(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, read);
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1h);
+    timerfd_settime(fd, 0, &value, nullptr);
+    uint64_t expirations;
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(fd, &expirations, sizeof(expirations))); });
+    close(fd);
+}
+BENCHMARK_MODES(BM_timerfd_read_not_expired);
+
+static void BM_dup_close(benchmark::State &state)
+{
+    auto dup_fd = FUNCTION_FOR_MODE(state, dup);
+    auto close_fd = FUNCTION_FOR_MODE(state, close);
+    run_batched(state, BATCH, [&] { close_fd(dup_fd(STDIN_FILENO)); });
+}
+BENCHMARK_MODES(BM_dup_close);
+
+static void BM_timer_create_delete(benchmark::State &state)
+{
+    auto create = FUNCTION_FOR_MODE(state, timer_create);
+    auto remove = FUNCTION_FOR_MODE(state, timer_delete);
+    auto sev = no_notification();
+    run_batched(state, BATCH, [&] {
+        timer_t timerid;
+        create(CLOCK_MONOTONIC, &sev, &timerid);
+        remove(timerid);
+    });
+}
+BENCHMARK_MODES(BM_timer_create_delete);
+
+static void BM_timer_settime(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, timer_settime);
+    auto sev = no_notification();
+    timer_t timerid;
+    timer_create(CLOCK_MONOTONIC, &sev, &timerid);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1h);
+    run_batched(state, BATCH, [&] { fn(timerid, 0, &value, nullptr); });
+    timer_delete(timerid);
+}
+BENCHMARK_MODES(BM_timer_settime);
+
+static void BM_timer_gettime(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, timer_gettime);
+    auto sev = no_notification();
+    timer_t timerid;
+    timer_create(CLOCK_MONOTONIC, &sev, &timerid);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1h);
+    timer_settime(timerid, 0, &value, nullptr);
+    run_batched(state, BATCH, [&] {
+        fn(timerid, &value);
+        benchmark::DoNotOptimize(value);
+    });
+    timer_delete(timerid);
+}
+BENCHMARK_MODES(BM_timer_gettime);
+
+static void BM_timer_getoverrun(benchmark::State &state)
+{
+    auto fn = FUNCTION_FOR_MODE(state, timer_getoverrun);
+    auto sev = no_notification();
+    timer_t timerid;
+    timer_create(CLOCK_MONOTONIC, &sev, &timerid);
+    run_batched(state, BATCH, [&] { benchmark::DoNotOptimize(fn(timerid)); });
+    timer_delete(timerid);
+}
+BENCHMARK_MODES(BM_timer_getoverrun);
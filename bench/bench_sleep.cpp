@@ -0,0 +1,71 @@
+#include "bench_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/fakeclock.h>
+#include <thread>
+#include <vector>
+using namespace std::chrono_literals;
+
+static void wait_for_waiters(size_t count)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    while (simulator.waiterCount() < count)
+    {
+        std::this_thread::yield();
+    }
+}
+
+/// state.range(0) threads sleep 1us at a time, the benchmark thread advances the clock as soon as all are asleep.
+static void BM_sleep_advance_ping_pong(benchmark::State &state)
+{
+    fakeclock::MasterOfTime master;
+    std::atomic<bool> stop = false;
+    std::atomic<int> stopped = 0;
+    std::vector<std::thread> sleepers;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        sleepers.emplace_back([&] {
+            while (!stop)
+            {
+                std::this_thread::sleep_for(1us);
+            }
+            stopped++;
+        });
+    }
+    run_batched(state, 100, [&] {
+        wait_for_waiters(state.range(0));
+        master.advance(1us);
+    });
+    state.SetItemsProcessed(state.iterations() * 100 * state.range(0)); // wake-ups
+    stop = true;
+    while (stopped < state.range(0))
+    {
+        master.advance(1us);
+        std::this_thread::yield();
+    }
+    for (auto &sleeper : sleepers)
+    {
+        sleeper.join();
+    }
+}
+BENCHMARK(BM_sleep_advance_ping_pong)->RangeMultiplier(2)->Range(1, 8)->UseManualTime();
+
+/// Cost of an advance that wakes nobody while state.range(0) threads sleep far in the future.
+static void BM_advance_with_idle_sleepers(benchmark::State &state)
+{
+    fakeclock::MasterOfTime master;
+    std::vector<std::thread> sleepers;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        sleepers.emplace_back([] { std::this_thread::sleep_for(24h); });
+    }
+    wait_for_waiters(state.range(0));
+    run_batched(state, 100, [&] { master.advance(1ns); });
+    master.advance(24h);
+    for (auto &sleeper : sleepers)
+    {
+        sleeper.join();
+    }
+}
+BENCHMARK(BM_advance_with_idle_sleepers)->RangeMultiplier(10)->Range(1, 1000)->UseManualTime();
@@ -0,0 +1,58 @@
+#ifndef FAKECLOCK_CALLBACKPOOL_H
+#define FAKECLOCK_CALLBACKPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+
+namespace fakeclock
+{
+
+/// The thread attributes of SIGEV_THREAD notifications (sigev_notify_attributes) that are honored: the stack and guard
+/// sizes and the scheduling. Copied when the timer is created, as the caller may destroy its attributes afterwards.
+struct ThreadAttributes
+{
+    explicit ThreadAttributes(const pthread_attr_t &attributes);
+    /// Initializes `attributes` for a detached thread with these settings.
+    void apply(pthread_attr_t &attributes) const;
+
+    size_t stack_size = 0;
+    size_t guard_size = 0;
+    int inherit_sched = PTHREAD_INHERIT_SCHED;
+    int policy = SCHED_OTHER;
+    sched_param param = {};
+};
+
+/// Runs SIGEV_THREAD notifications of POSIX timers on reusable threads instead of starting a thread per expiration.
+/// Each queued callback gets a thread of its own, so callbacks that wait for each other cannot deadlock; up to
+/// MAX_IDLE_THREADS of them stay around for later callbacks. Notifications with thread attributes run on a new thread
+/// with these attributes, like in glibc. The threads are not registered (see ClockSimulator::registerThread()) even if
+/// the thread submitting the callback is.
+class CallbackPool
+{
+  public:
+    static constexpr size_t MAX_IDLE_THREADS = 4;
+
+    static CallbackPool &getInstance();
+
+    void submit(std::function<void()> callback, std::shared_ptr<const ThreadAttributes> attributes = nullptr);
+
+  private:
+    CallbackPool();
+    void run();
+    void forgetThreadsAfterFork();
+
+    std::mutex mutex_;
+    std::condition_variable callback_queued_;
+    std::deque<std::function<void()>> callbacks_;
+    size_t threads_ = 0;
+    size_t idle_threads_ = 0;
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_CALLBACKPOOL_H
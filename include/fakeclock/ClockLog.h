@@ -0,0 +1,112 @@
+#ifndef FAKECLOCK_CLOCKLOG_H
+#define FAKECLOCK_CLOCKLOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <fakeclock/Trace.h>
+#include <optional>
+
+namespace fakeclock
+{
+
+class ClockSimulator;
+
+/// Clock readings and sleep or timer durations of a run on real time (see ClockRecorder), which
+/// MasterOfTime::replay() feeds back to the same threads of a simulated run.
+///
+/// The file streams: it is a header page followed by fixed-size chunks, each holding records of a single thread. A
+/// thread appends its records to its current chunk, which is the only part of the file it has mapped, and claims a
+/// new chunk at the end of the file when it is full. Threads are identified across runs by their lineage (see
+/// threadKey()), not by their tid.
+struct ClockLogRecord
+{
+    int64_t value; ///< time read in nanoseconds, or the time requested by a sleep, or the time until a timer expires
+    int64_t mono;  ///< real CLOCK_MONOTONIC when the operation returned
+    TraceOp op;
+    int16_t clock_id; ///< -1 if the operation has no clock
+    uint32_t reserved;
+};
+static_assert(sizeof(ClockLogRecord) == 24);
+
+struct ClockLogChunk
+{
+    static constexpr size_t SIZE = 65536;
+    static constexpr uint32_t CAPACITY = (SIZE - 16) / sizeof(ClockLogRecord);
+
+    uint64_t thread_key;
+    uint32_t sequence;           ///< number of the chunk among the chunks of its thread
+    std::atomic<uint32_t> count; ///< records written so far
+
+    ClockLogRecord *records()
+    {
+        return reinterpret_cast<ClockLogRecord *>(this + 1);
+    }
+    const ClockLogRecord *records() const
+    {
+        return reinterpret_cast<const ClockLogRecord *>(this + 1);
+    }
+};
+static_assert(sizeof(ClockLogChunk) == 16);
+
+struct ClockLogHeader
+{
+    static constexpr size_t SIZE = 4096; ///< chunks start at page boundaries
+    static constexpr char MAGIC[8] = {'F', 'C', 'C', 'L', 'O', 'C', 'K', '1'};
+
+    char magic[8];
+    uint32_t record_size;
+    uint32_t chunk_size;
+    std::atomic<uint64_t> chunks; ///< claimed so far
+    int64_t start_mono;           ///< real CLOCK_MONOTONIC when recording started
+    int64_t start_realtime;       ///< real CLOCK_REALTIME at the same moment
+};
+
+/// Set while recording, or while replaying.
+extern std::atomic<bool> clock_recording;
+extern std::atomic<bool> clock_replaying;
+
+void writeClockRecord(TraceOp op, int clock_id, int64_t value);
+std::optional<int64_t> replayClockRecord(TraceOp op, int clock_id);
+
+/// Called by overrides on real calls: records `value` if recording.
+inline void recordClock(TraceOp op, int clock_id, int64_t value)
+{
+    if (clock_recording.load(std::memory_order_relaxed)) [[unlikely]]
+    {
+        writeClockRecord(op, clock_id, value);
+    }
+}
+
+/// Called by intercepted calls: if replaying and the next record of the calling thread is `op` on `clock_id`, moves
+/// time along the recorded timeline to when that operation returned and returns the recorded value. Otherwise the
+/// thread has diverged from the recording (reported once) and gets simulated time from then on.
+inline std::optional<int64_t> replayClock(TraceOp op, int clock_id = -1)
+{
+    if (clock_replaying.load(std::memory_order_relaxed)) [[unlikely]]
+    {
+        return replayClockRecord(op, clock_id);
+    }
+    return std::nullopt;
+}
+
+/// Identity of the calling thread across runs: the main thread has key 1, and a thread created while recording or
+/// replaying is identified by its creator and how many threads the creator made before it.
+uint64_t threadKey();
+/// Key for the next thread created by the calling thread.
+uint64_t nextChildThreadKey();
+/// Called by a new thread with the key its creator got from nextChildThreadKey().
+void setThreadKey(uint64_t key);
+
+/// Starts recording to the file at `path`, which is created or truncated. Throws std::logic_error if already
+/// recording, std::system_error if the file cannot be created.
+void startClockRecording(const char *path);
+void stopClockRecording();
+/// Throws std::logic_error if already replaying or if `simulator` follows another process, std::system_error if the
+/// file cannot be read and std::runtime_error if it is no clock log.
+void startClockReplay(ClockSimulator &simulator, const char *path);
+/// Stops the replay of `simulator`, if there is one.
+void stopClockReplay(ClockSimulator &simulator);
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_CLOCKLOG_H
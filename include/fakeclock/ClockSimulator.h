@@ -5,45 +5,83 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
-#include <condition_variable>
+#include <cstdint>
+#include <fakeclock/Futex.h>
+#include <fakeclock/SharedTime.h>
+#include <fakeclock/TimeState.h>
+#include <fakeclock/TimerQueue.h>
 #include <fakeclock/fakeclock.h>
 #include <fcntl.h>
-#include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <poll.h>
+#include <pthread.h>
 #include <queue>
+#include <random>
+#include <signal.h>
 #include <sys/eventfd.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace fakeclock
 {
 
-inline bool are_fds_equivalent(int fd1, int fd2)
+/// Lock-free set of fd numbers. It lets fd operations (close, dup2, ...) that do not concern timerfds skip the
+/// simulator lock. Fds beyond MAX_FD are not stored individually, so mayContain() is conservative for them.
+class FdSet
 {
-#if 0
-    // we cannot SYS_kcmp here because sometimes we get EPERM on it (e.g. in docker)
-    long res = syscall(SYS_kcmp, getpid(), getpid(), KCMP_FILE, fd1, fd2);
-    return res == 0;
-#else
-    if (fcntl(fd1, F_GETFD) == -1 || fcntl(fd2, F_GETFD) == -1)
+  public:
+    static constexpr int MAX_FD = 65536;
+
+    void insert(int fd)
     {
-        return false; // one of the fds is closed, e.g. due to O_CLOEXEC
+        if (fd < 0)
+        {
+            return;
+        }
+        if (fd >= MAX_FD)
+        {
+            large_fds_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        bits_[fd / 64].fetch_or(uint64_t(1) << (fd % 64), std::memory_order_relaxed);
     }
-
-    // compare strings from /proc/self/fdinfo/<fd1> with /proc/self/fdinfo/<fd2>
-    std::ifstream fd1_info("/proc/self/fdinfo/" + std::to_string(fd1));
-    std::ifstream fd2_info("/proc/self/fdinfo/" + std::to_string(fd2));
-    if (!fd1_info.is_open() || !fd2_info.is_open())
+    void erase(int fd)
     {
-        return false;
+        if (fd < 0)
+        {
+            return;
+        }
+        if (fd >= MAX_FD)
+        {
+            large_fds_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        bits_[fd / 64].fetch_and(~(uint64_t(1) << (fd % 64)), std::memory_order_relaxed);
+    }
+    bool mayContain(int fd) const
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (fd >= MAX_FD)
+        {
+            return large_fds_.load(std::memory_order_relaxed) > 0;
+        }
+        return bits_[fd / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (fd % 64));
     }
-    std::string info1((std::istreambuf_iterator<char>(fd1_info)), std::istreambuf_iterator<char>());
-    std::string info2((std::istreambuf_iterator<char>(fd2_info)), std::istreambuf_iterator<char>());
-    return info1 == info2;
-#endif
-}
+
+  private:
+    std::array<std::atomic<uint64_t>, MAX_FD / 64> bits_ = {};
+    std::atomic<int> large_fds_ = 0;
+};
 
 class TimerFd
 {
@@ -55,14 +93,6 @@ class TimerFd
 
     TimerFd() = default;
 
-    ~TimerFd()
-    {
-        if (isValid())
-        {
-            this->close();
-        }
-    }
-
     TimerFd(const TimerFd &other) = delete;
     TimerFd &operator=(const TimerFd &other) = delete;
     TimerFd(TimerFd &&other)
@@ -77,32 +107,25 @@ class TimerFd
     void swap(TimerFd &other)
     {
         std::swap(client_fd, other.client_fd);
-        std::swap(my_fd, other.my_fd);
         std::swap(next_expiration_time, other.next_expiration_time);
         std::swap(interval, other.interval);
         std::swap(clock_id, other.clock_id);
+        std::swap(cancel_on_set, other.cancel_on_set);
+        std::swap(canceled, other.canceled);
     }
     bool open(int clock_id_, int flags)
     {
         assert(!*this); // already opened
         int eventfd_flags = 0;
-        int dup_flags = 0;
-        if (flags & TFD_TIMER_CANCEL_ON_SET)
-        {
-            std::cerr << "TFD_TIMER_CANCEL_ON_SET is not supported" << std::endl;
-            errno = EINVAL;
-            return false;
-        }
         if (flags & TFD_NONBLOCK)
         {
-            std::cerr << "TFD_NONBLOCK is not supported" << std::endl;
-            errno = EINVAL;
-            return false;
+            // Reads of an eventfd fail with EAGAIN while its counter is zero, like those of an unexpired timerfd.
+            eventfd_flags |= EFD_NONBLOCK;
+            flags &= ~TFD_NONBLOCK;
         }
         if (flags & TFD_CLOEXEC)
         {
             eventfd_flags |= EFD_CLOEXEC;
-            dup_flags |= FD_CLOEXEC;
             flags &= ~TFD_CLOEXEC;
         }
 
@@ -114,24 +137,19 @@ class TimerFd
         }
 
         client_fd = eventfd(0, eventfd_flags);
-        my_fd = dup(client_fd);
-        if (dup_flags)
+        if (client_fd == -1)
         {
-            fcntl(my_fd, F_SETFD, dup_flags);
+            return false;
         }
         clock_id = clock_id_;
         return true;
     }
-    void close()
+    /// Makes `fd` (a duplicate of the current fd) the one that receives expirations, e.g. after the client closed
+    /// the original fd but kept a dup() of it.
+    void set_client_fd(int fd)
     {
         assert(isValid());
-        if (!client_closed())
-        {
-            std::cerr << "fakeclock error: TimerFd " << client_fd << " not closed" << std::endl;
-        }
-        ::close(my_fd);
-        my_fd = -1;
-        client_fd = -1;
+        client_fd = fd;
     }
     void set_time(TimePoint next_expiration_time_, Duration interval_ = Duration::zero())
     {
@@ -149,6 +167,29 @@ class TimerFd
         assert(isValid());
         return interval;
     }
+    /// Set by timerfd_settime() with TFD_TIMER_CANCEL_ON_SET on an absolute CLOCK_REALTIME timer.
+    void set_cancel_on_set(bool enabled)
+    {
+        cancel_on_set = enabled;
+    }
+    /// Called when CLOCK_REALTIME is set. If the timer cancels on set, the next read() fails with ECANCELED; the fd
+    /// becomes readable, so that the read does not block and poll and epoll report it.
+    void clock_was_set()
+    {
+        assert(isValid());
+        if (cancel_on_set && !canceled)
+        {
+            canceled = true;
+            uint64_t one = 1;
+            auto _ = write(client_fd, &one, sizeof(one));
+            (void)_;
+        }
+    }
+    /// Whether the clock was set since the timer was armed or this was last called.
+    bool take_canceled()
+    {
+        return std::exchange(canceled, false);
+    }
     int get_clock_id() const
     {
         assert(isValid());
@@ -185,14 +226,9 @@ class TimerFd
             next_expiration_time = {};
         }
     }
-    bool client_closed() const
-    {
-        assert(isValid());
-        return !are_fds_equivalent(client_fd, my_fd);
-    }
     bool isValid() const
     {
-        return my_fd != -1;
+        return client_fd != -1;
     }
     operator bool() const
     {
@@ -204,14 +240,123 @@ class TimerFd
     }
 
   private:
-    int client_fd = -1; ///< fd returned to the client (closed by client)
-    int my_fd = -1;     ///< dup(client_fd) used to check if client closed the fd (closed by us)
+    int client_fd = -1; ///< fd returned to the client (closed by client, see ClockSimulator::fdClosed())
     TimePoint next_expiration_time = DISARM_TIME;
     Duration interval = Duration::zero();
     int clock_id = -1;
+    bool cancel_on_set = false;
+    bool canceled = false; ///< a read() must fail with ECANCELED
 };
 
-constexpr int MAX_CLK_ID = 16;
+/// State of a timer created by timer_create(). Expiration times are fake times.
+struct ThreadAttributes;
+
+struct PosixTimer
+{
+    using TimePoint = FakeClock::time_point;
+    using Duration = FakeClock::duration;
+    static constexpr auto DISARM_TIME = TimePoint{};
+
+    /// Moves the timer past `t` and returns how many times it expired on the way.
+    int64_t advance_to(TimePoint t)
+    {
+        if (expiration_time == DISARM_TIME || t < expiration_time)
+        {
+            return 0;
+        }
+        if (interval == Duration::zero())
+        {
+            expiration_time = DISARM_TIME;
+            return 1;
+        }
+        int64_t expirations = 1 + (t - expiration_time) / interval;
+        expiration_time += interval * expirations;
+        return expirations;
+    }
+
+    int clock_id = -1;
+    struct sigevent sevp = {};
+    TimePoint expiration_time = DISARM_TIME;
+    Duration interval = Duration::zero();
+    int overrun = 0;     ///< expirations coalesced into the last notification, reported by timer_getoverrun()
+    bool itimer = false; ///< the ITIMER_REAL timer of setitimer() and alarm(), which signals like the kernel does
+    std::shared_ptr<const ThreadAttributes> thread_attributes; ///< copy of sevp.sigev_notify_attributes
+};
+
+/// Notification of an expired POSIX timer, queued under the simulator lock and delivered after releasing it.
+struct TimerNotification
+{
+    timer_t timerid;
+    struct sigevent sevp;
+    int overrun;
+    bool itimer;
+    std::shared_ptr<const ThreadAttributes> thread_attributes;
+};
+
+class ClockSimulator;
+
+/// Bookkeeping of a thread registered with ClockSimulator::registerThread(), used for automatic time advance and
+/// deterministic scheduling.
+struct SimulatedThread
+{
+    static constexpr uint64_t NOT_POLLED = UINT64_MAX;
+
+    int registrations = 0;
+    bool blocked = false;                      ///< inside waitUntil() or between waitBegin() and waitEnd()
+    std::vector<pollfd> blocked_on_fds;        ///< fds whose readiness ends the current fd wait
+    uint64_t fds_polled_progress = NOT_POLLED; ///< progress of the simulator when blocked_on_fds were last not ready
+    ClockSimulator *unsettled_in = nullptr;    ///< advanceAndSettle() of this simulator waits for the thread to block
+    uint64_t settle_epoch = 0;                 ///< epoch of unsettled_in the thread was counted in
+    uint64_t schedule_id = 0;                  ///< rank among the threads waiting for their turn
+    bool ready = false;                        ///< waits for its turn
+    bool parked = false;                       ///< inside ClockSimulator::park()
+    const pthread_cond_t *parked_on = nullptr; ///< condition variable of a parked wait, none if it retries
+    uint64_t parked_progress = 0;              ///< progress of the simulator when the thread parked
+    std::atomic<uint32_t> turn = 0;            ///< futex the thread waits on, bumped when it gets its turn
+};
+
+/// A thread blocked in ClockSimulator::waitUntil(), which is woken through wake_event, or in a wait between
+/// ClockSimulator::waitBegin() and waitEnd(), which notices `expired` by itself: an fd wait through wake_fd, a timed
+/// wait on a condition variable through wake_cond, one on a futex through wake_futex, one for signals through
+/// wake_signal, other timed waits by checking it now and then.
+struct Waiter
+{
+    WakeEvent wake_event;
+    int wake_fd = -1;                    ///< eventfd the simulator writes to at the deadline of an fd wait
+    pthread_cond_t *wake_cond = nullptr; ///< condition variable the simulator broadcasts at the deadline
+    uint32_t *wake_futex = nullptr;      ///< futex the simulator wakes at the deadline (FUTEX_WAKE_BITSET)
+    bool wake_futex_private = false;     ///< wake_futex is private to the process
+    uint32_t wake_futex_bitset = 0;      ///< of the wait on wake_futex
+    pid_t wake_tid = 0;                  ///< thread the simulator sends wake_signal at the deadline
+    int wake_signal = 0;
+    bool wakes_itself = false;           ///< started by waitBegin()
+    std::atomic<bool> expired = false;   ///< the deadline of a wait started by waitBegin() has passed
+    SimulatedThread *thread = nullptr; ///< set if the waiting thread is registered
+    Waiter *next_to_wake = nullptr; ///< links waiters popped from the queue, so they can be woken after unlocking
+    const pollfd *fds = nullptr;    ///< of the fd wait in progress, polled to find threads woken through fds
+    size_t nfds = 0;
+    Waiter *prev_begun = nullptr;   ///< links the waits between waitBegin() and waitEnd()
+    Waiter *next_begun = nullptr;
+    uint64_t settle_epoch = 0;      ///< the waking step counted the thread as running in this settle epoch
+};
+
+/// Number of simulators with a MasterOfTime. It lives at namespace scope, so that overrides can check it without
+/// touching any simulator.
+extern std::atomic<int> intercepting;
+
+/// Number of simulators that schedule deterministically, see ClockSimulator::scheduleDeterministically().
+extern std::atomic<int> scheduling;
+
+/// Simulator of the Timeline the calling thread is attached to, nullptr for the default one.
+extern thread_local ClockSimulator *current_timeline;
+
+/// Whether calls of the calling thread are intercepted. If no simulator intercepts, this costs the overrides a single
+/// load on real calls.
+inline bool isIntercepting();
+
+/// Whether the calling thread takes turns, see ClockSimulator::scheduleDeterministically(). If no simulator schedules,
+/// this costs the overrides a single load.
+inline bool takesTurns();
 
 class ClockSimulator
 {
@@ -219,43 +364,296 @@ class ClockSimulator
     using ClockId = int32_t; // corresponds to clockid_t
     using TimePoint = FakeClock::time_point;
     using Duration = FakeClock::duration;
-    static ClockSimulator &getInstance();
+    /// The simulator of the calling thread's timeline.
+    static ClockSimulator &getInstance()
+    {
+        return current_timeline ? *current_timeline : getDefault();
+    }
+    /// The simulator of threads that are not attached to a Timeline.
+    static ClockSimulator &getDefault();
+
+    /// Use getInstance() unless this is for a new Timeline.
+    ClockSimulator();
+    ClockSimulator(const ClockSimulator &) = delete;
+    ClockSimulator &operator=(const ClockSimulator &) = delete;
+    ~ClockSimulator();
 
     void addClock();
     void removeClock();
     void handleExpiringFds();
-    void cleanupTimerfds();
     void advance(std::chrono::nanoseconds duration);
+    /// Advances like advance(), then waits until the threads woken by the step have blocked again in an intercepted
+    /// wait or exited and the SIGEV_THREAD callbacks it started have returned. Returns false if that did not happen
+    /// within `timeout` of real time.
+    bool advanceAndSettle(Duration duration, std::optional<Duration> timeout = std::nullopt);
+    /// Advances to `tp` unless time is already there or beyond. Does nothing in a process that follows another one.
+    void advanceTo(TimePoint tp);
+    /// Earliest pending deadline of a sleeping thread, timerfd or POSIX timer, if there is any.
+    std::optional<TimePoint> nextEventTime() const;
+    /// Advances to nextEventTime(). Returns false (and does not advance) if nothing is pending until `limit`.
+    bool advanceToNextEvent(TimePoint limit = TimePoint::max());
     void waitUntil(TimePoint tp);
+    size_t waiterCount() const;
+    /// When enabled, time jumps to the next event as soon as all registered threads are blocked.
+    void setAutoAdvance(bool enabled);
+    /// Lets fake time follow the real clock, multiplied by the time scale. A driver thread fires events on time.
+    void resume();
+    /// Freezes fake time (the initial state).
+    void pause();
+    bool isPaused() const;
+    /// Fake nanoseconds per real nanosecond while time flows. Must be positive.
+    void setTimeScale(double scale);
+    /// Publishes the time through shared memory, so that processes forked from now on follow it: their sleepers,
+    /// timerfds and POSIX timers expire as time advances here. Children cannot change the time themselves.
+    void shareWithChildProcesses();
+    /// LD_PRELOAD mode: follows the time in the file at `path`, which is controlled by other processes (see
+    /// SharedTime). Throws std::system_error if the file cannot be mapped.
+    void followExternalControl(const char *path);
+    /// Whether the time is driven by another process (see shareWithChildProcesses() and followExternalControl()).
+    bool isFollowing() const;
+    /// Makes a process that follows another one control its time again, from the time it has reached. Used by the
+    /// workers of exploreSchedules(), which must not follow a parent that shares its time.
+    void stopFollowing();
+    void registerThread();
+    void unregisterThread();
+    bool isThreadRegistered() const;
+    /// A registered thread is about to create a thread that will call registerSpawnedThread() (or the creation
+    /// failed and spawnFailed() is called). Until then the new thread counts as running.
+    /// Returns the schedule id of the new thread.
+    uint64_t threadSpawning();
+    void registerSpawnedThread(uint64_t schedule_id);
+    void spawnFailed();
+    /// Called by intercepted waits that also end on something other than time before the real wait: fd waits (poll,
+    /// select, ...) on `fds` and `waiter.wake_fd`, and timed waits on synchronization objects with no fds. Arms
+    /// `waiter` to fire at `deadline` (none for an infinite wait) and marks registered threads as blocked. Returns
+    /// false, without arming anything, if the deadline has already passed. Otherwise `fds` must stay in place until
+    /// waitEnd(), though the real wait may write their revents.
+    bool waitBegin(Waiter &waiter, std::optional<TimePoint> deadline, const pollfd *fds, size_t nfds);
+    /// Ends the wait started by waitBegin(). Returns true if the deadline has passed; then wake_fd is readable.
+    bool waitEnd(Waiter &waiter);
+    /// Called when the calling thread exits or detaches from the simulator's Timeline, so that advanceAndSettle()
+    /// stops waiting for it.
+    void threadLeft();
+
+    /// Runs the registered threads one at a time until restore(). The running thread hands its turn over when it
+    /// blocks in an intercepted wait, reads a clock (yieldTurn()) or waits in park(), and the next thread is picked
+    /// among those ready with a generator seeded with `seed`. Choices only depend on the seed and on which threads
+    /// are ready, so runs with the same seed interleave the same way.
+    void scheduleDeterministically(uint64_t seed);
+    bool takesTurns() const;
+    /// Lets the other ready threads run first, at random. Called by clock reads.
+    void yieldTurn()
+    {
+        if (scheduling_.load(std::memory_order_relaxed)) [[unlikely]]
+        {
+            yieldTurnSlow();
+        }
+    }
+    enum class Park
+    {
+        Retry,      ///< the calling thread has its turn again, and the wait may be over
+        Expired,    ///< the deadline has passed
+        Unscheduled ///< the thread does not take turns, so it must block for real
+    };
+    /// Blocking waits of threads that take turns park here instead of blocking, so that they never block holding the
+    /// turn: a thread that would have to wait hands its turn over and gets another one to retry once another thread
+    /// made progress or time advanced, or if nothing else can run, as the wait may be for an unregistered thread.
+    /// `again` is set if the thread parks again after a failed retry, which is no progress. Waits on `cond` instead
+    /// get their turn once it is signaled (see condSignaled()), and unlock `mutex` unless Unscheduled is returned.
+    /// Either way, the thread gets its turn back at `deadline`.
+    Park park(std::optional<TimePoint> deadline, bool again = false, const pthread_cond_t *cond = nullptr,
+              pthread_mutex_t *mutex = nullptr);
+    /// Called by pthread_cond_signal() (`all` unset) and pthread_cond_broadcast() on `cond`.
+    void condSignaled(const pthread_cond_t *cond, bool all);
+    /// Varies what one run leaves to chance, drawing from `seed` until restore(): schedules deterministically, breaks
+    /// ties between equal deadlines at random, wakes the threads a step releases in random order and splits advance()
+    /// into random steps. See exploreSchedules().
+    void explore(uint64_t seed);
+
     void setTime(TimePoint tp, ClockId clk_id);
     TimePoint now() const;
     TimePoint getTime(ClockId clk_id) const;
-    bool isIntercepting() const;
+    bool isIntercepting() const
+    {
+        // acquire pairs with the store in intercept(), so readers that see true also see the offsets
+        return intercepting_.load(std::memory_order_acquire);
+    }
     int timerfdCreate(ClockId clock_id, int flags);
-    void timerfdSetTime(int fd, TimePoint tp, Duration interval = Duration::zero());
+    /// `cancel_on_set` makes reads fail with ECANCELED once CLOCK_REALTIME gets set (TFD_TIMER_CANCEL_ON_SET).
+    void timerfdSetTime(int fd, TimePoint tp, Duration interval = Duration::zero(), bool cancel_on_set = false);
+    /// Called by read() on a timerfd after the real read of its eventfd: returns true, and discards the expirations
+    /// the fd still holds, if the clock was set since the timerfd was armed with TFD_TIMER_CANCEL_ON_SET.
+    bool timerfdTakeCanceled(int fd);
     void timerfdGetTime(int fd, struct itimerspec *curr_value);
     ClockId timerfdGetClockId(int fd);
+    /// Must be called before `fd` gets closed (explicitly or by dup2()). Fd numbers belong to the whole process, so
+    /// this and the calls below reach the simulator that created the timerfd, whatever the timeline of the caller.
+    static void fdClosed(int fd);
+    /// Must be called after `new_fd` became a duplicate of `old_fd`.
+    static void fdDuplicated(int old_fd, int new_fd);
+    /// Must be called before all fds in [first, last] get closed.
+    static void fdRangeClosed(unsigned int first, unsigned int last);
+    /// Cheap, lock-free check that may return true for fds that are not timerfds, but never false for timerfds.
+    bool mayBeTimerfd(int fd) const
+    {
+        return timerfd_numbers_.mayContain(fd);
+    }
+    timer_t posixTimerCreate(ClockId clock_id, const struct sigevent *sevp);
+    void posixTimerDelete(timer_t timerid);
+    void posixTimerSetTime(timer_t timerid, TimePoint tp, Duration interval = Duration::zero());
+    void posixTimerGetTime(timer_t timerid, struct itimerspec *curr_value);
+    ClockId posixTimerGetClockId(timer_t timerid);
+    int posixTimerGetOverrun(timer_t timerid);
+    /// The POSIX timer behind ITIMER_REAL of setitimer() and alarm(), which sends SIGALRM to the process. Created on
+    /// first use; a forked child starts without it.
+    timer_t realItimer();
     TimePoint toFakeTime(ClockId clk_id, timespec ts) const;
     timespec toTimespec(ClockId clk_id, TimePoint tp) const;
 
   private:
-    ClockSimulator() = default;
     void intercept();
     void restore();
+    int resolveTimerfd(int fd) const;
     TimerFd &getTimerfd(int fd);
+    void scheduleTimerfd(int fd, const TimerFd &timerfd);
+    /// Forgets `fd` here and in the process-wide owners of timerfds, whose lock the caller holds as well.
+    void eraseTimerfdNumber(int fd);
+    /// Resets the expiration count of `timerfd` without blocking.
+    static void drainTimerfd(const TimerFd &timerfd);
     void setOffsetsUsingCurrentTime();
     Duration getOffset(ClockId clk_id) const;
     void setOffset(ClockId clk_id, Duration offset);
+    void publishTime();
+    void handleExpiringTimers();
+    void handleExpiringPosixTimers();
+    Waiter *advanceLocked(Duration duration);
+    std::optional<TimePoint> nextEventTimeLocked() const;
+    Waiter *popExpiredWaiters(TimePoint t);
+    void markBlocked(SimulatedThread &thread, bool blocked);
+    void yieldTurnSlow();
+    /// Adds `thread` to the threads waiting for their turn.
+    void makeReadyLocked(SimulatedThread &thread);
+    void unparkLocked(SimulatedThread &thread);
+    /// Ends the turn of the calling thread, if it has it. `progress` counts the turn for the threads that retry.
+    void endTurnLocked(bool progress);
+    /// Gives the turn to a ready thread if nobody has it and all threads that are about to become ready are.
+    void scheduleLocked();
+    /// Makes the registered threads ready whose fd waits would return.
+    void markThreadsWithReadyFdsLocked();
+    /// Blocks until the calling thread has its turn, if it takes turns.
+    void awaitTurnLocked(std::unique_lock<Mutex> &lock);
+    /// Takes the turn away from a thread that did not hand it over in time, which must be blocked outside fakeclock.
+    void checkStalledTurnLocked();
+    void stopSchedulingLocked();
+    /// advance() while exploring: steps to random points between the pending events and `duration`, and lets the woken
+    /// threads settle in between.
+    void advanceInRandomSteps(Duration duration);
+    /// `waiters` in random order.
+    Waiter *shuffleLocked(Waiter *waiters);
+    bool anyBlockedThreadHasReadyFds() const;
+    /// The calling thread runs after returning from a wait, so advanceAndSettle() waits for it to block again.
+    /// `counted_epoch` is the settle epoch in which the waking step already counted it, if any.
+    void unsettleThreadLocked(uint64_t counted_epoch);
+    /// The calling thread blocks or leaves.
+    void settleThreadLocked();
+    /// Counts the threads in waits started by waitBegin() that are about to return, because their fds are ready or
+    /// the deadline has passed, as running.
+    void markReturningWaitersLocked();
+    Waiter *autoAdvanceLocked();
+    /// Brings fake_time_ up to date with flowing time (see resume()) and expires timers. Sleepers are left to the
+    /// driver thread.
+    void syncFlowingTimeLocked(Duration real_now = TimeState::realNow());
+    /// Makes the driver thread recompute its wake-up time if `deadline` comes before it.
+    void pokeDriverLocked(TimePoint deadline);
+    void startDriverLocked();
+    /// Loop of the driver thread, which wakes sleepers and expires timers while time flows or follows the parent.
+    void driveTime();
+    /// Futex the driver thread waits on: private while time flows, shared with the parent process in a child.
+    std::atomic<uint32_t> &driverWord();
+    void wakeDriverLocked();
+    static void joinDriver(pthread_t driver);
+    /// Throws in a child process, which cannot change the time it shares with its parent.
+    void checkNotFollowerLocked() const;
+    /// Makes `shared` the published time and keeps it consistent across fork(). Needs shared_simulators_mutex.
+    void addSharedLocked(SharedTime *shared);
+    /// Called in a forked child: drops the state of threads and timers that the child did not inherit and starts a
+    /// driver thread that follows the time of the parent.
+    void followParentAfterFork();
+    static void forkPrepare();
+    static void forkParent();
+    static void forkChild();
+    /// Wakes `waiters` and delivers the pending timer notifications. Must be called without holding mutex_.
+    void wakeWaiters(Waiter *waiters);
+    void deliverTimerNotifications();
+    timer_t posixTimerCreateLocked(ClockId clock_id, const struct sigevent *sevp);
+    void callbackDone();
 
+    /// Authoritative values, modified under mutex_ and then copied to published_time_ for lock-free readers.
     TimePoint fake_time_ /* zero is used as "no value" */ = TimePoint(std::chrono::seconds{1});
+    TimeState published_time_;
+    std::atomic<TimeState *> published_ = &published_time_; ///< published_time_ or the state in shared_
+    SharedTime *shared_ = nullptr;                         ///< see shareWithChildProcesses()
+    bool following_ = false;                               ///< time is driven by the parent process
     std::atomic<int> clock_count_ = 0;
-    mutable std::mutex mutex_;
-    std::condition_variable cv_;
-    bool intercepting_ = false;
-    std::unordered_map<int, TimerFd> timerfds_;
-    std::array<Duration, MAX_CLK_ID> clock_offsets_ = {}; // clock_time - fake_time
+    Mutex lifecycle_mutex_; ///< held by addClock() and removeClock() throughout, taken before mutex_
+    std::atomic<bool> intercepting_ = false; ///< set while a MasterOfTime exists
+    mutable Mutex mutex_;
+    TimerQueue<Waiter *> waiters_; ///< threads in waitUntil() ordered by deadline
+    bool auto_advance_ = false;
+    std::vector<SimulatedThread *> registered_threads_;
+    size_t blocked_threads_ = 0; ///< registered threads that are blocked
+    size_t spawning_threads_ = 0; ///< threads created by registered threads that did not register yet
+    std::unordered_map<int, TimerFd> timerfds_;        ///< keyed by TimerFd::getClientFd()
+    std::unordered_map<int, int> timerfd_duplicates_; ///< other fds referring to a timerfd -> its client fd
+    FdSet timerfd_numbers_;                           ///< all keys of timerfds_ and timerfd_duplicates_
+    TimerQueue<int> timerfd_queue_;                   ///< armed timerfds ordered by expiration time
+    std::unordered_map<timer_t, PosixTimer> posix_timers_;
+    TimerQueue<timer_t> posix_timer_queue_; ///< armed POSIX timers ordered by expiration time
+    timer_t real_itimer_ = nullptr;         ///< see realItimer()
+    bool flowing_ = false;
+    double time_scale_ = 1.0;
+    TimePoint flow_anchor_fake_;                   ///< fake time at real_anchor_ while time flows
+    Duration real_anchor_ = Duration::zero();      ///< real CLOCK_MONOTONIC at flow_anchor_fake_
+    pthread_t driver_ = {};                        ///< expires events while time flows
+    TimePoint driver_deadline_ = TimePoint::max(); ///< next event the driver thread waits for
+    std::atomic<uint32_t> driver_generation_ = 0;  ///< futex the driver thread waits on, bumped to wake it early
+    std::vector<TimerNotification> pending_notifications_;
+    std::atomic<bool> has_pending_notifications_ = false;
+    size_t running_callbacks_ = 0; ///< SIGEV_THREAD callbacks that were queued and did not return yet
+    Waiter *begun_waiters_ = nullptr;  ///< list of the waiters of all waits between waitBegin() and waitEnd()
+    std::vector<pollfd> polled_fds_;   ///< scratch space of markReturningWaitersLocked() and scheduleLocked()
+    std::vector<SimulatedThread *> polled_threads_; ///< scratch space of scheduleLocked()
+    size_t settling_ = 0;              ///< calls of advanceAndSettle() in progress
+    size_t unsettled_threads_ = 0;     ///< threads woken while settling_ that did not block again yet
+    uint64_t settle_epoch_ = 1;        ///< bumped when the last advanceAndSettle() returns, which forgets the counts
+    std::atomic<uint32_t> settle_generation_ = 0; ///< futex advanceAndSettle() waits on, bumped when threads settle
+    TimeState::Offsets clock_offsets_ = {}; // clock_time - fake_time
+    TimePoint simulation_fake_start_;                   ///< fake time when the first clock was added
+    Duration simulation_real_start_ = Duration::zero(); ///< real CLOCK_MONOTONIC at the same moment
+    size_t advance_fired_timers_ = 0;  ///< counted for Stats by advanceLocked()
+    size_t advance_woken_threads_ = 0; ///< counted for Stats by advanceLocked()
+    std::atomic<bool> scheduling_ = false;          ///< see scheduleDeterministically()
+    std::mt19937_64 schedule_rng_;                  ///< picks the next thread among the ready ones
+    SimulatedThread *running_thread_ = nullptr;     ///< the thread whose turn it is, if any
+    Duration turn_start_ = Duration::zero();        ///< real CLOCK_MONOTONIC when running_thread_ got its turn
+    std::vector<SimulatedThread *> ready_threads_;  ///< threads waiting for their turn, ordered by schedule id
+    std::vector<SimulatedThread *> parked_threads_; ///< threads in park(), in the order they parked
+    uint64_t progress_ = 0;                         ///< bumped by time advances and turns other than failed retries
+    uint64_t next_schedule_id_ = 1;                 ///< of the next thread that registers
+    std::atomic<bool> exploring_ = false;           ///< see explore()
+    std::mt19937_64 explore_rng_;                   ///< draws the steps, the wake orders and the tie breakers
 };
 
+inline bool isIntercepting()
+{
+    return intercepting.load(std::memory_order_relaxed) != 0 && ClockSimulator::getInstance().isIntercepting();
+}
+
+inline bool takesTurns()
+{
+    return scheduling.load(std::memory_order_relaxed) != 0 && ClockSimulator::getInstance().takesTurns();
+}
+
 } // namespace fakeclock
 
 #endif // FAKECLOCK_CLOCKSIMULATOR_H
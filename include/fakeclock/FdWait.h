@@ -0,0 +1,16 @@
+#ifndef FAKECLOCK_FDWAIT_H
+#define FAKECLOCK_FDWAIT_H
+
+#include <fakeclock/fakeclock.h>
+#include <optional>
+
+namespace fakeclock
+{
+
+/// Waits like poll() for `events` on `fd` in an intercepted fd wait, which ends at the fake time `deadline` (never if
+/// there is none). Returns the revents of `fd`, 0 on timeout, or -1 with errno set (EINTR if a signal interrupted it).
+int waitForFd(int fd, short events, std::optional<FakeClock::time_point> deadline);
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_FDWAIT_H
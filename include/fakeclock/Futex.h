@@ -0,0 +1,97 @@
+#ifndef FAKECLOCK_FUTEX_H
+#define FAKECLOCK_FUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <fakeclock/RealFunctions.h>
+#include <linux/futex.h>
+#include <optional>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+// The futex calls go to the real syscall(), around the override that simulates the timeouts of the program's futexes.
+
+namespace fakeclock
+{
+
+/// Blocks while `word` == `expected`. May return spuriously, so callers must re-check their condition.
+inline void futex_wait(std::atomic<uint32_t> &word, uint32_t expected)
+{
+    real.syscall(SYS_futex, long(&word), FUTEX_WAIT_PRIVATE, expected, 0, 0, 0);
+}
+
+/// Like futex_wait(), but gives up at `deadline` of the real CLOCK_MONOTONIC (never if there is none).
+/// `word` may live in memory shared with other processes if `process_shared` is set.
+inline void futex_wait_until(std::atomic<uint32_t> &word, uint32_t expected,
+                             std::optional<std::chrono::nanoseconds> deadline, bool process_shared = false)
+{
+    timespec ts = {};
+    if (deadline)
+    {
+        ts.tv_sec = deadline->count() / 1000000000;
+        ts.tv_nsec = deadline->count() % 1000000000;
+    }
+    real.syscall(SYS_futex, long(&word), process_shared ? FUTEX_WAIT_BITSET : FUTEX_WAIT_BITSET_PRIVATE, expected,
+                 deadline ? long(&ts) : 0, 0, FUTEX_BITSET_MATCH_ANY);
+}
+
+inline void futex_wake(std::atomic<uint32_t> &word, int count = INT_MAX, bool process_shared = false)
+{
+    real.syscall(SYS_futex, long(&word), process_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
+
+/// One-shot event a single thread can block on until another thread signals it.
+class WakeEvent
+{
+  public:
+    void wait()
+    {
+        while (state_.load(std::memory_order_acquire) == 0)
+        {
+            futex_wait(state_, 0);
+        }
+    }
+    /// The event may be destroyed by the woken thread as soon as this is called, unless the caller knows otherwise.
+    void signal()
+    {
+        state_.store(1, std::memory_order_release);
+        // Waking an address the waiter already released is harmless: futex users tolerate spurious wakeups.
+        futex_wake(state_, 1);
+    }
+    bool signaled() const
+    {
+        return state_.load(std::memory_order_acquire) != 0;
+    }
+
+  private:
+    std::atomic<uint32_t> state_ = 0;
+};
+
+/// Mutex guarding fakeclock's own state. It locks through the real pthread_mutex_lock(), which the threads that take
+/// turns (see ClockSimulator::scheduleDeterministically()) would otherwise hand their turn over in.
+class Mutex
+{
+  public:
+    void lock()
+    {
+        real.pthread_mutex_lock(&mutex_);
+    }
+    bool try_lock()
+    {
+        return pthread_mutex_trylock(&mutex_) == 0;
+    }
+    void unlock()
+    {
+        pthread_mutex_unlock(&mutex_);
+    }
+
+  private:
+    pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_FUTEX_H
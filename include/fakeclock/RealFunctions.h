@@ -0,0 +1,162 @@
+#ifndef FAKECLOCK_REALFUNCTIONS_H
+#define FAKECLOCK_REALFUNCTIONS_H
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Functions overridden by fakeclock whose real implementation is needed, except the variadic fcntl(), fcntl64() and
+/// syscall().
+#define FAKECLOCK_REAL_FUNCTIONS(X)                                                                                    \
+    X(sleep)                                                                                                           \
+    X(usleep)                                                                                                          \
+    X(nanosleep)                                                                                                       \
+    X(clock_nanosleep)                                                                                                 \
+    X(gettimeofday)                                                                                                    \
+    X(clock_gettime)                                                                                                   \
+    X(settimeofday)                                                                                                    \
+    X(clock_settime)                                                                                                   \
+    X(time)                                                                                                            \
+    X(poll)                                                                                                            \
+    X(ppoll)                                                                                                           \
+    X(select)                                                                                                          \
+    X(pselect)                                                                                                         \
+    X(epoll_wait)                                                                                                      \
+    X(epoll_pwait)                                                                                                     \
+    FAKECLOCK_REAL_EPOLL_PWAIT2(X)                                                                                     \
+    X(timerfd_create)                                                                                                  \
+    X(timerfd_settime)                                                                                                 \
+    X(timerfd_gettime)                                                                                                 \
+    X(read)                                                                                                            \
+    X(timer_create)                                                                                                    \
+    X(timer_delete)                                                                                                    \
+    X(timer_settime)                                                                                                   \
+    X(timer_gettime)                                                                                                   \
+    X(timer_getoverrun)                                                                                                \
+    X(alarm)                                                                                                           \
+    X(setitimer)                                                                                                       \
+    X(getitimer)                                                                                                       \
+    X(sigtimedwait)                                                                                                    \
+    X(close)                                                                                                           \
+    X(close_range)                                                                                                     \
+    X(dup)                                                                                                             \
+    X(dup2)                                                                                                            \
+    X(dup3)                                                                                                            \
+    X(setsockopt)                                                                                                      \
+    X(recv)                                                                                                            \
+    X(recvfrom)                                                                                                        \
+    X(recvmsg)                                                                                                         \
+    X(send)                                                                                                            \
+    X(sendto)                                                                                                          \
+    X(sendmsg)                                                                                                         \
+    X(readv)                                                                                                           \
+    X(write)                                                                                                           \
+    X(writev)                                                                                                          \
+    X(accept)                                                                                                          \
+    X(accept4)                                                                                                         \
+    X(connect)                                                                                                         \
+    X(pthread_create)                                                                                                  \
+    X(pthread_join)                                                                                                    \
+    X(pthread_mutex_lock)                                                                                              \
+    X(pthread_cond_wait)                                                                                               \
+    X(pthread_cond_signal)                                                                                             \
+    X(pthread_cond_broadcast)                                                                                          \
+    X(sem_wait)                                                                                                        \
+    X(pthread_cond_timedwait)                                                                                          \
+    X(pthread_mutex_timedlock)                                                                                         \
+    X(pthread_rwlock_timedrdlock)                                                                                      \
+    X(pthread_rwlock_timedwrlock)                                                                                      \
+    X(sem_timedwait)                                                                                                   \
+    FAKECLOCK_REAL_CLOCKWAIT(X)
+
+#if __GLIBC_PREREQ(2, 35)
+#define FAKECLOCK_REAL_EPOLL_PWAIT2(X) X(epoll_pwait2)
+#else
+#define FAKECLOCK_REAL_EPOLL_PWAIT2(X)
+#endif
+
+#if __GLIBC_PREREQ(2, 30)
+#define FAKECLOCK_REAL_CLOCKWAIT(X)                                                                                    \
+    X(pthread_cond_clockwait)                                                                                          \
+    X(pthread_mutex_clocklock)                                                                                         \
+    X(pthread_rwlock_clockrdlock)                                                                                      \
+    X(pthread_rwlock_clockwrlock)                                                                                      \
+    X(sem_clockwait)
+#else
+#define FAKECLOCK_REAL_CLOCKWAIT(X)
+#endif
+
+namespace fakeclock
+{
+
+/// Real implementations of the overridden functions (the next definitions after fakeclock's, usually libc's).
+///
+/// The table is valid from the start: until the library constructor has resolved it, each entry points to a stub
+/// that resolves the whole table and forwards the call. So the overrides call through it without any checks.
+/// It is only written while being resolved.
+struct RealFunctions
+{
+#define FAKECLOCK_DECLARE_REAL_FUNCTION(name) decltype(&::name) name;
+    FAKECLOCK_REAL_FUNCTIONS(FAKECLOCK_DECLARE_REAL_FUNCTION)
+#undef FAKECLOCK_DECLARE_REAL_FUNCTION
+    int (*fcntl)(int fd, int cmd, void *arg);
+    int (*fcntl64)(int fd, int cmd, void *arg);
+    /// Takes the six arguments any system call may have, which is harmless for those with fewer.
+    long (*syscall)(long number, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6);
+
+    /// Entries of the vDSO, which bypass the libc wrappers. Null if the kernel does not provide them.
+    int (*vdso_clock_gettime)(clockid_t clk_id, struct timespec *ts);
+    int (*vdso_gettimeofday)(struct timeval *tv, void *tz);
+};
+
+extern RealFunctions real;
+
+/// Resolves `real`. Called by the library constructor, and by the stubs if an override runs before it.
+void resolveRealFunctions();
+
+/// clock_gettime() of the kernel, preferably straight from the vDSO.
+inline int real_clock_gettime(clockid_t clk_id, struct timespec *ts)
+{
+    if (!real.vdso_clock_gettime)
+    {
+        return real.clock_gettime(clk_id, ts);
+    }
+    int result = real.vdso_clock_gettime(clk_id, ts);
+    if (result < 0)
+    {
+        errno = -result; // the vDSO returns -errno like the system call it falls back to
+        return -1;
+    }
+    return result;
+}
+
+/// gettimeofday() of the kernel, preferably straight from the vDSO.
+inline int real_gettimeofday(struct timeval *tv, void *tz)
+{
+    if (!real.vdso_gettimeofday)
+    {
+        return real.gettimeofday(tv, tz);
+    }
+    int result = real.vdso_gettimeofday(tv, tz);
+    if (result < 0)
+    {
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_REALFUNCTIONS_H
@@ -0,0 +1,60 @@
+#ifndef FAKECLOCK_SHAREDTIME_H
+#define FAKECLOCK_SHAREDTIME_H
+
+#include <atomic>
+#include <cstdint>
+#include <fakeclock/TimeState.h>
+
+namespace fakeclock
+{
+
+/// Time state in memory shared between processes. It is shared either by a MasterOfTime and the processes it forked
+/// (see ClockSimulator::shareWithChildProcesses()), or through a file by the processes started with
+/// FAKECLOCK_CONTROL=<file> and the controllers of that file, such as fakeclockctl.
+///
+/// Processes that follow the time only read `state` and wait for changes on `generation`. Controllers change it with
+/// the control operations, which are serialized across processes and cheap enough for thousands of calls per second.
+/// The locks hold the pid of their owner, so that a process that dies holding one does not block the others forever,
+/// as long as they share its PID namespace.
+class SharedTime
+{
+  public:
+    using TimePoint = TimeState::TimePoint;
+    using Duration = TimeState::Duration;
+
+    /// Anonymous shared memory that is inherited by forked processes. Throws std::system_error.
+    static SharedTime *create();
+    /// Maps the file at `path`, creating it if needed. Time in a new file starts flowing along with real time.
+    /// Throws std::system_error.
+    static SharedTime *open(const char *path);
+    static void unmap(SharedTime *shared);
+
+    /// Wakes the processes that follow `state` after it was changed.
+    void notify();
+
+    void advance(Duration duration);
+    /// Stops the time.
+    void freeze();
+    /// Lets the time flow, `scale` times faster than real time.
+    void resume(double scale = 1.0);
+    /// Sets clock `clk_id` to `time` (since the epoch of the clock) without moving the other clocks.
+    void setTime(int clk_id, Duration time);
+
+    TimeState state;
+    std::atomic<uint32_t> generation = 0; ///< bumped on every change of `state`, a process-shared futex
+
+  private:
+    /// Calls `fn(snapshot, fake_now, real_now)` to modify the current state, then stores and publishes it.
+    template <typename Fn> void modify(Fn &&fn);
+    void lockWriter();
+
+    static constexpr uint32_t INITIALIZED = UINT32_MAX;
+
+    /// Of a file: 0 while new, then the pid of the process that initializes it, then INITIALIZED.
+    std::atomic<uint32_t> initialized_ = 0;
+    std::atomic<uint32_t> writer_ = 0; ///< lock of the control operations: 0 or the pid of the owner
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_SHAREDTIME_H
@@ -0,0 +1,82 @@
+#ifndef FAKECLOCK_SOCKETTIMEOUTS_H
+#define FAKECLOCK_SOCKETTIMEOUTS_H
+
+#include <chrono>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/fakeclock.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace fakeclock
+{
+
+/// Receive and send timeouts (SO_RCVTIMEO, SO_SNDTIMEO) that were set on sockets, by fd, so that blocking socket calls
+/// can wait for them in fake time. Sockets share one table per process whatever their timeline, and duplicated fds
+/// share the timeouts of their socket like in the kernel. Fds without timeouts cost lookups a lock-free check only.
+class SocketTimeouts
+{
+  public:
+    using Duration = FakeClock::duration;
+
+    enum Direction
+    {
+        Receive,
+        Send,
+    };
+
+    static SocketTimeouts &getInstance();
+
+    /// Called after setsockopt() set the timeout of `fd`. Zero means none.
+    void set(int fd, Direction direction, Duration timeout);
+    /// The timeout of `fd`, if one was set.
+    std::optional<Duration> get(int fd, Direction direction);
+
+    /// Must be called before `fd` gets closed (explicitly or by dup2()).
+    void fdClosed(int fd);
+    /// Must be called after `new_fd` became a duplicate of `old_fd`.
+    void fdDuplicated(int old_fd, int new_fd);
+    /// Must be called after accept() returned `new_fd` for the listening socket `fd`, whose timeouts the new socket
+    /// inherits (as copies, unlike duplicates).
+    void fdAccepted(int fd, int new_fd);
+    /// Must be called before all fds in [first, last] get closed.
+    void fdRangeClosed(unsigned int first, unsigned int last);
+
+    /// Makes the socket `fd`, which has a timeout, non-blocking until the matching endNonBlocking(), for calls that
+    /// have no non-blocking flag (accept(), connect()). Calls of several threads may overlap: the socket stays
+    /// non-blocking until the last one ends, and becomes blocking again only if it was blocking before the first.
+    void beginNonBlocking(int fd);
+    void endNonBlocking(int fd);
+    /// Whether the program made the socket `fd`, which has a timeout, non-blocking, regardless of beginNonBlocking().
+    bool isNonBlocking(int fd);
+
+  private:
+    struct Timeouts
+    {
+        Duration receive = Duration::zero();
+        Duration send = Duration::zero();
+    };
+
+    /// State of the file status flags of a socket, shared by its duplicates like the flags themselves are.
+    struct Blocking
+    {
+        std::mutex mutex;              ///< serializes beginNonBlocking() and endNonBlocking()
+        int nonblocking_calls = 0;     ///< between beginNonBlocking() and endNonBlocking()
+        bool made_nonblocking = false; ///< O_NONBLOCK was set by the first of these calls, to be cleared by the last
+    };
+
+    /// Blocking state of the socket `fd`, nullptr if `fd` has no timeouts.
+    std::shared_ptr<Blocking> blocking(int fd);
+
+    SocketTimeouts() = default;
+
+    std::mutex mutex_;
+    std::unordered_map<int, std::shared_ptr<Timeouts>> timeouts_; ///< shared by the duplicates of a socket
+    std::unordered_map<int, std::shared_ptr<Blocking>> blocking_; ///< of the fds of timeouts_, shared the same way
+    FdSet fds_;                                                   ///< keys of timeouts_
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_SOCKETTIMEOUTS_H
@@ -0,0 +1,115 @@
+#ifndef FAKECLOCK_STATS_H
+#define FAKECLOCK_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fakeclock/fakeclock.h>
+
+namespace fakeclock
+{
+
+/// Counters behind fakeclock::Stats. Histograms and per-clock counts take a range of consecutive slots.
+enum class Stat : uint32_t
+{
+    ClockRead,
+    ClockSet = ClockRead + Stats::CLOCK_IDS,
+    Sleep,
+    SleepTime,
+    SleepDuration,
+    FdWait = SleepDuration + Stats::SLEEP_BOUNDS.size() + 1,
+    FdWaitTimeout,
+    TimerfdOperation,
+    TimerfdExpiration,
+    PosixTimerOperation,
+    PosixTimerExpiration,
+    Advance,
+    WokenThreads,
+    FiredTimers,
+    WokenThreadsPerAdvance,
+    FiredTimersPerAdvance = WokenThreadsPerAdvance + Stats::PER_ADVANCE_BOUNDS.size() + 1,
+    SimulatedTime = FiredTimersPerAdvance + Stats::PER_ADVANCE_BOUNDS.size() + 1,
+    WallTime,
+    Count
+};
+
+/// Counters of one thread, or of all threads that did not get a shard of their own. Shards take whole cache lines, so
+/// threads never write to the same line.
+struct alignas(64) StatsShard
+{
+    std::atomic<uint32_t> owner = 0; ///< tid of the thread that counts into it, 0 if free
+    bool shared = false;             ///< used by several threads, so counting needs atomic increments
+    std::array<std::atomic<uint64_t>, size_t(Stat::Count)> counters = {};
+};
+
+/// Shard of the calling thread, nullptr until it counts for the first time.
+extern constinit thread_local StatsShard *thread_stats_shard;
+
+StatsShard &acquireStatsShard();
+
+inline void count(Stat stat, uint64_t n = 1, size_t slot = 0)
+{
+    auto *shard = thread_stats_shard;
+    if (!shard) [[unlikely]]
+    {
+        shard = &acquireStatsShard();
+    }
+    auto &counter = shard->counters[size_t(stat) + slot];
+    if (shard->shared) [[unlikely]]
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+    else
+    {
+        // The owner is the only writer, so a plain read-modify-write suffices and the reader sees whole values.
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+/// Index of the histogram bucket of `value`.
+template <typename T, size_t N>
+size_t bucket(const std::array<T, N> &bounds, T value)
+{
+    return size_t(std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin());
+}
+
+inline void countClockRead(int clock_id)
+{
+    count(Stat::ClockRead, 1, clock_id >= 0 && clock_id < int(Stats::CLOCK_IDS) ? clock_id : Stats::CLOCK_IDS - 1);
+}
+
+inline void countSleep(FakeClock::duration duration)
+{
+    duration = std::max(duration, FakeClock::duration::zero());
+    count(Stat::Sleep);
+    count(Stat::SleepTime, uint64_t(duration.count()));
+    count(Stat::SleepDuration, 1, bucket(Stats::SLEEP_BOUNDS, duration));
+}
+
+inline void countFdWait(int result)
+{
+    count(Stat::FdWait);
+    if (result == 0)
+    {
+        count(Stat::FdWaitTimeout);
+    }
+}
+
+inline void countAdvance(uint64_t woken_threads, uint64_t fired_timers)
+{
+    count(Stat::Advance);
+    count(Stat::WokenThreads, woken_threads);
+    count(Stat::FiredTimers, fired_timers);
+    count(Stat::WokenThreadsPerAdvance, 1, bucket(Stats::PER_ADVANCE_BOUNDS, woken_threads));
+    count(Stat::FiredTimersPerAdvance, 1, bucket(Stats::PER_ADVANCE_BOUNDS, fired_timers));
+}
+
+/// Called when the last MasterOfTime of a simulator goes away: counts the time that passed while one existed, and with
+/// FAKECLOCK_REPORT=1 prints how much faster than real time the simulation ran.
+void endSimulation(FakeClock::duration simulated_time, FakeClock::duration wall_time);
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_STATS_H
@@ -0,0 +1,66 @@
+#ifndef FAKECLOCK_THREADSLOTS_H
+#define FAKECLOCK_THREADSLOTS_H
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <span>
+#include <unistd.h>
+
+namespace fakeclock
+{
+
+/// Hands out the slots of a static pool to threads, one slot per thread. A slot is taken by storing the tid of its
+/// thread in its `std::atomic<uint32_t> owner` (0 if free), and freed again when the thread exits. The pool itself
+/// never goes away, so whoever sums or drains the slots can always look at them.
+template <typename Slot> class ThreadSlots
+{
+  public:
+    /// Takes a free slot of `slots` for the calling thread, nullptr if all are taken.
+    static Slot *acquire(std::span<Slot> slots)
+    {
+        uint32_t tid = gettid();
+        for (auto &slot : slots)
+        {
+            uint32_t expected = 0;
+            if (slot.owner.load(std::memory_order_relaxed) == 0 && slot.owner.compare_exchange_strong(expected, tid))
+            {
+                pthread_setspecific(key(), &slot);
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    /// To be called in the child after fork(): only the forking thread exists there, so all slots are free except
+    /// `kept`, if given, which the forking thread keeps under its new tid.
+    static void forgetOtherThreads(std::span<Slot> slots, const Slot *kept)
+    {
+        uint32_t tid = gettid();
+        for (auto &slot : slots)
+        {
+            slot.owner.store(&slot == kept ? tid : 0, std::memory_order_relaxed);
+        }
+    }
+
+  private:
+    static void release(void *slot)
+    {
+        uint32_t tid = gettid();
+        static_cast<Slot *>(slot)->owner.compare_exchange_strong(tid, 0);
+    }
+
+    static pthread_key_t key()
+    {
+        static pthread_key_t key = [] {
+            pthread_key_t k;
+            pthread_key_create(&k, release);
+            return k;
+        }();
+        return key;
+    }
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_THREADSLOTS_H
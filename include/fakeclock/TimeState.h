@@ -0,0 +1,202 @@
+#ifndef FAKECLOCK_TIMESTATE_H
+#define FAKECLOCK_TIMESTATE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/fakeclock.h>
+#include <time.h>
+#include <type_traits>
+
+namespace fakeclock
+{
+
+constexpr int MAX_CLK_ID = 16;
+
+/// Fake time and clock offsets published to readers without locks.
+///
+/// While time flows (see ClockSimulator::resume()), the published fake time is an anchor: readers add the real time
+/// elapsed since `Flow::real_anchor`, multiplied by `Flow::scale`.
+///
+/// This is a latched seqlock: the state is kept in two slots and readers always read the slot that is not being
+/// written. Readers never wait for a writer, so they are async-signal-safe even if the signal interrupted a writer on
+/// the same thread. Writers must be serialized externally.
+class TimeState
+{
+  public:
+    using TimePoint = FakeClock::time_point;
+    using Duration = FakeClock::duration;
+    using Offsets = std::array<Duration, MAX_CLK_ID>;
+
+    struct Flow
+    {
+        Duration real_anchor = Duration::zero(); ///< real CLOCK_MONOTONIC of the fake time, zero if time is frozen
+        double scale = 1.0;                      ///< fake nanoseconds per real nanosecond
+    };
+
+    TimePoint loadFakeTime() const
+    {
+        return loadTime(-1);
+    }
+
+    /// Offset of `clk_id` (clock_time - fake_time), zero for unknown clocks.
+    Duration loadOffset(int clk_id) const
+    {
+        if (clk_id < 0 || clk_id >= MAX_CLK_ID)
+        {
+            return Duration::zero();
+        }
+        return read(
+            [clk_id](const Slot &slot) { return Duration(slot.offsets[clk_id].load(std::memory_order_relaxed)); });
+    }
+
+    /// Time of `clk_id`, i.e. fake time + offset, taken from a single consistent snapshot. Unknown clocks (e.g. -1)
+    /// get the fake time itself.
+    TimePoint loadTime(int clk_id) const
+    {
+        struct Snapshot
+        {
+            Duration::rep time;
+            Duration::rep real_anchor;
+            double scale;
+        };
+        auto snapshot = read([clk_id](const Slot &slot) {
+            auto time = slot.fake_time.load(std::memory_order_relaxed);
+            if (clk_id >= 0 && clk_id < MAX_CLK_ID)
+            {
+                time += slot.offsets[clk_id].load(std::memory_order_relaxed);
+            }
+            return Snapshot{time, slot.real_anchor.load(std::memory_order_relaxed),
+                            slot.scale.load(std::memory_order_relaxed)};
+        });
+        auto time = TimePoint(Duration(snapshot.time));
+        if (snapshot.real_anchor != 0)
+        {
+            time += flowElapsed(Flow{Duration(snapshot.real_anchor), snapshot.scale}, realNow());
+        }
+        return time;
+    }
+
+    /// Publishes frozen time.
+    void store(TimePoint fake_time, const Offsets &offsets)
+    {
+        store(fake_time, offsets, Flow{});
+    }
+
+    /// How the published time flows (zero real_anchor if it is frozen).
+    Flow loadFlow() const
+    {
+        return read([](const Slot &slot) {
+            return Flow{Duration(slot.real_anchor.load(std::memory_order_relaxed)),
+                        slot.scale.load(std::memory_order_relaxed)};
+        });
+    }
+
+    /// Everything store() was called with, e.g. to modify and store it again.
+    struct Snapshot
+    {
+        TimePoint fake_time;
+        Offsets offsets;
+        Flow flow;
+    };
+
+    Snapshot load() const
+    {
+        return read([](const Slot &slot) {
+            Snapshot snapshot;
+            snapshot.fake_time = TimePoint(Duration(slot.fake_time.load(std::memory_order_relaxed)));
+            for (int i = 0; i < MAX_CLK_ID; i++)
+            {
+                snapshot.offsets[i] = Duration(slot.offsets[i].load(std::memory_order_relaxed));
+            }
+            snapshot.flow = {Duration(slot.real_anchor.load(std::memory_order_relaxed)),
+                             slot.scale.load(std::memory_order_relaxed)};
+            return snapshot;
+        });
+    }
+
+    void store(TimePoint fake_time, const Offsets &offsets, Flow flow)
+    {
+        auto seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed); // readers switch to slot 1
+        std::atomic_thread_fence(std::memory_order_release);
+        write(slots_[0], fake_time, offsets, flow);
+        seq_.store(seq + 2, std::memory_order_release); // readers switch back to slot 0
+        std::atomic_thread_fence(std::memory_order_release);
+        write(slots_[1], fake_time, offsets, flow);
+    }
+
+    /// Finishes the store() of a writer that died in the middle, by copying the slot readers use to the other one.
+    /// Must be called by the next writer before its first store().
+    void repair()
+    {
+        auto snapshot = load();
+        auto seq = seq_.load(std::memory_order_relaxed);
+        write(slots_[(seq & 1) ^ 1], snapshot.fake_time, snapshot.offsets, snapshot.flow);
+        if (seq & 1)
+        {
+            seq_.store(seq + 1, std::memory_order_release); // readers switch back to slot 0
+        }
+    }
+
+    /// Real CLOCK_MONOTONIC, which drives flowing time.
+    static Duration realNow()
+    {
+        timespec ts;
+        real_clock_gettime(CLOCK_MONOTONIC, &ts);
+        return Duration(ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    }
+
+    /// Fake time that passed since the anchor of `flow` when the real clock shows `real_now`.
+    static Duration flowElapsed(Flow flow, Duration real_now)
+    {
+        if (flow.real_anchor == Duration::zero() || real_now <= flow.real_anchor)
+        {
+            return Duration::zero();
+        }
+        return Duration(static_cast<Duration::rep>(static_cast<double>((real_now - flow.real_anchor).count()) *
+                                                   flow.scale));
+    }
+
+  private:
+    struct Slot
+    {
+        std::atomic<Duration::rep> fake_time = 0;
+        std::array<std::atomic<Duration::rep>, MAX_CLK_ID> offsets = {};
+        std::atomic<Duration::rep> real_anchor = 0;
+        std::atomic<double> scale = 1.0;
+    };
+
+    static void write(Slot &slot, TimePoint fake_time, const Offsets &offsets, Flow flow)
+    {
+        slot.fake_time.store(fake_time.time_since_epoch().count(), std::memory_order_relaxed);
+        for (int i = 0; i < MAX_CLK_ID; i++)
+        {
+            slot.offsets[i].store(offsets[i].count(), std::memory_order_relaxed);
+        }
+        slot.real_anchor.store(flow.real_anchor.count(), std::memory_order_relaxed);
+        slot.scale.store(flow.scale, std::memory_order_relaxed);
+    }
+
+    template <typename Fn> std::invoke_result_t<Fn, const Slot &> read(Fn &&fn) const
+    {
+        while (true)
+        {
+            auto seq = seq_.load(std::memory_order_acquire);
+            auto result = fn(slots_[seq & 1]);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == seq)
+            {
+                return result;
+            }
+        }
+    }
+
+    std::atomic<uint64_t> seq_ = 0;
+    std::array<Slot, 2> slots_;
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_TIMESTATE_H
@@ -0,0 +1,155 @@
+#ifndef FAKECLOCK_TIMEDWAIT_H
+#define FAKECLOCK_TIMEDWAIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/Trace.h>
+#include <fakeclock/common.h>
+#include <optional>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+namespace fakeclock
+{
+
+/// A timed wait on an object the simulator cannot interrupt (a condition variable, mutex, semaphore, futex, ...), see
+/// timedWait().
+struct TimedWait
+{
+    TraceOp op;
+    clockid_t clock_id;               ///< of the deadline
+    timespec abstime;                 ///< the deadline, as taken by the intercepted call
+    clockid_t real_clock_id;          ///< of the absolute timeouts the real wait takes
+    FakeClock::duration slice;        ///< real time after which the wait checks its fake deadline again
+    FakeClock::duration max_slice{};  ///< up to which the slices grow while fake time stands still
+    pthread_cond_t *cond = nullptr;   ///< broadcast at the deadline, see below
+    pthread_mutex_t *mutex = nullptr; ///< of `cond`
+    /// Counts the signals of `cond`, see below.
+    const std::atomic<uint32_t> *signals = nullptr;
+    uint32_t *futex = nullptr;  ///< woken at the deadline, see below
+    bool futex_private = false; ///< `futex` is private to the process
+    uint32_t bitset = 0;        ///< of the wait on `futex`
+    int signal = 0;             ///< sent to the waiting thread at the deadline, see below
+};
+
+/// Blocking wait of a thread that takes turns (see ClockSimulator::park()). `attempt` does not block and returns
+/// `busy` as long as the thread would have to wait, or the result of the wait. Returns ETIMEDOUT at `deadline`, and
+/// nullopt if the thread does not take turns, so that the caller waits for real.
+template <typename Attempt>
+std::optional<int> waitInTurns(std::optional<FakeClock::time_point> deadline, int busy, Attempt &&attempt)
+{
+    auto &simulator = ClockSimulator::getInstance();
+    bool again = false;
+    int result;
+    while ((result = attempt()) == busy)
+    {
+        switch (simulator.park(deadline, again))
+        {
+        case ClockSimulator::Park::Retry:
+            again = true;
+            break;
+        case ClockSimulator::Park::Expired:
+            return ETIMEDOUT;
+        case ClockSimulator::Park::Unscheduled:
+            return std::nullopt;
+        }
+    }
+    return result;
+}
+
+/// Waits until `wait(real_abstime)` returns something other than ETIMEDOUT or fake time reaches the deadline of
+/// `spec`. `wait` is the real timed wait on `spec.real_clock_id` and returns 0 or an error number, like
+/// pthread_mutex_timedlock(). The slices of real time double up to `spec.max_slice` while fake time stands still, and
+/// start over when it moves. If `spec.cond` is set, a slice that ends after `spec.signals` changed is reported as a
+/// spurious wakeup rather than waiting again, as the signal may have come between two slices. If `spec.cond` or
+/// `spec.futex` is set, the wait ends at the deadline, as the simulator wakes them. So does a wait for `spec.signal`,
+/// which the simulator sends to the thread. Threads that take turns do not
+/// wait for real, but retry without blocking in their turns, and wait for the signals of `spec.cond` in park().
+template <typename Wait> int timedWait(const TimedWait &spec, Wait &&wait)
+{
+    auto &simulator = ClockSimulator::getInstance();
+    auto deadline = simulator.toFakeTime(spec.clock_id, spec.abstime);
+    trace(spec.op, spec.clock_id, deadline.time_since_epoch().count());
+    std::optional<int> in_turns;
+    if (spec.cond && simulator.takesTurns())
+    {
+        auto park = simulator.park(deadline, false, spec.cond, spec.mutex);
+        if (park != ClockSimulator::Park::Unscheduled)
+        {
+            int error = ::pthread_mutex_lock(spec.mutex); // takes turns as well
+            in_turns = error ? error : park == ClockSimulator::Park::Expired ? ETIMEDOUT : 0;
+        }
+    }
+    else if (simulator.takesTurns())
+    {
+        // A past deadline makes the real call return at once.
+        in_turns = waitInTurns(deadline, ETIMEDOUT, [&] { return wait(timespec{0, 0}); });
+    }
+    if (in_turns)
+    {
+        trace(TraceOp::Wake, -1, *in_turns);
+        return *in_turns;
+    }
+    Waiter waiter;
+    waiter.wake_cond = spec.cond;
+    waiter.wake_futex = spec.futex;
+    waiter.wake_futex_private = spec.futex_private;
+    waiter.wake_futex_bitset = spec.bitset;
+    waiter.wake_tid = spec.signal ? pid_t(real.syscall(SYS_gettid, 0, 0, 0, 0, 0, 0)) : 0;
+    waiter.wake_signal = spec.signal;
+    int result;
+    if (!simulator.waitBegin(waiter, deadline, nullptr, 0))
+    {
+        // Past deadlines make the real call take a free object without blocking.
+        result = wait(timespec{0, 0});
+    }
+    else
+    {
+        // Cancellation (most of these are cancellation points) unwinds through here, so end the wait in a destructor.
+        struct WaitEnd
+        {
+            ~WaitEnd()
+            {
+                simulator.waitEnd(waiter);
+            }
+            ClockSimulator &simulator;
+            Waiter &waiter;
+        } wait_end{simulator, waiter};
+        auto slice = spec.slice;
+        auto checked_at = simulator.now();
+        uint32_t signals = spec.signals ? spec.signals->load() : 0;
+        while (true)
+        {
+            timespec now;
+            real_clock_gettime(spec.real_clock_id, &now);
+            result = wait(to_timespec(to_duration(now) + slice));
+            if (result != ETIMEDOUT || waiter.expired)
+            {
+                if ((spec.cond || spec.futex) && result == 0 && waiter.expired)
+                {
+                    result = ETIMEDOUT; // woken by the simulator at the deadline, or by the program as time ran out
+                }
+                break;
+            }
+            if (spec.signals && spec.signals->load() != signals)
+            {
+                result = 0;
+                break;
+            }
+            auto fake_now = simulator.now();
+            slice = fake_now == checked_at ? std::max(std::min(2 * slice, spec.max_slice), spec.slice) : spec.slice;
+            checked_at = fake_now;
+        }
+    }
+    trace(TraceOp::Wake, -1, result);
+    return result;
+}
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_TIMEDWAIT_H
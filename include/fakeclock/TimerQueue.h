@@ -0,0 +1,141 @@
+#ifndef FAKECLOCK_TIMERQUEUE_H
+#define FAKECLOCK_TIMERQUEUE_H
+
+#include <fakeclock/fakeclock.h>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fakeclock
+{
+
+/// Deadline-ordered set of armed timers. Each timer is identified by a key and has at most one pending deadline.
+/// Popping expired timers costs O(log N) per expired timer, so timers that do not expire are never touched.
+/// Container nodes of disarmed timers are kept for reuse, so once the queue has reached its usual size, arming and
+/// disarming timers does not allocate. Timers with equal deadlines pop in key order, or in a random order drawn when
+/// they are armed after shuffleTies().
+template <typename Key> class TimerQueue
+{
+  public:
+    using TimePoint = FakeClock::time_point;
+
+    /// Arms the timer `key` (or moves its deadline if it is already armed).
+    void schedule(Key key, TimePoint deadline)
+    {
+        Slot slot = {deadline, tie_rng_ ? (*tie_rng_)() : 0};
+        auto it = deadlines_.find(key);
+        if (it != deadlines_.end())
+        {
+            auto node = queue_.extract(entry(key, it->second));
+            node.value() = entry(key, slot);
+            queue_.insert(std::move(node));
+            it->second = slot;
+            return;
+        }
+        if (spare_queue_nodes_.empty())
+        {
+            queue_.insert(entry(key, slot));
+            deadlines_.emplace(key, slot);
+            return;
+        }
+        auto node = std::move(spare_queue_nodes_.back());
+        spare_queue_nodes_.pop_back();
+        node.value() = entry(key, slot);
+        queue_.insert(std::move(node));
+        auto deadline_node = std::move(spare_deadline_nodes_.back());
+        spare_deadline_nodes_.pop_back();
+        deadline_node.key() = key;
+        deadline_node.mapped() = slot;
+        deadlines_.insert(std::move(deadline_node));
+    }
+
+    /// Disarms the timer `key`. Does nothing if it is not armed.
+    void cancel(Key key)
+    {
+        auto it = deadlines_.find(key);
+        if (it != deadlines_.end())
+        {
+            spare_queue_nodes_.push_back(queue_.extract(entry(key, it->second)));
+            spare_deadline_nodes_.push_back(deadlines_.extract(it));
+        }
+    }
+
+    bool contains(Key key) const
+    {
+        return deadlines_.contains(key);
+    }
+
+    std::optional<TimePoint> nextDeadline() const
+    {
+        if (queue_.empty())
+        {
+            return std::nullopt;
+        }
+        return std::get<0>(*queue_.begin());
+    }
+
+    /// Removes all timers with deadline <= `t` and calls `fn(key)` for each of them in deadline order.
+    /// `fn` may schedule timers again (e.g. periodic ones).
+    template <typename Fn> void popExpired(TimePoint t, Fn &&fn)
+    {
+        while (!queue_.empty() && std::get<0>(*queue_.begin()) <= t)
+        {
+            Key key = std::get<2>(*queue_.begin());
+            spare_queue_nodes_.push_back(queue_.extract(queue_.begin()));
+            spare_deadline_nodes_.push_back(deadlines_.extract(key));
+            fn(key);
+        }
+    }
+
+    size_t size() const
+    {
+        return deadlines_.size();
+    }
+
+    bool empty() const
+    {
+        return deadlines_.empty();
+    }
+
+    /// Timers armed from now on break ties with a generator seeded with `seed`, or by key again if none, so that
+    /// code relying on the order of simultaneous expirations can be caught.
+    void shuffleTies(std::optional<uint64_t> seed)
+    {
+        tie_rng_.reset();
+        if (seed)
+        {
+            tie_rng_.emplace(*seed);
+        }
+    }
+
+  private:
+    /// Deadline and tie breaker of an armed timer.
+    struct Slot
+    {
+        TimePoint deadline;
+        uint64_t rank;
+    };
+    using Entry = std::tuple<TimePoint, uint64_t, Key>;
+    using Queue = std::set<Entry>;
+    using Deadlines = std::unordered_map<Key, Slot>;
+
+    static Entry entry(Key key, const Slot &slot)
+    {
+        return {slot.deadline, slot.rank, key};
+    }
+
+    Queue queue_;
+    Deadlines deadlines_;
+    std::optional<std::mt19937_64> tie_rng_;
+    std::vector<typename Queue::node_type> spare_queue_nodes_;
+    std::vector<typename Deadlines::node_type> spare_deadline_nodes_;
+};
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_TIMERQUEUE_H
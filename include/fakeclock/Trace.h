@@ -0,0 +1,152 @@
+#ifndef FAKECLOCK_TRACE_H
+#define FAKECLOCK_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+
+namespace fakeclock
+{
+
+/// Intercepted operation (or simulator event) of a TraceRecord.
+enum class TraceOp : uint16_t
+{
+    // Clock reads: args[0] is the returned time in nanoseconds since the epoch of the clock.
+    ClockGettime,
+    Gettimeofday,
+    Time,
+    // Clock changes: args[0] is the new time in nanoseconds since the epoch of the clock.
+    ClockSettime,
+    Settimeofday,
+    // Sleeps: args[0] is the fake deadline. They end with a Wake record of the same thread.
+    Sleep,
+    Usleep,
+    Nanosleep,
+    ClockNanosleep,
+    // Fd waits: args[0] is the timeout in nanoseconds (-1 if infinite), args[1] the fd count (the epoll fd for epoll
+    // waits). They end with a Wake record of the same thread.
+    Poll,
+    Ppoll,
+    EpollWait,
+    EpollPwait,
+    EpollPwait2,
+    Select,
+    Pselect,
+    /// End of the last wait of the thread: args[0] is the result of fd waits and of timed waits on synchronization
+    /// objects, futexes and signals.
+    Wake,
+    // Timerfds: args[0] is the fd, args[1] the fake expiration time (zero if disarmed) for settime and expire.
+    TimerfdCreate,
+    TimerfdSettime,
+    TimerfdGettime,
+    TimerfdExpire,
+    // POSIX timers: args[0] is the timer id, args[1] as for timerfds, or the overrun count for getoverrun and expire.
+    TimerCreate,
+    TimerDelete,
+    TimerSettime,
+    TimerGettime,
+    TimerGetoverrun,
+    TimerExpire,
+    /// Fake time jumped ahead: args[0] is the duration.
+    Advance,
+    // Timed waits on synchronization objects, including the clock variants (added last, which keeps the numbers of
+    // the other ops): args[0] is the fake deadline. They end with a Wake record of the same thread.
+    CondTimedwait,
+    MutexTimedlock,
+    RwlockTimedlock,
+    SemTimedwait,
+    /// Futex wait with a timeout through syscall(): args[0] is the fake deadline. It ends with a Wake record.
+    FutexWait,
+    /// sigtimedwait() with a timeout: args[0] is the fake deadline. It ends with a Wake record.
+    Sigtimedwait,
+};
+
+/// Names of the TraceOp values, in order.
+constexpr const char *TRACE_OP_NAMES[] = {
+    "clock_gettime", "gettimeofday", "time", "clock_settime", "settimeofday", "sleep", "usleep", "nanosleep",
+    "clock_nanosleep", "poll", "ppoll", "epoll_wait", "epoll_pwait", "epoll_pwait2", "select", "pselect", "wake",
+    "timerfd_create", "timerfd_settime", "timerfd_gettime", "timerfd_expire", "timer_create", "timer_delete",
+    "timer_settime", "timer_gettime", "timer_getoverrun", "timer_expire", "advance", "pthread_cond_timedwait",
+    "pthread_mutex_timedlock", "pthread_rwlock_timedlock", "sem_timedwait", "futex_wait", "sigtimedwait",
+};
+static_assert(std::size(TRACE_OP_NAMES) == size_t(TraceOp::Sigtimedwait) + 1);
+
+struct TraceRecord
+{
+    int64_t fake_time; ///< nanoseconds of FakeClock
+    int64_t real_time; ///< ticks of a cheap real clock (the TSC on x86-64), see TraceFileHeader::toRealTime()
+    int64_t args[2];
+    uint32_t tid;
+    TraceOp op;
+    int16_t clock_id; ///< -1 if the operation has no clock
+};
+static_assert(sizeof(TraceRecord) == 40);
+
+/// Layout of a trace file: this header, then `max_threads` regions of `region_size` bytes. Each thread that records
+/// claims a region and writes its records there as a ring buffer, so old records are overwritten once it is full.
+/// The file is mapped while recording, so it holds everything recorded so far even if the process crashes.
+struct TraceFileHeader
+{
+    static constexpr char MAGIC[8] = {'F', 'C', 'T', 'R', 'A', 'C', 'E', '1'};
+
+    char magic[8];
+    uint32_t record_size;
+    uint32_t records_per_thread; ///< a power of two
+    uint32_t max_threads;
+    uint32_t region_size;
+    std::atomic<uint32_t> threads_used; ///< regions claimed so far, may exceed max_threads
+    uint32_t reserved;
+    int64_t ticks_anchor; ///< TraceRecord::real_time at real_anchor
+    int64_t real_anchor;  ///< nanoseconds of the real CLOCK_MONOTONIC
+    double ns_per_tick;   ///< measured when recording starts, refined when it stops
+    char padding[8];
+
+    /// Nanoseconds of the real CLOCK_MONOTONIC at `ticks`, a TraceRecord::real_time.
+    int64_t toRealTime(int64_t ticks) const
+    {
+        return real_anchor + static_cast<int64_t>(static_cast<double>(ticks - ticks_anchor) * ns_per_tick);
+    }
+};
+static_assert(sizeof(TraceFileHeader) == 64);
+
+struct TraceThreadRegion
+{
+    std::atomic<uint64_t> written; ///< records written so far, the last `records_per_thread` of them are kept
+    uint32_t tid;
+    uint32_t pid;
+    char padding[48];
+
+    TraceRecord *records()
+    {
+        return reinterpret_cast<TraceRecord *>(this + 1);
+    }
+    const TraceRecord *records() const
+    {
+        return reinterpret_cast<const TraceRecord *>(this + 1);
+    }
+};
+static_assert(sizeof(TraceThreadRegion) == 64);
+
+/// Set while a trace is being recorded.
+extern std::atomic<bool> tracing;
+
+void recordTrace(TraceOp op, int clock_id, int64_t arg0, int64_t arg1);
+
+/// Records `op` if tracing. The check is all it costs otherwise.
+inline void trace(TraceOp op, int clock_id = -1, int64_t arg0 = 0, int64_t arg1 = 0)
+{
+    if (tracing.load(std::memory_order_relaxed)) [[unlikely]]
+    {
+        recordTrace(op, clock_id, arg0, arg1);
+    }
+}
+
+/// Starts recording to the file at `path`, which is created or truncated. Throws std::logic_error if already
+/// recording, std::system_error if the file cannot be created.
+void startTracing(const char *path, uint32_t records_per_thread, uint32_t max_threads);
+/// Stops recording and unmaps the file. Does nothing unless recording.
+void stopTracing();
+
+} // namespace fakeclock
+
+#endif // FAKECLOCK_TRACE_H
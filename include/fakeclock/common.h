@@ -1,6 +1,8 @@
 #pragma once
 #include <chrono>
+#include <string>
 #include <sys/time.h>
+#include <unistd.h>
 
 namespace fakeclock
 {
@@ -26,4 +28,20 @@ inline std::chrono::nanoseconds to_duration(const timespec &ts)
     return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
 }
 
+inline std::chrono::nanoseconds to_duration(const timeval &tv)
+{
+    return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+}
+
+/// `path` with "%p" replaced by the pid, so that each process of a tree started with the same environment gets its own
+/// file.
+inline std::string with_pid(std::string path)
+{
+    if (auto pos = path.find("%p"); pos != std::string::npos)
+    {
+        path.replace(pos, 2, std::to_string(getpid()));
+    }
+    return path;
+}
+
 } // namespace fakeclock
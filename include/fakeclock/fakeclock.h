@@ -1,11 +1,20 @@
 #ifndef FAKECLOCK_FAKECLOCK_H
 #define FAKECLOCK_FAKECLOCK_H
 
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace fakeclock
 {
 
+class ClockSimulator;
+
 class FakeClock
 {
   public:
@@ -18,6 +27,7 @@ class FakeClock
     static time_point now() noexcept;
 };
 
+/// Takes control of the time of the calling thread's timeline (see Timeline) until destruction.
 class MasterOfTime
 {
 
@@ -27,8 +37,221 @@ class MasterOfTime
     ~MasterOfTime();
     MasterOfTime(const MasterOfTime &) = delete;
     void advance(FakeClock::duration duration);
+    /// Advances like advance(), then returns once every thread woken by the step is blocked again in an intercepted
+    /// wait (sleeps, fd waits, read() of a blocking timerfd, ...) or has exited, and the SIGEV_THREAD callbacks of the
+    /// step have returned. Threads whose fds become ready through the step, or through threads reacting to it, are
+    /// waited for too; threads woken through mutexes or condition variables are not. Returns false if the threads did
+    /// not settle within `timeout` of real time.
+    bool advanceAndSettle(FakeClock::duration duration, std::optional<std::chrono::nanoseconds> timeout = std::nullopt);
+
+    /// Earliest pending deadline of a sleeping thread, timerfd or POSIX timer, if there is any.
+    std::optional<FakeClock::time_point> nextEventTime() const;
+    /// Jumps straight to nextEventTime(). Returns false (and does not advance) if nothing is pending.
+    bool advanceToNextEvent();
+    /// Advances from event to event up to `tp`, then to `tp` itself. Events scheduled by threads woken on the way
+    /// are included only if they are scheduled before the next step is taken.
+    void runUntil(FakeClock::time_point tp);
+
+    /// When enabled, time jumps to nextEventTime() by itself as soon as every RegisteredThread is blocked in an
+    /// intercepted wait (sleeps, clock_nanosleep, poll/epoll_wait/select with a timeout, ...). Disabled by default.
+    void setAutoAdvance(bool enabled);
+
+    /// Runs the RegisteredThreads one at a time until destruction, so that their interleaving only depends on `seed`:
+    /// a thread runs until it sleeps, waits (for fds, timers, mutexes, condition variables, semaphores, futexes or
+    /// other threads) or reads a clock, and the next thread is drawn at random among those ready. Runs with the same
+    /// seed interleave the same way, so a failing seed reproduces its failure; sweeping seeds explores interleavings.
+    /// Meant to be used with setAutoAdvance(), and threads must be created by a registered thread. A thread that
+    /// blocks outside intercepted calls (e.g. in a spin loop or on a pipe without poll()) stalls the others for a
+    /// second, after which they run anyway and the interleaving is no longer reproducible; this is reported on stderr.
+    void scheduleDeterministically(uint64_t seed);
+    /// Like scheduleDeterministically(seed), and also draws from `seed` what the simulation otherwise decides in a
+    /// fixed way: the order of timers and sleepers with equal deadlines, the order in which the threads released by
+    /// one step are woken, and how advance() is split into smaller steps. After each step the woken threads must block
+    /// again within a second of real time, or advance() throws std::runtime_error. Used by exploreSchedules().
+    void explore(uint64_t seed);
+
+    /// Lets fake time flow along with the real clock, sped up by setTimeScale(), e.g. for soak tests. Deadlines are
+    /// met by a background thread; advance() and friends still jump ahead. Time is paused by default.
+    void resume();
+    /// Freezes fake time again.
+    void pause();
+    bool isPaused() const;
+    /// Fake seconds per real second while time flows (1 by default). Throws std::invalid_argument unless positive.
+    void setTimeScale(double scale);
+
+    /// Makes processes forked from now on follow this time: sleepers, timerfds and POSIX timers of the children
+    /// expire as time advances here. Children cannot change the time (advance() and the like throw there), and
+    /// automatic advance does not see their threads.
+    void shareWithChildProcesses();
+
+    /// Replays a recording made by ClockRecorder (or FAKECLOCK_RECORD) until destruction: each thread reads the
+    /// clock values and gets the sleep and timer durations of its counterpart in the recorded run, in the same order,
+    /// and time advances by itself along the recorded timeline as they do. Threads are matched by their lineage: the
+    /// main thread, then the threads created by a matched thread in creation order. A thread whose operations differ
+    /// from the recording is reported on stderr and gets plain simulated time from then on. Throws
+    /// std::system_error if the file cannot be read, std::runtime_error if it is no recording and std::logic_error if
+    /// a recording is already being replayed.
+    void replay(const std::string &path);
+
+  private:
+    ClockSimulator &simulator_;
+};
+
+/// Registers the calling thread as part of the simulated system for MasterOfTime::setAutoAdvance().
+/// Threads created by a registered thread are registered too, from creation until they exit. So the usual pattern is
+/// to create a RegisteredThread in the test body, start the threads of the system under test and then destroy it
+/// before joining them.
+class RegisteredThread
+{
+  public:
+    RegisteredThread();
+    ~RegisteredThread();
+    RegisteredThread(const RegisteredThread &) = delete;
+    RegisteredThread &operator=(const RegisteredThread &) = delete;
 };
 
+/// A run of exploreSchedules() that failed.
+struct ScheduleFailure
+{
+    uint64_t seed;
+    std::string reason; ///< the exception, signal, exit status or timeout that ended the run
+};
+
+struct ExplorationOptions
+{
+    uint64_t first_seed = 0;
+    uint64_t runs = 1000;                                            ///< seeds first_seed, first_seed + 1, ...
+    unsigned workers = 0;                                            ///< processes, 0 for one per available core
+    std::chrono::nanoseconds run_timeout = std::chrono::seconds(30); ///< of real time, after which a run fails
+    size_t max_failures = 10;                                        ///< stops early, 0 for never
+};
+
+struct ExplorationResult
+{
+    uint64_t runs = 0;                     ///< that ended, failed ones included
+    std::vector<ScheduleFailure> failures; ///< by seed
+};
+
+/// Runs `body` once with a new MasterOfTime on which explore(seed) was called, e.g. to debug a seed reported by
+/// exploreSchedules().
+void runSchedule(uint64_t seed, const std::function<void(MasterOfTime &)> &body);
+
+/// Looks for timing bugs by running `body` with runSchedule() for many seeds, in forked worker processes that share
+/// the seeds. A run fails if `body` throws, if its process dies (an assertion, a crash, exit()) or if it takes longer
+/// than the timeout; a worker that dies is replaced for the remaining seeds. Failures of gtest assertions do not reach
+/// the parent process, so `body` has to throw or abort instead. Failures are also reported on stderr. Must be called
+/// while no MasterOfTime exists, and preferably before the process starts threads, as only the calling thread is
+/// forked.
+ExplorationResult exploreSchedules(const std::function<void(MasterOfTime &)> &body,
+                                   const ExplorationOptions &options = {});
+
+/// An independent simulated time with its own clocks, sleepers, timerfds and POSIX timers, so that scenarios can run
+/// in parallel in one process (e.g. one per test shard). Threads use the default timeline until they attach to another
+/// one with ScopedTimeline, and threads created by attached threads inherit the timeline. Timerfds and POSIX timers
+/// belong to the timeline of the thread that created them and must be used by threads of that timeline, but may be
+/// closed or duplicated by any thread.
+/// A Timeline must outlive its MasterOfTime and all threads attached to it.
+class Timeline
+{
+  public:
+    Timeline();
+    ~Timeline();
+    Timeline(const Timeline &) = delete;
+    Timeline &operator=(const Timeline &) = delete;
+
+  private:
+    friend class ScopedTimeline;
+    std::unique_ptr<ClockSimulator> simulator_;
+};
+
+/// Attaches the calling thread to a Timeline until destruction, then restores the previous one.
+class ScopedTimeline
+{
+  public:
+    explicit ScopedTimeline(Timeline &timeline);
+    ~ScopedTimeline();
+    ScopedTimeline(const ScopedTimeline &) = delete;
+    ScopedTimeline &operator=(const ScopedTimeline &) = delete;
+
+  private:
+    ClockSimulator *previous_;
+};
+
+/// Records every intercepted time operation (clock reads and changes, sleeps, fd waits, timerfds and POSIX timers) and
+/// every advance of the time into the file at `path` until destruction, e.g. to find out which thread waited for what
+/// in a test that misbehaves. Convert the file with fakeclocktrace and open the result in Perfetto or chrome://tracing.
+/// Each thread keeps its last `records_per_thread` records; threads beyond `max_threads` are not recorded. Only one
+/// recording can be active at a time; FAKECLOCK_TRACE=<file> records the whole run of a process instead.
+class TraceRecorder
+{
+  public:
+    static constexpr uint32_t DEFAULT_RECORDS_PER_THREAD = 16384;
+    static constexpr uint32_t DEFAULT_MAX_THREADS = 64;
+
+    /// Throws std::logic_error if a recording is active, std::system_error if the file cannot be created.
+    explicit TraceRecorder(const std::string &path, uint32_t records_per_thread = DEFAULT_RECORDS_PER_THREAD,
+                           uint32_t max_threads = DEFAULT_MAX_THREADS);
+    ~TraceRecorder();
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+};
+
+/// Records the clock readings (clock_gettime, gettimeofday, time) and the requested sleep, timerfd and POSIX timer
+/// durations of every thread into the file at `path` until destruction, while time is real. This is meant for
+/// production runs: a record costs a few stores, and the file streams to disk in chunks. MasterOfTime::replay() turns
+/// a recording into a deterministic simulated run. Only one recording can be active at a time;
+/// FAKECLOCK_RECORD=<file> records the whole run of a process and FAKECLOCK_REPLAY=<file> replays it.
+class ClockRecorder
+{
+  public:
+    /// Throws std::logic_error if a recording is active, std::system_error if the file cannot be created.
+    explicit ClockRecorder(const std::string &path);
+    ~ClockRecorder();
+    ClockRecorder(const ClockRecorder &) = delete;
+    ClockRecorder &operator=(const ClockRecorder &) = delete;
+};
+
+/// Counts of intercepted operations of all threads since the process started or resetStats() was called. Buckets of
+/// the histograms are not cumulative: bucket i counts values up to the i-th bound that are above the previous one, and
+/// the last bucket counts values above all bounds.
+struct Stats
+{
+    /// Clock reads are counted per clock id; reads of other clocks (e.g. CPU clocks of processes) go to the last slot.
+    static constexpr size_t CLOCK_IDS = 16;
+    static constexpr std::array<FakeClock::duration, 9> SLEEP_BOUNDS = {
+        std::chrono::microseconds(1), std::chrono::microseconds(10), std::chrono::microseconds(100),
+        std::chrono::milliseconds(1), std::chrono::milliseconds(10), std::chrono::milliseconds(100),
+        std::chrono::seconds(1),      std::chrono::seconds(10),      std::chrono::seconds(100)};
+    static constexpr std::array<uint64_t, 8> PER_ADVANCE_BOUNDS = {0, 1, 2, 4, 8, 16, 32, 64};
+
+    std::array<uint64_t, CLOCK_IDS> clock_reads = {}; ///< clock_gettime, gettimeofday and time
+    uint64_t clock_sets = 0;
+    uint64_t sleeps = 0; ///< sleep, usleep, nanosleep and clock_nanosleep
+    FakeClock::duration sleep_time = {}; ///< requested by all sleeps
+    std::array<uint64_t, SLEEP_BOUNDS.size() + 1> sleep_durations = {};
+    uint64_t fd_waits = 0;         ///< poll, epoll_wait, select and their variants that may block
+    uint64_t fd_wait_timeouts = 0; ///< fd waits that ended without ready fds
+    uint64_t timerfd_operations = 0;
+    uint64_t timerfd_expirations = 0;
+    uint64_t posix_timer_operations = 0;
+    uint64_t posix_timer_expirations = 0;
+    uint64_t advances = 0; ///< of the time, explicit or automatic
+    uint64_t woken_threads = 0;
+    uint64_t fired_timers = 0;
+    std::array<uint64_t, PER_ADVANCE_BOUNDS.size() + 1> woken_threads_per_advance = {};
+    std::array<uint64_t, PER_ADVANCE_BOUNDS.size() + 1> fired_timers_per_advance = {};
+    /// Fake and real time that passed while a MasterOfTime existed, summed over the periods that ended.
+    FakeClock::duration simulated_time = {};
+    FakeClock::duration wall_time = {};
+};
+
+/// Sums the counters of all threads. Threads count into shards of their own, so counting never contends.
+Stats stats();
+/// stats() in the Prometheus text exposition format.
+std::string statsText();
+/// Zeroes all counters. Operations that run concurrently may be counted before or after the reset.
+void resetStats();
+
 } // namespace fakeclock
 
 #endif // FAKECLOCK_FAKECLOCK_H
@@ -0,0 +1,119 @@
+#include <fakeclock/CallbackPool.h>
+#include <fakeclock/RealFunctions.h>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <pthread.h>
+
+namespace fakeclock
+{
+
+ThreadAttributes::ThreadAttributes(const pthread_attr_t &attributes)
+{
+    pthread_attr_getstacksize(&attributes, &stack_size);
+    pthread_attr_getguardsize(&attributes, &guard_size);
+    pthread_attr_getinheritsched(&attributes, &inherit_sched);
+    pthread_attr_getschedpolicy(&attributes, &policy);
+    pthread_attr_getschedparam(&attributes, &param);
+}
+
+void ThreadAttributes::apply(pthread_attr_t &attributes) const
+{
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attributes, stack_size);
+    pthread_attr_setguardsize(&attributes, guard_size);
+    pthread_attr_setinheritsched(&attributes, inherit_sched);
+    pthread_attr_setschedpolicy(&attributes, policy);
+    pthread_attr_setschedparam(&attributes, &param);
+}
+
+CallbackPool &CallbackPool::getInstance()
+{
+    // Never destroyed: the pool threads may still be waiting for work while the process exits.
+    static auto *instance = new CallbackPool;
+    return *instance;
+}
+
+CallbackPool::CallbackPool()
+{
+    pthread_atfork(nullptr, nullptr, [] { getInstance().forgetThreadsAfterFork(); });
+}
+
+void CallbackPool::submit(std::function<void()> callback, std::shared_ptr<const ThreadAttributes> attributes)
+{
+    // The real pthread_create(), so that the threads do not inherit the registration of the calling thread.
+    if (attributes)
+    {
+        pthread_attr_t thread_attributes;
+        attributes->apply(thread_attributes);
+        auto *owned = new std::function<void()>(std::move(callback));
+        auto start = [](void *callback) -> void * {
+            std::unique_ptr<std::function<void()>> owned(static_cast<std::function<void()> *>(callback));
+            (*owned)();
+            return nullptr;
+        };
+        pthread_t thread;
+        int error = real.pthread_create(&thread, &thread_attributes, start, owned);
+        pthread_attr_destroy(&thread_attributes);
+        if (error == 0)
+        {
+            return;
+        }
+        // Attributes the process may not use, such as a real-time policy, leave the callback to the pool.
+        callback = std::move(*owned);
+        delete owned;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    callbacks_.push_back(std::move(callback));
+    if (idle_threads_ >= callbacks_.size())
+    {
+        callback_queued_.notify_one();
+        return;
+    }
+    pthread_t thread;
+    auto start = [](void *pool) -> void * {
+        static_cast<CallbackPool *>(pool)->run();
+        return nullptr;
+    };
+    if (real.pthread_create(&thread, nullptr, start, this) != 0)
+    {
+        // The callback runs once a pool thread is free; without any thread it waits for the next submission.
+        std::cerr << "fakeclock error: cannot start a thread for SIGEV_THREAD notifications" << std::endl;
+        return;
+    }
+    pthread_detach(thread);
+    threads_++;
+}
+
+void CallbackPool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        idle_threads_++;
+        callback_queued_.wait(lock, [this] { return !callbacks_.empty(); });
+        idle_threads_--;
+        auto callback = std::move(callbacks_.front());
+        callbacks_.pop_front();
+        lock.unlock();
+        callback();
+        lock.lock();
+        if (idle_threads_ >= MAX_IDLE_THREADS && callbacks_.empty())
+        {
+            threads_--; // started for a burst of callbacks
+            return;
+        }
+    }
+}
+
+void CallbackPool::forgetThreadsAfterFork()
+{
+    // Only the forking thread exists in the child. The mutex may have been held by a pool thread.
+    new (&mutex_) std::mutex;
+    new (&callback_queued_) std::condition_variable;
+    threads_ = 0;
+    idle_threads_ = 0;
+}
+
+} // namespace fakeclock
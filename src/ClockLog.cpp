@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <cstring>
+#include <fakeclock/ClockLog.h>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/common.h>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Recording must not slow down the application: a record is a few stores into the chunk its thread has mapped. Only
+// claiming a new chunk, once every ClockLogChunk::CAPACITY records, takes a lock and a few syscalls. Each thread
+// unmaps only its own chunks (when it claims the next one, sees that the recording ended or exits), so stopping the
+// recording never pulls memory from under a writer.
+
+namespace fakeclock
+{
+
+std::atomic<bool> clock_recording = false;
+std::atomic<bool> clock_replaying = false;
+
+namespace
+{
+
+uint64_t mix(uint64_t x)
+{
+    // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+struct ThreadLineage
+{
+    uint64_t key = 0;
+    uint64_t children = 0; ///< threads created since `epoch`
+    uint64_t epoch = 0;
+};
+
+thread_local ThreadLineage lineage;
+/// Bumped when a recording or replay starts, so that children are counted from there in both runs.
+std::atomic<uint64_t> lineage_epoch = 1;
+std::atomic<uint64_t> untracked_threads = 0;
+
+struct Recording
+{
+    int fd;
+    ClockLogHeader *header;
+};
+
+std::mutex recording_mutex; ///< guards `recording`
+Recording *recording = nullptr;
+std::atomic<uint64_t> recording_generation = 0;
+
+/// The chunk the calling thread appends to.
+struct ChunkWriter
+{
+    uint64_t generation = 0;
+    ClockLogChunk *chunk = nullptr;
+    uint32_t sequence = 0;
+    bool writing = false; ///< guards against signal handlers that interrupt a write
+};
+
+thread_local ChunkWriter chunk_writer;
+
+void unmap_chunk(void *chunk)
+{
+    munmap(chunk, ClockLogChunk::SIZE);
+}
+
+pthread_key_t chunk_key()
+{
+    static pthread_key_t key = [] {
+        pthread_key_t k;
+        pthread_key_create(&k, unmap_chunk); // unmaps the chunk of an exiting thread
+        return k;
+    }();
+    return key;
+}
+
+/// Replaces the chunk of `writer` with a new one of the recording `generation`, nullptr if it has ended.
+ClockLogChunk *claim_chunk(ChunkWriter &writer, uint64_t generation)
+{
+    if (writer.chunk)
+    {
+        munmap(writer.chunk, ClockLogChunk::SIZE);
+        writer.chunk = nullptr;
+        pthread_setspecific(chunk_key(), nullptr);
+    }
+    if (writer.generation != generation)
+    {
+        writer.generation = generation;
+        writer.sequence = 0;
+    }
+    std::lock_guard<std::mutex> lock(recording_mutex);
+    if (!recording || recording_generation.load(std::memory_order_relaxed) != generation)
+    {
+        return nullptr;
+    }
+    // The counter is in the file, so processes forked while recording claim distinct chunks. The file only grows.
+    auto index = recording->header->chunks.fetch_add(1);
+    off_t offset = off_t(ClockLogHeader::SIZE + index * ClockLogChunk::SIZE);
+    if (posix_fallocate(recording->fd, offset, ClockLogChunk::SIZE) != 0)
+    {
+        return nullptr;
+    }
+    void *memory = mmap(nullptr, ClockLogChunk::SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, recording->fd, offset);
+    if (memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    auto *chunk = static_cast<ClockLogChunk *>(memory);
+    chunk->thread_key = threadKey();
+    chunk->sequence = writer.sequence++;
+    writer.chunk = chunk;
+    pthread_setspecific(chunk_key(), chunk);
+    return chunk;
+}
+
+/// Threads that exist in a forked child get their own identity and chunks.
+uint64_t fork_child_key = 0;
+
+void fork_prepare()
+{
+    if (clock_recording.load() || clock_replaying.load())
+    {
+        fork_child_key = nextChildThreadKey();
+    }
+}
+
+void fork_child()
+{
+    if (chunk_writer.chunk)
+    {
+        unmap_chunk(chunk_writer.chunk); // the parent keeps writing to it
+        chunk_writer.chunk = nullptr;
+        pthread_setspecific(chunk_key(), nullptr);
+    }
+    if (fork_child_key)
+    {
+        setThreadKey(fork_child_key);
+        fork_child_key = 0;
+    }
+}
+
+[[maybe_unused]] const int fork_handler_registered = pthread_atfork(fork_prepare, nullptr, fork_child);
+
+class Replay
+{
+  public:
+    using Chunks = std::vector<const ClockLogChunk *>; ///< of a thread, by sequence
+
+    Replay(ClockSimulator &simulator, const char *path) : simulator(simulator)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            if (fd != -1)
+            {
+                real.close(fd);
+            }
+            throw std::system_error(err, std::generic_category(), std::string("fakeclock: cannot open ") + path);
+        }
+        size_ = size_t(st.st_size);
+        memory_ = size_ >= ClockLogHeader::SIZE ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        real.close(fd);
+        const auto *header = static_cast<const ClockLogHeader *>(memory_);
+        if (memory_ == MAP_FAILED || std::memcmp(header->magic, ClockLogHeader::MAGIC, sizeof(header->magic)) != 0 ||
+            header->record_size != sizeof(ClockLogRecord) || header->chunk_size != ClockLogChunk::SIZE)
+        {
+            if (memory_ != MAP_FAILED)
+            {
+                munmap(memory_, size_); // the destructor does not run
+            }
+            throw std::runtime_error(std::string("fakeclock: ") + path + " is no clock recording");
+        }
+        start_mono = header->start_mono;
+        start_time = simulator.now();
+        // Then simulated CLOCK_REALTIME agrees with the recorded readings, e.g. for absolute timer deadlines.
+        // CLOCK_MONOTONIC keeps its offset, as it must not go backwards.
+        simulator.setTime(ClockSimulator::TimePoint(std::chrono::nanoseconds(header->start_realtime)), CLOCK_REALTIME);
+        // A crashed recording may have claimed chunks it never got to write.
+        auto chunks = std::min<uint64_t>(header->chunks.load(), (size_ - ClockLogHeader::SIZE) / ClockLogChunk::SIZE);
+        for (uint64_t i = 0; i < chunks; i++)
+        {
+            const auto *chunk = reinterpret_cast<const ClockLogChunk *>(static_cast<const char *>(memory_) +
+                                                                        ClockLogHeader::SIZE + i * ClockLogChunk::SIZE);
+            auto &thread = threads[chunk->thread_key];
+            if (thread.size() <= chunk->sequence)
+            {
+                thread.resize(chunk->sequence + 1);
+            }
+            thread[chunk->sequence] = chunk;
+        }
+    }
+    ~Replay()
+    {
+        if (memory_ != MAP_FAILED)
+        {
+            munmap(memory_, size_);
+        }
+    }
+    Replay(const Replay &) = delete;
+    Replay &operator=(const Replay &) = delete;
+
+    ClockSimulator &simulator;
+    int64_t start_mono;                            ///< recorded CLOCK_MONOTONIC that corresponds to start_time
+    ClockSimulator::TimePoint start_time;          ///< fake time when the replay started
+    std::unordered_map<uint64_t, Chunks> threads; ///< by thread key
+    uint64_t generation = 0;
+
+  private:
+    void *memory_ = MAP_FAILED;
+    size_t size_ = 0;
+};
+
+std::mutex replay_mutex; ///< serializes startClockReplay() and stopClockReplay()
+/// Threads hold a reference while they read from it, so stopping a replay never unmaps it under them.
+std::atomic<std::shared_ptr<Replay>> current_replay;
+uint64_t replay_generation = 0;
+
+/// Position of the calling thread in its recorded records.
+struct ReplayCursor
+{
+    uint64_t generation = 0;
+    const Replay::Chunks *chunks = nullptr;
+    size_t chunk = 0;
+    uint32_t index = 0;
+    bool diverged = false;
+};
+
+thread_local ReplayCursor cursor;
+
+void diverge(const char *reason, TraceOp op)
+{
+    std::cerr << "fakeclock: replay diverged on thread " << gettid() << " (" << TRACE_OP_NAMES[size_t(op)]
+              << "): " << reason << ", using simulated time from now on" << std::endl;
+    cursor.diverged = true;
+}
+
+} // namespace
+
+uint64_t threadKey()
+{
+    if (!lineage.key)
+    {
+        // Threads created before the recording or replay started cannot be told apart reliably.
+        lineage.key = gettid() == getpid() ? 1 : mix(0xfffffffful + untracked_threads.fetch_add(1));
+    }
+    return lineage.key;
+}
+
+uint64_t nextChildThreadKey()
+{
+    auto epoch = lineage_epoch.load(std::memory_order_relaxed);
+    if (lineage.epoch != epoch)
+    {
+        lineage.epoch = epoch;
+        lineage.children = 0;
+    }
+    return mix(threadKey() * 0x9e3779b97f4a7c15ULL + ++lineage.children);
+}
+
+void setThreadKey(uint64_t key)
+{
+    lineage = {key, 0, lineage_epoch.load(std::memory_order_relaxed)};
+}
+
+void writeClockRecord(TraceOp op, int clock_id, int64_t value)
+{
+    auto &writer = chunk_writer;
+    if (writer.writing)
+    {
+        return;
+    }
+    writer.writing = true;
+    auto generation = recording_generation.load(std::memory_order_acquire);
+    auto *chunk = writer.chunk;
+    if (writer.generation != generation || !chunk ||
+        chunk->count.load(std::memory_order_relaxed) == ClockLogChunk::CAPACITY)
+    {
+        chunk = claim_chunk(writer, generation);
+    }
+    if (chunk)
+    {
+        auto index = chunk->count.load(std::memory_order_relaxed);
+        auto mono = op == TraceOp::ClockGettime && clock_id == CLOCK_MONOTONIC ? value : TimeState::realNow().count();
+        chunk->records()[index] = {value, mono, op, static_cast<int16_t>(clock_id), 0};
+        chunk->count.store(index + 1, std::memory_order_release);
+    }
+    writer.writing = false;
+}
+
+std::optional<int64_t> replayClockRecord(TraceOp op, int clock_id)
+{
+    auto replay = current_replay.load();
+    if (!replay || &ClockSimulator::getInstance() != &replay->simulator)
+    {
+        return std::nullopt;
+    }
+    if (cursor.generation != replay->generation)
+    {
+        auto it = replay->threads.find(threadKey());
+        cursor = {replay->generation, it == replay->threads.end() ? nullptr : &it->second};
+        if (!cursor.chunks)
+        {
+            diverge("the thread was not recorded", op);
+        }
+    }
+    if (cursor.diverged)
+    {
+        return std::nullopt;
+    }
+    const auto &chunks = *cursor.chunks;
+    while (cursor.chunk < chunks.size() &&
+           (!chunks[cursor.chunk] || cursor.index >= chunks[cursor.chunk]->count.load(std::memory_order_acquire)))
+    {
+        cursor.chunk++;
+        cursor.index = 0;
+    }
+    if (cursor.chunk == chunks.size())
+    {
+        diverge("the recording of the thread ended", op);
+        return std::nullopt;
+    }
+    const auto &record = chunks[cursor.chunk]->records()[cursor.index];
+    if (record.op != op || record.clock_id != clock_id)
+    {
+        auto reason = std::string("the recording has ") + TRACE_OP_NAMES[size_t(record.op)] + " on clock " +
+                      std::to_string(record.clock_id) + " instead of clock " + std::to_string(clock_id);
+        diverge(reason.c_str(), op);
+        return std::nullopt;
+    }
+    cursor.index++;
+    replay->simulator.advanceTo(replay->start_time + ClockSimulator::Duration(record.mono - replay->start_mono));
+    return record.value;
+}
+
+void startClockRecording(const char *path)
+{
+    std::lock_guard<std::mutex> lock(recording_mutex);
+    if (recording)
+    {
+        throw std::logic_error("fakeclock: the clock is already being recorded");
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), std::string("fakeclock: cannot create ") + path);
+    }
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, ClockLogHeader::SIZE) == 0)
+    {
+        memory = mmap(nullptr, ClockLogHeader::SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (memory == MAP_FAILED)
+    {
+        int err = errno;
+        real.close(fd);
+        throw std::system_error(err, std::generic_category(), std::string("fakeclock: cannot map ") + path);
+    }
+    auto *header = static_cast<ClockLogHeader *>(memory);
+    std::memcpy(header->magic, ClockLogHeader::MAGIC, sizeof(header->magic));
+    header->record_size = sizeof(ClockLogRecord);
+    header->chunk_size = ClockLogChunk::SIZE;
+    timespec realtime;
+    real_clock_gettime(CLOCK_REALTIME, &realtime);
+    header->start_mono = TimeState::realNow().count();
+    header->start_realtime = to_duration(realtime).count();
+    recording = new Recording{fd, header};
+    lineage_epoch.fetch_add(1);
+    recording_generation.fetch_add(1, std::memory_order_release);
+    clock_recording.store(true);
+}
+
+void stopClockRecording()
+{
+    std::lock_guard<std::mutex> lock(recording_mutex);
+    if (!recording)
+    {
+        return;
+    }
+    clock_recording.store(false);
+    recording_generation.fetch_add(1, std::memory_order_release);
+    // Drops the space preallocated for chunks that were never claimed.
+    auto chunks = recording->header->chunks.load();
+    auto _ = ftruncate(recording->fd, off_t(ClockLogHeader::SIZE + chunks * ClockLogChunk::SIZE));
+    (void)_;
+    munmap(recording->header, ClockLogHeader::SIZE);
+    real.close(recording->fd);
+    delete recording;
+    recording = nullptr;
+    // Chunks still mapped by threads stay valid; the threads unmap them when they notice the end.
+}
+
+void startClockReplay(ClockSimulator &simulator, const char *path)
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    if (current_replay.load())
+    {
+        throw std::logic_error("fakeclock: a recording is already being replayed");
+    }
+    if (simulator.isFollowing())
+    {
+        throw std::logic_error("fakeclock: a process that follows the time of another one cannot replay");
+    }
+    auto replay = std::make_shared<Replay>(simulator, path);
+    replay->generation = ++replay_generation;
+    lineage_epoch.fetch_add(1);
+    current_replay.store(std::move(replay));
+    clock_replaying.store(true);
+}
+
+void stopClockReplay(ClockSimulator &simulator)
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    auto replay = current_replay.load();
+    if (!replay || &replay->simulator != &simulator)
+    {
+        return;
+    }
+    clock_replaying.store(false);
+    current_replay.store(nullptr);
+}
+
+ClockRecorder::ClockRecorder(const std::string &path)
+{
+    startClockRecording(path.c_str());
+}
+
+ClockRecorder::~ClockRecorder()
+{
+    stopClockRecording();
+}
+
+} // namespace fakeclock
+
+/// FAKECLOCK_RECORD=<file> records the whole run of the process, FAKECLOCK_REPLAY=<file> replays it. "%p" in the path
+/// is replaced by the pid.
+__attribute__((constructor)) static void record_or_replay_on_load()
+{
+    const char *record_path = getenv("FAKECLOCK_RECORD");
+    const char *replay_path = getenv("FAKECLOCK_REPLAY");
+    try
+    {
+        if (record_path && *record_path)
+        {
+            fakeclock::startClockRecording(fakeclock::with_pid(record_path).c_str());
+        }
+        else if (replay_path && *replay_path)
+        {
+            auto &simulator = fakeclock::ClockSimulator::getDefault();
+            simulator.addClock(); // like a MasterOfTime that lives as long as the process
+            fakeclock::startClockReplay(simulator, fakeclock::with_pid(replay_path).c_str());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "fakeclock error: " << e.what() << std::endl;
+    }
+}
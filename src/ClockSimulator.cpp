@@ -1,11 +1,23 @@
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <fakeclock/CallbackPool.h>
 #include <fakeclock/ClockSimulator.h>
+#include <fakeclock/Futex.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/Stats.h>
+#include <fakeclock/Trace.h>
 #include <fakeclock/common.h>
 #include <iostream>
 #include <signal.h>
 #include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <system_error>
 #include <sys/timerfd.h>
+#include <vector>
 
 // ScopedSigpipeIgnore class definition
 class ScopedSigpipeIgnore
@@ -31,110 +43,1561 @@ class ScopedSigpipeIgnore
     struct sigaction new_action_;
 };
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 namespace fakeclock
 {
 
-ClockSimulator &ClockSimulator::getInstance()
+std::atomic<int> intercepting = 0;
+std::atomic<int> scheduling = 0;
+thread_local ClockSimulator *current_timeline = nullptr;
+
+static thread_local SimulatedThread current_thread;
+
+/// Settles a thread that exits while advanceAndSettle() waits for it to block.
+struct SettleAtExit
+{
+    ~SettleAtExit()
+    {
+        if (current_thread.unsettled_in)
+        {
+            current_thread.unsettled_in->threadLeft();
+        }
+    }
+    bool armed = false; ///< set on first use, which registers the destructor
+};
+static thread_local SettleAtExit settle_at_exit;
+
+/// Upper bound of consecutive automatic steps that wake nobody, e.g. a periodic timerfd that no one reads.
+static constexpr int MAX_IDLE_AUTO_ADVANCE_STEPS = 100000;
+
+/// Real time a thread may keep its turn without reaching an intercepted call before the others run anyway.
+static constexpr auto STALLED_TURN_TIMEOUT = std::chrono::seconds(1);
+
+/// Real time after which a parked thread retries if nothing else can run.
+static constexpr auto IDLE_RETRY_INTERVAL = std::chrono::milliseconds(1);
+
+/// Explicit advances are split into at most this many random steps while exploring, see ClockSimulator::explore().
+static constexpr int MAX_EXPLORE_STEPS = 4;
+
+/// Real time the threads woken by a random step get to block again before the run fails, rather than taking the next
+/// step at a moment that depends on real time.
+static constexpr auto EXPLORE_SETTLE_TIMEOUT = std::chrono::seconds(1);
+
+/// Simulators whose time is shared with child processes, see ClockSimulator::shareWithChildProcesses().
+static Mutex shared_simulators_mutex;
+static std::vector<ClockSimulator *> shared_simulators;
+
+/// The simulator that created each timerfd, by fd number (its duplicates included), as fd numbers belong to the whole
+/// process and timerfds may be closed or duplicated by threads of any timeline. Taken before the lock of a simulator.
+struct TimerfdOwners
+{
+    Mutex mutex;
+    std::unordered_map<int, ClockSimulator *> by_fd;
+    FdSet fds; ///< keys of by_fd
+};
+
+static TimerfdOwners &timerfd_owners()
+{
+    // Never destroyed: fds may be closed by other threads while the process exits.
+    static auto *owners = new TimerfdOwners;
+    return *owners;
+}
+
+ClockSimulator &ClockSimulator::getDefault()
+{
+    // Never destroyed: a driver thread may still be running while the process exits.
+    static auto *instance = new ClockSimulator;
+    return *instance;
+}
+
+ClockSimulator::ClockSimulator()
+{
+    publishTime();
+}
+
+ClockSimulator::~ClockSimulator()
+{
+    pthread_t driver;
+    bool driven;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        driven = flowing_ || following_;
+        if (driven)
+        {
+            wakeDriverLocked();
+        }
+        flowing_ = following_ = false;
+        driver = driver_;
+    }
+    if (driven)
+    {
+        joinDriver(driver);
+    }
+    if (shared_)
+    {
+        std::lock_guard<Mutex> registry_lock(shared_simulators_mutex);
+        std::erase(shared_simulators, this);
+        SharedTime::unmap(shared_);
+    }
+    auto &owners = timerfd_owners();
+    std::lock_guard<Mutex> owners_lock(owners.mutex);
+    for (auto &[fd, _] : timerfds_)
+    {
+        owners.by_fd.erase(fd);
+        owners.fds.erase(fd);
+    }
+    for (auto &[fd, _] : timerfd_duplicates_)
+    {
+        owners.by_fd.erase(fd);
+        owners.fds.erase(fd);
+    }
+}
+
+void ClockSimulator::addClock()
+{
+    std::lock_guard<Mutex> lifecycle_lock(lifecycle_mutex_);
+    std::lock_guard<Mutex> lock(mutex_);
+    if (clock_count_++ == 0)
+    {
+        intercept();
+        simulation_fake_start_ = fake_time_;
+        simulation_real_start_ = TimeState::realNow();
+    }
+}
+
+void ClockSimulator::removeClock()
+{
+    // The lifecycle lock keeps the count from changing until the simulation has ended, as the driver thread has to be
+    // joined without holding mutex_.
+    std::lock_guard<Mutex> lifecycle_lock(lifecycle_mutex_);
+    if (clock_count_ == 1)
+    {
+        pause(); // joins the driver thread, which needs the lock
+    }
+    Waiter *to_wake = nullptr;
+    std::optional<std::pair<Duration, Duration>> simulation; // simulated and wall time
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (--clock_count_ == 0)
+        {
+            restore();
+            to_wake = popExpiredWaiters(TimePoint::max()); // Release all pending waits
+            simulation.emplace(fake_time_ - simulation_fake_start_, TimeState::realNow() - simulation_real_start_);
+        }
+    }
+    wakeWaiters(to_wake);
+    if (simulation)
+    {
+        endSimulation(simulation->first, simulation->second);
+    }
+}
+
+void ClockSimulator::handleExpiringFds()
+{
+    timerfd_queue_.popExpired(fake_time_, [this](int fd) {
+        auto it = timerfds_.find(fd);
+        if (it == timerfds_.end())
+        {
+            return;
+        }
+        trace(TraceOp::TimerfdExpire, it->second.get_clock_id(), fd,
+              it->second.get_expiration_time().time_since_epoch().count());
+        count(Stat::TimerfdExpiration);
+        advance_fired_timers_++;
+        it->second.advance_to(fake_time_);
+        scheduleTimerfd(fd, it->second);
+    });
+}
+
+void ClockSimulator::scheduleTimerfd(int fd, const TimerFd &timerfd)
+{
+    auto expiration_time = timerfd.get_expiration_time();
+    if (expiration_time == TimerFd::DISARM_TIME)
+    {
+        timerfd_queue_.cancel(fd);
+    }
+    else
+    {
+        timerfd_queue_.schedule(fd, expiration_time);
+    }
+}
+
+void ClockSimulator::handleExpiringPosixTimers()
+{
+    posix_timer_queue_.popExpired(fake_time_, [this](timer_t timerid) {
+        auto &timer = posix_timers_.at(timerid);
+        // A long advance over a periodic timer results in a single notification with an overrun count.
+        auto expirations = timer.advance_to(fake_time_);
+        timer.overrun = static_cast<int>(std::min<int64_t>(expirations - 1, DELAYTIMER_MAX));
+        trace(TraceOp::TimerExpire, timer.clock_id, reinterpret_cast<intptr_t>(timerid), timer.overrun);
+        count(Stat::PosixTimerExpiration);
+        advance_fired_timers_++;
+        if (timer.expiration_time != PosixTimer::DISARM_TIME)
+        {
+            posix_timer_queue_.schedule(timerid, timer.expiration_time);
+        }
+        if (timer.sevp.sigev_notify == SIGEV_NONE)
+        {
+            return;
+        }
+        if (timer.sevp.sigev_notify == SIGEV_THREAD)
+        {
+            running_callbacks_++; // keeps automatic advance from moving on before the callback ran
+        }
+        pending_notifications_.push_back({timerid, timer.sevp, timer.overrun, timer.itimer, timer.thread_attributes});
+        has_pending_notifications_.store(true, std::memory_order_release);
+    });
+}
+
+void ClockSimulator::handleExpiringTimers()
+{
+    handleExpiringFds();
+    handleExpiringPosixTimers();
+}
+
+void ClockSimulator::advance(std::chrono::nanoseconds duration)
+{
+    if (exploring_.load(std::memory_order_relaxed))
+    {
+        advanceInRandomSteps(duration);
+        return;
+    }
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        checkNotFollowerLocked();
+        syncFlowingTimeLocked();
+        to_wake = advanceLocked(duration);
+    }
+    wakeWaiters(to_wake);
+}
+
+bool ClockSimulator::advanceAndSettle(Duration duration, std::optional<Duration> timeout)
+{
+    std::optional<Duration> real_deadline;
+    if (timeout)
+    {
+        real_deadline = TimeState::realNow() + *timeout;
+    }
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        checkNotFollowerLocked();
+        syncFlowingTimeLocked();
+        settling_++;
+        to_wake = advanceLocked(duration);
+    }
+    wakeWaiters(to_wake);
+    bool settled = false;
+    std::unique_lock<Mutex> lock(mutex_);
+    while (true)
+    {
+        markReturningWaitersLocked();
+        if (unsettled_threads_ == 0 && running_callbacks_ == 0)
+        {
+            settled = true;
+            break;
+        }
+        if (real_deadline && TimeState::realNow() >= *real_deadline)
+        {
+            break;
+        }
+        uint32_t generation = settle_generation_.load(std::memory_order_relaxed);
+        lock.unlock();
+        futex_wait_until(settle_generation_, generation, real_deadline);
+        lock.lock();
+    }
+    if (--settling_ == 0)
+    {
+        // Threads that did not settle in time must not hold up later calls.
+        settle_epoch_++;
+        unsettled_threads_ = 0;
+    }
+    return settled;
+}
+
+void ClockSimulator::advanceTo(TimePoint tp)
+{
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (following_)
+        {
+            return; // the parent moves the time
+        }
+        syncFlowingTimeLocked();
+        if (tp <= fake_time_)
+        {
+            return;
+        }
+        to_wake = advanceLocked(tp - fake_time_);
+    }
+    wakeWaiters(to_wake);
+}
+
+bool ClockSimulator::isFollowing() const
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return following_;
+}
+
+Waiter *ClockSimulator::advanceLocked(Duration duration)
+{
+    fake_time_ += duration;
+    if (flowing_)
+    {
+        flow_anchor_fake_ += duration;
+        pokeDriverLocked(TimePoint::min()); // its wake-up time is based on the old fake time
+    }
+    publishTime();
+    trace(TraceOp::Advance, -1, duration.count());
+    advance_fired_timers_ = advance_woken_threads_ = 0;
+    handleExpiringTimers();
+    auto *to_wake = popExpiredWaiters(fake_time_);
+    if (exploring_)
+    {
+        to_wake = shuffleLocked(to_wake);
+    }
+    countAdvance(advance_woken_threads_, advance_fired_timers_);
+    if (scheduling_)
+    {
+        progress_++; // parked threads retry, as timers may have fired
+        scheduleLocked();
+    }
+    return to_wake;
+}
+
+void ClockSimulator::syncFlowingTimeLocked(Duration real_now)
+{
+    if (following_)
+    {
+        fake_time_ = std::max(fake_time_, published_.load(std::memory_order_relaxed)->loadFakeTime());
+    }
+    else if (flowing_)
+    {
+        // Always computed from the anchor, exactly like readers of published_time_ do, so both agree.
+        fake_time_ = flow_anchor_fake_ + TimeState::flowElapsed({real_anchor_, time_scale_}, real_now);
+    }
+    else
+    {
+        return;
+    }
+    handleExpiringTimers();
+    if (has_pending_notifications_.load(std::memory_order_relaxed))
+    {
+        pokeDriverLocked(TimePoint::min()); // delivers them
+    }
+}
+
+void ClockSimulator::pokeDriverLocked(TimePoint deadline)
+{
+    if ((flowing_ || following_) && deadline < driver_deadline_)
+    {
+        driver_deadline_ = deadline;
+        wakeDriverLocked();
+    }
+}
+
+std::atomic<uint32_t> &ClockSimulator::driverWord()
+{
+    return following_ ? shared_->generation : driver_generation_;
+}
+
+void ClockSimulator::wakeDriverLocked()
+{
+    auto &word = driverWord();
+    word.fetch_add(1, std::memory_order_release);
+    futex_wake(word, INT_MAX, following_);
+}
+
+void ClockSimulator::startDriverLocked()
+{
+    driver_deadline_ = TimePoint::max();
+    // Not through the pthread_create() override: the driver is no simulated thread.
+    auto drive = [](void *simulator) -> void * {
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, nullptr); // process-directed timer signals go to the application
+        current_timeline = simulator == &getDefault() ? nullptr : static_cast<ClockSimulator *>(simulator);
+        static_cast<ClockSimulator *>(simulator)->driveTime();
+        return nullptr;
+    };
+    int err = real.pthread_create(&driver_, nullptr, drive, this);
+    if (err != 0)
+    {
+        throw std::system_error(err, std::generic_category(), "fakeclock: cannot start the time driver thread");
+    }
+}
+
+void ClockSimulator::joinDriver(pthread_t driver)
+{
+    if (pthread_equal(driver, pthread_self()))
+    {
+        pthread_detach(driver); // stopped from a timer notification delivered by the driver itself
+        return;
+    }
+    pthread_join(driver, nullptr);
+}
+
+void ClockSimulator::driveTime()
+{
+    std::unique_lock<Mutex> lock(mutex_);
+    while (flowing_ || following_)
+    {
+        // Loaded first: the parent process publishes without our lock, and changes after this load must wake us.
+        auto &word = driverWord();
+        auto generation = word.load(std::memory_order_acquire);
+        bool process_shared = following_;
+        auto real_now = TimeState::realNow();
+        syncFlowingTimeLocked(real_now);
+        Waiter *to_wake = popExpiredWaiters(fake_time_);
+        auto next = nextEventTimeLocked();
+        auto flow = following_ ? published_.load(std::memory_order_relaxed)->loadFlow()
+                               : TimeState::Flow{real_anchor_, time_scale_};
+        std::optional<Duration> real_deadline;
+        if (next && flow.real_anchor != Duration::zero())
+        {
+            auto fake_wait = static_cast<double>((*next - fake_time_).count()) / flow.scale;
+            real_deadline = real_now + Duration(static_cast<Duration::rep>(std::ceil(fake_wait)));
+        }
+        driver_deadline_ = next.value_or(TimePoint::max());
+        lock.unlock();
+        wakeWaiters(to_wake);
+        futex_wait_until(word, generation, real_deadline, process_shared);
+        lock.lock();
+    }
+}
+
+void ClockSimulator::stopFollowing()
+{
+    pthread_t driver;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (!following_)
+        {
+            return;
+        }
+        syncFlowingTimeLocked();
+        wakeDriverLocked();
+        following_ = false;
+        driver = driver_;
+    }
+    joinDriver(driver);
+    std::lock_guard<Mutex> registry_lock(shared_simulators_mutex);
+    std::lock_guard<Mutex> lock(mutex_);
+    std::erase(shared_simulators, this);
+    published_.store(&published_time_, std::memory_order_release);
+    // Not unmapped: threads that read the clock may still be reading the shared time they loaded before.
+    shared_ = nullptr;
+    publishTime();
+}
+
+void ClockSimulator::checkNotFollowerLocked() const
+{
+    if (following_)
+    {
+        throw std::logic_error("fakeclock: time is controlled by the parent process");
+    }
+}
+
+void ClockSimulator::resume()
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    checkNotFollowerLocked();
+    if (flowing_)
+    {
+        return;
+    }
+    flowing_ = true;
+    flow_anchor_fake_ = fake_time_;
+    real_anchor_ = TimeState::realNow();
+    publishTime();
+    try
+    {
+        startDriverLocked();
+    }
+    catch (...)
+    {
+        flowing_ = false;
+        publishTime();
+        throw;
+    }
+}
+
+void ClockSimulator::pause()
+{
+    pthread_t driver;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (!flowing_)
+        {
+            return;
+        }
+        syncFlowingTimeLocked();
+        wakeDriverLocked();
+        flowing_ = false;
+        publishTime();
+        driver = driver_;
+    }
+    joinDriver(driver);
+}
+
+bool ClockSimulator::isPaused() const
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    if (following_)
+    {
+        return published_.load(std::memory_order_relaxed)->loadFlow().real_anchor == Duration::zero();
+    }
+    return !flowing_;
+}
+
+void ClockSimulator::setTimeScale(double scale)
+{
+    if (!(scale > 0) || !std::isfinite(scale))
+    {
+        throw std::invalid_argument("fakeclock: time scale must be positive");
+    }
+    std::lock_guard<Mutex> lock(mutex_);
+    checkNotFollowerLocked();
+    if (flowing_)
+    {
+        auto real_now = TimeState::realNow();
+        syncFlowingTimeLocked(real_now);
+        flow_anchor_fake_ = fake_time_;
+        real_anchor_ = real_now;
+    }
+    time_scale_ = scale;
+    publishTime();
+    pokeDriverLocked(TimePoint::min());
+}
+
+void ClockSimulator::shareWithChildProcesses()
+{
+    std::lock_guard<Mutex> registry_lock(shared_simulators_mutex);
+    std::lock_guard<Mutex> lock(mutex_);
+    if (shared_)
+    {
+        return;
+    }
+    addSharedLocked(SharedTime::create());
+}
+
+void ClockSimulator::followExternalControl(const char *path)
+{
+    auto *shared = SharedTime::open(path);
+    std::lock_guard<Mutex> registry_lock(shared_simulators_mutex);
+    std::lock_guard<Mutex> lock(mutex_);
+    following_ = true;
+    addSharedLocked(shared);
+    intercepting_.store(true, std::memory_order_release);
+    intercepting.fetch_add(1, std::memory_order_relaxed);
+    startDriverLocked();
+}
+
+void ClockSimulator::addSharedLocked(SharedTime *shared)
+{
+    static std::once_flag fork_handlers;
+    std::call_once(fork_handlers, [] { pthread_atfork(forkPrepare, forkParent, forkChild); });
+    shared_ = shared;
+    publishTime();
+    published_.store(&shared_->state, std::memory_order_release);
+    shared_simulators.push_back(this);
+}
+
+void ClockSimulator::forkPrepare()
+{
+    // Keeps every shared simulator consistent while the address space is copied.
+    shared_simulators_mutex.lock();
+    for (auto *simulator : shared_simulators)
+    {
+        simulator->mutex_.lock();
+    }
+}
+
+void ClockSimulator::forkParent()
+{
+    for (auto *simulator : shared_simulators)
+    {
+        simulator->mutex_.unlock();
+    }
+    shared_simulators_mutex.unlock();
+}
+
+void ClockSimulator::forkChild()
+{
+    for (auto *simulator : shared_simulators)
+    {
+        simulator->mutex_.unlock();
+        simulator->followParentAfterFork();
+    }
+    shared_simulators_mutex.unlock();
+}
+
+void ClockSimulator::followParentAfterFork()
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    // Only the forking thread exists in the child, and POSIX timers are not inherited by fork().
+    flowing_ = false;
+    following_ = true;
+    waiters_ = {};
+    registered_threads_.clear();
+    if (current_thread.registrations)
+    {
+        registered_threads_.push_back(&current_thread);
+    }
+    current_thread.blocked = false;
+    current_thread.blocked_on_fds.clear();
+    blocked_threads_ = 0;
+    spawning_threads_ = 0;
+    running_callbacks_ = 0;
+    begun_waiters_ = nullptr;
+    settling_ = 0;
+    unsettled_threads_ = 0;
+    current_thread.unsettled_in = nullptr;
+    auto_advance_ = false;
+    // The child cannot schedule without the other threads, and must not touch their bookkeeping.
+    if (scheduling_)
+    {
+        scheduling_.store(false, std::memory_order_relaxed);
+        scheduling.fetch_sub(1, std::memory_order_relaxed);
+    }
+    running_thread_ = nullptr;
+    ready_threads_.clear();
+    parked_threads_.clear();
+    current_thread.ready = current_thread.parked = false;
+    pending_notifications_.clear();
+    has_pending_notifications_.store(false, std::memory_order_relaxed);
+    posix_timers_.clear();
+    posix_timer_queue_ = {};
+    real_itimer_ = nullptr;
+    // The parent keeps expiring the armed timerfds; the child shares the eventfds behind them.
+    timerfd_queue_ = {};
+    try
+    {
+        startDriverLocked();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "fakeclock error: " << e.what() << ", the child process will not follow time" << std::endl;
+        following_ = false;
+    }
+}
+
+std::optional<ClockSimulator::TimePoint> ClockSimulator::nextEventTime() const
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return nextEventTimeLocked();
+}
+
+std::optional<ClockSimulator::TimePoint> ClockSimulator::nextEventTimeLocked() const
+{
+    std::optional<TimePoint> result;
+    for (auto deadline :
+         {waiters_.nextDeadline(), timerfd_queue_.nextDeadline(), posix_timer_queue_.nextDeadline()})
+    {
+        if (deadline && (!result || *deadline < *result))
+        {
+            result = deadline;
+        }
+    }
+    return result;
+}
+
+bool ClockSimulator::advanceToNextEvent(TimePoint limit)
+{
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        checkNotFollowerLocked();
+        syncFlowingTimeLocked();
+        auto next = nextEventTimeLocked();
+        if (!next || *next > limit)
+        {
+            return false;
+        }
+        to_wake = advanceLocked(std::max(*next - fake_time_, Duration::zero()));
+    }
+    wakeWaiters(to_wake);
+    return true;
+}
+
+void ClockSimulator::waitUntil(TimePoint tp)
+{
+    Waiter waiter;
+    Waiter *to_wake = nullptr;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (!isIntercepting())
+        {
+            std::cerr << "fakeclock error: MasterOfTime destroyed during some wait operation" << std::endl;
+            return;
+        }
+        syncFlowingTimeLocked();
+        if (fake_time_ >= tp)
+        {
+            return;
+        }
+        settleThreadLocked();
+        waiters_.schedule(&waiter, tp);
+        pokeDriverLocked(tp);
+        if (current_thread.registrations)
+        {
+            waiter.thread = &current_thread;
+            markBlocked(current_thread, true);
+            endTurnLocked(true);
+            to_wake = autoAdvanceLocked();
+        }
+    }
+    wakeWaiters(to_wake);
+    waiter.wake_event.wait();
+    if (!isIntercepting())
+    {
+        std::cerr << "fakeclock error: MasterOfTime destroyed during some wait operation" << std::endl;
+    }
+    if (waiter.settle_epoch || scheduling_.load(std::memory_order_relaxed))
+    {
+        std::unique_lock<Mutex> lock(mutex_);
+        if (waiter.settle_epoch)
+        {
+            unsettleThreadLocked(waiter.settle_epoch);
+        }
+        awaitTurnLocked(lock);
+    }
+}
+
+size_t ClockSimulator::waiterCount() const
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return waiters_.size();
+}
+
+Waiter *ClockSimulator::popExpiredWaiters(TimePoint t)
+{
+    Waiter *to_wake = nullptr;
+    Waiter **tail = &to_wake;
+    waiters_.popExpired(t, [&](Waiter *waiter) {
+        advance_woken_threads_++;
+        if (settling_)
+        {
+            waiter->settle_epoch = settle_epoch_;
+            unsettled_threads_++;
+        }
+        if (waiter->thread)
+        {
+            markBlocked(*waiter->thread, false);
+            if (scheduling_)
+            {
+                // Ready right away, so that the next thread is picked among all threads woken by the step.
+                waiter->thread->parked ? unparkLocked(*waiter->thread) : makeReadyLocked(*waiter->thread);
+            }
+        }
+        if (waiter->wakes_itself)
+        {
+            // Woken under the lock: once waitEnd() has returned, the thread may start another wait with the same
+            // waiter or destroy the condition variable, so neither must be touched after unlocking.
+            waiter->expired = true;
+            if (waiter->wake_fd >= 0)
+            {
+                uint64_t one = 1;
+                auto _ = ::write(waiter->wake_fd, &one, sizeof(one));
+                (void)_;
+            }
+            if (waiter->wake_cond)
+            {
+                real.pthread_cond_broadcast(waiter->wake_cond); // the override would take the lock
+            }
+            if (waiter->wake_futex)
+            {
+                real.syscall(SYS_futex, long(waiter->wake_futex),
+                             waiter->wake_futex_private ? FUTEX_WAKE_BITSET_PRIVATE : FUTEX_WAKE_BITSET, INT_MAX, 0, 0,
+                             waiter->wake_futex_bitset);
+            }
+            if (waiter->wake_tid)
+            {
+                real.syscall(SYS_tgkill, getpid(), waiter->wake_tid, waiter->wake_signal, 0, 0, 0);
+            }
+            return;
+        }
+        *tail = waiter;
+        tail = &waiter->next_to_wake;
+    });
+    return to_wake;
+}
+
+void ClockSimulator::wakeWaiters(Waiter *waiters)
+{
+    while (waiters)
+    {
+        Waiter *next = waiters->next_to_wake; // the waiter may be gone once it is signaled
+        waiters->wake_event.signal();
+        waiters = next;
+    }
+    if (has_pending_notifications_.load(std::memory_order_acquire))
+    {
+        deliverTimerNotifications();
+    }
+}
+
+void ClockSimulator::deliverTimerNotifications()
+{
+    std::vector<TimerNotification> notifications;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        notifications.swap(pending_notifications_);
+        has_pending_notifications_.store(false, std::memory_order_relaxed);
+    }
+    // Outside the lock: signal handlers and callbacks may use the simulator themselves.
+    for (const auto &notification : notifications)
+    {
+        const auto &sevp = notification.sevp;
+        if (sevp.sigev_notify == SIGEV_THREAD)
+        {
+            auto function = sevp.sigev_notify_function;
+            auto value = sevp.sigev_value;
+            CallbackPool::getInstance().submit(
+                [this, function, value] {
+                    current_timeline = this == &getDefault() ? nullptr : this; // the timeline of the timer
+                    function(value);
+                    current_timeline = nullptr;
+                    callbackDone();
+                },
+                notification.thread_attributes);
+            continue;
+        }
+        siginfo_t info = {};
+        info.si_signo = sevp.sigev_signo;
+        if (notification.itimer)
+        {
+            info.si_code = SI_KERNEL;
+        }
+        else
+        {
+            info.si_code = SI_TIMER;
+            info.si_timerid = static_cast<int>(reinterpret_cast<uintptr_t>(notification.timerid));
+            info.si_overrun = notification.overrun;
+            info.si_value = sevp.sigev_value;
+        }
+        if (sevp.sigev_notify == SIGEV_THREAD_ID)
+        {
+            syscall(SYS_rt_tgsigqueueinfo, getpid(), sevp.sigev_notify_thread_id, sevp.sigev_signo, &info);
+        }
+        else
+        {
+            syscall(SYS_rt_sigqueueinfo, getpid(), sevp.sigev_signo, &info);
+        }
+    }
+}
+
+void ClockSimulator::callbackDone()
+{
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (--running_callbacks_ == 0 && settling_)
+        {
+            settle_generation_.fetch_add(1, std::memory_order_relaxed);
+            futex_wake(settle_generation_);
+        }
+        to_wake = autoAdvanceLocked();
+    }
+    wakeWaiters(to_wake);
+}
+
+void ClockSimulator::setAutoAdvance(bool enabled)
+{
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (enabled)
+        {
+            checkNotFollowerLocked(); // the parent cannot see whether threads of the child are blocked
+        }
+        auto_advance_ = enabled;
+        to_wake = autoAdvanceLocked();
+    }
+    wakeWaiters(to_wake);
+}
+
+void ClockSimulator::registerThread()
+{
+    std::unique_lock<Mutex> lock(mutex_);
+    if (current_thread.registrations++ == 0)
+    {
+        current_thread.schedule_id = next_schedule_id_++;
+        registered_threads_.push_back(&current_thread);
+        awaitTurnLocked(lock);
+    }
+}
+
+void ClockSimulator::unregisterThread()
+{
+    Waiter *to_wake = nullptr;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        assert(current_thread.registrations > 0);
+        if (--current_thread.registrations == 0)
+        {
+            std::erase(registered_threads_, &current_thread);
+            if (current_thread.ready)
+            {
+                current_thread.ready = false;
+                std::erase(ready_threads_, &current_thread);
+            }
+            endTurnLocked(true);
+            // the remaining threads may all be blocked now
+            to_wake = autoAdvanceLocked();
+        }
+    }
+    wakeWaiters(to_wake);
+}
+
+bool ClockSimulator::isThreadRegistered() const
+{
+    return current_thread.registrations > 0;
+}
+
+uint64_t ClockSimulator::threadSpawning()
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    spawning_threads_++;
+    return next_schedule_id_++; // in creation order, since the creating thread has its turn
+}
+
+void ClockSimulator::registerSpawnedThread(uint64_t schedule_id)
+{
+    std::unique_lock<Mutex> lock(mutex_);
+    spawning_threads_--;
+    if (current_thread.registrations++ == 0)
+    {
+        current_thread.schedule_id = schedule_id;
+        registered_threads_.push_back(&current_thread);
+    }
+    awaitTurnLocked(lock);
+}
+
+void ClockSimulator::spawnFailed()
+{
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        spawning_threads_--;
+        scheduleLocked();
+        to_wake = autoAdvanceLocked();
+    }
+    wakeWaiters(to_wake);
+}
+
+bool ClockSimulator::waitBegin(Waiter &waiter, std::optional<TimePoint> deadline, const pollfd *fds, size_t nfds)
+{
+    Waiter *to_wake = nullptr;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        syncFlowingTimeLocked();
+        if (deadline && (*deadline <= fake_time_ || !isIntercepting()))
+        {
+            return false;
+        }
+        settleThreadLocked();
+        waiter.wakes_itself = true;
+        waiter.expired = false;
+        waiter.settle_epoch = 0;
+        waiter.fds = fds;
+        waiter.nfds = nfds;
+        waiter.prev_begun = nullptr;
+        waiter.next_begun = begun_waiters_;
+        if (begun_waiters_)
+        {
+            begun_waiters_->prev_begun = &waiter;
+        }
+        begun_waiters_ = &waiter;
+        if (deadline)
+        {
+            waiters_.schedule(&waiter, *deadline);
+            pokeDriverLocked(*deadline);
+        }
+        if (current_thread.registrations)
+        {
+            waiter.thread = &current_thread;
+            current_thread.blocked_on_fds.assign(fds, fds + nfds);
+            current_thread.fds_polled_progress = SimulatedThread::NOT_POLLED;
+            markBlocked(current_thread, true);
+            endTurnLocked(true);
+            to_wake = autoAdvanceLocked();
+        }
+    }
+    wakeWaiters(to_wake);
+    return true;
+}
+
+bool ClockSimulator::waitEnd(Waiter &waiter)
+{
+    std::unique_lock<Mutex> lock(mutex_);
+    waiters_.cancel(&waiter);
+    (waiter.prev_begun ? waiter.prev_begun->next_begun : begun_waiters_) = waiter.next_begun;
+    if (waiter.next_begun)
+    {
+        waiter.next_begun->prev_begun = waiter.prev_begun;
+    }
+    waiter.fds = nullptr;
+    waiter.nfds = 0;
+    unsettleThreadLocked(std::exchange(waiter.settle_epoch, 0));
+    if (waiter.thread)
+    {
+        waiter.thread->blocked_on_fds.clear();
+        markBlocked(*waiter.thread, false);
+        waiter.thread = nullptr;
+    }
+    awaitTurnLocked(lock);
+    return waiter.expired;
+}
+
+void ClockSimulator::threadLeft()
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    settleThreadLocked();
+}
+
+void ClockSimulator::unsettleThreadLocked(uint64_t counted_epoch)
+{
+    if (counted_epoch != settle_epoch_)
+    {
+        if (!settling_)
+        {
+            return;
+        }
+        unsettled_threads_++; // it returned from a wait on its own, but may be reacting to the step
+    }
+    current_thread.unsettled_in = this;
+    current_thread.settle_epoch = settle_epoch_;
+    settle_at_exit.armed = true;
+}
+
+void ClockSimulator::settleThreadLocked()
+{
+    if (current_thread.unsettled_in != this)
+    {
+        return;
+    }
+    current_thread.unsettled_in = nullptr;
+    if (current_thread.settle_epoch == settle_epoch_ && --unsettled_threads_ == 0)
+    {
+        settle_generation_.fetch_add(1, std::memory_order_relaxed);
+        futex_wake(settle_generation_);
+    }
+}
+
+void ClockSimulator::markReturningWaitersLocked()
+{
+    // One poll() for the fds of all waits that may still be blocked. It polls copies, as the real waits write to the
+    // revents of the originals.
+    polled_fds_.clear();
+    for (auto *waiter = begun_waiters_; waiter; waiter = waiter->next_begun)
+    {
+        if (waiter->settle_epoch != settle_epoch_ && !waiter->expired)
+        {
+            for (size_t i = 0; i < waiter->nfds; i++)
+            {
+                polled_fds_.push_back({waiter->fds[i].fd, waiter->fds[i].events, 0});
+            }
+        }
+    }
+    if (!polled_fds_.empty() && real.poll(polled_fds_.data(), polled_fds_.size(), 0) <= 0)
+    {
+        for (auto &fd : polled_fds_)
+        {
+            fd.revents = 0; // none ready, or the poll failed
+        }
+    }
+    const pollfd *polled = polled_fds_.data();
+    for (auto *waiter = begun_waiters_; waiter; waiter = waiter->next_begun)
+    {
+        if (waiter->settle_epoch == settle_epoch_)
+        {
+            continue;
+        }
+        bool returning = waiter->expired; // set under the lock, so the same as above
+        if (!returning)
+        {
+            returning = std::any_of(polled, polled + waiter->nfds, [](const pollfd &fd) { return fd.revents; });
+            polled += waiter->nfds;
+        }
+        if (returning)
+        {
+            waiter->settle_epoch = settle_epoch_;
+            unsettled_threads_++;
+        }
+    }
+}
+
+void ClockSimulator::markBlocked(SimulatedThread &thread, bool blocked)
+{
+    if (thread.blocked != blocked && thread.registrations)
+    {
+        thread.blocked = blocked;
+        blocked ? blocked_threads_++ : blocked_threads_--;
+    }
+}
+
+bool ClockSimulator::anyBlockedThreadHasReadyFds() const
+{
+    // A thread woken by fd activity still counts as blocked until it returns from the real wait, so look at its fds.
+    for (auto *thread : registered_threads_)
+    {
+        auto &fds = thread->blocked_on_fds; // a private copy, so overwriting revents is harmless
+        if (!fds.empty() && real.poll(fds.data(), fds.size(), 0) != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Waiter *ClockSimulator::autoAdvanceLocked()
+{
+    Waiter *to_wake = nullptr;
+    for (int step = 0; step < MAX_IDLE_AUTO_ADVANCE_STEPS; step++)
+    {
+        if (!auto_advance_ || !isIntercepting() || registered_threads_.empty() || spawning_threads_ > 0 ||
+            running_callbacks_ > 0 || blocked_threads_ < registered_threads_.size() || anyBlockedThreadHasReadyFds())
+        {
+            return to_wake;
+        }
+        auto next = nextEventTimeLocked();
+        if (!next)
+        {
+            return to_wake; // everybody waits for something other than time
+        }
+        Waiter *woken = advanceLocked(std::max(*next - fake_time_, Duration::zero()));
+        if (woken)
+        {
+            // prepend the woken waiters; they are runnable now, so the loop ends on the next check
+            Waiter *last = woken;
+            while (last->next_to_wake)
+            {
+                last = last->next_to_wake;
+            }
+            last->next_to_wake = to_wake;
+            to_wake = woken;
+        }
+    }
+    std::cerr << "fakeclock error: automatic advance made " << MAX_IDLE_AUTO_ADVANCE_STEPS
+              << " steps without waking any thread" << std::endl;
+    return to_wake;
+}
+
+void ClockSimulator::scheduleDeterministically(uint64_t seed)
 {
-    static ClockSimulator instance;
-    return instance;
+    std::lock_guard<Mutex> lock(mutex_);
+    checkNotFollowerLocked(); // the threads of the parent cannot be scheduled from here
+    schedule_rng_.seed(seed);
+    progress_ = 0;
+    for (auto *thread : registered_threads_)
+    {
+        thread->fds_polled_progress = SimulatedThread::NOT_POLLED;
+    }
+    if (!scheduling_)
+    {
+        scheduling_.store(true, std::memory_order_relaxed);
+        scheduling.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Registered threads that already run join in at their next intercepted call. The calling thread keeps running.
+    if (!running_thread_ && current_thread.registrations)
+    {
+        running_thread_ = &current_thread;
+        turn_start_ = TimeState::realNow();
+    }
 }
 
-void ClockSimulator::addClock()
+bool ClockSimulator::takesTurns() const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (clock_count_++ == 0)
+    return scheduling_.load(std::memory_order_relaxed) && current_thread.registrations > 0;
+}
+
+void ClockSimulator::yieldTurnSlow()
+{
+    std::unique_lock<Mutex> lock(mutex_);
+    if (!scheduling_ || !current_thread.registrations)
     {
-        intercept();
+        return;
     }
+    makeReadyLocked(current_thread);
+    endTurnLocked(true);
+    awaitTurnLocked(lock);
 }
 
-void ClockSimulator::removeClock()
+ClockSimulator::Park ClockSimulator::park(std::optional<TimePoint> deadline, bool again, const pthread_cond_t *cond,
+                                          pthread_mutex_t *mutex)
+{
+    auto &thread = current_thread;
+    Waiter waiter;
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        if (!scheduling_ || !thread.registrations)
+        {
+            return Park::Unscheduled;
+        }
+        syncFlowingTimeLocked();
+        if (mutex)
+        {
+            pthread_mutex_unlock(mutex); // nobody can signal before the thread is on the list, as that takes the lock
+        }
+        if (deadline && *deadline <= fake_time_)
+        {
+            return Park::Expired;
+        }
+        settleThreadLocked();
+        waiter.wakes_itself = true;
+        waiter.thread = &thread;
+        if (deadline)
+        {
+            waiters_.schedule(&waiter, *deadline);
+            pokeDriverLocked(*deadline);
+        }
+        if (running_thread_ == &thread)
+        {
+            running_thread_ = nullptr;
+            if (!again)
+            {
+                progress_++;
+            }
+        }
+        thread.parked = true;
+        thread.parked_on = cond;
+        thread.parked_progress = progress_;
+        parked_threads_.push_back(&thread);
+        markBlocked(thread, true);
+        scheduleLocked();
+        to_wake = autoAdvanceLocked();
+    }
+    wakeWaiters(to_wake);
+    std::unique_lock<Mutex> lock(mutex_);
+    while (scheduling_ && running_thread_ != &thread)
+    {
+        bool retries = thread.parked && !thread.parked_on;
+        uint32_t turn = thread.turn.load(std::memory_order_acquire);
+        lock.unlock();
+        futex_wait_until(thread.turn, turn,
+                         TimeState::realNow() + (retries ? Duration(IDLE_RETRY_INTERVAL) : STALLED_TURN_TIMEOUT));
+        lock.lock();
+        scheduleLocked();
+        if (!running_thread_ && spawning_threads_ == 0 && thread.parked && !thread.parked_on)
+        {
+            // Nothing else can run, so the wait may be for a thread that does not take turns.
+            std::erase(parked_threads_, &thread);
+            thread.parked = false;
+            markBlocked(thread, false);
+            running_thread_ = &thread;
+            turn_start_ = TimeState::realNow();
+        }
+        checkStalledTurnLocked();
+    }
+    waiters_.cancel(&waiter);
+    if (thread.parked)
+    {
+        std::erase(parked_threads_, &thread);
+        thread.parked = false;
+    }
+    markBlocked(thread, false);
+    unsettleThreadLocked(std::exchange(waiter.settle_epoch, 0));
+    return waiter.expired ? Park::Expired : Park::Retry;
+}
+
+void ClockSimulator::condSignaled(const pthread_cond_t *cond, bool all)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    if (!scheduling_)
+    {
+        return;
+    }
+    // The threads that parked first are woken first, so that signals do not depend on the real scheduler.
+    for (size_t i = 0; i < parked_threads_.size();)
+    {
+        auto *thread = parked_threads_[i];
+        if (thread->parked_on != cond)
+        {
+            i++;
+            continue;
+        }
+        unparkLocked(*thread);
+        if (!all)
+        {
+            break;
+        }
+    }
+    scheduleLocked();
+}
+
+void ClockSimulator::makeReadyLocked(SimulatedThread &thread)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (--clock_count_ == 0)
+    if (thread.ready)
     {
-        restore();
-        cv_.notify_all(); // Release all pending waits
+        return;
     }
+    thread.ready = true;
+    markBlocked(thread, false);
+    auto position = std::lower_bound(ready_threads_.begin(), ready_threads_.end(), &thread,
+                                     [](auto *a, auto *b) { return a->schedule_id < b->schedule_id; });
+    ready_threads_.insert(position, &thread);
 }
 
-void ClockSimulator::handleExpiringFds()
+void ClockSimulator::unparkLocked(SimulatedThread &thread)
+{
+    std::erase(parked_threads_, &thread);
+    thread.parked = false;
+    makeReadyLocked(thread);
+}
+
+void ClockSimulator::endTurnLocked(bool progress)
+{
+    if (running_thread_ != &current_thread)
+    {
+        return;
+    }
+    running_thread_ = nullptr;
+    if (progress)
+    {
+        progress_++;
+    }
+    scheduleLocked();
+}
+
+void ClockSimulator::scheduleLocked()
 {
-    cleanupTimerfds();
-    for (auto &[_, timerfd] : timerfds_)
+    if (!scheduling_ || running_thread_ || spawning_threads_ > 0)
+    {
+        return; // new threads wait for their turn before they run, so they will be ready soon
+    }
+    markThreadsWithReadyFdsLocked();
+    for (size_t i = 0; i < parked_threads_.size();)
+    {
+        auto *thread = parked_threads_[i];
+        if (!thread->parked_on && thread->parked_progress != progress_)
+        {
+            unparkLocked(*thread);
+            continue;
+        }
+        i++;
+    }
+    if (ready_threads_.empty())
     {
-        timerfd.advance_to(fake_time_);
+        return;
     }
+    // A single candidate takes no draw, so that turns nobody competes for do not shift the sequence.
+    size_t index = ready_threads_.size() > 1 ? schedule_rng_() % ready_threads_.size() : 0;
+    running_thread_ = ready_threads_[index];
+    ready_threads_.erase(ready_threads_.begin() + index);
+    running_thread_->ready = false;
+    turn_start_ = TimeState::realNow();
+    running_thread_->turn.fetch_add(1, std::memory_order_release);
+    futex_wake(running_thread_->turn);
 }
 
-void ClockSimulator::cleanupTimerfds()
+void ClockSimulator::markThreadsWithReadyFdsLocked()
 {
-    for (auto it = timerfds_.begin(); it != timerfds_.end();)
+    // Threads whose fds are ready become ready before their fd wait returns, so the choice does not depend on when it
+    // does. Only time advances and turns change what registered threads wait for, so fds found not ready at the same
+    // progress are not polled again. One poll() covers the rest; like in anyBlockedThreadHasReadyFds(), the fds are a
+    // private copy.
+    polled_fds_.clear();
+    polled_threads_.clear();
+    for (auto *thread : registered_threads_)
+    {
+        auto &fds = thread->blocked_on_fds;
+        if (!thread->ready && !fds.empty() && thread->fds_polled_progress != progress_)
+        {
+            polled_fds_.insert(polled_fds_.end(), fds.begin(), fds.end());
+            polled_threads_.push_back(thread);
+        }
+    }
+    if (polled_fds_.empty())
+    {
+        return;
+    }
+    bool any_ready = real.poll(polled_fds_.data(), polled_fds_.size(), 0) > 0;
+    auto fd = polled_fds_.begin();
+    for (auto *thread : polled_threads_)
     {
-        if (it->second.client_closed())
+        auto end = fd + ptrdiff_t(thread->blocked_on_fds.size());
+        if (any_ready && std::any_of(fd, end, [](const pollfd &polled) { return polled.revents != 0; }))
         {
-            it = timerfds_.erase(it);
+            makeReadyLocked(*thread);
         }
         else
         {
-            ++it;
+            thread->fds_polled_progress = progress_;
         }
+        fd = end;
     }
 }
 
-void ClockSimulator::advance(std::chrono::nanoseconds duration)
+void ClockSimulator::awaitTurnLocked(std::unique_lock<Mutex> &lock)
+{
+    auto &thread = current_thread;
+    if (!scheduling_ || !thread.registrations || running_thread_ == &thread)
+    {
+        return;
+    }
+    makeReadyLocked(thread);
+    scheduleLocked();
+    while (scheduling_ && running_thread_ != &thread)
+    {
+        uint32_t turn = thread.turn.load(std::memory_order_acquire);
+        lock.unlock();
+        futex_wait_until(thread.turn, turn, TimeState::realNow() + STALLED_TURN_TIMEOUT);
+        lock.lock();
+        checkStalledTurnLocked();
+    }
+}
+
+void ClockSimulator::checkStalledTurnLocked()
 {
+    if (running_thread_ && TimeState::realNow() - turn_start_ >= STALLED_TURN_TIMEOUT)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        fake_time_ += duration;
-        handleExpiringFds();
+        std::cerr << "fakeclock error: a registered thread kept its turn for "
+                  << std::chrono::duration_cast<std::chrono::seconds>(STALLED_TURN_TIMEOUT).count()
+                  << " s without an intercepted call, so it probably blocks elsewhere; the other threads run anyway "
+                     "and the schedule can no longer be reproduced"
+                  << std::endl;
+        running_thread_ = nullptr;
+        progress_++;
     }
-    cv_.notify_all();
+    scheduleLocked();
 }
 
-void ClockSimulator::waitUntil(TimePoint tp)
+void ClockSimulator::explore(uint64_t seed)
 {
-    std::unique_lock<std::mutex> lock(mutex_);
-    cv_.wait(lock, [&] {
-        if (!isIntercepting())
+    scheduleDeterministically(seed);
+    std::lock_guard<Mutex> lock(mutex_);
+    // A stream of its own, so that the scheduler draws the same choices as with scheduleDeterministically(seed).
+    explore_rng_.seed(seed ^ 0x9e3779b97f4a7c15);
+    waiters_.shuffleTies(explore_rng_());
+    timerfd_queue_.shuffleTies(explore_rng_());
+    posix_timer_queue_.shuffleTies(explore_rng_());
+    exploring_.store(true, std::memory_order_relaxed);
+}
+
+void ClockSimulator::advanceInRandomSteps(Duration duration)
+{
+    TimePoint target;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        checkNotFollowerLocked();
+        syncFlowingTimeLocked();
+        target = fake_time_ + duration;
+    }
+    for (int step = 1; step < MAX_EXPLORE_STEPS; step++)
+    {
+        Duration length;
         {
-            std::cerr << "fakeclock error: MasterOfTime destroyed during some wait operation" << std::endl;
-            return true;
+            std::lock_guard<Mutex> lock(mutex_);
+            auto next = nextEventTimeLocked();
+            if (!next || *next >= target)
+            {
+                break;
+            }
+            // Half of the steps stop right at the next event, so that close events get apart.
+            auto end = *next;
+            if (explore_rng_() % 2)
+            {
+                end += Duration(explore_rng_() % (target - *next).count());
+            }
+            length = std::max(end - fake_time_, Duration::zero());
         }
-        return fake_time_ >= tp;
-    });
+        if (!advanceAndSettle(length, EXPLORE_SETTLE_TIMEOUT))
+        {
+            throw std::runtime_error("fakeclock: threads woken by a step of advance() did not settle within " +
+                                     std::to_string(EXPLORE_SETTLE_TIMEOUT.count()) + " s");
+        }
+    }
+    Waiter *to_wake;
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        syncFlowingTimeLocked();
+        to_wake = advanceLocked(std::max(target - fake_time_, Duration::zero()));
+    }
+    wakeWaiters(to_wake);
+}
+
+Waiter *ClockSimulator::shuffleLocked(Waiter *waiters)
+{
+    std::vector<Waiter *> shuffled;
+    for (; waiters; waiters = waiters->next_to_wake)
+    {
+        shuffled.push_back(waiters);
+    }
+    std::shuffle(shuffled.begin(), shuffled.end(), explore_rng_);
+    Waiter *head = nullptr;
+    for (auto it = shuffled.rbegin(); it != shuffled.rend(); ++it)
+    {
+        (*it)->next_to_wake = head;
+        head = *it;
+    }
+    return head;
+}
+
+void ClockSimulator::stopSchedulingLocked()
+{
+    if (!scheduling_)
+    {
+        return;
+    }
+    scheduling_.store(false, std::memory_order_relaxed);
+    scheduling.fetch_sub(1, std::memory_order_relaxed);
+    running_thread_ = nullptr;
+    // The waiting threads go on without turns.
+    for (auto *threads : {&ready_threads_, &parked_threads_})
+    {
+        for (auto *thread : *threads)
+        {
+            thread->ready = thread->parked = false;
+            thread->turn.fetch_add(1, std::memory_order_release);
+            futex_wake(thread->turn);
+        }
+        threads->clear();
+    }
 }
 
 void ClockSimulator::setTime(TimePoint tp, ClockId clk_id)
 {
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<Mutex> lock(mutex_);
+        checkNotFollowerLocked();
+        syncFlowingTimeLocked();
         setOffset(clk_id, tp - fake_time_);
-        handleExpiringFds();
+        publishTime();
+        if (clk_id == CLOCK_REALTIME)
+        {
+            for (auto &[_, timerfd] : timerfds_)
+            {
+                timerfd.clock_was_set();
+            }
+        }
+        handleExpiringTimers();
     }
-    cv_.notify_all();
+    // Waiters are keyed by fake time, which does not change here, but timers may have expired.
+    wakeWaiters(nullptr);
 }
 
 ClockSimulator::TimePoint ClockSimulator::now() const
 {
-    return fake_time_;
+    return published_.load(std::memory_order_acquire)->loadFakeTime();
 }
 
 ClockSimulator::TimePoint ClockSimulator::getTime(ClockId clk_id) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return fake_time_ + getOffset(clk_id);
-}
-
-bool ClockSimulator::isIntercepting() const
-{
-    return intercepting_;
+    return published_.load(std::memory_order_acquire)->loadTime(clk_id);
 }
 
 int ClockSimulator::timerfdCreate(ClockId clock_id, int flags)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto &owners = timerfd_owners();
+    std::lock_guard<Mutex> owners_lock(owners.mutex);
+    std::lock_guard<Mutex> lock(mutex_);
     TimerFd timer_fd;
 
     bool success = timer_fd.open(clock_id, flags);
@@ -145,43 +1608,193 @@ int ClockSimulator::timerfdCreate(ClockId clock_id, int flags)
     }
     int client_fd = timer_fd.getClientFd();
 
+    if (timerfds_.contains(client_fd) || timerfd_duplicates_.contains(client_fd))
     {
-        /// if there is already such client_fd it must have been closed already
-        auto it = timerfds_.find(client_fd);
-        if (it != timerfds_.end())
-        {
-            assert(it->second.client_closed());
-            timerfds_.erase(it);
-        }
+        // the fd number got reused, so the old timerfd was closed behind our back (e.g. by a raw syscall)
+        std::cerr << "fakeclock error: TimerFd " << client_fd << " closed without close()" << std::endl;
+        eraseTimerfdNumber(client_fd);
     }
 
     timerfds_.emplace(client_fd, std::move(timer_fd));
+    timerfd_numbers_.insert(client_fd);
+    if (owners.by_fd.insert_or_assign(client_fd, this).second)
+    {
+        owners.fds.insert(client_fd);
+    }
     return client_fd;
 }
 
+int ClockSimulator::resolveTimerfd(int fd) const
+{
+    auto it = timerfd_duplicates_.find(fd);
+    return it != timerfd_duplicates_.end() ? it->second : fd;
+}
+
 TimerFd &ClockSimulator::getTimerfd(int fd)
 {
-    return timerfds_.at(fd);
+    return timerfds_.at(resolveTimerfd(fd));
+}
+
+void ClockSimulator::eraseTimerfdNumber(int fd)
+{
+    auto &owners = timerfd_owners();
+    auto owner = owners.by_fd.find(fd);
+    if (owner != owners.by_fd.end() && owner->second == this)
+    {
+        owners.by_fd.erase(owner);
+        owners.fds.erase(fd);
+    }
+    if (timerfd_duplicates_.erase(fd))
+    {
+        timerfd_numbers_.erase(fd);
+        return;
+    }
+    auto it = timerfds_.find(fd);
+    if (it == timerfds_.end())
+    {
+        return;
+    }
+    timerfd_numbers_.erase(fd);
+    timerfd_queue_.cancel(fd);
+    // If the client still holds a duplicate, the timer lives on and expirations go to that duplicate.
+    auto dup_it = std::find_if(timerfd_duplicates_.begin(), timerfd_duplicates_.end(),
+                               [fd](const auto &entry) { return entry.second == fd; });
+    if (dup_it == timerfd_duplicates_.end())
+    {
+        timerfds_.erase(it);
+        return;
+    }
+    int new_fd = dup_it->first;
+    TimerFd timerfd = std::move(it->second);
+    timerfds_.erase(it);
+    timerfd.set_client_fd(new_fd);
+    for (auto &[_, target] : timerfd_duplicates_)
+    {
+        if (target == fd)
+        {
+            target = new_fd;
+        }
+    }
+    timerfd_duplicates_.erase(new_fd);
+    scheduleTimerfd(new_fd, timerfd);
+    timerfds_.emplace(new_fd, std::move(timerfd));
+}
+
+void ClockSimulator::fdClosed(int fd)
+{
+    auto &owners = timerfd_owners();
+    if (!owners.fds.mayContain(fd))
+    {
+        return;
+    }
+    std::lock_guard<Mutex> owners_lock(owners.mutex);
+    auto it = owners.by_fd.find(fd);
+    if (it == owners.by_fd.end())
+    {
+        return;
+    }
+    auto *owner = it->second;
+    std::lock_guard<Mutex> lock(owner->mutex_);
+    owner->eraseTimerfdNumber(fd);
+}
+
+void ClockSimulator::fdDuplicated(int old_fd, int new_fd)
+{
+    auto &owners = timerfd_owners();
+    if (!owners.fds.mayContain(old_fd))
+    {
+        return;
+    }
+    std::lock_guard<Mutex> owners_lock(owners.mutex);
+    auto it = owners.by_fd.find(old_fd);
+    if (it == owners.by_fd.end())
+    {
+        return;
+    }
+    auto *owner = it->second;
+    std::lock_guard<Mutex> lock(owner->mutex_);
+    int client_fd = owner->resolveTimerfd(old_fd);
+    if (owner->timerfds_.contains(client_fd))
+    {
+        owner->timerfd_duplicates_[new_fd] = client_fd;
+        owner->timerfd_numbers_.insert(new_fd);
+        if (owners.by_fd.insert_or_assign(new_fd, owner).second)
+        {
+            owners.fds.insert(new_fd);
+        }
+    }
+}
+
+void ClockSimulator::fdRangeClosed(unsigned int first, unsigned int last)
+{
+    auto &owners = timerfd_owners();
+    std::lock_guard<Mutex> owners_lock(owners.mutex);
+    std::vector<std::pair<ClockSimulator *, int>> closed;
+    for (auto &[fd, owner] : owners.by_fd)
+    {
+        if (unsigned(fd) >= first && unsigned(fd) <= last)
+        {
+            closed.emplace_back(owner, fd);
+        }
+    }
+    for (auto [owner, fd] : closed)
+    {
+        std::lock_guard<Mutex> lock(owner->mutex_);
+        owner->eraseTimerfdNumber(fd);
+    }
 }
 
-void ClockSimulator::timerfdSetTime(int fd, TimePoint tp, Duration interval)
+void ClockSimulator::timerfdSetTime(int fd, TimePoint tp, Duration interval, bool cancel_on_set)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto &timer_fd = timerfds_.at(fd);
+    std::lock_guard<Mutex> lock(mutex_);
+    syncFlowingTimeLocked();
+    auto &timer_fd = getTimerfd(fd);
+    if (timer_fd.take_canceled())
+    {
+        drainTimerfd(timer_fd); // the cancelation is only reported to reads before the timer is set again
+    }
     timer_fd.set_time(tp, interval);
+    timer_fd.set_cancel_on_set(cancel_on_set);
+    scheduleTimerfd(timer_fd.getClientFd(), timer_fd);
+    pokeDriverLocked(timer_fd.get_expiration_time());
 
     handleExpiringFds();
 }
 
+bool ClockSimulator::timerfdTakeCanceled(int fd)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    auto it = timerfds_.find(resolveTimerfd(fd));
+    if (it == timerfds_.end() || !it->second.take_canceled())
+    {
+        return false;
+    }
+    drainTimerfd(it->second);
+    return true;
+}
+
+void ClockSimulator::drainTimerfd(const TimerFd &timerfd)
+{
+    // Expirations are written under the lock, so the count cannot change between the poll and the read.
+    pollfd pfd = {timerfd.getClientFd(), POLLIN, 0};
+    uint64_t expirations;
+    if (real.poll(&pfd, 1, 0) == 1)
+    {
+        auto _ = real.read(pfd.fd, &expirations, sizeof(expirations));
+        (void)_;
+    }
+}
+
 ClockSimulator::ClockId ClockSimulator::timerfdGetClockId(int fd)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return timerfds_.at(fd).get_clock_id();
+    std::lock_guard<Mutex> lock(mutex_);
+    return getTimerfd(fd).get_clock_id();
 }
 
 void ClockSimulator::timerfdGetTime(int fd, itimerspec *curr_value)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Mutex> lock(mutex_);
+    syncFlowingTimeLocked();
     auto &timerfd = getTimerfd(fd);
 
     auto expiration_time = timerfd.get_expiration_time();
@@ -196,16 +1809,123 @@ void ClockSimulator::timerfdGetTime(int fd, itimerspec *curr_value)
     curr_value->it_interval = to_timespec(timerfd.get_interval());
 }
 
+timer_t ClockSimulator::posixTimerCreate(ClockId clock_id, const struct sigevent *sevp)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return posixTimerCreateLocked(clock_id, sevp);
+}
+
+timer_t ClockSimulator::posixTimerCreateLocked(ClockId clock_id, const struct sigevent *sevp)
+{
+    // Create a new timer ID (using a simple pointer cast to ensure uniqueness across timelines)
+    static std::atomic<uintptr_t> next_timer_id = 1;
+    auto timerid = reinterpret_cast<timer_t>(next_timer_id++);
+
+    PosixTimer timer;
+    timer.clock_id = clock_id;
+    if (sevp)
+    {
+        timer.sevp = *sevp;
+        if (sevp->sigev_notify == SIGEV_THREAD && sevp->sigev_notify_attributes)
+        {
+            timer.thread_attributes = std::make_shared<ThreadAttributes>(*sevp->sigev_notify_attributes);
+        }
+    }
+    else
+    {
+        // Default of timer_create(): SIGALRM carrying the timer ID
+        timer.sevp.sigev_notify = SIGEV_SIGNAL;
+        timer.sevp.sigev_signo = SIGALRM;
+        timer.sevp.sigev_value.sival_int = static_cast<int>(reinterpret_cast<uintptr_t>(timerid));
+    }
+    posix_timers_.emplace(timerid, timer);
+    return timerid;
+}
+
+void ClockSimulator::posixTimerDelete(timer_t timerid)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    if (!posix_timers_.erase(timerid))
+    {
+        throw std::out_of_range("unknown POSIX timer");
+    }
+    posix_timer_queue_.cancel(timerid);
+}
+
+void ClockSimulator::posixTimerSetTime(timer_t timerid, TimePoint tp, Duration interval)
+{
+    {
+        std::lock_guard<Mutex> lock(mutex_);
+        syncFlowingTimeLocked();
+        auto &timer = posix_timers_.at(timerid);
+        timer.expiration_time = tp;
+        timer.interval = interval;
+        if (tp == PosixTimer::DISARM_TIME)
+        {
+            posix_timer_queue_.cancel(timerid);
+        }
+        else
+        {
+            posix_timer_queue_.schedule(timerid, tp);
+            pokeDriverLocked(tp);
+        }
+        handleExpiringPosixTimers(); // an absolute expiration time may lie in the past
+    }
+    wakeWaiters(nullptr);
+}
+
+void ClockSimulator::posixTimerGetTime(timer_t timerid, struct itimerspec *curr_value)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    syncFlowingTimeLocked();
+    auto &timer = posix_timers_.at(timerid);
+    if (timer.expiration_time == PosixTimer::DISARM_TIME)
+    {
+        curr_value->it_value = {0, 0}; // Disarmed (or a one-shot timer that already expired)
+    }
+    else
+    {
+        curr_value->it_value = to_timespec(Duration(timer.expiration_time - fake_time_));
+    }
+    curr_value->it_interval = to_timespec(timer.interval);
+}
+
+ClockSimulator::ClockId ClockSimulator::posixTimerGetClockId(timer_t timerid)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return posix_timers_.at(timerid).clock_id;
+}
+
+int ClockSimulator::posixTimerGetOverrun(timer_t timerid)
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    return posix_timers_.at(timerid).overrun;
+}
+
+timer_t ClockSimulator::realItimer()
+{
+    std::lock_guard<Mutex> lock(mutex_);
+    if (!real_itimer_)
+    {
+        // ITIMER_REAL counts elapsed time, unaffected by changes of the wall clock.
+        struct sigevent sev = {};
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGALRM;
+        real_itimer_ = posixTimerCreateLocked(CLOCK_MONOTONIC, &sev);
+        posix_timers_.at(real_itimer_).itimer = true;
+    }
+    return real_itimer_;
+}
+
 ClockSimulator::TimePoint ClockSimulator::toFakeTime(ClockId clk_id, timespec ts) const
 {
-    std::scoped_lock lock(mutex_);
-    return TimePoint(to_duration(ts) - getOffset(clk_id));
+    return TimePoint(to_duration(ts) - published_.load(std::memory_order_acquire)->loadOffset(clk_id));
 }
 
 timespec ClockSimulator::toTimespec(ClockId clk_id, TimePoint tp) const
 {
-    std::scoped_lock lock(mutex_);
-    return fakeclock::to_timespec(tp.time_since_epoch() + getOffset(clk_id));
+    return fakeclock::to_timespec(tp.time_since_epoch() +
+                                  published_.load(std::memory_order_acquire)->loadOffset(clk_id));
 }
 
 void ClockSimulator::setOffsetsUsingCurrentTime()
@@ -221,19 +1941,29 @@ void ClockSimulator::setOffsetsUsingCurrentTime()
         auto time_before = to_duration(ts);
         setOffset(clk_id, time_before - fake_time_.time_since_epoch());
     }
+    publishTime();
 }
 
 void ClockSimulator::intercept()
 {
-    if (!intercepting_)
-    {
-        setOffsetsUsingCurrentTime();
-    }
-    intercepting_ = true;
+    setOffsetsUsingCurrentTime();
+    intercepting_.store(true, std::memory_order_release);
+    intercepting.fetch_add(1, std::memory_order_relaxed);
 }
 void ClockSimulator::restore()
 {
-    intercepting_ = false;
+    intercepting.fetch_sub(1, std::memory_order_relaxed);
+    intercepting_.store(false, std::memory_order_release);
+    auto_advance_ = false;
+    time_scale_ = 1.0;
+    stopSchedulingLocked();
+    if (exploring_)
+    {
+        exploring_.store(false, std::memory_order_relaxed);
+        waiters_.shuffleTies(std::nullopt);
+        timerfd_queue_.shuffleTies(std::nullopt);
+        posix_timer_queue_.shuffleTies(std::nullopt);
+    }
 }
 
 ClockSimulator::Duration ClockSimulator::getOffset(ClockId clk_id) const
@@ -255,4 +1985,44 @@ void ClockSimulator::setOffset(ClockId clk_id, Duration offset)
     // e.g., by adding it or logging an error. For now, we assume it's in the list.
 }
 
+void ClockSimulator::publishTime()
+{
+    if (following_)
+    {
+        return; // the parent process publishes
+    }
+    auto &state = shared_ ? shared_->state : published_time_;
+    if (flowing_)
+    {
+        state.store(flow_anchor_fake_, clock_offsets_, {real_anchor_, time_scale_});
+    }
+    else
+    {
+        state.store(fake_time_, clock_offsets_);
+    }
+    if (shared_)
+    {
+        shared_->notify(); // wakes the followers in child processes
+    }
+}
+
 } // namespace fakeclock
+
+/// LD_PRELOAD mode: processes started with FAKECLOCK_CONTROL=<file> follow the time in that file, which is controlled
+/// from outside, e.g. with fakeclockctl. The variable is inherited, so whole process trees share the time.
+__attribute__((constructor)) static void follow_external_control_on_load()
+{
+    const char *path = getenv("FAKECLOCK_CONTROL");
+    if (!path || !*path)
+    {
+        return;
+    }
+    try
+    {
+        fakeclock::ClockSimulator::getDefault().followExternalControl(path);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "fakeclock error: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/TimeState.h>
+#include <fakeclock/fakeclock.h>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+// exploreSchedules() forks one worker per core. Worker w runs the seeds at indexes w, w + workers, ... one after the
+// other, and reports each run on a pipe, one line per event: "start <seed>", then "pass <seed>" or
+// "fail <seed> <reason>". A run that started and never ended took its worker down, or was killed for its timeout.
+
+namespace fakeclock
+{
+
+namespace
+{
+
+using Duration = std::chrono::nanoseconds;
+
+/// Cores the process may run on.
+unsigned available_cores()
+{
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+        return std::max(CPU_COUNT(&cpus), 1);
+    }
+    return unsigned(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+}
+
+void send_line(int fd, std::string line)
+{
+    line += '\n';
+    for (size_t sent = 0; sent < line.size();)
+    {
+        ssize_t result = ::write(fd, line.data() + sent, line.size() - sent);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            _exit(127); // the parent is gone
+        }
+        sent += size_t(result);
+    }
+}
+
+[[noreturn]] void run_worker(int fd, const std::function<void(MasterOfTime &)> &body,
+                             const ExplorationOptions &options, uint64_t index, uint64_t stride)
+{
+    ClockSimulator::getInstance().stopFollowing(); // the parent may share its time, but runs no simulation
+    for (; index < options.runs; index += stride)
+    {
+        uint64_t seed = options.first_seed + index;
+        send_line(fd, "start " + std::to_string(seed));
+        std::string failure;
+        try
+        {
+            runSchedule(seed, body);
+        }
+        catch (const std::exception &e)
+        {
+            failure = std::string("exception: ") + e.what();
+        }
+        catch (...)
+        {
+            failure = "unknown exception";
+        }
+        if (failure.empty())
+        {
+            send_line(fd, "pass " + std::to_string(seed));
+        }
+        else
+        {
+            std::replace(failure.begin(), failure.end(), '\n', ' ');
+            send_line(fd, "fail " + std::to_string(seed) + " " + failure);
+        }
+    }
+    _exit(0); // neither atexit handlers nor the test framework of the parent run here
+}
+
+/// Why a worker that was running a seed ended with `status`.
+std::string describe_exit(int status)
+{
+    if (WIFSIGNALED(status))
+    {
+        return "killed by signal " + std::to_string(WTERMSIG(status)) + " (" + strsignal(WTERMSIG(status)) + ")";
+    }
+    return "exited with status " + std::to_string(WEXITSTATUS(status));
+}
+
+struct Worker
+{
+    pid_t pid = -1;
+    int fd = -1;                  ///< read end of the pipe the worker reports on
+    std::string buffer;           ///< received, up to the last complete line
+    std::optional<uint64_t> seed; ///< of the run in progress
+    Duration started{};           ///< real CLOCK_MONOTONIC when the run started
+    bool timed_out = false;       ///< killed for its timeout
+};
+
+class Explorer
+{
+  public:
+    Explorer(const std::function<void(MasterOfTime &)> &body, const ExplorationOptions &options)
+        : body_(body), options_(options),
+          stride_(std::min<uint64_t>(options.workers ? options.workers : available_cores(), options.runs))
+    {
+    }
+
+    ExplorationResult run()
+    {
+        for (uint64_t index = 0; index < stride_; index++)
+        {
+            spawn(index);
+        }
+        while (!workers_.empty() && !enoughFailures())
+        {
+            std::vector<pollfd> fds;
+            for (auto &worker : workers_)
+            {
+                fds.push_back({worker.fd, POLLIN, 0});
+            }
+            real.poll(fds.data(), fds.size(), pollTimeout());
+            for (size_t i = 0; i < fds.size(); i++)
+            {
+                if (fds[i].revents)
+                {
+                    receive(workers_[i]);
+                }
+            }
+            killStuckWorkers();
+            reapFinishedWorkers();
+        }
+        for (auto &worker : workers_) // left after enough failures
+        {
+            kill(worker.pid, SIGKILL);
+            real.close(worker.fd);
+            waitpid(worker.pid, nullptr, 0);
+        }
+        std::sort(result_.failures.begin(), result_.failures.end(),
+                  [](const auto &a, const auto &b) { return a.seed < b.seed; });
+        return result_;
+    }
+
+  private:
+    /// Starts a worker for the seeds from `index` on.
+    void spawn(uint64_t index)
+    {
+        if (index >= options_.runs)
+        {
+            return;
+        }
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "fakeclock: cannot create a pipe for a worker");
+        }
+        std::fflush(nullptr); // buffered output would be written by both processes
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            real.close(fds[0]);
+            run_worker(fds[1], body_, options_, index, stride_);
+        }
+        real.close(fds[1]);
+        if (pid < 0)
+        {
+            int error = errno;
+            real.close(fds[0]);
+            throw std::system_error(error, std::generic_category(), "fakeclock: cannot fork a worker");
+        }
+        Worker worker;
+        worker.pid = pid;
+        worker.fd = fds[0];
+        workers_.push_back(std::move(worker));
+    }
+
+    void receive(Worker &worker)
+    {
+        char data[4096];
+        ssize_t size = real.read(worker.fd, data, sizeof(data));
+        if (size <= 0)
+        {
+            if (size < 0 && errno == EINTR)
+            {
+                return;
+            }
+            real.close(worker.fd);
+            worker.fd = -1; // reaped by reapFinishedWorkers()
+            return;
+        }
+        worker.buffer.append(data, size_t(size));
+        size_t end;
+        while ((end = worker.buffer.find('\n')) != std::string::npos)
+        {
+            handle(worker, worker.buffer.substr(0, end));
+            worker.buffer.erase(0, end + 1);
+        }
+    }
+
+    void handle(Worker &worker, const std::string &line)
+    {
+        size_t space = line.find(' ');
+        std::string event = line.substr(0, space);
+        size_t seed_end = line.find(' ', space + 1);
+        uint64_t seed = std::stoull(line.substr(space + 1, seed_end - space - 1));
+        if (event == "start")
+        {
+            worker.seed = seed;
+            worker.started = TimeState::realNow();
+            return;
+        }
+        worker.seed.reset();
+        result_.runs++;
+        if (event == "fail")
+        {
+            fail(seed, line.substr(seed_end + 1));
+        }
+    }
+
+    void fail(uint64_t seed, std::string reason)
+    {
+        std::cerr << "fakeclock: schedule " << seed << " failed: " << reason
+                  << " (rerun it with fakeclock::runSchedule(" << seed << ", ...))" << std::endl;
+        result_.failures.push_back({seed, std::move(reason)});
+    }
+
+    bool enoughFailures() const
+    {
+        return options_.max_failures && result_.failures.size() >= options_.max_failures;
+    }
+
+    /// Until the earliest run timeout, in milliseconds.
+    int pollTimeout() const
+    {
+        auto now = TimeState::realNow();
+        std::optional<Duration> timeout;
+        for (const auto &worker : workers_)
+        {
+            if (worker.seed && !worker.timed_out)
+            {
+                auto left = std::max(worker.started + options_.run_timeout - now, Duration::zero());
+                timeout = timeout ? std::min(*timeout, left) : left;
+            }
+        }
+        if (!timeout)
+        {
+            return -1;
+        }
+        return int(std::chrono::ceil<std::chrono::milliseconds>(*timeout).count());
+    }
+
+    void killStuckWorkers()
+    {
+        auto now = TimeState::realNow();
+        for (auto &worker : workers_)
+        {
+            if (worker.seed && !worker.timed_out && now - worker.started >= options_.run_timeout)
+            {
+                worker.timed_out = true;
+                kill(worker.pid, SIGKILL);
+            }
+        }
+    }
+
+    /// Collects the workers whose pipe was closed, and replaces those that died during a run.
+    void reapFinishedWorkers()
+    {
+        for (size_t i = 0; i < workers_.size();)
+        {
+            if (workers_[i].fd >= 0)
+            {
+                i++;
+                continue;
+            }
+            Worker worker = std::move(workers_[i]);
+            workers_.erase(workers_.begin() + i);
+            int status = 0;
+            waitpid(worker.pid, &status, 0);
+            if (!worker.seed)
+            {
+                continue; // done with its seeds
+            }
+            result_.runs++;
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(options_.run_timeout).count();
+            fail(*worker.seed, worker.timed_out ? "timed out after " + std::to_string(timeout) + " ms"
+                                                : describe_exit(status));
+            if (!enoughFailures())
+            {
+                spawn(*worker.seed - options_.first_seed + stride_);
+            }
+        }
+    }
+
+    const std::function<void(MasterOfTime &)> &body_;
+    const ExplorationOptions &options_;
+    uint64_t stride_; ///< number of workers
+    std::vector<Worker> workers_;
+    ExplorationResult result_;
+};
+
+} // namespace
+
+void runSchedule(uint64_t seed, const std::function<void(MasterOfTime &)> &body)
+{
+    MasterOfTime clock;
+    clock.explore(seed);
+    body(clock);
+}
+
+ExplorationResult exploreSchedules(const std::function<void(MasterOfTime &)> &body, const ExplorationOptions &options)
+{
+    if (isIntercepting())
+    {
+        throw std::logic_error("fakeclock: exploreSchedules() cannot run while a MasterOfTime exists");
+    }
+    return Explorer(body, options).run();
+}
+
+} // namespace fakeclock
@@ -0,0 +1,181 @@
+#include <cerrno>
+#include <climits>
+#include <fakeclock/Futex.h>
+#include <fakeclock/SharedTime.h>
+#include <fakeclock/common.h>
+#include <fcntl.h>
+#include <new>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace fakeclock
+{
+
+namespace
+{
+
+void *map_fd(int fd, const char *what)
+{
+    void *memory = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        (st.st_size >= off_t(sizeof(SharedTime)) || ftruncate(fd, sizeof(SharedTime)) == 0))
+    {
+        memory = mmap(nullptr, sizeof(SharedTime), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    real.close(fd); // the mapping keeps the memory alive
+    if (memory == MAP_FAILED)
+    {
+        throw std::system_error(err, std::generic_category(), what);
+    }
+    return memory;
+}
+
+/// Whether the process `pid`, which holds a lock, is gone.
+bool is_dead(uint32_t pid)
+{
+    return kill(pid_t(pid), 0) == -1 && errno == ESRCH;
+}
+
+} // namespace
+
+SharedTime *SharedTime::create()
+{
+    int fd = memfd_create("fakeclock", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "fakeclock: memfd_create");
+    }
+    auto *shared = new (map_fd(fd, "fakeclock: cannot map shared time")) SharedTime;
+    shared->initialized_.store(INITIALIZED, std::memory_order_relaxed);
+    return shared;
+}
+
+SharedTime *SharedTime::open(const char *path)
+{
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), std::string("fakeclock: cannot open ") + path);
+    }
+    // A new file is all zeros, which is a valid state for the atomics; the first process to map it initializes it,
+    // or the next one if that process dies on the way.
+    auto *shared = static_cast<SharedTime *>(map_fd(fd, "fakeclock: cannot map the control file"));
+    auto self = uint32_t(getpid());
+    uint32_t owner = 0;
+    while (!shared->initialized_.compare_exchange_strong(owner, self, std::memory_order_acquire))
+    {
+        if (owner == INITIALIZED)
+        {
+            return shared;
+        }
+        if (!is_dead(owner))
+        {
+            sched_yield();
+            owner = 0;
+        } // else taken over from the dead process on the next try, unless another process is faster
+    }
+    if (owner != 0)
+    {
+        shared->state.repair();
+    }
+    auto real_now = TimeState::realNow();
+    auto fake_time = TimePoint(real_now);
+    TimeState::Offsets offsets = {};
+    for (int clk_id : {CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC_RAW, CLOCK_BOOTTIME, CLOCK_TAI})
+    {
+        timespec ts;
+        real_clock_gettime(clk_id, &ts);
+        offsets[clk_id] = to_duration(ts) - fake_time.time_since_epoch();
+    }
+    shared->state.store(fake_time, offsets, {real_now, 1.0});
+    shared->initialized_.store(INITIALIZED, std::memory_order_release);
+    return shared;
+}
+
+void SharedTime::unmap(SharedTime *shared)
+{
+    munmap(shared, sizeof(SharedTime));
+}
+
+void SharedTime::notify()
+{
+    generation.fetch_add(1, std::memory_order_release);
+    futex_wake(generation, INT_MAX, true);
+}
+
+void SharedTime::lockWriter()
+{
+    auto self = uint32_t(getpid());
+    uint32_t owner = 0;
+    while (!writer_.compare_exchange_strong(owner, self, std::memory_order_acquire))
+    {
+        if (!is_dead(owner))
+        {
+            sched_yield();
+            owner = 0;
+        } // else taken over from the dead process on the next try, unless another process is faster
+    }
+    if (owner != 0)
+    {
+        state.repair(); // the dead process may have stopped in the middle of a store
+    }
+}
+
+template <typename Fn> void SharedTime::modify(Fn &&fn)
+{
+    lockWriter();
+    auto snapshot = state.load();
+    auto real_now = TimeState::realNow();
+    auto fake_now = snapshot.fake_time + TimeState::flowElapsed(snapshot.flow, real_now);
+    fn(snapshot, fake_now, real_now);
+    state.store(snapshot.fake_time, snapshot.offsets, snapshot.flow);
+    writer_.store(0, std::memory_order_release);
+    notify();
+}
+
+void SharedTime::advance(Duration duration)
+{
+    // While time flows, the anchor moves, so the time keeps flowing from the new point.
+    modify([duration](TimeState::Snapshot &snapshot, TimePoint, Duration) { snapshot.fake_time += duration; });
+}
+
+void SharedTime::freeze()
+{
+    modify([](TimeState::Snapshot &snapshot, TimePoint fake_now, Duration) {
+        snapshot.fake_time = fake_now;
+        snapshot.flow = {};
+    });
+}
+
+void SharedTime::resume(double scale)
+{
+    modify([scale](TimeState::Snapshot &snapshot, TimePoint fake_now, Duration real_now) {
+        snapshot.fake_time = fake_now;
+        snapshot.flow = {real_now, scale};
+    });
+}
+
+void SharedTime::setTime(int clk_id, Duration time)
+{
+    if (clk_id < 0 || clk_id >= MAX_CLK_ID)
+    {
+        throw std::system_error(EINVAL, std::generic_category(), "fakeclock: unknown clock");
+    }
+    modify([clk_id, time](TimeState::Snapshot &snapshot, TimePoint fake_now, Duration real_now) {
+        if (snapshot.flow.real_anchor != Duration::zero())
+        {
+            snapshot.flow.real_anchor = real_now; // re-anchored, so that the offset refers to fake_now
+        }
+        snapshot.fake_time = fake_now;
+        snapshot.offsets[clk_id] = time - fake_now.time_since_epoch();
+    });
+}
+
+} // namespace fakeclock
@@ -0,0 +1,185 @@
+#include <cerrno>
+#include <cstdint>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/SocketTimeouts.h>
+#include <fcntl.h>
+#include <vector>
+
+namespace fakeclock
+{
+
+SocketTimeouts &SocketTimeouts::getInstance()
+{
+    // Never destroyed: fds may be closed by other threads while the process exits.
+    static auto *instance = new SocketTimeouts;
+    return *instance;
+}
+
+void SocketTimeouts::set(int fd, Direction direction, Duration timeout)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &timeouts = timeouts_[fd];
+    if (!timeouts)
+    {
+        timeouts = std::make_shared<Timeouts>();
+        blocking_[fd] = std::make_shared<Blocking>();
+        fds_.insert(fd);
+    }
+    (direction == Receive ? timeouts->receive : timeouts->send) = timeout;
+}
+
+std::optional<SocketTimeouts::Duration> SocketTimeouts::get(int fd, Direction direction)
+{
+    if (!fds_.mayContain(fd))
+    {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timeouts_.find(fd);
+    if (it == timeouts_.end())
+    {
+        return std::nullopt;
+    }
+    auto timeout = direction == Receive ? it->second->receive : it->second->send;
+    if (timeout == Duration::zero())
+    {
+        return std::nullopt;
+    }
+    return timeout;
+}
+
+void SocketTimeouts::fdClosed(int fd)
+{
+    if (!fds_.mayContain(fd))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (timeouts_.erase(fd))
+    {
+        blocking_.erase(fd);
+        fds_.erase(fd);
+    }
+}
+
+void SocketTimeouts::fdDuplicated(int old_fd, int new_fd)
+{
+    if (!fds_.mayContain(old_fd))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timeouts_.find(old_fd);
+    if (it == timeouts_.end())
+    {
+        return;
+    }
+    auto timeouts = it->second;
+    blocking_[new_fd] = blocking_[old_fd];
+    if (timeouts_.insert_or_assign(new_fd, std::move(timeouts)).second)
+    {
+        fds_.insert(new_fd);
+    }
+}
+
+void SocketTimeouts::fdAccepted(int fd, int new_fd)
+{
+    if (!fds_.mayContain(fd))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timeouts_.find(fd);
+    if (it == timeouts_.end())
+    {
+        return;
+    }
+    auto timeouts = std::make_shared<Timeouts>(*it->second);
+    blocking_[new_fd] = std::make_shared<Blocking>();
+    if (timeouts_.insert_or_assign(new_fd, std::move(timeouts)).second)
+    {
+        fds_.insert(new_fd);
+    }
+}
+
+void SocketTimeouts::fdRangeClosed(unsigned int first, unsigned int last)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> closed;
+    for (auto &[fd, _] : timeouts_)
+    {
+        if (unsigned(fd) >= first && unsigned(fd) <= last)
+        {
+            closed.push_back(fd);
+        }
+    }
+    for (int fd : closed)
+    {
+        timeouts_.erase(fd);
+        blocking_.erase(fd);
+        fds_.erase(fd);
+    }
+}
+
+std::shared_ptr<SocketTimeouts::Blocking> SocketTimeouts::blocking(int fd)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = blocking_.find(fd);
+    return it == blocking_.end() ? nullptr : it->second;
+}
+
+void SocketTimeouts::beginNonBlocking(int fd)
+{
+    auto state = blocking(fd);
+    if (!state)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->nonblocking_calls++ == 0)
+    {
+        int flags = real.fcntl(fd, F_GETFL, nullptr);
+        state->made_nonblocking = flags >= 0 && !(flags & O_NONBLOCK);
+        if (state->made_nonblocking)
+        {
+            real.fcntl(fd, F_SETFL, reinterpret_cast<void *>(intptr_t(flags | O_NONBLOCK)));
+        }
+    }
+}
+
+void SocketTimeouts::endNonBlocking(int fd)
+{
+    auto state = blocking(fd);
+    if (!state)
+    {
+        return; // closed in the meantime
+    }
+    int saved_errno = errno;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->nonblocking_calls > 0 && --state->nonblocking_calls == 0 && state->made_nonblocking)
+    {
+        // The current flags rather than those before the first call, in case the program changed others since.
+        int flags = real.fcntl(fd, F_GETFL, nullptr);
+        if (flags >= 0)
+        {
+            real.fcntl(fd, F_SETFL, reinterpret_cast<void *>(intptr_t(flags & ~O_NONBLOCK)));
+        }
+        state->made_nonblocking = false;
+    }
+    errno = saved_errno;
+}
+
+bool SocketTimeouts::isNonBlocking(int fd)
+{
+    if (auto state = blocking(fd))
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->made_nonblocking)
+        {
+            return false;
+        }
+    }
+    return real.fcntl(fd, F_GETFL, nullptr) & O_NONBLOCK;
+}
+
+} // namespace fakeclock
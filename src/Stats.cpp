@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fakeclock/Stats.h>
+#include <fakeclock/ThreadSlots.h>
+#include <pthread.h>
+#include <span>
+#include <sstream>
+#include <string>
+
+namespace fakeclock
+{
+
+constinit thread_local StatsShard *thread_stats_shard = nullptr;
+
+namespace
+{
+
+constexpr size_t MAX_SHARDS = 256;
+
+/// shards[0] is shared by the threads that find no free shard. The pool never goes away, so threads that exit leave
+/// their counts behind for the next owner.
+constinit StatsShard shards[MAX_SHARDS] = {{{0}, true}};
+
+/// The shards threads take for themselves, all but shards[0].
+std::span<StatsShard> own_shards()
+{
+    return std::span(shards).subspan(1);
+}
+
+void fork_child()
+{
+    ThreadSlots<StatsShard>::forgetOtherThreads(own_shards(), thread_stats_shard);
+}
+
+[[maybe_unused]] const int fork_handler_registered = pthread_atfork(nullptr, nullptr, fork_child);
+
+uint64_t sum(Stat stat, size_t slot = 0)
+{
+    uint64_t total = 0;
+    for (const auto &shard : shards)
+    {
+        total += shard.counters[size_t(stat) + slot].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template <size_t N>
+void sum(std::array<uint64_t, N> &values, Stat stat)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        values[i] = sum(stat, i);
+    }
+}
+
+const char *clock_name(size_t clock_id)
+{
+    static constexpr const char *NAMES[] = {
+        "realtime",        "monotonic",       "process_cputime_id", "thread_cputime_id",
+        "monotonic_raw",   "realtime_coarse", "monotonic_coarse",   "boottime",
+        "realtime_alarm",  "boottime_alarm",  nullptr,              "tai"};
+    return clock_id < std::size(NAMES) ? NAMES[clock_id] : nullptr;
+}
+
+class PrometheusWriter
+{
+  public:
+    void metric(const char *name, const char *type, const char *help)
+    {
+        out_ << "# HELP fakeclock_" << name << ' ' << help << "\n# TYPE fakeclock_" << name << ' ' << type << '\n';
+    }
+    template <typename T>
+    void sample(const char *name, T value, const std::string &labels = {})
+    {
+        out_ << "fakeclock_" << name << (labels.empty() ? "" : "{" + labels + "}") << ' ' << value << '\n';
+    }
+    /// `buckets` are not cumulative (see Stats), Prometheus buckets are.
+    template <typename Bounds, typename Buckets, typename Sum>
+    void histogram(const char *name, const char *help, const Bounds &bounds, const Buckets &buckets, Sum sum,
+                   double scale = 1.0)
+    {
+        metric(name, "histogram", help);
+        std::string bucket_name = std::string(name) + "_bucket";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            cumulative += buckets[i];
+            std::ostringstream le;
+            if (i < bounds.size())
+            {
+                le << double(value(bounds[i])) * scale;
+            }
+            else
+            {
+                le << "+Inf";
+            }
+            sample(bucket_name.c_str(), cumulative, "le=\"" + le.str() + "\"");
+        }
+        sample((std::string(name) + "_sum").c_str(), double(sum) * scale);
+        sample((std::string(name) + "_count").c_str(), cumulative);
+    }
+    std::string str() const
+    {
+        return out_.str();
+    }
+
+  private:
+    static uint64_t value(uint64_t v)
+    {
+        return v;
+    }
+    static uint64_t value(FakeClock::duration d)
+    {
+        return uint64_t(d.count());
+    }
+
+    std::ostringstream out_;
+};
+
+double seconds(FakeClock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+StatsShard &acquireStatsShard()
+{
+    auto *shard = ThreadSlots<StatsShard>::acquire(own_shards());
+    thread_stats_shard = shard ? shard : &shards[0];
+    return *thread_stats_shard;
+}
+
+void endSimulation(FakeClock::duration simulated_time, FakeClock::duration wall_time)
+{
+    count(Stat::SimulatedTime, uint64_t(std::max(simulated_time.count(), int64_t(0))));
+    count(Stat::WallTime, uint64_t(std::max(wall_time.count(), int64_t(0))));
+    static const bool report = [] {
+        const char *value = getenv("FAKECLOCK_REPORT");
+        return value && *value && std::string(value) != "0";
+    }();
+    if (report)
+    {
+        std::fprintf(stderr, "fakeclock: simulated %.6f s in %.6f s of wall time (%.1fx)\n", seconds(simulated_time),
+                     seconds(wall_time), wall_time.count() > 0 ? seconds(simulated_time) / seconds(wall_time) : 0.0);
+    }
+}
+
+Stats stats()
+{
+    Stats result;
+    sum(result.clock_reads, Stat::ClockRead);
+    result.clock_sets = sum(Stat::ClockSet);
+    result.sleeps = sum(Stat::Sleep);
+    result.sleep_time = FakeClock::duration(sum(Stat::SleepTime));
+    sum(result.sleep_durations, Stat::SleepDuration);
+    result.fd_waits = sum(Stat::FdWait);
+    result.fd_wait_timeouts = sum(Stat::FdWaitTimeout);
+    result.timerfd_operations = sum(Stat::TimerfdOperation);
+    result.timerfd_expirations = sum(Stat::TimerfdExpiration);
+    result.posix_timer_operations = sum(Stat::PosixTimerOperation);
+    result.posix_timer_expirations = sum(Stat::PosixTimerExpiration);
+    result.advances = sum(Stat::Advance);
+    result.woken_threads = sum(Stat::WokenThreads);
+    result.fired_timers = sum(Stat::FiredTimers);
+    sum(result.woken_threads_per_advance, Stat::WokenThreadsPerAdvance);
+    sum(result.fired_timers_per_advance, Stat::FiredTimersPerAdvance);
+    result.simulated_time = FakeClock::duration(sum(Stat::SimulatedTime));
+    result.wall_time = FakeClock::duration(sum(Stat::WallTime));
+    return result;
+}
+
+std::string statsText()
+{
+    auto s = stats();
+    PrometheusWriter out;
+    out.metric("clock_reads_total", "counter", "Intercepted clock_gettime, gettimeofday and time calls.");
+    for (size_t i = 0; i < s.clock_reads.size(); i++)
+    {
+        if (s.clock_reads[i] == 0)
+        {
+            continue;
+        }
+        const char *name = i + 1 < s.clock_reads.size() ? clock_name(i) : "other";
+        out.sample("clock_reads_total", s.clock_reads[i],
+                   std::string("clock=\"") + (name ? name : std::to_string(i).c_str()) + "\"");
+    }
+    out.metric("clock_sets_total", "counter", "Intercepted clock_settime and settimeofday calls.");
+    out.sample("clock_sets_total", s.clock_sets);
+    out.histogram("sleep_duration_seconds", "Durations requested by intercepted sleeps.", Stats::SLEEP_BOUNDS,
+                  s.sleep_durations, s.sleep_time.count(), 1e-9);
+    out.metric("fd_waits_total", "counter", "Intercepted poll, epoll_wait and select calls that may block.");
+    out.sample("fd_waits_total", s.fd_waits);
+    out.metric("fd_wait_timeouts_total", "counter", "Intercepted fd waits that ended without ready fds.");
+    out.sample("fd_wait_timeouts_total", s.fd_wait_timeouts);
+    out.metric("timerfd_operations_total", "counter", "Intercepted timerfd_create, timerfd_settime and "
+                                                      "timerfd_gettime calls.");
+    out.sample("timerfd_operations_total", s.timerfd_operations);
+    out.metric("timerfd_expirations_total", "counter", "Expirations of simulated timerfds.");
+    out.sample("timerfd_expirations_total", s.timerfd_expirations);
+    out.metric("posix_timer_operations_total", "counter", "Intercepted timer_* calls.");
+    out.sample("posix_timer_operations_total", s.posix_timer_operations);
+    out.metric("posix_timer_expirations_total", "counter", "Expirations of simulated POSIX timers.");
+    out.sample("posix_timer_expirations_total", s.posix_timer_expirations);
+    out.histogram("advance_woken_threads", "Sleeping threads woken by an advance of the time.",
+                  Stats::PER_ADVANCE_BOUNDS, s.woken_threads_per_advance, s.woken_threads);
+    out.histogram("advance_fired_timers", "Timerfds and POSIX timers that expired in an advance of the time.",
+                  Stats::PER_ADVANCE_BOUNDS, s.fired_timers_per_advance, s.fired_timers);
+    out.metric("simulated_seconds_total", "counter", "Fake time that passed while a MasterOfTime existed.");
+    out.sample("simulated_seconds_total", seconds(s.simulated_time));
+    out.metric("wall_seconds_total", "counter", "Real time that passed while a MasterOfTime existed.");
+    out.sample("wall_seconds_total", seconds(s.wall_time));
+    return out.str();
+}
+
+void resetStats()
+{
+    for (auto &shard : shards)
+    {
+        for (auto &counter : shard.counters)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace fakeclock
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/ThreadSlots.h>
+#include <fakeclock/Trace.h>
+#include <fakeclock/common.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <linux/membarrier.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+// Each recording thread writes to its own region of the mapped trace file, so recording takes no lock and shares no
+// cache line with other threads. The only synchronization is with stopTracing(), which must not unmap the file while
+// a thread writes to it: writers flag themselves as busy in a TraceWriter, which lives in a static pool rather than in
+// the file, and stopTracing() waits for the flags to clear after it has ended the session. The flag and the session
+// form a Dekker handshake. Its expensive half, the barrier between them, is taken by stopTracing() with membarrier(),
+// so that writers get away with plain stores.
+
+namespace fakeclock
+{
+
+std::atomic<bool> tracing = false;
+
+namespace
+{
+
+/// Per-thread recording state. The static pool never goes away, so stopTracing() can always look at it.
+struct TraceWriter
+{
+    std::atomic<uint32_t> owner = 0; ///< tid of the thread that uses it, 0 if free
+    std::atomic<uint32_t> busy = 0;  ///< set while the owner writes a record
+    uint64_t session = 0;            ///< session `region` belongs to
+    TraceThreadRegion *region = nullptr;
+    uint64_t mask = 0; ///< records_per_thread - 1
+};
+
+/// A tick count and the real CLOCK_MONOTONIC nanoseconds at the same moment.
+struct TickSample
+{
+    int64_t ticks;
+    int64_t real;
+};
+
+struct TraceSession
+{
+    TraceFileHeader *header;
+    size_t size;
+    TickSample start;
+};
+
+constexpr size_t MAX_WRITERS = 1024;
+TraceWriter writers[MAX_WRITERS];
+thread_local TraceWriter *thread_writer = nullptr;
+
+std::mutex session_mutex; ///< serializes startTracing() and stopTracing()
+std::atomic<TraceSession *> current_session = nullptr;
+std::atomic<uint64_t> session_generation = 0; ///< bumped whenever the session changes
+/// Set at load time, before there are other threads. Without membarrier(), writers issue the barrier themselves.
+const bool membarrier_registered = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+
+/// Real time of records. Reading the TSC costs a fraction of a clock_gettime(); the trace file header tells how to
+/// convert its ticks.
+int64_t ticks()
+{
+#if defined(__x86_64__)
+    return static_cast<int64_t>(__builtin_ia32_rdtsc());
+#else
+    return TimeState::realNow().count();
+#endif
+}
+
+TickSample sample_ticks()
+{
+    auto before = ticks();
+    auto real = TimeState::realNow().count();
+    auto after = ticks();
+    return {before + (after - before) / 2, real};
+}
+
+void calibrate(TraceFileHeader &header, TickSample start, TickSample end)
+{
+    header.ticks_anchor = start.ticks;
+    header.real_anchor = start.real;
+    header.ns_per_tick =
+        end.ticks > start.ticks ? double(end.real - start.real) / double(end.ticks - start.ticks) : 1.0;
+}
+
+/// Takes a free TraceWriter for the calling thread, nullptr if all are taken.
+TraceWriter *acquire_writer()
+{
+    auto *writer = ThreadSlots<TraceWriter>::acquire(writers);
+    if (writer)
+    {
+        writer->session = 0;
+        writer->region = nullptr;
+        thread_writer = writer;
+    }
+    return writer;
+}
+
+/// Claims a region of the current session for `writer`, if there is a session and the file has a region left.
+void claim_region(TraceWriter &writer, uint64_t generation)
+{
+    writer.session = generation;
+    writer.region = nullptr;
+    auto *session = current_session.load(std::memory_order_acquire);
+    if (!session)
+    {
+        return;
+    }
+    auto *header = session->header;
+    auto index = header->threads_used.fetch_add(1, std::memory_order_relaxed);
+    if (index >= header->max_threads)
+    {
+        return;
+    }
+    auto *region = reinterpret_cast<TraceThreadRegion *>(reinterpret_cast<char *>(header) + sizeof(TraceFileHeader) +
+                                                         size_t(index) * header->region_size);
+    region->tid = writer.owner.load(std::memory_order_relaxed);
+    region->pid = getpid();
+    writer.region = region;
+    writer.mask = header->records_per_thread - 1;
+}
+
+void fork_child()
+{
+    // The child keeps writing to the same file (it is a shared mapping), but through regions of its own.
+    ThreadSlots<TraceWriter>::forgetOtherThreads(writers, nullptr);
+    for (auto &writer : writers)
+    {
+        writer.busy.store(0, std::memory_order_relaxed);
+    }
+    thread_writer = nullptr;
+    session_generation.fetch_add(1);
+}
+
+[[maybe_unused]] const int fork_handler_registered = pthread_atfork(nullptr, nullptr, fork_child);
+
+} // namespace
+
+void recordTrace(TraceOp op, int clock_id, int64_t arg0, int64_t arg1)
+{
+    auto *writer = thread_writer ? thread_writer : acquire_writer();
+    if (!writer || writer->busy.load(std::memory_order_relaxed))
+    {
+        return; // out of writers, or a signal handler interrupted a write
+    }
+    writer->busy.store(1, std::memory_order_relaxed);
+    if (membarrier_registered)
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst); // the barrier is issued by stopTracing()
+    }
+    else
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    // Loaded after setting busy, so either this sees the session end, or stopTracing() sees busy and waits.
+    auto generation = session_generation.load(std::memory_order_relaxed);
+    if (writer->session != generation)
+    {
+        claim_region(*writer, generation);
+    }
+    if (auto *region = writer->region)
+    {
+        auto index = region->written.load(std::memory_order_relaxed);
+        auto &record = region->records()[index & writer->mask];
+        record.fake_time = ClockSimulator::getInstance().now().time_since_epoch().count();
+        record.real_time = ticks();
+        record.args[0] = arg0;
+        record.args[1] = arg1;
+        record.tid = region->tid;
+        record.op = op;
+        record.clock_id = static_cast<int16_t>(clock_id);
+        region->written.store(index + 1, std::memory_order_release);
+    }
+    writer->busy.store(0, std::memory_order_release);
+}
+
+void startTracing(const char *path, uint32_t records_per_thread, uint32_t max_threads)
+{
+    std::lock_guard<std::mutex> lock(session_mutex);
+    if (current_session.load(std::memory_order_relaxed))
+    {
+        throw std::logic_error("fakeclock: a trace is already being recorded");
+    }
+    records_per_thread = std::bit_ceil(std::max<uint32_t>(records_per_thread, 2));
+    max_threads = std::max<uint32_t>(max_threads, 1);
+    size_t region_size = sizeof(TraceThreadRegion) + size_t(records_per_thread) * sizeof(TraceRecord);
+    size_t size = sizeof(TraceFileHeader) + max_threads * region_size;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), std::string("fakeclock: cannot create ") + path);
+    }
+    // Sparse: only the pages that get written take space.
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0)
+    {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    real.close(fd);
+    if (memory == MAP_FAILED)
+    {
+        throw std::system_error(err, std::generic_category(), std::string("fakeclock: cannot map ") + path);
+    }
+    auto *header = static_cast<TraceFileHeader *>(memory);
+    std::memcpy(header->magic, TraceFileHeader::MAGIC, sizeof(header->magic));
+    header->record_size = sizeof(TraceRecord);
+    header->records_per_thread = records_per_thread;
+    header->max_threads = max_threads;
+    header->region_size = static_cast<uint32_t>(region_size);
+    auto start = sample_ticks();
+    timespec calibration = {0, 1000000};
+    real.nanosleep(&calibration, nullptr);
+    calibrate(*header, start, sample_ticks());
+    current_session.store(new TraceSession{header, size, start}, std::memory_order_release);
+    session_generation.fetch_add(1);
+    tracing.store(true);
+}
+
+void stopTracing()
+{
+    std::lock_guard<std::mutex> lock(session_mutex);
+    auto *session = current_session.load(std::memory_order_relaxed);
+    if (!session)
+    {
+        return;
+    }
+    tracing.store(false);
+    current_session.store(nullptr);
+    session_generation.fetch_add(1);
+    if (membarrier_registered)
+    {
+        // Makes every running thread pass a full barrier: a writer either has its busy flag visible by now, or it
+        // loads the new generation.
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    }
+    for (auto &writer : writers)
+    {
+        while (writer.busy.load())
+        {
+            sched_yield();
+        }
+    }
+    calibrate(*session->header, session->start, sample_ticks());
+    munmap(session->header, session->size);
+    delete session;
+}
+
+TraceRecorder::TraceRecorder(const std::string &path, uint32_t records_per_thread, uint32_t max_threads)
+{
+    startTracing(path.c_str(), records_per_thread, max_threads);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stopTracing();
+}
+
+} // namespace fakeclock
+
+/// FAKECLOCK_TRACE=<file> records the whole run of the process. "%p" in the path is replaced by the pid, so that each
+/// process of a tree started with LD_PRELOAD gets its own file.
+__attribute__((constructor)) static void record_trace_on_load()
+{
+    const char *path = getenv("FAKECLOCK_TRACE");
+    if (!path || !*path)
+    {
+        return;
+    }
+    try
+    {
+        fakeclock::startTracing(fakeclock::with_pid(path).c_str(), fakeclock::TraceRecorder::DEFAULT_RECORDS_PER_THREAD,
+                                fakeclock::TraceRecorder::DEFAULT_MAX_THREADS);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "fakeclock error: " << e.what() << std::endl;
+    }
+}
@@ -3,6 +3,7 @@
 #include <condition_variable>
 #include <cstring>
 #include <dlfcn.h>
+#include <fakeclock/ClockLog.h>
 #include <fakeclock/ClockSimulator.h>
 #include <fakeclock/fakeclock.h>
 #include <iostream>
@@ -19,19 +20,118 @@
 namespace fakeclock
 {
 
-MasterOfTime::MasterOfTime()
+MasterOfTime::MasterOfTime() : simulator_(ClockSimulator::getInstance())
 {
-    ClockSimulator::getInstance().addClock();
+    simulator_.addClock();
 }
 
 MasterOfTime::~MasterOfTime()
 {
-    ClockSimulator::getInstance().removeClock();
+    stopClockReplay(simulator_);
+    simulator_.removeClock();
 }
 
 void MasterOfTime::advance(FakeClock::duration duration)
 {
-    ClockSimulator::getInstance().advance(duration);
+    simulator_.advance(duration);
+}
+
+bool MasterOfTime::advanceAndSettle(FakeClock::duration duration, std::optional<std::chrono::nanoseconds> timeout)
+{
+    return simulator_.advanceAndSettle(duration, timeout);
+}
+
+std::optional<FakeClock::time_point> MasterOfTime::nextEventTime() const
+{
+    return simulator_.nextEventTime();
+}
+
+bool MasterOfTime::advanceToNextEvent()
+{
+    return simulator_.advanceToNextEvent();
+}
+
+void MasterOfTime::runUntil(FakeClock::time_point tp)
+{
+    while (simulator_.advanceToNextEvent(tp))
+    {
+    }
+    if (simulator_.now() < tp)
+    {
+        simulator_.advance(tp - simulator_.now());
+    }
+}
+
+void MasterOfTime::setAutoAdvance(bool enabled)
+{
+    simulator_.setAutoAdvance(enabled);
+}
+
+void MasterOfTime::scheduleDeterministically(uint64_t seed)
+{
+    simulator_.scheduleDeterministically(seed);
+}
+
+void MasterOfTime::explore(uint64_t seed)
+{
+    simulator_.explore(seed);
+}
+
+void MasterOfTime::resume()
+{
+    simulator_.resume();
+}
+
+void MasterOfTime::pause()
+{
+    simulator_.pause();
+}
+
+bool MasterOfTime::isPaused() const
+{
+    return simulator_.isPaused();
+}
+
+void MasterOfTime::setTimeScale(double scale)
+{
+    simulator_.setTimeScale(scale);
+}
+
+void MasterOfTime::shareWithChildProcesses()
+{
+    simulator_.shareWithChildProcesses();
+}
+
+void MasterOfTime::replay(const std::string &path)
+{
+    startClockReplay(simulator_, path.c_str());
+}
+
+Timeline::Timeline() : simulator_(std::make_unique<ClockSimulator>())
+{
+}
+
+Timeline::~Timeline() = default;
+
+ScopedTimeline::ScopedTimeline(Timeline &timeline) : previous_(current_timeline)
+{
+    current_timeline = timeline.simulator_.get();
+}
+
+ScopedTimeline::~ScopedTimeline()
+{
+    current_timeline->threadLeft();
+    current_timeline = previous_;
+}
+
+RegisteredThread::RegisteredThread()
+{
+    ClockSimulator::getInstance().registerThread();
+}
+
+RegisteredThread::~RegisteredThread()
+{
+    ClockSimulator::getInstance().unregisterThread();
 }
 
 FakeClock::time_point FakeClock::now() noexcept
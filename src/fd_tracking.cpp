@@ -0,0 +1,115 @@
+#include <cstdarg>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/SocketTimeouts.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Timerfds are emulated with eventfds, so the simulator that created them has to know when the client closes or
+// duplicates them, from whatever timeline, and the timeouts of sockets are kept by fd. These overrides are active even
+// when time is not intercepted, because timerfds and sockets may outlive MasterOfTime.
+
+namespace
+{
+
+template <typename Fn> int fcntl_impl(Fn real_fcntl, int fd, int cmd, void *arg)
+{
+    int result = real_fcntl(fd, cmd, arg);
+    if (result != -1 && (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC))
+    {
+        fakeclock::ClockSimulator::fdDuplicated(fd, result);
+        fakeclock::SocketTimeouts::getInstance().fdDuplicated(fd, result);
+    }
+    return result;
+}
+
+} // namespace
+
+extern "C"
+{
+    int close(int fd)
+    {
+        // Forget the timerfd or socket before the fd number can be reused by another thread.
+        fakeclock::ClockSimulator::fdClosed(fd);
+        fakeclock::SocketTimeouts::getInstance().fdClosed(fd);
+        return fakeclock::real.close(fd);
+    }
+
+    int dup(int oldfd)
+    {
+        int result = fakeclock::real.dup(oldfd);
+        if (result != -1)
+        {
+            fakeclock::ClockSimulator::fdDuplicated(oldfd, result);
+            fakeclock::SocketTimeouts::getInstance().fdDuplicated(oldfd, result);
+        }
+        return result;
+    }
+
+    int dup2(int oldfd, int newfd)
+    {
+        auto &socket_timeouts = fakeclock::SocketTimeouts::getInstance();
+        if (oldfd != newfd)
+        {
+            fakeclock::ClockSimulator::fdClosed(newfd);
+            socket_timeouts.fdClosed(newfd);
+        }
+        int result = fakeclock::real.dup2(oldfd, newfd);
+        if (result != -1 && oldfd != newfd)
+        {
+            fakeclock::ClockSimulator::fdDuplicated(oldfd, newfd);
+            socket_timeouts.fdDuplicated(oldfd, newfd);
+        }
+        return result;
+    }
+
+    int dup3(int oldfd, int newfd, int flags)
+    {
+        auto &socket_timeouts = fakeclock::SocketTimeouts::getInstance();
+        if (oldfd != newfd)
+        {
+            fakeclock::ClockSimulator::fdClosed(newfd);
+            socket_timeouts.fdClosed(newfd);
+        }
+        int result = fakeclock::real.dup3(oldfd, newfd, flags);
+        if (result != -1)
+        {
+            fakeclock::ClockSimulator::fdDuplicated(oldfd, newfd);
+            socket_timeouts.fdDuplicated(oldfd, newfd);
+        }
+        return result;
+    }
+
+    int fcntl(int fd, int cmd, ...)
+    {
+        va_list ap;
+        va_start(ap, cmd);
+        void *arg = va_arg(ap, void *); // the same way glibc forwards the optional argument
+        va_end(ap);
+        return fcntl_impl(fakeclock::real.fcntl, fd, cmd, arg);
+    }
+
+    int fcntl64(int fd, int cmd, ...)
+    {
+        va_list ap;
+        va_start(ap, cmd);
+        void *arg = va_arg(ap, void *);
+        va_end(ap);
+        return fcntl_impl(fakeclock::real.fcntl64, fd, cmd, arg);
+    }
+
+    int close_range(unsigned int first, unsigned int last, int flags) noexcept
+    {
+        if (!(flags & CLOSE_RANGE_CLOEXEC))
+        {
+            fakeclock::ClockSimulator::fdRangeClosed(first, last);
+            fakeclock::SocketTimeouts::getInstance().fdRangeClosed(first, last);
+        }
+        if (!fakeclock::real.close_range)
+        {
+            return syscall(SYS_close_range, first, last, flags);
+        }
+        return fakeclock::real.close_range(first, last, flags);
+    }
+}
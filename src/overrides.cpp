@@ -2,122 +2,515 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstring>
-#include <dlfcn.h>
+#include <fakeclock/ClockLog.h>
 #include <fakeclock/ClockSimulator.h>
+#include <fakeclock/FdWait.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/SocketTimeouts.h>
+#include <fakeclock/Stats.h>
+#include <fakeclock/Trace.h>
 #include <fakeclock/common.h>
 #include <iostream>
 #include <mutex>
+#include <optional>
 #include <poll.h>
+#include <pthread.h>
 #include <queue>
 #include <stdexcept>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/select.h>
 #include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 using TimePoint = fakeclock::ClockSimulator::TimePoint;
 using Duration = fakeclock::ClockSimulator::Duration;
 using fakeclock::FakeClock;
 using fakeclock::to_duration;
+using fakeclock::TraceOp;
+
+namespace
+{
+
+/// glibc declares some pointer arguments nonnull, which would let the compiler drop checks for null. Callers may pass
+/// null anyway, which the real calls accept.
+template <typename T> bool is_null(T *pointer)
+{
+    asm("" : "+r"(pointer)); // hides where the pointer comes from
+    return pointer == nullptr;
+}
+
+/// Bumped in forked children, so that they do not keep using the wake fds they share with their parent.
+std::atomic<unsigned> fork_generation = 0;
+[[maybe_unused]] const int fork_handler_registered = pthread_atfork(nullptr, nullptr, [] { fork_generation++; });
+
+/// State of an intercepted fd wait (poll, select, epoll_wait, ...), with or without timeout. The fake timeout is
+/// signaled by the simulator through an eventfd that is polled together with the caller's fds. Each thread reuses its
+/// eventfd, waiter and pollfd buffer, into which the caller's fds are copied. Besides the real wait (and a read() of
+/// the eventfd when the timeout fires), a wait locks the simulator twice, which makes futex calls under contention, and
+/// registered threads copy their fds for the simulator (blocked_on_fds.assign), which allocates while they grow.
+class FdWait
+{
+  public:
+    FdWait() = default;
+    FdWait(const FdWait &) = delete;
+    FdWait &operator=(const FdWait &) = delete;
+    ~FdWait()
+    {
+        if (waiter_.wake_fd >= 0)
+        {
+            close(waiter_.wake_fd);
+        }
+    }
+
+    /// Cleared buffer for the fds to wait on.
+    std::vector<pollfd> &fds()
+    {
+        fds_.clear();
+        return fds_;
+    }
+
+    /// Waits like ppoll() on fds() until the fake time `deadline` (forever if there is none).
+    /// On return fds() holds the revents. The result only counts the caller's fds.
+    int wait(std::optional<TimePoint> deadline, const sigset_t *sigmask)
+    {
+        auto &simulator = fakeclock::ClockSimulator::getInstance();
+        if (deadline && !openWakeFd())
+        {
+            return -1;
+        }
+        fds_.reserve(fds_.size() + 1); // the wake fd must not move the fds the simulator looks at
+        if (!simulator.waitBegin(waiter_, deadline, fds_.data(), fds_.size()))
+        {
+            struct timespec no_wait = {0, 0};
+            return fakeclock::real.ppoll(fds_.data(), fds_.size(), &no_wait, sigmask);
+        }
+        if (deadline)
+        {
+            fds_.push_back({waiter_.wake_fd, POLLIN, 0});
+        }
+        int result = fakeclock::real.ppoll(fds_.data(), fds_.size(), nullptr, sigmask);
+        int saved_errno = errno;
+        bool expired = simulator.waitEnd(waiter_);
+        if (deadline)
+        {
+            if (expired)
+            {
+                uint64_t expirations;
+                auto _ = read(waiter_.wake_fd, &expirations, sizeof(expirations));
+                (void)_;
+            }
+            if (result > 0 && fds_.back().revents)
+            {
+                result--;
+            }
+            fds_.pop_back();
+        }
+        errno = saved_errno;
+        return result;
+    }
+
+    /// Marks the wait of the current thread as in progress. Returns false if it already is, i.e. when an fd wait is
+    /// made by a signal handler that interrupted another one.
+    bool tryAcquire()
+    {
+        return !std::exchange(busy_, true);
+    }
+    void release()
+    {
+        busy_ = false;
+    }
+
+  private:
+    bool openWakeFd()
+    {
+        auto generation = fork_generation.load(std::memory_order_relaxed);
+        if (waiter_.wake_fd >= 0 && generation_ == generation)
+        {
+            return true;
+        }
+        if (waiter_.wake_fd >= 0)
+        {
+            close(waiter_.wake_fd); // inherited from the parent process
+        }
+        waiter_.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        generation_ = generation;
+        return waiter_.wake_fd >= 0;
+    }
+
+    fakeclock::Waiter waiter_;
+    std::vector<pollfd> fds_;
+    unsigned generation_ = 0;
+    bool busy_ = false;
+};
+
+/// Gives access to the FdWait of the current thread, or to a private one for nested waits.
+class FdWaitScope
+{
+  public:
+    FdWaitScope()
+    {
+        static thread_local FdWait thread_wait;
+        if (thread_wait.tryAcquire())
+        {
+            wait_ = &thread_wait;
+        }
+        else
+        {
+            wait_ = &nested_wait_.emplace();
+        }
+    }
+    ~FdWaitScope()
+    {
+        if (!nested_wait_)
+        {
+            wait_->release();
+        }
+    }
+    FdWaitScope(const FdWaitScope &) = delete;
+    FdWaitScope &operator=(const FdWaitScope &) = delete;
+
+    FdWait *operator->()
+    {
+        return wait_;
+    }
+
+  private:
+    FdWait *wait_;
+    std::optional<FdWait> nested_wait_;
+};
+
+/// Whether an fd wait with `timeout` (none if it is infinite) must be emulated rather than passed to the real call.
+/// Infinite waits are emulated too, so that the simulator knows the thread is blocked (for automatic time advance and
+/// MasterOfTime::advanceAndSettle()).
+bool emulates_fd_wait(std::optional<Duration> timeout)
+{
+    return fakeclock::isIntercepting() && !(timeout && *timeout <= Duration::zero());
+}
+
+/// Timeout of an fd wait for the trace, -1 if it is infinite.
+int64_t trace_timeout(std::optional<Duration> timeout)
+{
+    return timeout ? timeout->count() : -1;
+}
+
+std::optional<TimePoint> fd_wait_deadline(const fakeclock::ClockSimulator &simulator, std::optional<Duration> timeout)
+{
+    if (!timeout)
+    {
+        return std::nullopt;
+    }
+    return simulator.now() + *timeout;
+}
+
+std::optional<Duration> poll_timeout(int timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        return std::nullopt;
+    }
+    return std::chrono::milliseconds(timeout_ms);
+}
+
+std::optional<Duration> timespec_timeout(const struct timespec *timeout)
+{
+    if (!timeout)
+    {
+        return std::nullopt;
+    }
+    return to_duration(*timeout);
+}
+
+std::optional<Duration> timeval_timeout(const struct timeval *timeout)
+{
+    if (!timeout)
+    {
+        return std::nullopt;
+    }
+    return std::chrono::seconds(timeout->tv_sec) + std::chrono::microseconds(timeout->tv_usec);
+}
+
+int fake_ppoll(TraceOp op, struct pollfd *fds, nfds_t nfds, std::optional<Duration> timeout, const sigset_t *sigmask)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    fakeclock::trace(op, -1, trace_timeout(timeout), static_cast<int64_t>(nfds));
+    FdWaitScope wait;
+    auto &pollfds = wait->fds();
+    pollfds.assign(fds, fds + nfds);
+    int result = wait->wait(fd_wait_deadline(simulator, timeout), sigmask);
+    fakeclock::trace(TraceOp::Wake, -1, result);
+    fakeclock::countFdWait(result);
+    if (result >= 0)
+    {
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            fds[i].revents = pollfds[i].revents;
+        }
+    }
+    return result;
+}
+
+int fake_pselect(TraceOp op, int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+                 std::optional<Duration> timeout, const sigset_t *sigmask)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    fakeclock::trace(op, -1, trace_timeout(timeout), nfds);
+    FdWaitScope wait;
+    auto &pollfds = wait->fds();
+    for (int fd = 0; fd < nfds; fd++)
+    {
+        short events = 0;
+        events |= (readfds && FD_ISSET(fd, readfds)) ? POLLIN : 0;
+        events |= (writefds && FD_ISSET(fd, writefds)) ? POLLOUT : 0;
+        events |= (exceptfds && FD_ISSET(fd, exceptfds)) ? POLLPRI : 0;
+        if (events)
+        {
+            pollfds.push_back({fd, events, 0});
+        }
+    }
+    int result = wait->wait(fd_wait_deadline(simulator, timeout), sigmask);
+    fakeclock::trace(TraceOp::Wake, -1, result);
+    fakeclock::countFdWait(result);
+    if (result < 0)
+    {
+        return result;
+    }
+    int ready = 0;
+    for (const auto &pollfd : pollfds)
+    {
+        if (pollfd.revents & POLLNVAL)
+        {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    for (const auto &pollfd : pollfds)
+    {
+        auto update = [&](fd_set *set, short ready_events) {
+            if (set && FD_ISSET(pollfd.fd, set))
+            {
+                if (pollfd.revents & ready_events)
+                {
+                    ready++;
+                }
+                else
+                {
+                    FD_CLR(pollfd.fd, set);
+                }
+            }
+        };
+        update(readfds, POLLIN | POLLHUP | POLLERR);
+        update(writefds, POLLOUT | POLLERR);
+        update(exceptfds, POLLPRI);
+    }
+    return ready;
+}
+
+int fake_epoll_pwait(TraceOp op, int epfd, struct epoll_event *events, int maxevents, std::optional<Duration> timeout,
+                     const sigset_t *sigmask)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    fakeclock::trace(op, -1, trace_timeout(timeout), epfd);
+    auto deadline = fd_wait_deadline(simulator, timeout);
+    FdWaitScope wait;
+    while (true)
+    {
+        // An epoll fd is readable while it has events, so no epoll_ctl() is needed to add the wake fd.
+        wait->fds().push_back({epfd, POLLIN, 0});
+        int result = wait->wait(deadline, sigmask);
+        if (result > 0)
+        {
+            result = fakeclock::real.epoll_wait(epfd, events, maxevents, 0);
+            if (result == 0)
+            {
+                continue; // another thread took the events, keep waiting
+            }
+        }
+        fakeclock::trace(TraceOp::Wake, -1, result);
+        fakeclock::countFdWait(result);
+        return result;
+    }
+}
+
+/// Intercepted sleep until `deadline`. While replaying, the sleep ends when the recorded one did instead: the thread
+/// moves time there and returns, as other threads may have moved time past the recorded start of the sleep.
+void sleep_until(fakeclock::ClockSimulator &simulator, TraceOp op, int clock_id, TimePoint deadline)
+{
+    fakeclock::trace(op, clock_id, deadline.time_since_epoch().count());
+    fakeclock::countSleep(deadline - simulator.now());
+    if (!fakeclock::replayClock(op, clock_id))
+    {
+        simulator.waitUntil(deadline);
+    }
+    fakeclock::trace(TraceOp::Wake);
+}
+
+/// Waits in an intercepted fd wait until timerfd `fd` is readable, if it is a blocking one, so that the simulator sees
+/// a thread blocked in read() like one blocked in poll(). Returns false if a signal interrupted the wait.
+bool wait_for_timerfd(int fd)
+{
+    if (fakeclock::real.fcntl(fd, F_GETFL, nullptr) & O_NONBLOCK)
+    {
+        return true;
+    }
+    return fakeclock::waitForFd(fd, POLLIN, std::nullopt) >= 0;
+}
+
+/// Records the time until the first expiration of timerfd `fd`, which was just set on real time.
+void record_timerfd(int fd)
+{
+    struct itimerspec current;
+    if (fakeclock::clock_recording.load(std::memory_order_relaxed) &&
+        fakeclock::real.timerfd_gettime(fd, &current) == 0)
+    {
+        fakeclock::recordClock(TraceOp::TimerfdSettime, -1, to_duration(current.it_value).count());
+    }
+}
+
+} // namespace
+
+namespace fakeclock
+{
+
+int waitForFd(int fd, short events, std::optional<TimePoint> deadline)
+{
+    FdWaitScope wait;
+    auto &pollfds = wait->fds();
+    pollfds.push_back({fd, events, 0});
+    int result = wait->wait(deadline, nullptr);
+    return result > 0 ? pollfds[0].revents : result;
+}
+
+} // namespace fakeclock
 
 extern "C"
 {
     unsigned int sleep(unsigned int seconds)
     {
-        static const auto real_sleep = (decltype(&sleep))dlsym(RTLD_NEXT, "sleep");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_sleep(seconds);
+            auto result = fakeclock::real.sleep(seconds);
+            fakeclock::recordClock(TraceOp::Sleep, -1, Duration(std::chrono::seconds(seconds)).count());
+            return result;
         }
         else
         {
-            auto now = simulator.now();
-            simulator.waitUntil(now + std::chrono::seconds(seconds));
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            sleep_until(simulator, TraceOp::Sleep, -1, simulator.now() + std::chrono::seconds(seconds));
             return 0;
         }
     }
 
     int usleep(useconds_t usec)
     {
-        static const auto real_usleep = (decltype(&usleep))dlsym(RTLD_NEXT, "usleep");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_usleep(usec);
+            int result = fakeclock::real.usleep(usec);
+            fakeclock::recordClock(TraceOp::Usleep, -1, Duration(std::chrono::microseconds(usec)).count());
+            return result;
         }
         else
         {
-            auto now = simulator.now();
-            simulator.waitUntil(now + std::chrono::microseconds(usec));
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            sleep_until(simulator, TraceOp::Usleep, -1, simulator.now() + std::chrono::microseconds(usec));
             return 0;
         }
     }
 
     int nanosleep(const struct timespec *req, struct timespec *rem)
     {
-        static const auto real_nanosleep = (decltype(&nanosleep))dlsym(RTLD_NEXT, "nanosleep");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_nanosleep(req, rem);
+            int result = fakeclock::real.nanosleep(req, rem);
+            if (result == 0 && fakeclock::clock_recording.load(std::memory_order_relaxed))
+            {
+                fakeclock::recordClock(TraceOp::Nanosleep, -1, to_duration(*req).count());
+            }
+            return result;
         }
         else
         {
+            if (!req)
+            {
+                errno = EFAULT;
+                return -1;
+            }
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             auto duration = std::chrono::seconds(req->tv_sec) + std::chrono::nanoseconds(req->tv_nsec);
-            auto now = simulator.now();
-            simulator.waitUntil(now + duration);
+            sleep_until(simulator, TraceOp::Nanosleep, -1, simulator.now() + duration);
             return 0;
         }
     }
 
     int gettimeofday(struct timeval *tv, void *tz)
     {
-        static const auto real_gettimeofday = (decltype(&gettimeofday))dlsym(RTLD_NEXT, "gettimeofday");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_gettimeofday(tv, tz);
+            int result = fakeclock::real_gettimeofday(tv, tz);
+            // Both arguments may be null.
+            if (result == 0 && !is_null(tv) && fakeclock::clock_recording.load(std::memory_order_relaxed))
+            {
+                fakeclock::recordClock(TraceOp::Gettimeofday, CLOCK_REALTIME, to_duration(*tv).count());
+            }
+            return result;
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            // Other threads that take turns may run in between, like they could when the real clock is read.
+            simulator.yieldTurn();
             // TODO: handle tz
-            auto duration = simulator.getTime(CLOCK_REALTIME).time_since_epoch();
-            tv->tv_sec = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
-            tv->tv_usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() % 1000000;
+            auto recorded = fakeclock::replayClock(TraceOp::Gettimeofday, CLOCK_REALTIME);
+            auto duration = recorded ? Duration(*recorded) : simulator.getTime(CLOCK_REALTIME).time_since_epoch();
+            if (!is_null(tv))
+            {
+                tv->tv_sec = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+                tv->tv_usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() % 1000000;
+            }
+            fakeclock::trace(TraceOp::Gettimeofday, CLOCK_REALTIME, duration.count());
+            fakeclock::countClockRead(CLOCK_REALTIME);
             return 0;
         }
     }
 
     int clock_gettime(clockid_t clk_id, struct timespec *ts) noexcept
     {
-        static const auto real_clock_gettime = (decltype(&clock_gettime))dlsym(RTLD_NEXT, "clock_gettime");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_clock_gettime(clk_id, ts);
+            int result = fakeclock::real_clock_gettime(clk_id, ts);
+            if (result == 0 && fakeclock::clock_recording.load(std::memory_order_relaxed))
+            {
+                fakeclock::recordClock(TraceOp::ClockGettime, clk_id, to_duration(*ts).count());
+            }
+            return result;
         }
         else
         {
-            auto duration = simulator.getTime(clk_id).time_since_epoch();
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            simulator.yieldTurn();
+            auto recorded = fakeclock::replayClock(TraceOp::ClockGettime, clk_id);
+            auto duration = recorded ? Duration(*recorded) : simulator.getTime(clk_id).time_since_epoch();
             ts->tv_sec = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
             ts->tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() % 1000000000;
+            fakeclock::trace(TraceOp::ClockGettime, clk_id, duration.count());
+            fakeclock::countClockRead(clk_id);
             return 0;
         }
     }
 
     int settimeofday(const struct timeval *tv, const struct timezone *tz)
     {
-        static const auto real_settimeofday = (decltype(&settimeofday))dlsym(RTLD_NEXT, "settimeofday");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_settimeofday(tv, tz);
+            return fakeclock::real.settimeofday(tv, tz);
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             if (!tv)
             {
                 errno = EFAULT;
@@ -132,6 +525,8 @@ extern "C"
             auto duration = std::chrono::seconds(tv->tv_sec) + std::chrono::microseconds(tv->tv_usec);
             // TODO: handle tz
             simulator.setTime(TimePoint(duration), CLOCK_REALTIME);
+            fakeclock::trace(TraceOp::Settimeofday, CLOCK_REALTIME, Duration(duration).count());
+            fakeclock::count(fakeclock::Stat::ClockSet);
             (void)tz;
             return 0;
         }
@@ -139,14 +534,13 @@ extern "C"
 
     int clock_settime(clockid_t clk_id, const struct timespec *ts)
     {
-        static const auto real_clock_settime = (decltype(&clock_settime))dlsym(RTLD_NEXT, "clock_settime");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_clock_settime(clk_id, ts);
+            return fakeclock::real.clock_settime(clk_id, ts);
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             if (ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000)
             {
                 errno = EINVAL;
@@ -154,23 +548,32 @@ extern "C"
             }
             auto duration = std::chrono::seconds(ts->tv_sec) + std::chrono::nanoseconds(ts->tv_nsec);
             simulator.setTime(TimePoint(duration), clk_id);
+            fakeclock::trace(TraceOp::ClockSettime, clk_id, duration.count());
+            fakeclock::count(fakeclock::Stat::ClockSet);
             return 0;
         }
     }
 
     time_t time(time_t *t)
     {
-        static const auto real_time = (decltype(&time))dlsym(RTLD_NEXT, "time");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_time(t);
+            time_t result = fakeclock::real.time(t);
+            if (result != time_t(-1))
+            {
+                fakeclock::recordClock(TraceOp::Time, CLOCK_REALTIME, Duration(std::chrono::seconds(result)).count());
+            }
+            return result;
         }
         else
         {
-            time_t result =
-                std::chrono::duration_cast<std::chrono::seconds>(simulator.getTime(CLOCK_REALTIME).time_since_epoch())
-                    .count();
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            simulator.yieldTurn();
+            auto recorded = fakeclock::replayClock(TraceOp::Time, CLOCK_REALTIME);
+            auto duration = recorded ? Duration(*recorded) : simulator.getTime(CLOCK_REALTIME).time_since_epoch();
+            time_t result = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+            fakeclock::trace(TraceOp::Time, CLOCK_REALTIME, duration.count());
+            fakeclock::countClockRead(CLOCK_REALTIME);
             if (t)
             {
                 *t = result;
@@ -181,108 +584,125 @@ extern "C"
 
     int poll(struct pollfd *fds, nfds_t nfds, int timeout)
     {
-        static const auto real_poll = (decltype(&poll))dlsym(RTLD_NEXT, "poll");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting() || timeout <= 0)
+        if (!emulates_fd_wait(poll_timeout(timeout)))
         {
-            return real_poll(fds, nfds, timeout);
+            return fakeclock::real.poll(fds, nfds, timeout);
         }
         else
         {
-            auto now = simulator.now();
-            int fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
-            simulator.timerfdSetTime(fd, now + std::chrono::milliseconds(timeout));
-            struct pollfd fake_fd = {fd, POLLIN, 0};
-            std::vector<struct pollfd> all_fds(fds, fds + nfds);
-            all_fds.push_back(fake_fd);
-            int result = real_poll(all_fds.data(), all_fds.size(), -1);
-            close(fd);
-            return result;
+            return fake_ppoll(TraceOp::Poll, fds, nfds, poll_timeout(timeout), nullptr);
+        }
+    }
+
+    int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout, const sigset_t *sigmask)
+    {
+        if (!emulates_fd_wait(timespec_timeout(timeout)))
+        {
+            return fakeclock::real.ppoll(fds, nfds, timeout, sigmask);
+        }
+        else
+        {
+            return fake_ppoll(TraceOp::Ppoll, fds, nfds, timespec_timeout(timeout), sigmask);
         }
     }
 
     int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
     {
-        static const auto real_epoll_wait = (decltype(&epoll_wait))dlsym(RTLD_NEXT, "epoll_wait");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting() || timeout <= 0)
+        if (!emulates_fd_wait(poll_timeout(timeout)))
         {
-            return real_epoll_wait(epfd, events, maxevents, timeout);
+            return fakeclock::real.epoll_wait(epfd, events, maxevents, timeout);
         }
         else
         {
-            auto now = simulator.now();
-            int fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
-            simulator.timerfdSetTime(fd, now + std::chrono::milliseconds(timeout));
-            struct epoll_event fake_event;
-            fake_event.events = EPOLLIN;
-            fake_event.data.fd = fd;
-            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &fake_event);
-            int result = real_epoll_wait(epfd, events, maxevents, -1);
-            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
-            close(fd);
-            return result;
+            return fake_epoll_pwait(TraceOp::EpollWait, epfd, events, maxevents, poll_timeout(timeout), nullptr);
+        }
+    }
+
+    int epoll_pwait(int epfd, struct epoll_event *events, int maxevents, int timeout, const sigset_t *sigmask)
+    {
+        if (!emulates_fd_wait(poll_timeout(timeout)))
+        {
+            return fakeclock::real.epoll_pwait(epfd, events, maxevents, timeout, sigmask);
+        }
+        else
+        {
+            return fake_epoll_pwait(TraceOp::EpollPwait, epfd, events, maxevents, poll_timeout(timeout), sigmask);
         }
     }
 
+#if __GLIBC_PREREQ(2, 35)
+    int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents, const struct timespec *timeout,
+                     const sigset_t *sigmask)
+    {
+        if (!emulates_fd_wait(timespec_timeout(timeout)))
+        {
+            return fakeclock::real.epoll_pwait2(epfd, events, maxevents, timeout, sigmask);
+        }
+        else
+        {
+            return fake_epoll_pwait(TraceOp::EpollPwait2, epfd, events, maxevents, timespec_timeout(timeout),
+                                    sigmask);
+        }
+    }
+#endif
+
     int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
     {
-        static const auto real_select = (decltype(&select))dlsym(RTLD_NEXT, "select");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting() || !timeout)
+        if (!emulates_fd_wait(timeval_timeout(timeout)))
         {
-            return real_select(nfds, readfds, writefds, exceptfds, timeout);
+            return fakeclock::real.select(nfds, readfds, writefds, exceptfds, timeout);
         }
         else
         {
-            auto now = simulator.now();
-            auto duration = std::chrono::seconds(timeout->tv_sec) + std::chrono::microseconds(timeout->tv_usec);
-            int fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
-            simulator.timerfdSetTime(fd, now + duration);
-            fd_set fake_readfds = *readfds;
-            FD_SET(fd, &fake_readfds);
-            int result = real_select(std::max(nfds, fd + 1), &fake_readfds, writefds, exceptfds, nullptr);
-            if (result > 0)
-            {
-                if (FD_ISSET(fd, &fake_readfds))
-                {
-                    uint64_t buf;
-                    auto _ = read(fd, &buf, sizeof(buf));
-                    (void)_;
-                    result--;
-                }
-                FD_CLR(fd, &fake_readfds);
-                *readfds = fake_readfds;
-            }
-            close(fd);
-            return result;
+            return fake_pselect(TraceOp::Select, nfds, readfds, writefds, exceptfds, timeval_timeout(timeout),
+                                nullptr);
+        }
+    }
+
+    int pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, const struct timespec *timeout,
+                const sigset_t *sigmask)
+    {
+        if (!emulates_fd_wait(timespec_timeout(timeout)))
+        {
+            return fakeclock::real.pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
+        }
+        else
+        {
+            return fake_pselect(TraceOp::Pselect, nfds, readfds, writefds, exceptfds, timespec_timeout(timeout),
+                                sigmask);
         }
     }
 
     int timerfd_create(int clockid, int flags)
     {
-        static const auto real_timerfd_create = (decltype(&timerfd_create))dlsym(RTLD_NEXT, "timerfd_create");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_timerfd_create(clockid, flags);
+            return fakeclock::real.timerfd_create(clockid, flags);
         }
         else
         {
-            return simulator.timerfdCreate(clockid, flags);
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            int fd = simulator.timerfdCreate(clockid, flags);
+            fakeclock::trace(TraceOp::TimerfdCreate, clockid, fd);
+            fakeclock::count(fakeclock::Stat::TimerfdOperation);
+            return fd;
         }
     }
 
     int timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value)
     {
-        static const auto real_timerfd_settime = (decltype(&timerfd_settime))dlsym(RTLD_NEXT, "timerfd_settime");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_timerfd_settime(fd, flags, new_value, old_value);
+            int result = fakeclock::real.timerfd_settime(fd, flags, new_value, old_value);
+            if (result == 0 && new_value)
+            {
+                record_timerfd(fd);
+            }
+            return result;
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             try
             {
                 if (old_value)
@@ -300,10 +720,10 @@ extern "C"
                     }
 
                     std::chrono::time_point<FakeClock> expiration_time;
+                    auto clock_id = simulator.timerfdGetClockId(fd);
 
                     if (flags & TFD_TIMER_ABSTIME)
                     {
-                        auto clock_id = simulator.timerfdGetClockId(fd);
                         expiration_time =
                             simulator.toFakeTime(clock_id, {new_value->it_value.tv_sec, new_value->it_value.tv_nsec});
                     }
@@ -320,7 +740,13 @@ extern "C"
                         std::chrono::seconds(new_value->it_interval.tv_sec) +
                         std::chrono::nanoseconds(new_value->it_interval.tv_nsec));
 
-                    simulator.timerfdSetTime(fd, expiration_time, interval);
+                    // Like the kernel, only absolute timers on the settable clock cancel on set.
+                    bool cancel_on_set = (flags & TFD_TIMER_ABSTIME) && (flags & TFD_TIMER_CANCEL_ON_SET) &&
+                                         (clock_id == CLOCK_REALTIME || clock_id == CLOCK_REALTIME_ALARM);
+                    simulator.timerfdSetTime(fd, expiration_time, interval, cancel_on_set);
+                    fakeclock::trace(TraceOp::TimerfdSettime, -1, fd, expiration_time.time_since_epoch().count());
+                    fakeclock::replayClock(TraceOp::TimerfdSettime);
+                    fakeclock::count(fakeclock::Stat::TimerfdOperation);
                 }
             }
             catch (const std::out_of_range &e)
@@ -341,17 +767,18 @@ extern "C"
 
     int timerfd_gettime(int fd, struct itimerspec *curr_value)
     {
-        static const auto real_timerfd_gettime = (decltype(&timerfd_gettime))dlsym(RTLD_NEXT, "timerfd_gettime");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_timerfd_gettime(fd, curr_value);
+            return fakeclock::real.timerfd_gettime(fd, curr_value);
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             try
             {
                 simulator.timerfdGetTime(fd, curr_value);
+                fakeclock::trace(TraceOp::TimerfdGettime, -1, fd);
+                fakeclock::count(fakeclock::Stat::TimerfdOperation);
                 return 0;
             }
             catch (const std::out_of_range &e)
@@ -367,16 +794,49 @@ extern "C"
         }
     }
 
+    ssize_t read(int fd, void *buf, size_t count)
+    {
+        if (!fakeclock::isIntercepting())
+        {
+            return fakeclock::real.read(fd, buf, count);
+        }
+        else
+        {
+            if (fakeclock::SocketTimeouts::getInstance().get(fd, fakeclock::SocketTimeouts::Receive))
+            {
+                return ::recv(fd, buf, count, 0); // which waits for the receive timeout in fake time
+            }
+            // Timerfds are eventfds, whose reads already behave the same, except for TFD_TIMER_CANCEL_ON_SET.
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            bool may_be_timerfd = simulator.mayBeTimerfd(fd);
+            if (may_be_timerfd && count >= sizeof(uint64_t) && !wait_for_timerfd(fd))
+            {
+                return -1;
+            }
+            ssize_t result = fakeclock::real.read(fd, buf, count);
+            if (result > 0 && may_be_timerfd && simulator.timerfdTakeCanceled(fd))
+            {
+                errno = ECANCELED;
+                return -1;
+            }
+            return result;
+        }
+    }
+
     int clock_nanosleep(clockid_t clock_id, int flags, const struct timespec *request, struct timespec *remain)
     {
-        static const auto real_clock_nanosleep = (decltype(&clock_nanosleep))dlsym(RTLD_NEXT, "clock_nanosleep");
-        auto &simulator = fakeclock::ClockSimulator::getInstance();
-        if (!simulator.isIntercepting())
+        if (!fakeclock::isIntercepting())
         {
-            return real_clock_nanosleep(clock_id, flags, request, remain);
+            int result = fakeclock::real.clock_nanosleep(clock_id, flags, request, remain);
+            if (result == 0 && request && fakeclock::clock_recording.load(std::memory_order_relaxed))
+            {
+                fakeclock::recordClock(TraceOp::ClockNanosleep, clock_id, to_duration(*request).count());
+            }
+            return result;
         }
         else
         {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
             if (!request)
             {
                 return EFAULT;
@@ -398,16 +858,16 @@ extern "C"
                     if (target_time <= now)
                     {
                         // Target time has already passed
+                        fakeclock::replayClock(TraceOp::ClockNanosleep, clock_id);
                         return 0;
                     }
 
-                    simulator.waitUntil(target_time);
+                    sleep_until(simulator, TraceOp::ClockNanosleep, clock_id, target_time);
                 }
                 else
                 {
                     // For relative time, simply wait for the specified duration
-                    auto duration = to_duration(*request);
-                    simulator.waitUntil(simulator.now() + duration);
+                    sleep_until(simulator, TraceOp::ClockNanosleep, clock_id, now + to_duration(*request));
                 }
 
                 // In simulated time, there's no real interruption, so we always succeed
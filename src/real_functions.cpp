@@ -0,0 +1,81 @@
+#include <cstdarg>
+#include <dlfcn.h>
+#include <fakeclock/RealFunctions.h>
+#include <mutex>
+
+namespace fakeclock
+{
+
+namespace
+{
+
+/// Initial value of the entry `RealFunctions::*Entry`.
+template <auto Entry> struct Stub;
+
+template <typename R, typename... Args, bool NoExcept, R (*RealFunctions::*Entry)(Args...) noexcept(NoExcept)>
+struct Stub<Entry>
+{
+    static R call(Args... args) noexcept(NoExcept)
+    {
+        resolveRealFunctions();
+        return (real.*Entry)(args...);
+    }
+};
+
+template <typename Fn> Fn resolve(const char *name)
+{
+    return reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+}
+
+template <typename Fn> Fn resolve_vdso(void *vdso, const char *x86_name, const char *arm_name)
+{
+    if (!vdso)
+    {
+        return nullptr;
+    }
+    void *symbol = dlsym(vdso, x86_name);
+    return reinterpret_cast<Fn>(symbol ? symbol : dlsym(vdso, arm_name));
+}
+
+} // namespace
+
+// Constant-initialized, so that it is usable before any constructor runs.
+RealFunctions real = {
+#define FAKECLOCK_STUB(name) &Stub<&RealFunctions::name>::call,
+    FAKECLOCK_REAL_FUNCTIONS(FAKECLOCK_STUB)
+#undef FAKECLOCK_STUB
+    &Stub<&RealFunctions::fcntl>::call,
+    &Stub<&RealFunctions::fcntl64>::call,
+    &Stub<&RealFunctions::syscall>::call,
+    nullptr,
+    nullptr,
+};
+
+void resolveRealFunctions()
+{
+    static std::once_flag resolved;
+    std::call_once(resolved, [] {
+        RealFunctions resolved_functions;
+#define FAKECLOCK_RESOLVE(name) resolved_functions.name = resolve<decltype(RealFunctions::name)>(#name);
+        FAKECLOCK_REAL_FUNCTIONS(FAKECLOCK_RESOLVE)
+#undef FAKECLOCK_RESOLVE
+        // glibc reads the optional argument of fcntl() as a pointer as well
+        resolved_functions.fcntl = resolve<int (*)(int, int, void *)>("fcntl");
+        resolved_functions.fcntl64 = resolve<int (*)(int, int, void *)>("fcntl64");
+        resolved_functions.syscall = resolve<decltype(RealFunctions::syscall)>("syscall");
+        void *vdso = dlopen("linux-vdso.so.1", RTLD_NOW | RTLD_NOLOAD);
+        resolved_functions.vdso_clock_gettime =
+            resolve_vdso<decltype(RealFunctions::vdso_clock_gettime)>(vdso, "__vdso_clock_gettime",
+                                                                     "__kernel_clock_gettime");
+        resolved_functions.vdso_gettimeofday = resolve_vdso<decltype(RealFunctions::vdso_gettimeofday)>(
+            vdso, "__vdso_gettimeofday", "__kernel_gettimeofday");
+        real = resolved_functions;
+    });
+}
+
+} // namespace fakeclock
+
+__attribute__((constructor)) static void resolve_real_functions_on_load()
+{
+    fakeclock::resolveRealFunctions();
+}
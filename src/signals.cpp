@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/Stats.h>
+#include <fakeclock/TimedWait.h>
+#include <fakeclock/Trace.h>
+#include <fakeclock/common.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// alarm() and ITIMER_REAL of setitimer() run on a simulated POSIX timer that sends SIGALRM to the process, and the
+// timeouts of sigtimedwait() are fake time. The other interval timers count CPU time and stay real.
+//
+// sigtimedwait() waits for real without timeout, for the signals of the program and WAKE_SIGNAL, which the simulator
+// sends the thread at the deadline. WAKE_SIGNAL stays blocked until the wait has taken it, so it is never delivered.
+// Programs that use SIGRTMAX themselves may lose it to a sigtimedwait() with timeout.
+
+using Duration = fakeclock::ClockSimulator::Duration;
+using fakeclock::to_duration;
+using fakeclock::TraceOp;
+
+namespace
+{
+
+using namespace std::chrono_literals;
+
+/// The signal that ends sigtimedwait() at its deadline. The last real-time signal is the least likely to be in use.
+int wake_signal()
+{
+    return SIGRTMAX;
+}
+
+bool is_valid(const timeval &tv)
+{
+    return tv.tv_sec >= 0 && tv.tv_usec >= 0 && tv.tv_usec < 1000000;
+}
+
+/// The setting of ITIMER_REAL as getitimer() reports it.
+itimerval get_real_itimer(fakeclock::ClockSimulator &simulator, timer_t timerid)
+{
+    itimerspec current;
+    simulator.posixTimerGetTime(timerid, &current);
+    auto remaining = to_duration(current.it_value);
+    if (remaining > Duration::zero())
+    {
+        remaining = std::max<Duration>(remaining, 1us); // an armed timer never reports zero, like in the kernel
+    }
+    return {fakeclock::to_timeval(to_duration(current.it_interval)), fakeclock::to_timeval(remaining)};
+}
+
+/// Arms ITIMER_REAL with `value` (disarms it if it_value is zero) and returns its previous setting.
+itimerval set_real_itimer(const itimerval &value)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    auto timerid = simulator.realItimer();
+    auto old_value = get_real_itimer(simulator, timerid);
+    auto expiration_time = fakeclock::PosixTimer::DISARM_TIME;
+    if (to_duration(value.it_value) > Duration::zero())
+    {
+        expiration_time = simulator.now() + to_duration(value.it_value);
+    }
+    simulator.posixTimerSetTime(timerid, expiration_time, to_duration(value.it_interval));
+    fakeclock::count(fakeclock::Stat::PosixTimerOperation);
+    return old_value;
+}
+
+} // namespace
+
+extern "C"
+{
+    unsigned int alarm(unsigned int seconds)
+    {
+        if (!fakeclock::isIntercepting())
+        {
+            return fakeclock::real.alarm(seconds);
+        }
+        else
+        {
+            itimerval value = {};
+            value.it_value.tv_sec = seconds;
+            auto old_value = set_real_itimer(value);
+            // Rounded like glibc does, which never returns zero for a pending alarm.
+            unsigned int remaining = old_value.it_value.tv_sec;
+            if (old_value.it_value.tv_usec >= 500000 || (remaining == 0 && old_value.it_value.tv_usec > 0))
+            {
+                remaining++;
+            }
+            return remaining;
+        }
+    }
+
+    int setitimer(__itimer_which_t which, const struct itimerval *new_value, struct itimerval *old_value)
+    {
+        if (!fakeclock::isIntercepting() || which != ITIMER_REAL)
+        {
+            return fakeclock::real.setitimer(which, new_value, old_value);
+        }
+        else
+        {
+            // Linux takes a null new_value for a disarmed one.
+            itimerval value = new_value ? *new_value : itimerval{};
+            if (!is_valid(value.it_value) || !is_valid(value.it_interval))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            auto previous = set_real_itimer(value);
+            if (old_value)
+            {
+                *old_value = previous;
+            }
+            return 0;
+        }
+    }
+
+    int getitimer(__itimer_which_t which, struct itimerval *curr_value)
+    {
+        if (!fakeclock::isIntercepting() || which != ITIMER_REAL)
+        {
+            return fakeclock::real.getitimer(which, curr_value);
+        }
+        else
+        {
+            if (!curr_value)
+            {
+                errno = EFAULT;
+                return -1;
+            }
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            *curr_value = get_real_itimer(simulator, simulator.realItimer());
+            fakeclock::count(fakeclock::Stat::PosixTimerOperation);
+            return 0;
+        }
+    }
+
+    int sigtimedwait(const sigset_t *set, siginfo_t *info, const struct timespec *timeout)
+    {
+        if (!fakeclock::isIntercepting() || !timeout || timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+            timeout->tv_nsec >= 1000000000)
+        {
+            return fakeclock::real.sigtimedwait(set, info, timeout);
+        }
+        else
+        {
+            auto &simulator = fakeclock::ClockSimulator::getInstance();
+            auto abstime = simulator.toTimespec(CLOCK_MONOTONIC, simulator.now() + to_duration(*timeout));
+            sigset_t wake_set;
+            sigemptyset(&wake_set);
+            sigaddset(&wake_set, wake_signal());
+            sigset_t old_mask;
+            pthread_sigmask(SIG_BLOCK, &wake_set, &old_mask);
+            sigset_t waited = *set;
+            sigaddset(&waited, wake_signal());
+            // The slice is unused: the real wait has no timeout, unless timedWait() passes a zero deadline to take
+            // only the pending signals. It reports running out of time with EAGAIN.
+            fakeclock::TimedWait spec = {TraceOp::Sigtimedwait, CLOCK_MONOTONIC, abstime, CLOCK_MONOTONIC, 0ns};
+            spec.signal = wake_signal();
+            int signo = -1;
+            int error = fakeclock::timedWait(spec, [&](const timespec &t) {
+                timespec pending_only = {0, 0};
+                bool check_only = t.tv_sec == 0 && t.tv_nsec == 0;
+                signo = fakeclock::real.sigtimedwait(&waited, info, check_only ? &pending_only : nullptr);
+                if (signo > 0)
+                {
+                    return signo == wake_signal() ? ETIMEDOUT : 0;
+                }
+                return errno == EAGAIN ? ETIMEDOUT : errno;
+            });
+            // The deadline may have passed while the wait took another signal, which leaves WAKE_SIGNAL pending.
+            timespec pending_only = {0, 0};
+            fakeclock::real.sigtimedwait(&wake_set, nullptr, &pending_only);
+            pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+            if (error)
+            {
+                errno = error == ETIMEDOUT ? EAGAIN : error;
+                return -1;
+            }
+            return signo;
+        }
+    }
+}
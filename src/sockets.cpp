@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/FdWait.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/SocketTimeouts.h>
+#include <optional>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Blocking socket calls on sockets with a receive or send timeout (SO_RCVTIMEO, SO_SNDTIMEO) time out in fake time:
+// they are made non-blocking, and wait for the socket in an intercepted fd wait that ends at the timeout. Sockets
+// without timeouts, and non-blocking calls, go straight to the real calls. Receives with MSG_WAITALL on stream sockets
+// gather the data of several non-blocking calls, and accepted sockets inherit the timeouts of the listening socket.
+// read(), readv(), write() and writev() on sockets with timeouts go through the socket calls as well.
+
+using Duration = fakeclock::SocketTimeouts::Duration;
+using fakeclock::SocketTimeouts;
+
+namespace
+{
+
+/// Whether setsockopt(SOL_SOCKET, `optname`) sets a timeout, and which.
+std::optional<SocketTimeouts::Direction> timeout_direction(int optname)
+{
+#ifdef SO_RCVTIMEO_NEW
+    if (optname == SO_RCVTIMEO_OLD || optname == SO_RCVTIMEO_NEW)
+    {
+        return SocketTimeouts::Receive;
+    }
+    if (optname == SO_SNDTIMEO_OLD || optname == SO_SNDTIMEO_NEW)
+    {
+        return SocketTimeouts::Send;
+    }
+#else
+    if (optname == SO_RCVTIMEO)
+    {
+        return SocketTimeouts::Receive;
+    }
+    if (optname == SO_SNDTIMEO)
+    {
+        return SocketTimeouts::Send;
+    }
+#endif
+    return std::nullopt;
+}
+
+/// The timeout `optval` of option `optname`, or zero if it means none. Negative timeouts make the kernel fail right
+/// away, which the real calls do by themselves, so they count as none too.
+Duration timeout_value(int optname, const void *optval, socklen_t optlen)
+{
+    int64_t seconds;
+    int64_t microseconds;
+#ifdef SO_RCVTIMEO_NEW
+    if (optname == SO_RCVTIMEO_NEW || optname == SO_SNDTIMEO_NEW)
+    {
+        int64_t value[2]; // struct __kernel_sock_timeval
+        if (optlen < sizeof(value))
+        {
+            return Duration::zero();
+        }
+        std::memcpy(value, optval, sizeof(value));
+        seconds = value[0];
+        microseconds = value[1];
+    }
+    else
+#endif
+    {
+        timeval value;
+        if (optlen < sizeof(value))
+        {
+            return Duration::zero();
+        }
+        std::memcpy(&value, optval, sizeof(value));
+        seconds = value.tv_sec;
+        microseconds = value.tv_usec;
+    }
+    auto timeout = std::chrono::seconds(seconds) + std::chrono::microseconds(microseconds);
+    return timeout > Duration::zero() ? Duration(timeout) : Duration::zero();
+}
+
+/// The timeout of a blocking call on `fd` in `direction` with `flags`, if fakeclock waits for it in fake time.
+std::optional<Duration> socket_timeout(int fd, SocketTimeouts::Direction direction, int flags = 0)
+{
+    if (!fakeclock::isIntercepting() || (flags & MSG_DONTWAIT))
+    {
+        return std::nullopt;
+    }
+    auto timeout = SocketTimeouts::getInstance().get(fd, direction);
+    if (!timeout || SocketTimeouts::getInstance().isNonBlocking(fd))
+    {
+        return std::nullopt;
+    }
+    return timeout;
+}
+
+/// Repeats `call`, the non-blocking variant of an intercepted call, while it fails with EAGAIN, and waits for `events`
+/// on `fd` in between. Fails with EAGAIN once `timeout` has passed in fake time, like the blocking call does.
+template <typename Call> auto with_timeout(int fd, short events, Duration timeout, Call &&call)
+{
+    auto deadline = fakeclock::ClockSimulator::getInstance().now() + timeout;
+    while (true)
+    {
+        auto result = call();
+        if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            return result;
+        }
+        int ready = fakeclock::waitForFd(fd, events, deadline);
+        if (ready <= 0)
+        {
+            if (ready == 0)
+            {
+                errno = EAGAIN;
+            }
+            return decltype(result)(-1);
+        }
+    }
+}
+
+/// Whether `flags` make a receive on `fd` wait until the whole buffer is filled, which only stream sockets do.
+bool waits_for_all(int fd, int flags)
+{
+    if (!(flags & MSG_WAITALL))
+    {
+        return false;
+    }
+    int type = 0;
+    socklen_t type_size = sizeof(type);
+    return getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_size) == 0 && type == SOCK_STREAM;
+}
+
+/// with_timeout() for receives with MSG_WAITALL: repeats `call(received)`, which receives into the buffer after the
+/// `received` bytes received so far, until `len` bytes arrived. Like the kernel, returns what was received if the
+/// connection ends, an error occurs or the timeout passes in between.
+template <typename Call> ssize_t receive_all(int fd, size_t len, Duration timeout, Call &&call)
+{
+    size_t received = 0;
+    auto result = with_timeout(fd, POLLIN, timeout, [&] {
+        while (true)
+        {
+            ssize_t part = call(received);
+            if (part > 0)
+            {
+                received += size_t(part);
+                if (received < len)
+                {
+                    continue;
+                }
+            }
+            if (part < 0 && received > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return ssize_t(-1); // waits for more
+            }
+            return part < 0 && received == 0 ? part : ssize_t(received);
+        }
+    });
+    return result < 0 && received > 0 ? ssize_t(received) : result;
+}
+
+/// The iovecs of `msg` after its first `skipped` bytes.
+std::vector<iovec> iovecs_after(const msghdr &msg, size_t skipped)
+{
+    std::vector<iovec> rest;
+    for (size_t i = 0; i < msg.msg_iovlen; i++)
+    {
+        auto part = msg.msg_iov[i];
+        size_t skip = std::min(skipped, part.iov_len);
+        skipped -= skip;
+        if (skip < part.iov_len)
+        {
+            rest.push_back({static_cast<char *>(part.iov_base) + skip, part.iov_len - skip});
+        }
+    }
+    return rest;
+}
+
+} // namespace
+
+extern "C"
+{
+    int setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen)
+    {
+        int result = fakeclock::real.setsockopt(fd, level, optname, optval, optlen);
+        if (result == 0 && level == SOL_SOCKET)
+        {
+            // Recorded even while time is not intercepted, as sockets may outlive MasterOfTime.
+            if (auto direction = timeout_direction(optname))
+            {
+                SocketTimeouts::getInstance().set(fd, *direction, timeout_value(optname, optval, optlen));
+            }
+        }
+        return result;
+    }
+
+    ssize_t recv(int fd, void *buf, size_t len, int flags)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Receive, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.recv(fd, buf, len, flags);
+        }
+        if (waits_for_all(fd, flags))
+        {
+            return receive_all(fd, len, *timeout, [&](size_t received) {
+                return fakeclock::real.recv(fd, static_cast<char *>(buf) + received, len - received,
+                                            flags | MSG_DONTWAIT);
+            });
+        }
+        return with_timeout(fd, POLLIN, *timeout,
+                            [&] { return fakeclock::real.recv(fd, buf, len, flags | MSG_DONTWAIT); });
+    }
+
+    ssize_t recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Receive, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.recvfrom(fd, buf, len, flags, src_addr, addrlen);
+        }
+        if (waits_for_all(fd, flags))
+        {
+            return receive_all(fd, len, *timeout, [&](size_t received) {
+                return fakeclock::real.recvfrom(fd, static_cast<char *>(buf) + received, len - received,
+                                                flags | MSG_DONTWAIT, src_addr, addrlen);
+            });
+        }
+        return with_timeout(fd, POLLIN, *timeout, [&] {
+            return fakeclock::real.recvfrom(fd, buf, len, flags | MSG_DONTWAIT, src_addr, addrlen);
+        });
+    }
+
+    ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Receive, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.recvmsg(fd, msg, flags);
+        }
+        if (waits_for_all(fd, flags))
+        {
+            size_t len = 0;
+            for (size_t i = 0; i < msg->msg_iovlen; i++)
+            {
+                len += msg->msg_iov[i].iov_len;
+            }
+            auto controllen = msg->msg_controllen;
+            return receive_all(fd, len, *timeout, [&](size_t received) {
+                auto rest = iovecs_after(*msg, received);
+                msghdr part = *msg;
+                part.msg_iov = rest.data();
+                part.msg_iovlen = rest.size();
+                part.msg_controllen = controllen;
+                auto result = fakeclock::real.recvmsg(fd, &part, flags | MSG_DONTWAIT);
+                msg->msg_namelen = part.msg_namelen;
+                msg->msg_controllen = part.msg_controllen;
+                msg->msg_flags = part.msg_flags;
+                return result;
+            });
+        }
+        return with_timeout(fd, POLLIN, *timeout,
+                            [&] { return fakeclock::real.recvmsg(fd, msg, flags | MSG_DONTWAIT); });
+    }
+
+    ssize_t send(int fd, const void *buf, size_t len, int flags)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Send, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.send(fd, buf, len, flags);
+        }
+        return with_timeout(fd, POLLOUT, *timeout,
+                            [&] { return fakeclock::real.send(fd, buf, len, flags | MSG_DONTWAIT); });
+    }
+
+    ssize_t sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr,
+                   socklen_t addrlen)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Send, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.sendto(fd, buf, len, flags, dest_addr, addrlen);
+        }
+        return with_timeout(fd, POLLOUT, *timeout, [&] {
+            return fakeclock::real.sendto(fd, buf, len, flags | MSG_DONTWAIT, dest_addr, addrlen);
+        });
+    }
+
+    ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Send, flags);
+        if (!timeout)
+        {
+            return fakeclock::real.sendmsg(fd, msg, flags);
+        }
+        return with_timeout(fd, POLLOUT, *timeout,
+                            [&] { return fakeclock::real.sendmsg(fd, msg, flags | MSG_DONTWAIT); });
+    }
+
+    // read() on a socket with a receive timeout goes to recv() (see overrides.cpp), and these go to their socket
+    // counterparts likewise. Other fds have no timeouts, so they cost a lock-free check only.
+
+    ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+    {
+        if (!socket_timeout(fd, SocketTimeouts::Receive))
+        {
+            return fakeclock::real.readv(fd, iov, iovcnt);
+        }
+        msghdr msg = {};
+        msg.msg_iov = const_cast<iovec *>(iov);
+        msg.msg_iovlen = size_t(iovcnt);
+        return recvmsg(fd, &msg, 0);
+    }
+
+    ssize_t write(int fd, const void *buf, size_t count)
+    {
+        if (!socket_timeout(fd, SocketTimeouts::Send))
+        {
+            return fakeclock::real.write(fd, buf, count);
+        }
+        return send(fd, buf, count, 0);
+    }
+
+    ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+    {
+        if (!socket_timeout(fd, SocketTimeouts::Send))
+        {
+            return fakeclock::real.writev(fd, iov, iovcnt);
+        }
+        msghdr msg = {};
+        msg.msg_iov = const_cast<iovec *>(iov);
+        msg.msg_iovlen = size_t(iovcnt);
+        return sendmsg(fd, &msg, 0);
+    }
+
+    int accept4(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Receive);
+        int result;
+        if (!timeout)
+        {
+            result = fakeclock::real.accept4(fd, addr, addrlen, flags);
+        }
+        else
+        {
+            // accept() has no non-blocking flag, so the listening socket is non-blocking during the call, like in
+            // connect(). Then another thread that takes the connection first makes it fail with EAGAIN.
+            auto &timeouts = SocketTimeouts::getInstance();
+            result = with_timeout(fd, POLLIN, *timeout, [&] {
+                timeouts.beginNonBlocking(fd);
+                int accepted = fakeclock::real.accept4(fd, addr, addrlen, flags);
+                timeouts.endNonBlocking(fd);
+                return accepted;
+            });
+        }
+        if (result >= 0)
+        {
+            SocketTimeouts::getInstance().fdAccepted(fd, result);
+        }
+        return result;
+    }
+
+    int accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+    {
+        return accept4(fd, addr, addrlen, 0);
+    }
+
+    int connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+    {
+        auto timeout = socket_timeout(fd, SocketTimeouts::Send);
+        if (!timeout)
+        {
+            return fakeclock::real.connect(fd, addr, addrlen);
+        }
+        // connect() has no non-blocking flag either, so the socket is non-blocking while the connection starts.
+        SocketTimeouts::getInstance().beginNonBlocking(fd);
+        int result = fakeclock::real.connect(fd, addr, addrlen);
+        int saved_errno = errno;
+        SocketTimeouts::getInstance().endNonBlocking(fd);
+        if (result == 0 || saved_errno != EINPROGRESS)
+        {
+            errno = saved_errno;
+            return result;
+        }
+        int ready = fakeclock::waitForFd(fd, POLLOUT, fakeclock::ClockSimulator::getInstance().now() + *timeout);
+        if (ready <= 0)
+        {
+            if (ready == 0)
+            {
+                errno = EINPROGRESS; // like Linux, whose connection goes on in the background
+            }
+            return -1;
+        }
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+        if (error)
+        {
+            errno = error;
+            return -1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,321 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/TimedWait.h>
+#include <fakeclock/Trace.h>
+#include <iterator>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <type_traits>
+
+// Timed waits on condition variables, mutexes, read-write locks and semaphores get their deadline in fake time. The
+// simulator cannot interrupt a real wait on these objects, so the thread waits in slices of real time and checks in
+// between whether fake time has reached the deadline. Condition variables are also broadcast at the deadline, which
+// wakes their waiters right away.
+//
+// Threads that take turns (see ClockSimulator::scheduleDeterministically()) must not block holding their turn, so their
+// waits on mutexes, condition variables and semaphores never block for real, with or without timeout: they retry in
+// their turns, and wait for the signals of condition variables in the simulator.
+
+namespace
+{
+
+using fakeclock::TraceOp;
+using namespace std::chrono_literals;
+
+/// Real time after which a timed wait on a mutex, read-write lock or semaphore first checks its fake deadline again.
+/// While fake time stands still, the checks back off up to LOCK_MAX_SLICE.
+constexpr auto LOCK_SLICE = 1ms;
+constexpr auto LOCK_MAX_SLICE = 16ms;
+
+/// Real time after which a timed wait on a condition variable checks its fake deadline again, in case the broadcast at
+/// the deadline came before it started to wait.
+constexpr auto COND_SLICE = 100ms;
+
+/// Signals and broadcasts of condition variables while intercepting, counted per hash of their address. A timed wait
+/// that sees its count change between two slices of its real wait returns as a spurious wakeup, as the signal may
+/// have come while it was not waiting.
+std::atomic<uint32_t> cond_signals[64];
+
+std::atomic<uint32_t> &signals_of(const pthread_cond_t *cond)
+{
+    return cond_signals[reinterpret_cast<uintptr_t>(cond) / alignof(pthread_cond_t) % std::size(cond_signals)];
+}
+
+bool is_valid(const timespec *abstime)
+{
+    return abstime && abstime->tv_nsec >= 0 && abstime->tv_nsec < 1000000000;
+}
+
+bool is_valid_clock(clockid_t clock_id)
+{
+    return clock_id == CLOCK_REALTIME || clock_id == CLOCK_MONOTONIC;
+}
+
+#if !__GLIBC_PREREQ(2, 25)
+#error "cond_clock() reads the clock from the condition variables of glibc 2.25 and later"
+#endif
+static_assert(std::is_same_v<decltype(pthread_cond_t::__data.__wrefs), unsigned int>,
+              "cond_clock() expects the condition variable layout of glibc 2.25 and later");
+
+/// Clock of the timeouts of pthread_cond_timedwait() on `cond` (see pthread_condattr_setclock()), which glibc keeps in
+/// bit 1 of __wrefs since 2.25. The check above stops the build on layouts without it.
+clockid_t cond_clock(const pthread_cond_t *cond)
+{
+    return (__atomic_load_n(&cond->__data.__wrefs, __ATOMIC_RELAXED) & 2) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+}
+
+static_assert(std::is_same_v<decltype(pthread_mutex_t::__data.__owner), int>,
+              "mutex_owner() expects the mutex layout of glibc");
+
+/// Thread id of the thread holding `mutex`, which glibc keeps in __owner. Read racily, which only matters for the
+/// calling thread, whose own id cannot appear or vanish behind its back.
+pid_t mutex_owner(const pthread_mutex_t *mutex)
+{
+    return __atomic_load_n(&mutex->__data.__owner, __ATOMIC_RELAXED);
+}
+
+/// Timed wait on a mutex, read-write lock or semaphore, whose real wait takes CLOCK_REALTIME timeouts.
+template <typename Wait> int lock_wait(TraceOp op, clockid_t clock_id, const timespec &abstime, Wait &&wait)
+{
+    return fakeclock::timedWait({op, clock_id, abstime, CLOCK_REALTIME, LOCK_SLICE, LOCK_MAX_SLICE}, wait);
+}
+
+/// Timed wait on `cond`, which is broadcast at the deadline.
+template <typename Wait>
+int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id, const timespec &abstime, Wait &&wait)
+{
+    return fakeclock::timedWait({TraceOp::CondTimedwait, clock_id, abstime, cond_clock(cond), COND_SLICE, COND_SLICE,
+                                 cond, mutex, &signals_of(cond)},
+                                wait);
+}
+
+/// sem_timedwait() and sem_clockwait() report errors through errno.
+int sem_result(int error)
+{
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace
+
+extern "C"
+{
+    int pthread_mutex_lock(pthread_mutex_t *mutex)
+    {
+        if (!fakeclock::takesTurns())
+        {
+            return fakeclock::real.pthread_mutex_lock(mutex);
+        }
+        else
+        {
+            // A mutex the thread holds itself is left to the real call, which deadlocks or fails like it should.
+            auto self = pid_t(fakeclock::real.syscall(SYS_gettid, 0, 0, 0, 0, 0, 0));
+            auto result = fakeclock::waitInTurns(std::nullopt, EBUSY, [&] {
+                int error = pthread_mutex_trylock(mutex);
+                return error == EBUSY && mutex_owner(mutex) == self ? EDEADLK : error;
+            });
+            if (!result || *result == EDEADLK)
+            {
+                return fakeclock::real.pthread_mutex_lock(mutex);
+            }
+            return *result;
+        }
+    }
+
+    int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+    {
+        if (!fakeclock::takesTurns() ||
+            fakeclock::ClockSimulator::getInstance().park(std::nullopt, false, cond, mutex) ==
+                fakeclock::ClockSimulator::Park::Unscheduled)
+        {
+            return fakeclock::real.pthread_cond_wait(cond, mutex);
+        }
+        else
+        {
+            return pthread_mutex_lock(mutex);
+        }
+    }
+
+    int pthread_cond_signal(pthread_cond_t *cond)
+    {
+        if (fakeclock::isIntercepting())
+        {
+            signals_of(cond)++;
+        }
+        if (fakeclock::scheduling.load(std::memory_order_relaxed) != 0)
+        {
+            fakeclock::ClockSimulator::getInstance().condSignaled(cond, false);
+        }
+        return fakeclock::real.pthread_cond_signal(cond); // for the waiters that do not take turns
+    }
+
+    int pthread_cond_broadcast(pthread_cond_t *cond)
+    {
+        if (fakeclock::isIntercepting())
+        {
+            signals_of(cond)++;
+        }
+        if (fakeclock::scheduling.load(std::memory_order_relaxed) != 0)
+        {
+            fakeclock::ClockSimulator::getInstance().condSignaled(cond, true);
+        }
+        return fakeclock::real.pthread_cond_broadcast(cond);
+    }
+
+    int sem_wait(sem_t *sem)
+    {
+        std::optional<int> result;
+        if (fakeclock::takesTurns())
+        {
+            result = fakeclock::waitInTurns(std::nullopt, EAGAIN, [&] { return sem_trywait(sem) == 0 ? 0 : errno; });
+        }
+        return result ? sem_result(*result) : fakeclock::real.sem_wait(sem);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime))
+        {
+            return fakeclock::real.pthread_cond_timedwait(cond, mutex, abstime);
+        }
+        else
+        {
+            return cond_wait(
+                cond, mutex, cond_clock(cond), *abstime,
+                [&](const timespec &t) { return fakeclock::real.pthread_cond_timedwait(cond, mutex, &t); });
+        }
+    }
+
+    int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime))
+        {
+            return fakeclock::real.pthread_mutex_timedlock(mutex, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::MutexTimedlock, CLOCK_REALTIME, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_mutex_timedlock(mutex, &t); });
+        }
+    }
+
+    int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime))
+        {
+            return fakeclock::real.pthread_rwlock_timedrdlock(rwlock, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::RwlockTimedlock, CLOCK_REALTIME, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_rwlock_timedrdlock(rwlock, &t); });
+        }
+    }
+
+    int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime))
+        {
+            return fakeclock::real.pthread_rwlock_timedwrlock(rwlock, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::RwlockTimedlock, CLOCK_REALTIME, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_rwlock_timedwrlock(rwlock, &t); });
+        }
+    }
+
+    int sem_timedwait(sem_t *sem, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime))
+        {
+            return fakeclock::real.sem_timedwait(sem, abstime);
+        }
+        else
+        {
+            return sem_result(lock_wait(TraceOp::SemTimedwait, CLOCK_REALTIME, *abstime, [&](const timespec &t) {
+                return fakeclock::real.sem_timedwait(sem, &t) == 0 ? 0 : errno;
+            }));
+        }
+    }
+
+#if __GLIBC_PREREQ(2, 30)
+    int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id,
+                               const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime) || !is_valid_clock(clock_id))
+        {
+            return fakeclock::real.pthread_cond_clockwait(cond, mutex, clock_id, abstime);
+        }
+        else
+        {
+            return cond_wait(
+                cond, mutex, clock_id, *abstime,
+                [&](const timespec &t) { return fakeclock::real.pthread_cond_timedwait(cond, mutex, &t); });
+        }
+    }
+
+    int pthread_mutex_clocklock(pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime) || !is_valid_clock(clock_id))
+        {
+            return fakeclock::real.pthread_mutex_clocklock(mutex, clock_id, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::MutexTimedlock, clock_id, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_mutex_timedlock(mutex, &t); });
+        }
+    }
+
+    int pthread_rwlock_clockrdlock(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime) || !is_valid_clock(clock_id))
+        {
+            return fakeclock::real.pthread_rwlock_clockrdlock(rwlock, clock_id, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::RwlockTimedlock, clock_id, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_rwlock_timedrdlock(rwlock, &t); });
+        }
+    }
+
+    int pthread_rwlock_clockwrlock(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime) || !is_valid_clock(clock_id))
+        {
+            return fakeclock::real.pthread_rwlock_clockwrlock(rwlock, clock_id, abstime);
+        }
+        else
+        {
+            return lock_wait(TraceOp::RwlockTimedlock, clock_id, *abstime,
+                             [&](const timespec &t) { return fakeclock::real.pthread_rwlock_timedwrlock(rwlock, &t); });
+        }
+    }
+
+    int sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime)
+    {
+        if (!fakeclock::isIntercepting() || !is_valid(abstime) || !is_valid_clock(clock_id))
+        {
+            return fakeclock::real.sem_clockwait(sem, clock_id, abstime);
+        }
+        else
+        {
+            return sem_result(lock_wait(TraceOp::SemTimedwait, clock_id, *abstime, [&](const timespec &t) {
+                return fakeclock::real.sem_timedwait(sem, &t) == 0 ? 0 : errno;
+            }));
+        }
+    }
+#endif
+}
@@ -0,0 +1,236 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/TimedWait.h>
+#include <fakeclock/Trace.h>
+#include <fakeclock/common.h>
+#include <linux/futex.h>
+#include <optional>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Programs and runtimes that call syscall() directly bypass the libc wrappers fakeclock overrides: libstdc++ waits on
+// futexes this way for std::future, std::counting_semaphore and std::atomic::wait, and reads the clock for them. The
+// time-related system calls are routed to the overrides of their wrappers, other numbers go straight to the kernel.
+
+namespace
+{
+
+using fakeclock::TraceOp;
+using namespace std::chrono_literals;
+
+/// Real time after which a futex wait with a timeout checks its fake deadline again, in case the wake at the deadline
+/// came before it started to wait.
+constexpr auto FUTEX_SLICE = 100ms;
+
+/// Real time after which a futex_waitv() with a timeout first checks its fake deadline again. While fake time stands
+/// still, the checks back off up to FUTEX_WAITV_MAX_SLICE.
+constexpr auto FUTEX_WAITV_SLICE = 1ms;
+constexpr auto FUTEX_WAITV_MAX_SLICE = 16ms;
+
+/// System calls report errors as -1 and errno, like the libc wrappers.
+long syscall_result(int error)
+{
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/// Kernel timer ids are ints. The ids of simulated POSIX timers are small integers in a timer_t.
+timer_t to_timer(long id)
+{
+    return reinterpret_cast<timer_t>(uintptr_t(id));
+}
+
+/// FUTEX_WAIT and FUTEX_WAIT_BITSET with a timeout. The simulator wakes the futex at the deadline, which the wait
+/// reports as ETIMEDOUT.
+long futex_wait(uint32_t *word, int op, uint32_t expected, const timespec &timeout, uint32_t bitset)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    int cmd = op & FUTEX_CMD_MASK;
+    // FUTEX_WAIT takes a relative timeout, FUTEX_WAIT_BITSET an absolute one on the clock selected by the op.
+    clockid_t clock_id = (op & FUTEX_CLOCK_REALTIME) && cmd == FUTEX_WAIT_BITSET ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+    timespec abstime = timeout;
+    if (cmd == FUTEX_WAIT)
+    {
+        bitset = FUTEX_BITSET_MATCH_ANY;
+        abstime = simulator.toTimespec(CLOCK_MONOTONIC, simulator.now() + fakeclock::to_duration(timeout));
+    }
+    int wait_op = FUTEX_WAIT_BITSET | (op & FUTEX_PRIVATE_FLAG);
+    fakeclock::TimedWait spec = {TraceOp::FutexWait, clock_id, abstime, CLOCK_MONOTONIC, FUTEX_SLICE, FUTEX_SLICE};
+    spec.futex = word;
+    spec.futex_private = op & FUTEX_PRIVATE_FLAG;
+    spec.bitset = bitset;
+    return syscall_result(fakeclock::timedWait(spec, [&](const timespec &t) {
+        return fakeclock::real.syscall(SYS_futex, long(word), wait_op, expected, long(&t), 0, bitset) == 0 ? 0 : errno;
+    }));
+}
+
+/// FUTEX_WAIT and FUTEX_WAIT_BITSET without timeout of a thread that takes turns, which must not block for real: it
+/// tries again in its turns with a past deadline. Returns nullopt if the thread does not take turns (any more).
+std::optional<long> futex_wait_in_turns(uint32_t *word, int op, uint32_t expected, uint32_t bitset)
+{
+    if ((op & FUTEX_CMD_MASK) == FUTEX_WAIT)
+    {
+        bitset = FUTEX_BITSET_MATCH_ANY;
+    }
+    int wait_op = FUTEX_WAIT_BITSET | (op & FUTEX_PRIVATE_FLAG);
+    timespec past = {0, 0};
+    auto error = fakeclock::waitInTurns(std::nullopt, ETIMEDOUT, [&] {
+        return fakeclock::real.syscall(SYS_futex, long(word), wait_op, expected, long(&past), 0, bitset) == 0 ? 0
+                                                                                                             : errno;
+    });
+    if (!error)
+    {
+        return std::nullopt;
+    }
+    return syscall_result(*error);
+}
+
+#ifdef SYS_futex_waitv
+/// futex_waitv() with a timeout, which returns the index of the woken futex.
+long futex_waitv(long waiters, long count, long flags, const timespec &abstime, clockid_t clock_id)
+{
+    long index = -1;
+    int error = fakeclock::timedWait(
+        {TraceOp::FutexWait, clock_id, abstime, clock_id, FUTEX_WAITV_SLICE, FUTEX_WAITV_MAX_SLICE},
+        [&](const timespec &t) {
+            index = fakeclock::real.syscall(SYS_futex_waitv, waiters, count, flags, long(&t), clock_id, 0);
+            return index >= 0 ? 0 : errno;
+        });
+    return error ? syscall_result(error) : index;
+}
+#endif
+
+/// The time-related system call `number` in simulated time. Arguments narrower than long are truncated like the kernel
+/// does, as callers may leave garbage in their upper bits.
+long fake_syscall(long number, const long (&args)[6])
+{
+    switch (number)
+    {
+    case SYS_futex: {
+        int op = int(args[1]);
+        int cmd = op & FUTEX_CMD_MASK;
+        auto *timeout = reinterpret_cast<const timespec *>(args[3]);
+        // Wakes and the priority-inheritance ops do not depend on time, nor do waits without timeout unless the thread
+        // takes turns.
+        if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET)
+        {
+            break;
+        }
+        if (!timeout)
+        {
+            if (!fakeclock::takesTurns())
+            {
+                break;
+            }
+            auto result = futex_wait_in_turns(reinterpret_cast<uint32_t *>(args[0]), op, uint32_t(args[2]),
+                                              uint32_t(args[5]));
+            if (!result)
+            {
+                break;
+            }
+            return *result;
+        }
+        if (timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000)
+        {
+            return syscall_result(EINVAL);
+        }
+        return futex_wait(reinterpret_cast<uint32_t *>(args[0]), op, uint32_t(args[2]), *timeout, uint32_t(args[5]));
+    }
+#ifdef SYS_futex_waitv
+    case SYS_futex_waitv: {
+        auto *timeout = reinterpret_cast<const timespec *>(args[3]);
+        clockid_t clock_id = clockid_t(args[4]);
+        if (!timeout || (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) || timeout->tv_nsec < 0 ||
+            timeout->tv_nsec >= 1000000000)
+        {
+            break;
+        }
+        return futex_waitv(args[0], args[1], args[2], *timeout, clock_id);
+    }
+#endif
+    case SYS_clock_gettime:
+        return ::clock_gettime(clockid_t(args[0]), reinterpret_cast<timespec *>(args[1]));
+    case SYS_gettimeofday:
+        return ::gettimeofday(reinterpret_cast<timeval *>(args[0]), reinterpret_cast<void *>(args[1]));
+#ifdef SYS_time
+    case SYS_time:
+        return ::time(reinterpret_cast<time_t *>(args[0]));
+#endif
+    case SYS_nanosleep:
+        return ::nanosleep(reinterpret_cast<const timespec *>(args[0]), reinterpret_cast<timespec *>(args[1]));
+    case SYS_clock_nanosleep:
+        return syscall_result(::clock_nanosleep(clockid_t(args[0]), int(args[1]),
+                                                reinterpret_cast<const timespec *>(args[2]),
+                                                reinterpret_cast<timespec *>(args[3])));
+    case SYS_timerfd_create:
+        return ::timerfd_create(int(args[0]), int(args[1]));
+    case SYS_timerfd_settime:
+        return ::timerfd_settime(int(args[0]), int(args[1]), reinterpret_cast<const itimerspec *>(args[2]),
+                                 reinterpret_cast<itimerspec *>(args[3]));
+    case SYS_timerfd_gettime:
+        return ::timerfd_gettime(int(args[0]), reinterpret_cast<itimerspec *>(args[1]));
+    case SYS_timer_create: {
+        auto *id = reinterpret_cast<int *>(args[2]);
+        if (!id)
+        {
+            return syscall_result(EFAULT);
+        }
+        timer_t timerid;
+        if (::timer_create(clockid_t(args[0]), reinterpret_cast<sigevent *>(args[1]), &timerid) != 0)
+        {
+            return -1;
+        }
+        *id = int(reinterpret_cast<uintptr_t>(timerid));
+        return 0;
+    }
+    case SYS_timer_delete:
+        return ::timer_delete(to_timer(args[0]));
+    case SYS_timer_settime:
+        return ::timer_settime(to_timer(args[0]), int(args[1]), reinterpret_cast<const itimerspec *>(args[2]),
+                               reinterpret_cast<itimerspec *>(args[3]));
+    case SYS_timer_gettime:
+        return ::timer_gettime(to_timer(args[0]), reinterpret_cast<itimerspec *>(args[1]));
+    case SYS_timer_getoverrun:
+        return ::timer_getoverrun(to_timer(args[0]));
+    default:
+        break;
+    }
+    return fakeclock::real.syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+} // namespace
+
+extern "C"
+{
+    long syscall(long number, ...)
+    {
+        // Reading all six arguments is fine for calls with fewer: the extra ones are garbage nobody looks at.
+        long args[6];
+        va_list list;
+        va_start(list, number);
+        for (auto &arg : args)
+        {
+            arg = va_arg(list, long);
+        }
+        va_end(list);
+        if (!fakeclock::isIntercepting())
+        {
+            return fakeclock::real.syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+        }
+        else
+        {
+            return fake_syscall(number, args);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include <cerrno>
+#include <fakeclock/ClockLog.h>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/TimedWait.h>
+#include <fakeclock/fakeclock.h>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+
+// Threads inherit the timeline of their creator (see Timeline), and threads created by registered threads inherit
+// the registration (see MasterOfTime::setAutoAdvance()). The simulator counts them as running from pthread_create()
+// on, so time cannot advance before they get going. While the clock is recorded or replayed, threads also inherit an
+// identity derived from their creator's (see fakeclock::threadKey()). Threads that take turns (see
+// ClockSimulator::scheduleDeterministically()) join threads in their turns.
+
+namespace
+{
+
+struct ThreadStart
+{
+    void *(*start_routine)(void *);
+    void *arg;
+    fakeclock::ClockSimulator *timeline;
+    bool registered;
+    uint64_t schedule_id; ///< see ClockSimulator::threadSpawning()
+    uint64_t key; ///< see fakeclock::threadKey(), 0 if not recording or replaying
+};
+
+void *start_simulated_thread(void *arg)
+{
+    std::unique_ptr<ThreadStart> start(static_cast<ThreadStart *>(arg));
+    fakeclock::current_timeline = start->timeline;
+    if (start->key)
+    {
+        fakeclock::setThreadKey(start->key);
+    }
+    if (!start->registered)
+    {
+        return start->start_routine(start->arg);
+    }
+    fakeclock::ClockSimulator::getInstance().registerSpawnedThread(start->schedule_id);
+    // pthread_exit() unwinds the stack, so the registration ends in both cases
+    struct Unregister
+    {
+        ~Unregister()
+        {
+            fakeclock::ClockSimulator::getInstance().unregisterThread();
+        }
+    } unregister;
+    return start->start_routine(start->arg);
+}
+
+} // namespace
+
+extern "C"
+{
+    int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg)
+    {
+        auto &simulator = fakeclock::ClockSimulator::getInstance();
+        bool registered = simulator.isThreadRegistered();
+        bool keyed = fakeclock::clock_recording.load(std::memory_order_relaxed) ||
+                     fakeclock::clock_replaying.load(std::memory_order_relaxed);
+        if (!registered && !fakeclock::current_timeline && !keyed)
+        {
+            return fakeclock::real.pthread_create(thread, attr, start_routine, arg);
+        }
+        uint64_t schedule_id = registered ? simulator.threadSpawning() : 0;
+        auto *start = new ThreadStart{start_routine, arg, fakeclock::current_timeline, registered, schedule_id,
+                                      keyed ? fakeclock::nextChildThreadKey() : 0};
+        int result = fakeclock::real.pthread_create(thread, attr, start_simulated_thread, start);
+        if (result != 0)
+        {
+            delete start;
+            if (registered)
+            {
+                simulator.spawnFailed();
+            }
+        }
+        return result;
+    }
+
+    int pthread_join(pthread_t thread, void **retval)
+    {
+        std::optional<int> result;
+        if (fakeclock::takesTurns())
+        {
+            result = fakeclock::waitInTurns(std::nullopt, EBUSY, [&] { return pthread_tryjoin_np(thread, retval); });
+        }
+        return result ? *result : fakeclock::real.pthread_join(thread, retval);
+    }
+}
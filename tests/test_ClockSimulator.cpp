@@ -4,12 +4,52 @@
 #include <fakeclock/ClockSimulator.h>
 #include <gtest/gtest.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include <sys/timerfd.h>
 #include <thread>
+#include <vector>
 using namespace std::chrono_literals;
 
 static constexpr auto LONG_DURATION = 3s;
 
+/// CPU time consumed by the calling thread. getrusage() is not intercepted, so it is measured in real time.
+static std::chrono::microseconds thread_cpu_time()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+/// Returns the CPU time of `steps` small advances while `armed_timers` timerfds are armed far in the future.
+static std::chrono::microseconds measure_advances(int armed_timers, int steps)
+{
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    std::vector<int> fds;
+    for (int i = 0; i < armed_timers; i++)
+    {
+        int fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
+        simulator.timerfdSetTime(fd, simulator.now() + 24h + std::chrono::milliseconds(i));
+        fds.push_back(fd);
+    }
+    auto best = std::chrono::microseconds::max();
+    for (int repetition = 0; repetition < 3; repetition++)
+    {
+        auto start = thread_cpu_time();
+        for (int i = 0; i < steps; i++)
+        {
+            simulator.advance(1ns);
+        }
+        best = std::min(best, thread_cpu_time() - start);
+    }
+    for (int fd : fds)
+    {
+        ::close(fd);
+    }
+    return best;
+}
+
 TEST(ClockSimulatorTest, now)
 {
     fakeclock::MasterOfTime clock; // Take control of time
@@ -43,3 +83,77 @@ TEST(ClockSimulatorTest, timerfd)
     });
     ::close(fd);
 }
+
+TEST(ClockSimulatorTest, advanceCostDoesNotDependOnArmedTimers)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static constexpr int STEPS = 20000;
+    auto few_timers = measure_advances(10, STEPS);
+    auto many_timers = measure_advances(4000, STEPS);
+    // Scanning all timers on each advance would make it hundreds of times slower.
+    EXPECT_LT(many_timers, 4 * few_timers + 10ms);
+}
+
+TEST(ClockSimulatorTest, onlyExpiredTimerfdsFire)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    int late_fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
+    int early_fd = simulator.timerfdCreate(CLOCK_MONOTONIC, 0);
+    simulator.timerfdSetTime(late_fd, simulator.now() + 2s);
+    simulator.timerfdSetTime(early_fd, simulator.now() + 1s, 1s);
+
+    uint64_t buf;
+    clock.advance(1s);
+    ASSERT_EQ(read(early_fd, &buf, sizeof(buf)), sizeof(buf));
+    EXPECT_EQ(buf, 1);
+    struct pollfd late_pollfd = {late_fd, POLLIN, 0};
+    EXPECT_EQ(poll(&late_pollfd, 1, 0), 0);
+
+    clock.advance(3s);
+    ASSERT_EQ(read(late_fd, &buf, sizeof(buf)), sizeof(buf));
+    EXPECT_EQ(buf, 1);
+    ASSERT_EQ(read(early_fd, &buf, sizeof(buf)), sizeof(buf));
+    EXPECT_EQ(buf, 3); // periodic timer is rescheduled after each expiration
+
+    ::close(late_fd);
+    ::close(early_fd);
+}
+
+TEST(ClockSimulatorTest, advanceWakesOnlyExpiredWaiters)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    static constexpr int SLEEPERS = 5;
+    std::atomic<int> finished = 0;
+    auto start = simulator.now();
+    std::vector<std::thread> sleepers;
+    for (int i = 1; i <= SLEEPERS; i++)
+    {
+        sleepers.emplace_back([&, i] {
+            simulator.waitUntil(start + std::chrono::seconds(i));
+            finished++;
+        });
+    }
+    ASSERT_TRUE(wait_for([&] { return simulator.waiterCount() == SLEEPERS; }));
+
+    for (int i = 1; i <= SLEEPERS; i++)
+    {
+        clock.advance(1s);
+        ASSERT_TRUE(wait_for([&] { return finished == i; }));
+        EXPECT_EQ(simulator.waiterCount(), size_t(SLEEPERS - i));
+    }
+    for (auto &sleeper : sleepers)
+    {
+        sleeper.join();
+    }
+}
+
+TEST(ClockSimulatorTest, waitUntilPastDeadlineReturnsImmediately)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto &simulator = fakeclock::ClockSimulator::getInstance();
+    simulator.waitUntil(simulator.now());
+    simulator.waitUntil(simulator.now() - 1s);
+    EXPECT_EQ(simulator.waiterCount(), 0);
+}
@@ -0,0 +1,143 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+TEST(AutoAdvanceTest, retries_with_backoff_finish_without_driver)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    auto start = FakeClock::now();
+    std::thread worker([] {
+        fakeclock::RegisteredThread registered;
+        auto backoff = 1s;
+        for (int attempt = 0; attempt < 20; attempt++)
+        {
+            std::this_thread::sleep_for(backoff);
+            backoff = std::min<std::chrono::seconds>(backoff * 2, 1h);
+        }
+    });
+    worker.join();
+    EXPECT_EQ(FakeClock::now() - start, 4095s + 8h); // 1s, 2s, ..., 2048s, then 8 times 1h
+}
+
+TEST(AutoAdvanceTest, waits_for_all_registered_threads)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    auto start = FakeClock::now();
+    std::atomic<bool> release = false;
+    std::atomic<bool> sleeper_done = false;
+
+    std::thread busy([&] {
+        fakeclock::RegisteredThread registered;
+        // Running (not blocked), so time must not advance until this thread blocks or exits.
+        while (!release)
+        {
+            std::this_thread::yield();
+        }
+    });
+    std::thread sleeper([&] {
+        fakeclock::RegisteredThread registered;
+        std::this_thread::sleep_for(1min);
+        sleeper_done = true;
+    });
+
+    EXPECT_FALSE(wait_for([&] { return sleeper_done.load(); }));
+    EXPECT_EQ(FakeClock::now(), start);
+    release = true;
+    busy.join();
+    sleeper.join();
+    EXPECT_EQ(FakeClock::now(), start + 1min);
+}
+
+TEST(AutoAdvanceTest, poll_woken_by_fd_does_not_advance_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    auto start = FakeClock::now();
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FakeClock::time_point received_at;
+    int poll_result = -1;
+
+    std::thread reader;
+    std::thread writer;
+    {
+        // registered while both threads start, so that time does not advance while only one of them is running
+        fakeclock::RegisteredThread registered;
+        reader = std::thread([&] {
+            struct pollfd pfd = {fds[0], POLLIN, 0};
+            poll_result = poll(&pfd, 1, 3600 * 1000);
+            received_at = FakeClock::now();
+        });
+        writer = std::thread([&] {
+            char c = 'x';
+            ASSERT_EQ(write(fds[1], &c, 1), 1);
+            // Blocks while the reader may not have returned from poll yet; its pending data must stop the advance.
+            std::this_thread::sleep_for(10s);
+        });
+    }
+    reader.join();
+    writer.join();
+    EXPECT_EQ(poll_result, 1);
+    EXPECT_EQ(received_at, start);
+    EXPECT_EQ(FakeClock::now(), start + 10s);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(AutoAdvanceTest, select_timeout)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    auto start = FakeClock::now();
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::thread reader([&] {
+        fakeclock::RegisteredThread registered;
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(fds[0], &readfds);
+        struct timeval tv = fakeclock::to_timeval(5s);
+        EXPECT_EQ(select(fds[0] + 1, &readfds, nullptr, nullptr, &tv), 0);
+    });
+    reader.join();
+    EXPECT_EQ(FakeClock::now(), start + 5s);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(AutoAdvanceTest, spawned_threads_inherit_registration)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    auto start = FakeClock::now();
+    std::atomic<int> finished = 0;
+    std::vector<std::thread> threads;
+    {
+        fakeclock::RegisteredThread registered;
+        for (int i = 1; i <= 3; i++)
+        {
+            threads.emplace_back([&, i] {
+                std::this_thread::sleep_for(std::chrono::minutes(i));
+                finished++;
+            });
+        }
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(finished, 3);
+    EXPECT_EQ(FakeClock::now(), start + 3min);
+}
@@ -0,0 +1,157 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+/// Two registered threads increment a counter without a lock, reading the clock in between, so that some schedules
+/// lose an update.
+void lost_update(fakeclock::MasterOfTime &clock)
+{
+    clock.setAutoAdvance(true);
+    int counter = 0;
+    std::vector<std::thread> threads;
+    {
+        fakeclock::RegisteredThread registered;
+        for (int i = 0; i < 2; i++)
+        {
+            threads.emplace_back([&] {
+                int value = counter;
+                (void)std::chrono::steady_clock::now();
+                counter = value + 1;
+            });
+        }
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    if (counter != 2)
+    {
+        throw std::runtime_error("lost update");
+    }
+}
+
+} // namespace
+
+TEST(ExplorationTest, finds_and_replays_failing_schedules)
+{
+    fakeclock::ExplorationOptions options;
+    options.runs = 100;
+    options.workers = 4;
+    options.max_failures = 0;
+    auto result = fakeclock::exploreSchedules(lost_update, options);
+    EXPECT_EQ(result.runs, 100u);
+    ASSERT_FALSE(result.failures.empty());
+    ASSERT_LT(result.failures.size(), 100u);
+    std::set<uint64_t> failing;
+    for (const auto &failure : result.failures)
+    {
+        EXPECT_EQ(failure.reason, "exception: lost update");
+        failing.insert(failure.seed);
+    }
+    EXPECT_THROW(fakeclock::runSchedule(*failing.begin(), lost_update), std::runtime_error);
+    uint64_t passing = 0;
+    while (failing.contains(passing))
+    {
+        passing++;
+    }
+    EXPECT_NO_THROW(fakeclock::runSchedule(passing, lost_update));
+}
+
+TEST(ExplorationTest, reports_crashes_and_timeouts)
+{
+    fakeclock::ExplorationOptions options;
+    options.first_seed = 10;
+    options.runs = 4;
+    options.workers = 2;
+    options.run_timeout = 200ms;
+    options.max_failures = 0;
+    auto result = fakeclock::exploreSchedules(
+        [](fakeclock::MasterOfTime &) {
+            std::this_thread::sleep_for(1s); // never ends, as nothing advances the time
+        },
+        options);
+    EXPECT_EQ(result.runs, 4u);
+    ASSERT_EQ(result.failures.size(), 4u);
+    for (uint64_t i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(result.failures[i].seed, 10 + i);
+        EXPECT_EQ(result.failures[i].reason, "timed out after 200 ms");
+    }
+
+    options.max_failures = 2;
+    result = fakeclock::exploreSchedules([](fakeclock::MasterOfTime &) { std::abort(); }, options);
+    ASSERT_EQ(result.failures.size(), 2u);
+    EXPECT_EQ(result.failures[0].reason.rfind("killed by signal 6", 0), 0u) << result.failures[0].reason;
+}
+
+TEST(ExplorationTest, splits_advances_into_random_steps)
+{
+    // A sleeper that sleeps again when woken gets further in one advance() if the advance is split.
+    auto sleeps_during_advance = [](uint64_t seed) {
+        int sleeps = 0;
+        fakeclock::runSchedule(seed, [&](fakeclock::MasterOfTime &clock) {
+            std::atomic<int> woken = 0;
+            std::atomic<bool> stop = false;
+            std::thread sleeper([&] {
+                while (!stop)
+                {
+                    std::this_thread::sleep_for(1s);
+                    woken++;
+                }
+            });
+            ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+            clock.advance(10s);
+            ASSERT_TRUE(wait_for([&] {
+                auto next = clock.nextEventTime();
+                return next && *next > FakeClock::now();
+            }));
+            sleeps = woken;
+            stop = true;
+            clock.advance(1s);
+            sleeper.join();
+        });
+        return sleeps;
+    };
+    std::set<int> counts;
+    for (uint64_t seed = 0; seed < 20; seed++)
+    {
+        int sleeps = sleeps_during_advance(seed);
+        EXPECT_GE(sleeps, 1);
+        EXPECT_LE(sleeps, 4); // at most four steps
+        EXPECT_EQ(sleeps_during_advance(seed), sleeps);
+        counts.insert(sleeps);
+    }
+    EXPECT_GT(counts.size(), 1u);
+}
+
+TEST(ExplorationTest, fails_runs_whose_threads_do_not_settle)
+{
+    std::atomic<bool> stop = false;
+    std::thread spinner;
+    auto spin_when_woken = [&](fakeclock::MasterOfTime &clock) {
+        spinner = std::thread([&] {
+            std::this_thread::sleep_for(1s);
+            while (!stop) // runs on without blocking
+            {
+            }
+        });
+        ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+        clock.advance(10s);
+    };
+    EXPECT_THROW(fakeclock::runSchedule(1, spin_when_woken), std::runtime_error);
+    stop = true;
+    spinner.join();
+}
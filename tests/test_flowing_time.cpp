@@ -0,0 +1,137 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <optional>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+std::chrono::nanoseconds real_now()
+{
+    timespec ts;
+    fakeclock::real_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return fakeclock::to_duration(ts);
+}
+
+void real_sleep(std::chrono::nanoseconds duration)
+{
+    auto ts = fakeclock::to_timespec(duration);
+    fakeclock::real.nanosleep(&ts, nullptr);
+}
+
+} // namespace
+
+TEST(FlowingTimeTest, paused_by_default)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    EXPECT_TRUE(clock.isPaused());
+    auto start = FakeClock::now();
+    real_sleep(20ms);
+    EXPECT_EQ(FakeClock::now(), start);
+}
+
+TEST(FlowingTimeTest, sleep_finishes_at_scaled_speed)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setTimeScale(1000);
+    clock.resume();
+    EXPECT_FALSE(clock.isPaused());
+    auto real_start = real_now();
+    auto start = FakeClock::now();
+    std::this_thread::sleep_for(10s);
+    EXPECT_GE(FakeClock::now() - start, 10s);
+    EXPECT_LT(real_now() - real_start, 5s); // 10ms if the machine keeps up
+}
+
+TEST(FlowingTimeTest, time_progresses_with_scale)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setTimeScale(100);
+    clock.resume();
+    auto real_start = real_now();
+    auto start = FakeClock::now();
+    real_sleep(20ms);
+    auto fake_elapsed = FakeClock::now() - start;
+    auto real_elapsed = real_now() - real_start;
+    EXPECT_GE(fake_elapsed, 2s);
+    EXPECT_LE(fake_elapsed, real_elapsed * 100);
+}
+
+TEST(FlowingTimeTest, timerfd_fires_while_time_flows)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setTimeScale(1000);
+    clock.resume();
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_GE(fd, 0);
+    itimerspec spec = {};
+    spec.it_value.tv_sec = 5;
+    ASSERT_EQ(timerfd_settime(fd, 0, &spec, nullptr), 0);
+    uint64_t expirations = 0;
+    ASSERT_EQ(read(fd, &expirations, sizeof(expirations)), ssize_t(sizeof(expirations)));
+    EXPECT_EQ(expirations, 1u);
+    close(fd);
+}
+
+TEST(FlowingTimeTest, pause_freezes_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setTimeScale(1000);
+    clock.resume();
+    real_sleep(5ms);
+    clock.pause();
+    EXPECT_TRUE(clock.isPaused());
+    auto paused_at = FakeClock::now();
+    real_sleep(20ms);
+    EXPECT_EQ(FakeClock::now(), paused_at);
+
+    // Explicit advances still work, paused or not
+    clock.advance(1h);
+    EXPECT_EQ(FakeClock::now(), paused_at + 1h);
+    clock.resume();
+    real_sleep(5ms);
+    EXPECT_GT(FakeClock::now(), paused_at + 1h);
+}
+
+TEST(FlowingTimeTest, rejects_invalid_scale)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    EXPECT_THROW(clock.setTimeScale(0), std::invalid_argument);
+    EXPECT_THROW(clock.setTimeScale(-1), std::invalid_argument);
+}
+
+TEST(FlowingTimeTest, last_of_concurrently_destroyed_masters_stops_the_flow)
+{
+    for (int round = 0; round < 100; round++)
+    {
+        std::optional<fakeclock::MasterOfTime> masters[2];
+        masters[0].emplace();
+        masters[1].emplace();
+        masters[0]->resume();
+        std::atomic<int> started = 0;
+        auto destroy = [&](int i) {
+            started++;
+            while (started < 2)
+            {
+                std::this_thread::yield();
+            }
+            masters[i].reset(); // at the same time as the other one
+        };
+        std::thread first(destroy, 0);
+        std::thread second(destroy, 1);
+        first.join();
+        second.join();
+        fakeclock::MasterOfTime clock;
+        ASSERT_TRUE(clock.isPaused()) << "in round " << round;
+    }
+}
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+/// Advances `clock` in steps until the child exits (it waits for time to pass), then returns its exit status.
+int advance_until_exit(fakeclock::MasterOfTime &clock, pid_t child, FakeClock::duration step)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        int status;
+        if (waitpid(child, &status, WNOHANG) == child)
+        {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        clock.advance(step);
+        timespec pause = {0, 1000000};
+        fakeclock::real.nanosleep(&pause, nullptr);
+    }
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    return -1;
+}
+
+} // namespace
+
+TEST(ForkTest, child_sees_time_of_parent)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.shareWithChildProcesses();
+    int to_child[2];
+    int to_parent[2];
+    ASSERT_EQ(pipe(to_child), 0);
+    ASSERT_EQ(pipe(to_parent), 0);
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0)
+    {
+        char go;
+        if (read(to_child[0], &go, 1) != 1)
+        {
+            _exit(1);
+        }
+        auto now = FakeClock::now();
+        _exit(write(to_parent[1], &now, sizeof(now)) == sizeof(now) ? 0 : 1);
+    }
+    clock.advance(5h);
+    auto parent_now = FakeClock::now();
+    ASSERT_EQ(write(to_child[1], "g", 1), 1);
+    FakeClock::time_point child_now;
+    ASSERT_EQ(read(to_parent[0], &child_now, sizeof(child_now)), ssize_t(sizeof(child_now)));
+    EXPECT_EQ(child_now, parent_now);
+    int status;
+    waitpid(child, &status, 0);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    for (int fd : {to_child[0], to_child[1], to_parent[0], to_parent[1]})
+    {
+        close(fd);
+    }
+}
+
+TEST(ForkTest, child_sleep_is_woken_by_parent_advance)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.shareWithChildProcesses();
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0)
+    {
+        auto start = FakeClock::now();
+        std::this_thread::sleep_for(1h);
+        auto elapsed = FakeClock::now() - start;
+        _exit(elapsed >= 1h && elapsed <= 1h + 10min ? 0 : 1);
+    }
+    EXPECT_EQ(advance_until_exit(clock, child, 10min), 0);
+}
+
+TEST(ForkTest, child_timerfd_fires_on_parent_advance)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.shareWithChildProcesses();
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0)
+    {
+        int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+        itimerspec spec = {};
+        spec.it_value.tv_sec = 60;
+        if (fd < 0 || timerfd_settime(fd, 0, &spec, nullptr) != 0)
+        {
+            _exit(1);
+        }
+        uint64_t expirations = 0;
+        _exit(read(fd, &expirations, sizeof(expirations)) == sizeof(expirations) && expirations >= 1 ? 0 : 1);
+    }
+    EXPECT_EQ(advance_until_exit(clock, child, 10s), 0);
+}
+
+TEST(ForkTest, child_cannot_change_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.shareWithChildProcesses();
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0)
+    {
+        try
+        {
+            clock.advance(1s);
+        }
+        catch (const std::logic_error &)
+        {
+            _exit(0);
+        }
+        _exit(1);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+}
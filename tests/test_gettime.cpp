@@ -3,9 +3,11 @@
 #include <ctime>
 #include <fakeclock/fakeclock.h>
 #include <gtest/gtest.h>
+#include <signal.h>
 #include <sys/time.h>
 #include <sys/timerfd.h>
 #include <thread>
+#include <vector>
 using namespace std::chrono_literals;
 
 static constexpr auto LONG_DURATION = 3s;
@@ -25,6 +27,15 @@ TEST(FakeClockGetTest, gettimeofday)
     ASSERT_EQ(duration, LONG_DURATION);
 }
 
+TEST(FakeClockGetTest, gettimeofday_takes_null_arguments)
+{
+    struct timeval *volatile no_tv = nullptr; // volatile, as glibc declares the argument nonnull
+    struct timezone tz;
+    EXPECT_EQ(gettimeofday(no_tv, &tz), 0); // real time
+    fakeclock::MasterOfTime clock; // Take control of time
+    EXPECT_EQ(gettimeofday(no_tv, &tz), 0);
+}
+
 TEST(FakeClockGetTest, clock_gettime)
 {
     fakeclock::MasterOfTime clock; // Take control of time
@@ -99,3 +110,65 @@ TEST(FakeClockGetTest, high_resolution_clock_now)
     auto duration = end - start;
     ASSERT_EQ(duration, LONG_DURATION);
 }
+
+TEST(FakeClockGetTest, concurrent_reads_are_consistent_during_advance)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static constexpr int STEPS = 10000;
+    static constexpr int READERS = 4;
+    std::atomic<bool> done = false;
+    std::atomic<int> errors = 0;
+    timespec start;
+    ASSERT_EQ(clock_gettime(CLOCK_MONOTONIC, &start), 0);
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READERS; i++)
+    {
+        readers.emplace_back([&] {
+            auto previous = fakeclock::to_duration(start);
+            while (!done)
+            {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                auto current = fakeclock::to_duration(ts);
+                // each step advances by a whole millisecond, so a torn read would show up as a fraction of it
+                if (current < previous || (current - fakeclock::to_duration(start)) % 1ms != 0ns)
+                {
+                    errors++;
+                }
+                previous = current;
+            }
+        });
+    }
+    for (int i = 0; i < STEPS; i++)
+    {
+        clock.advance(1ms);
+    }
+    done = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(errors, 0);
+}
+
+static std::atomic<fakeclock::FakeClock::rep> time_read_in_handler = 0;
+
+TEST(FakeClockGetTest, clock_gettime_in_signal_handler)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    struct sigaction action = {};
+    struct sigaction old_action;
+    action.sa_handler = [](int) {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        time_read_in_handler = fakeclock::to_duration(ts).count();
+    };
+    ASSERT_EQ(sigaction(SIGUSR1, &action, &old_action), 0);
+    clock.advance(LONG_DURATION);
+    timespec expected;
+    ASSERT_EQ(clock_gettime(CLOCK_MONOTONIC, &expected), 0);
+    ASSERT_EQ(raise(SIGUSR1), 0);
+    EXPECT_EQ(time_read_in_handler, fakeclock::to_duration(expected).count());
+    sigaction(SIGUSR1, &old_action, nullptr);
+}
@@ -0,0 +1,96 @@
+#include "test_helpers.h"
+#include <chrono>
+#include <fakeclock/ClockSimulator.h>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+TEST(NextEventTest, nothing_pending)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto start = FakeClock::now();
+    EXPECT_EQ(clock.nextEventTime(), std::nullopt);
+    EXPECT_FALSE(clock.advanceToNextEvent());
+    EXPECT_EQ(FakeClock::now(), start);
+}
+
+TEST(NextEventTest, jumps_to_sleeping_thread_deadline)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto start = FakeClock::now();
+    std::atomic<bool> woke = false;
+    std::thread sleeper([&] {
+        std::this_thread::sleep_for(1h);
+        woke = true;
+    });
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+    EXPECT_EQ(clock.nextEventTime(), start + 1h);
+    EXPECT_TRUE(clock.advanceToNextEvent());
+    EXPECT_EQ(FakeClock::now(), start + 1h);
+    sleeper.join();
+    EXPECT_TRUE(woke);
+}
+
+TEST(NextEventTest, earliest_of_timerfd_and_posix_timer)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto start = FakeClock::now();
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_NE(timer_fd, -1);
+    itimerspec timerfd_value{};
+    timerfd_value.it_value = fakeclock::to_timespec(10s);
+    ASSERT_EQ(timerfd_settime(timer_fd, 0, &timerfd_value, nullptr), 0);
+
+    timer_t timerid;
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_NONE;
+    ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timerid), 0);
+    itimerspec posix_value{};
+    posix_value.it_value = fakeclock::to_timespec(3s);
+    ASSERT_EQ(timer_settime(timerid, 0, &posix_value, nullptr), 0);
+
+    EXPECT_EQ(clock.nextEventTime(), start + 3s);
+    EXPECT_TRUE(clock.advanceToNextEvent());
+    EXPECT_EQ(FakeClock::now(), start + 3s);
+    EXPECT_EQ(clock.nextEventTime(), start + 10s);
+    EXPECT_TRUE(clock.advanceToNextEvent());
+    EXPECT_EQ(FakeClock::now(), start + 10s);
+    EXPECT_EQ(clock.nextEventTime(), std::nullopt);
+
+    uint64_t expirations = 0;
+    ASSERT_EQ(read(timer_fd, &expirations, sizeof(expirations)), sizeof(expirations));
+    EXPECT_EQ(expirations, 1);
+    timer_delete(timerid);
+    close(timer_fd);
+}
+
+TEST(NextEventTest, run_until_visits_every_periodic_expiration)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    auto start = FakeClock::now();
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_NE(timer_fd, -1);
+    itimerspec value{};
+    value.it_value = fakeclock::to_timespec(1s);
+    value.it_interval = fakeclock::to_timespec(1s);
+    ASSERT_EQ(timerfd_settime(timer_fd, 0, &value, nullptr), 0);
+
+    clock.runUntil(start + 5500ms);
+    EXPECT_EQ(FakeClock::now(), start + 5500ms);
+    EXPECT_EQ(clock.nextEventTime(), start + 6s);
+
+    uint64_t expirations = 0;
+    ASSERT_EQ(read(timer_fd, &expirations, sizeof(expirations)), sizeof(expirations));
+    EXPECT_EQ(expirations, 5);
+    close(timer_fd);
+}
@@ -0,0 +1,160 @@
+#include "test_helpers.h"
+#include <chrono>
+#include <dirent.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <thread>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+namespace
+{
+
+int open_fd_count()
+{
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    while (readdir(dir))
+    {
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+class PollTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        ASSERT_EQ(pipe(pipe_fds_), 0);
+    }
+    void TearDown() override
+    {
+        close(pipe_fds_[0]);
+        close(pipe_fds_[1]);
+    }
+    void writeByte()
+    {
+        char c = 'x';
+        ASSERT_EQ(write(pipe_fds_[1], &c, 1), 1);
+    }
+
+    fakeclock::MasterOfTime clock_; // Take control of time
+    int pipe_fds_[2];
+};
+
+} // namespace
+
+TEST_F(PollTest, poll_reports_only_the_callers_fds)
+{
+    writeByte();
+    std::thread poller([&] {
+        struct pollfd pfds[2] = {{pipe_fds_[0], POLLIN, 0}, {pipe_fds_[1], POLLOUT, 0}};
+        EXPECT_EQ(poll(pfds, 2, 1000), 2);
+        EXPECT_EQ(pfds[0].revents, POLLIN);
+        EXPECT_EQ(pfds[1].revents, POLLOUT);
+    });
+    poller.join();
+}
+
+TEST_F(PollTest, poll_timeout_clears_revents)
+{
+    int result = -1;
+    struct pollfd pfd = {pipe_fds_[0], POLLIN, POLLIN};
+    assert_sleeps_for(clock_, 100ms, [&] { result = poll(&pfd, 1, 100); });
+    EXPECT_EQ(result, 0);
+    EXPECT_EQ(pfd.revents, 0);
+}
+
+TEST_F(PollTest, ppoll_has_nanosecond_precision)
+{
+    int result = -1;
+    auto start = fakeclock::FakeClock::now();
+    std::thread poller([&] {
+        struct pollfd pfd = {pipe_fds_[0], POLLIN, 0};
+        struct timespec timeout = {0, 1500};
+        result = ppoll(&pfd, 1, &timeout, nullptr);
+    });
+    ASSERT_TRUE(wait_for([&] { return clock_.nextEventTime() == start + 1500ns; }));
+    clock_.advance(1499ns);
+    ASSERT_FALSE(wait_for([&] { return result != -1; }, 1000));
+    clock_.advance(1ns);
+    poller.join();
+    EXPECT_EQ(result, 0);
+}
+
+TEST_F(PollTest, pselect)
+{
+    int result = -1;
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(pipe_fds_[0], &readfds);
+    assert_sleeps_for(clock_, 2s, [&] {
+        struct timespec timeout = {2, 0};
+        result = pselect(pipe_fds_[0] + 1, &readfds, nullptr, nullptr, &timeout, nullptr);
+    });
+    EXPECT_EQ(result, 0);
+    EXPECT_FALSE(FD_ISSET(pipe_fds_[0], &readfds));
+}
+
+TEST_F(PollTest, select_with_only_write_fds)
+{
+    fd_set writefds;
+    FD_ZERO(&writefds);
+    FD_SET(pipe_fds_[1], &writefds);
+    struct timeval timeout = {1, 0};
+    EXPECT_EQ(select(pipe_fds_[1] + 1, nullptr, &writefds, nullptr, &timeout), 1);
+    EXPECT_TRUE(FD_ISSET(pipe_fds_[1], &writefds));
+}
+
+TEST_F(PollTest, epoll_pwait_woken_by_fd_and_by_timeout)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_GE(epfd, 0);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = pipe_fds_[0];
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, pipe_fds_[0], &event), 0);
+
+    int result = -1;
+    struct epoll_event received[4];
+    assert_sleeps_for(clock_, 1s, [&] { result = epoll_pwait(epfd, received, 4, 1000, nullptr); });
+    EXPECT_EQ(result, 0);
+
+    writeByte();
+    EXPECT_EQ(epoll_pwait(epfd, received, 4, 1000, nullptr), 1);
+    EXPECT_EQ(received[0].data.fd, pipe_fds_[0]);
+    close(epfd);
+}
+
+TEST_F(PollTest, epoll_pwait2)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_GE(epfd, 0);
+    int result = -1;
+    struct epoll_event received[1];
+    assert_sleeps_for(clock_, 250us, [&] {
+        struct timespec timeout = {0, 250000};
+        result = epoll_pwait2(epfd, received, 1, &timeout, nullptr);
+    });
+    EXPECT_EQ(result, 0);
+    close(epfd);
+}
+
+TEST_F(PollTest, repeated_waits_do_not_open_fds)
+{
+    struct pollfd pfd = {pipe_fds_[0], POLLIN, 0};
+    writeByte();
+    ASSERT_EQ(poll(&pfd, 1, 1000), 1); // opens the wake fd of this thread
+    int fds_before = open_fd_count();
+    for (int i = 0; i < 1000; i++)
+    {
+        ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+    }
+    EXPECT_EQ(open_fd_count(), fds_before);
+}
@@ -5,9 +5,13 @@
 #include <fakeclock/fakeclock.h>
 #include <fakeclock/common.h>
 #include <gtest/gtest.h>
+#include <mutex>
+#include <pthread.h>
+#include <set>
 #include <signal.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 #include <thread>
 using namespace std::chrono_literals;
 
@@ -178,3 +182,197 @@ TEST(PosixTimerTest, AbsoluteTimer)
     // Cleanup
     timer_delete(timerid);
 }
+
+namespace
+{
+std::atomic<int> signals_received = 0;
+std::atomic<int> last_si_code = 0;
+std::atomic<int> last_si_overrun = -1;
+std::atomic<int> last_si_value = 0;
+
+void record_signal(int, siginfo_t *info, void *)
+{
+    last_si_code = info->si_code;
+    last_si_overrun = info->si_overrun;
+    last_si_value = info->si_value.sival_int;
+    signals_received++;
+}
+
+class ScopedSignalHandler
+{
+  public:
+    explicit ScopedSignalHandler(int signo) : signo_(signo)
+    {
+        struct sigaction action = {};
+        action.sa_sigaction = record_signal;
+        action.sa_flags = SA_SIGINFO;
+        sigaction(signo_, &action, &old_action_);
+        signals_received = 0;
+    }
+    ~ScopedSignalHandler()
+    {
+        sigaction(signo_, &old_action_, nullptr);
+    }
+
+  private:
+    int signo_;
+    struct sigaction old_action_;
+};
+} // namespace
+
+TEST(PosixTimerTest, SignalCarriesOverrunOfCoalescedExpirations)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    ScopedSignalHandler handler(SIGUSR1);
+
+    timer_t timerid;
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD_ID; // delivered to this thread before advance() returns
+    sev.sigev_signo = SIGUSR1;
+    sev.sigev_value.sival_int = 42;
+    sev._sigev_un._tid = gettid();
+    ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timerid), 0);
+
+    struct itimerspec its = {};
+    its.it_value = fakeclock::to_timespec(1ms);
+    its.it_interval = fakeclock::to_timespec(1ms);
+    ASSERT_EQ(timer_settime(timerid, 0, &its, nullptr), 0);
+
+    clock.advance(1s); // 1000 expirations, a single signal
+    EXPECT_EQ(signals_received, 1);
+    EXPECT_EQ(last_si_code, SI_TIMER);
+    EXPECT_EQ(last_si_value, 42);
+    EXPECT_EQ(last_si_overrun, 999);
+    EXPECT_EQ(timer_getoverrun(timerid), 999);
+
+    clock.advance(1ms);
+    EXPECT_EQ(signals_received, 2);
+    EXPECT_EQ(timer_getoverrun(timerid), 0);
+
+    timer_delete(timerid);
+}
+
+TEST(PosixTimerTest, SignalToProcess)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    ScopedSignalHandler handler(SIGUSR2);
+
+    timer_t timerid;
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGUSR2;
+    ASSERT_EQ(timer_create(CLOCK_REALTIME, &sev, &timerid), 0);
+
+    struct itimerspec its = {};
+    its.it_value = fakeclock::to_timespec(5s);
+    ASSERT_EQ(timer_settime(timerid, 0, &its, nullptr), 0);
+
+    clock.advance(4s);
+    EXPECT_FALSE(wait_for([] { return signals_received > 0; }, 1000));
+    clock.advance(1s);
+    EXPECT_TRUE(wait_for([] { return signals_received == 1; }));
+
+    timer_delete(timerid);
+}
+
+TEST(PosixTimerTest, ThreadCallbacksRunOnPool)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static std::atomic<int> callbacks = 0;
+    static std::mutex thread_ids_mutex;
+    static std::set<std::thread::id> thread_ids;
+    callbacks = 0;
+    thread_ids.clear();
+
+    timer_t timerid;
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = [](sigval) {
+        {
+            std::lock_guard<std::mutex> lock(thread_ids_mutex);
+            thread_ids.insert(std::this_thread::get_id());
+        }
+        callbacks++;
+    };
+    ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timerid), 0);
+
+    struct itimerspec its = {};
+    its.it_value = fakeclock::to_timespec(10ms);
+    its.it_interval = fakeclock::to_timespec(10ms);
+    ASSERT_EQ(timer_settime(timerid, 0, &its, nullptr), 0);
+
+    static constexpr int EXPIRATIONS = 200;
+    for (int i = 0; i < EXPIRATIONS; i++)
+    {
+        clock.advance(10ms);
+        ASSERT_TRUE(wait_for([i] { return callbacks == i + 1; })); // so that a thread is idle for the next one
+    }
+    timer_delete(timerid);
+    std::lock_guard<std::mutex> lock(thread_ids_mutex);
+    EXPECT_LE(thread_ids.size(), 4u);
+}
+
+TEST(PosixTimerTest, ThreadCallbacksThatWaitForEachOtherDoNotDeadlock)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static constexpr int TIMERS = 8;
+    static std::atomic<int> started = 0;
+    static std::atomic<int> met = 0;
+    started = 0;
+    met = 0;
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = [](sigval) {
+        started++;
+        if (wait_for([] { return started == TIMERS; }))
+        {
+            met++;
+        }
+    };
+    timer_t timers[TIMERS];
+    struct itimerspec its = {};
+    its.it_value = fakeclock::to_timespec(1s);
+    for (auto &timerid : timers)
+    {
+        ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timerid), 0);
+        ASSERT_EQ(timer_settime(timerid, 0, &its, nullptr), 0);
+    }
+    clock.advance(1s);
+    EXPECT_TRUE(wait_for([] { return met == TIMERS; }));
+    for (auto timerid : timers)
+    {
+        timer_delete(timerid);
+    }
+}
+
+TEST(PosixTimerTest, ThreadCallbacksRunWithTheirAttributes)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static constexpr size_t STACK_SIZE = 16 << 20; // more than the default, so that no cached stack fits
+    static std::atomic<size_t> stack_size = 0;
+    stack_size = 0;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, STACK_SIZE);
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_attributes = &attributes;
+    sev.sigev_notify_function = [](sigval) {
+        pthread_attr_t current;
+        pthread_getattr_np(pthread_self(), &current);
+        size_t size = 0;
+        pthread_attr_getstacksize(&current, &size);
+        pthread_attr_destroy(&current);
+        stack_size = size;
+    };
+    timer_t timerid;
+    ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timerid), 0);
+    pthread_attr_destroy(&attributes); // copied by timer_create()
+    struct itimerspec its = {};
+    its.it_value = fakeclock::to_timespec(1s);
+    ASSERT_EQ(timer_settime(timerid, 0, &its, nullptr), 0);
+    clock.advance(1s);
+    ASSERT_TRUE(wait_for([] { return stack_size != 0; }));
+    EXPECT_GE(stack_size, STACK_SIZE);
+    timer_delete(timerid);
+}
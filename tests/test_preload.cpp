@@ -0,0 +1,159 @@
+#include <chrono>
+#include <cstdlib>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/SharedTime.h>
+#include <fakeclock/common.h>
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+extern char **environ;
+
+namespace
+{
+
+class ControlFile
+{
+  public:
+    ControlFile()
+    {
+        char path[] = "/tmp/fakeclock_control_XXXXXX";
+        int fd = mkstemp(path);
+        EXPECT_NE(fd, -1);
+        close(fd);
+        path_ = path;
+    }
+    ~ControlFile()
+    {
+        unlink(path_.c_str());
+    }
+    const std::string &path() const
+    {
+        return path_;
+    }
+
+  private:
+    std::string path_;
+};
+
+pid_t spawn(const std::vector<std::string> &args, const std::vector<std::string> &extra_env = {})
+{
+    std::vector<char *> argv;
+    for (const auto &arg : args)
+    {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::vector<char *> envp(extra_env.size());
+    for (size_t i = 0; i < extra_env.size(); i++)
+    {
+        envp[i] = const_cast<char *>(extra_env[i].c_str());
+    }
+    for (char **var = environ; *var; var++)
+    {
+        envp.push_back(*var);
+    }
+    envp.push_back(nullptr);
+    pid_t pid;
+    EXPECT_EQ(posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), envp.data()), 0);
+    return pid;
+}
+
+int exit_status(pid_t pid)
+{
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void real_sleep(std::chrono::nanoseconds duration)
+{
+    auto ts = fakeclock::to_timespec(duration);
+    fakeclock::real.nanosleep(&ts, nullptr);
+}
+
+} // namespace
+
+TEST(PreloadTest, control_operations)
+{
+    ControlFile file;
+    auto *shared = fakeclock::SharedTime::open(file.path().c_str());
+    EXPECT_NE(shared->state.loadFlow().real_anchor, 0ns); // a new file follows real time
+
+    shared->freeze();
+    auto frozen = shared->state.loadTime(CLOCK_MONOTONIC);
+    real_sleep(5ms);
+    EXPECT_EQ(shared->state.loadTime(CLOCK_MONOTONIC), frozen);
+
+    shared->advance(1h);
+    EXPECT_EQ(shared->state.loadTime(CLOCK_MONOTONIC), frozen + 1h);
+
+    shared->setTime(CLOCK_REALTIME, 1000000000s);
+    EXPECT_EQ(shared->state.loadTime(CLOCK_REALTIME).time_since_epoch(), 1000000000s);
+    EXPECT_EQ(shared->state.loadTime(CLOCK_MONOTONIC), frozen + 1h);
+
+    shared->resume(1000);
+    real_sleep(5ms);
+    EXPECT_GT(shared->state.loadTime(CLOCK_MONOTONIC), frozen + 1h + 4s);
+    fakeclock::SharedTime::unmap(shared);
+}
+
+TEST(PreloadTest, control_operations_survive_writers_that_die)
+{
+    ControlFile file;
+    auto *shared = fakeclock::SharedTime::open(file.path().c_str());
+    shared->freeze();
+    for (int i = 0; i < 20; i++)
+    {
+        pid_t writer = fork();
+        if (writer == 0)
+        {
+            while (true)
+            {
+                shared->advance(1ns); // killed at some point, maybe holding the lock
+            }
+        }
+        real_sleep(1ms);
+        kill(writer, SIGKILL);
+        waitpid(writer, nullptr, 0);
+        auto before = shared->state.loadTime(CLOCK_MONOTONIC);
+        shared->advance(1h);
+        EXPECT_EQ(shared->state.loadTime(CLOCK_MONOTONIC), before + 1h);
+    }
+    fakeclock::SharedTime::unmap(shared);
+}
+
+TEST(PreloadTest, fakeclockctl_drives_preloaded_process)
+{
+    ControlFile file;
+    ASSERT_EQ(exit_status(spawn({FAKECLOCKCTL_PATH, "-f", file.path(), "freeze"})), 0);
+    pid_t sleeper = spawn({"/bin/sleep", "3600"}, {std::string("LD_PRELOAD=") + FAKECLOCK_LIBRARY_PATH,
+                                                    "FAKECLOCK_CONTROL=" + file.path()});
+    int status = 0;
+    bool exited = false;
+    for (int i = 0; i < 1000 && !exited; i++)
+    {
+        ASSERT_EQ(exit_status(spawn({FAKECLOCKCTL_PATH, "-f", file.path(), "advance", "10min"})), 0);
+        exited = waitpid(sleeper, &status, WNOHANG) == sleeper;
+        real_sleep(1ms);
+    }
+    if (!exited)
+    {
+        kill(sleeper, SIGKILL);
+        waitpid(sleeper, &status, 0);
+    }
+    EXPECT_TRUE(exited);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(PreloadTest, fakeclockctl_rejects_bad_commands)
+{
+    ControlFile file;
+    EXPECT_EQ(exit_status(spawn({FAKECLOCKCTL_PATH, "-f", file.path(), "advance", "10"})), 2);
+    EXPECT_EQ(exit_status(spawn({FAKECLOCKCTL_PATH, "-f", file.path(), "travel"})), 2);
+}
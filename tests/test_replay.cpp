@@ -0,0 +1,125 @@
+#include <chrono>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+class RecordingFile
+{
+  public:
+    RecordingFile()
+    {
+        char path[] = "/tmp/fakeclock_recording_XXXXXX";
+        int fd = mkstemp(path);
+        EXPECT_NE(fd, -1);
+        close(fd);
+        path_ = path;
+    }
+    ~RecordingFile()
+    {
+        unlink(path_.c_str());
+    }
+    const std::string &path() const
+    {
+        return path_;
+    }
+
+  private:
+    std::string path_;
+};
+
+struct Readings
+{
+    std::vector<int64_t> main;
+    std::vector<int64_t> worker;
+};
+
+int64_t read_clock(clockid_t clk_id)
+{
+    timespec ts;
+    clock_gettime(clk_id, &ts);
+    return fakeclock::to_duration(ts).count();
+}
+
+/// The same sequence of operations for the recorded and the replayed run.
+Readings run_workload()
+{
+    Readings readings;
+    readings.main.push_back(read_clock(CLOCK_MONOTONIC));
+    std::thread worker([&] {
+        readings.worker.push_back(read_clock(CLOCK_MONOTONIC));
+        std::this_thread::sleep_for(20ms);
+        readings.worker.push_back(read_clock(CLOCK_MONOTONIC));
+    });
+    readings.main.push_back(read_clock(CLOCK_REALTIME));
+    readings.main.push_back(std::chrono::nanoseconds(std::chrono::seconds(time(nullptr))).count());
+    usleep(10000);
+    readings.main.push_back(read_clock(CLOCK_MONOTONIC));
+    worker.join();
+    return readings;
+}
+
+} // namespace
+
+TEST(ReplayTest, replays_clock_readings_per_thread)
+{
+    RecordingFile file;
+    Readings recorded;
+    {
+        fakeclock::ClockRecorder recorder(file.path());
+        recorded = run_workload();
+    }
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.replay(file.path());
+    auto start = FakeClock::now();
+    auto replayed = run_workload();
+    EXPECT_EQ(replayed.main, recorded.main);
+    EXPECT_EQ(replayed.worker, recorded.worker);
+    // Time followed the recorded timeline, so the sleeps did not need anybody to advance it.
+    EXPECT_GE(FakeClock::now() - start, 20ms);
+}
+
+TEST(ReplayTest, diverging_thread_gets_simulated_time)
+{
+    RecordingFile file;
+    int64_t recorded;
+    {
+        fakeclock::ClockRecorder recorder(file.path());
+        recorded = read_clock(CLOCK_MONOTONIC);
+        EXPECT_THROW(fakeclock::ClockRecorder(file.path() + ".2"), std::logic_error);
+    }
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.replay(file.path());
+    EXPECT_THROW(clock.replay(file.path()), std::logic_error);
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts); // the recording has a CLOCK_MONOTONIC read
+    auto simulated = read_clock(CLOCK_MONOTONIC);
+    EXPECT_NE(simulated, recorded);
+    clock.advance(1s);
+    EXPECT_EQ(read_clock(CLOCK_MONOTONIC), simulated + std::chrono::nanoseconds(1s).count());
+}
+
+TEST(ReplayTest, rejects_files_that_are_no_recording)
+{
+    RecordingFile file;
+    std::ofstream(file.path()) << std::string(8192, 'x');
+    fakeclock::MasterOfTime clock; // Take control of time
+    EXPECT_THROW(clock.replay(file.path()), std::runtime_error);
+    std::stringstream maps;
+    maps << std::ifstream("/proc/self/maps").rdbuf();
+    EXPECT_EQ(maps.str().find(file.path()), std::string::npos); // unmapped again
+    EXPECT_THROW(clock.replay(file.path() + ".missing"), std::system_error);
+}
@@ -0,0 +1,206 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fakeclock/fakeclock.h>
+#include <functional>
+#include <future>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+/// Runs `body(id, log)` in `count` registered threads scheduled with `seed`, and returns the ids the threads logged,
+/// in order.
+std::vector<int> run_scheduled(uint64_t seed, int count, std::function<void(int, std::function<void()>)> body)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.setAutoAdvance(true);
+    clock.scheduleDeterministically(seed);
+    std::mutex mutex;
+    std::vector<int> order;
+    std::vector<std::thread> threads;
+    {
+        fakeclock::RegisteredThread registered; // the threads must be created by a registered thread
+        for (int id = 0; id < count; id++)
+        {
+            threads.emplace_back([&, id] {
+                body(id, [&, id] {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    order.push_back(id);
+                });
+            });
+        }
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    return order;
+}
+
+/// Logs between clock reads, where the threads hand their turns over.
+void read_clock_and_log(int, std::function<void()> log)
+{
+    for (int i = 0; i < 10; i++)
+    {
+        (void)std::chrono::steady_clock::now();
+        log();
+    }
+}
+
+} // namespace
+
+TEST(SchedulerTest, same_seed_interleaves_clock_reads_the_same_way)
+{
+    auto order = run_scheduled(1, 4, read_clock_and_log);
+    EXPECT_EQ(order.size(), 40u);
+    for (int run = 0; run < 5; run++)
+    {
+        EXPECT_EQ(run_scheduled(1, 4, read_clock_and_log), order);
+    }
+    bool other_seed_differs = false;
+    for (uint64_t seed = 2; seed < 10 && !other_seed_differs; seed++)
+    {
+        other_seed_differs = run_scheduled(seed, 4, read_clock_and_log) != order;
+    }
+    EXPECT_TRUE(other_seed_differs);
+}
+
+TEST(SchedulerTest, sleepers_with_the_same_deadline_wake_in_seed_order)
+{
+    auto sleep_and_log = [](int, std::function<void()> log) {
+        for (int i = 0; i < 3; i++)
+        {
+            std::this_thread::sleep_for(1s);
+            log();
+        }
+    };
+    auto order = run_scheduled(7, 3, sleep_and_log);
+    EXPECT_EQ(order.size(), 9u);
+    for (int run = 0; run < 5; run++)
+    {
+        EXPECT_EQ(run_scheduled(7, 3, sleep_and_log), order);
+    }
+}
+
+TEST(SchedulerTest, mutex_contention_is_reproducible)
+{
+    int counter = 0;
+    std::mutex counter_mutex;
+    auto increment = [&](int, std::function<void()> log) {
+        for (int i = 0; i < 20; i++)
+        {
+            std::lock_guard<std::mutex> lock(counter_mutex);
+            int value = counter;
+            (void)std::chrono::steady_clock::now(); // other threads run while this one holds the mutex
+            counter = value + 1;
+            log();
+        }
+    };
+    auto order = run_scheduled(3, 3, increment);
+    EXPECT_EQ(counter, 60);
+    counter = 0;
+    EXPECT_EQ(run_scheduled(3, 3, increment), order);
+    EXPECT_EQ(counter, 60);
+}
+
+TEST(SchedulerTest, condition_variable_producer_and_consumer)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<int> queue;
+    std::vector<int> consumed;
+    bool timed_out = false;
+    FakeClock::duration waited{};
+    auto produce_or_consume = [&](int id, std::function<void()> log) {
+        if (id == 0)
+        {
+            for (int item = 1; item <= 5; item++)
+            {
+                std::this_thread::sleep_for(1s);
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(item);
+                cv.notify_one();
+                log();
+            }
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        while (consumed.size() < 5)
+        {
+            cv.wait(lock, [&] { return !queue.empty(); });
+            consumed.push_back(queue.front());
+            queue.erase(queue.begin());
+            log();
+        }
+        auto start = FakeClock::now();
+        timed_out = !cv.wait_for(lock, 1h, [&] { return !queue.empty(); });
+        waited = FakeClock::now() - start;
+    };
+    auto order = run_scheduled(11, 2, produce_or_consume);
+    EXPECT_EQ(consumed, (std::vector<int>{1, 2, 3, 4, 5}));
+    EXPECT_TRUE(timed_out);
+    EXPECT_EQ(waited, 1h); // reached by automatic advance, as both threads were waiting
+    EXPECT_EQ(order.size(), 10u);
+}
+
+TEST(SchedulerTest, joins_threads_and_waits_for_futures)
+{
+    std::atomic<int> result = 0;
+    auto order = run_scheduled(5, 2, [&](int id, std::function<void()> log) {
+        auto future = std::async(std::launch::async, [id] {
+            std::this_thread::sleep_for(std::chrono::seconds(id + 1));
+            return id + 1;
+        });
+        result += future.get();
+        std::thread child([&] { log(); });
+        child.join();
+        log();
+    });
+    EXPECT_EQ(result, 3);
+    EXPECT_EQ(order.size(), 4u);
+}
+
+TEST(SchedulerTest, fd_waits_ended_by_other_threads_are_reproducible)
+{
+    auto write_and_poll = [](uint64_t seed) {
+        int fds[2];
+        EXPECT_EQ(pipe(fds), 0);
+        auto order = run_scheduled(seed, 2, [&](int id, std::function<void()> log) {
+            if (id == 0)
+            {
+                pollfd readable = {fds[0], POLLIN, 0};
+                EXPECT_EQ(poll(&readable, 1, -1), 1);
+                log();
+                return;
+            }
+            for (int i = 0; i < 5; i++)
+            {
+                if (i == 1)
+                {
+                    EXPECT_EQ(write(fds[1], "x", 1), 1);
+                }
+                (void)std::chrono::steady_clock::now();
+                log();
+            }
+        });
+        close(fds[0]);
+        close(fds[1]);
+        return order;
+    };
+    auto order = write_and_poll(13);
+    EXPECT_EQ(order.size(), 6u);
+    for (int run = 0; run < 5; run++)
+    {
+        EXPECT_EQ(write_and_poll(13), order);
+    }
+}
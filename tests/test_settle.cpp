@@ -0,0 +1,150 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+/// Waits until a thread sleeps, so that the next step wakes it. Threads that start with a sleep are known to be
+/// blocked from then on.
+void wait_for_sleeper(fakeclock::MasterOfTime &clock)
+{
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+}
+
+} // namespace
+
+TEST(SettleTest, returns_after_woken_threads_sleep_again)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::atomic<int> ticks = 0;
+    std::thread worker([&] {
+        for (int i = 0; i < 3; i++)
+        {
+            std::this_thread::sleep_for(1s);
+            ticks++;
+        }
+    });
+    wait_for_sleeper(clock);
+    for (int i = 1; i <= 3; i++)
+    {
+        EXPECT_TRUE(clock.advanceAndSettle(1s));
+        EXPECT_EQ(ticks, i);
+    }
+    worker.join();
+}
+
+TEST(SettleTest, returns_after_timerfd_readers_wait_again)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    for (bool use_epoll : {true, false})
+    {
+        std::atomic<uint64_t> expirations = 0;
+        std::thread worker([&] {
+            std::this_thread::sleep_for(1s);
+            int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+            itimerspec spec = {};
+            spec.it_value.tv_nsec = spec.it_interval.tv_nsec = 100000000;
+            timerfd_settime(fd, 0, &spec, nullptr);
+            int epfd = epoll_create1(0);
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+            while (expirations < 3)
+            {
+                if (use_epoll)
+                {
+                    epoll_wait(epfd, &event, 1, -1);
+                }
+                uint64_t value;
+                ASSERT_EQ(read(fd, &value, sizeof(value)), ssize_t(sizeof(value))); // blocks without epoll
+                expirations += value;
+            }
+            close(epfd);
+            close(fd);
+        });
+        wait_for_sleeper(clock);
+        EXPECT_TRUE(clock.advanceAndSettle(1s)); // the worker waits for its timerfd now
+        for (uint64_t i = 1; i <= 3; i++)
+        {
+            EXPECT_TRUE(clock.advanceAndSettle(100ms));
+            EXPECT_EQ(expirations, i);
+        }
+        worker.join();
+    }
+}
+
+TEST(SettleTest, follows_threads_woken_through_fds)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    std::atomic<bool> received = false;
+    std::thread reader([&] {
+        std::this_thread::sleep_for(1s);
+        pollfd fd = {pipe_fds[0], POLLIN, 0};
+        poll(&fd, 1, -1);
+        received = true;
+    });
+    wait_for_sleeper(clock);
+    EXPECT_TRUE(clock.advanceAndSettle(1s)); // the reader polls now
+    std::thread writer([&] {
+        std::this_thread::sleep_for(1s);
+        EXPECT_EQ(write(pipe_fds[1], "x", 1), 1);
+    });
+    wait_for_sleeper(clock);
+    EXPECT_TRUE(clock.advanceAndSettle(1s));
+    EXPECT_TRUE(received);
+    writer.join();
+    reader.join();
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+TEST(SettleTest, waits_for_timer_callbacks)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    static std::atomic<int> calls;
+    calls = 0;
+    sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = [](sigval) { calls++; };
+    timer_t timer;
+    ASSERT_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timer), 0);
+    itimerspec spec = {};
+    spec.it_value.tv_sec = 1;
+    ASSERT_EQ(timer_settime(timer, 0, &spec, nullptr), 0);
+    EXPECT_TRUE(clock.advanceAndSettle(1s));
+    EXPECT_EQ(calls, 1);
+    timer_delete(timer);
+}
+
+TEST(SettleTest, times_out_while_woken_thread_runs)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::atomic<bool> release = false;
+    std::thread worker([&] {
+        std::this_thread::sleep_for(1s);
+        while (!release)
+        {
+            std::this_thread::yield();
+        }
+    });
+    wait_for_sleeper(clock);
+    EXPECT_FALSE(clock.advanceAndSettle(1s, 10ms));
+    release = true;
+    worker.join();
+    EXPECT_TRUE(clock.advanceAndSettle(1s, 10s)); // the thread that did not settle is forgotten
+}
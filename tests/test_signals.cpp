@@ -0,0 +1,137 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+std::atomic<int> alarms_received = 0;
+std::atomic<int> last_si_code = 0;
+
+void record_alarm(int, siginfo_t *info, void *)
+{
+    last_si_code = info->si_code;
+    alarms_received++;
+}
+
+class ScopedAlarmHandler
+{
+  public:
+    ScopedAlarmHandler()
+    {
+        struct sigaction action = {};
+        action.sa_sigaction = record_alarm;
+        action.sa_flags = SA_SIGINFO;
+        sigaction(SIGALRM, &action, &old_action_);
+        alarms_received = 0;
+    }
+    ~ScopedAlarmHandler()
+    {
+        alarm(0);
+        sigaction(SIGALRM, &old_action_, nullptr);
+    }
+
+  private:
+    struct sigaction old_action_;
+};
+
+} // namespace
+
+TEST(SignalsTest, alarm_fires_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    ScopedAlarmHandler handler;
+    EXPECT_EQ(alarm(30), 0u);
+    clock.advance(10s);
+    EXPECT_EQ(alarm(30), 20u); // rearming returns the seconds that were left
+    clock.advance(29s);
+    EXPECT_FALSE(wait_for([] { return alarms_received > 0; }, 1000));
+    clock.advance(1s);
+    EXPECT_TRUE(wait_for([] { return alarms_received == 1; }));
+    EXPECT_EQ(last_si_code, SI_KERNEL);
+    EXPECT_EQ(alarm(0), 0u);
+}
+
+TEST(SignalsTest, setitimer_repeats_and_getitimer_reports_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    ScopedAlarmHandler handler;
+    itimerval value = {};
+    value.it_value.tv_sec = 2;
+    value.it_interval.tv_sec = 1;
+    ASSERT_EQ(setitimer(ITIMER_REAL, &value, nullptr), 0);
+    clock.advance(500ms);
+    itimerval current;
+    ASSERT_EQ(getitimer(ITIMER_REAL, &current), 0);
+    EXPECT_EQ(fakeclock::to_duration(current.it_value), 1500ms);
+    EXPECT_EQ(fakeclock::to_duration(current.it_interval), 1s);
+    clock.advance(1500ms);
+    EXPECT_TRUE(wait_for([] { return alarms_received == 1; }));
+    clock.advance(1s);
+    EXPECT_TRUE(wait_for([] { return alarms_received == 2; }));
+
+    itimerval disarm = {};
+    itimerval old_value;
+    ASSERT_EQ(setitimer(ITIMER_REAL, &disarm, &old_value), 0);
+    EXPECT_EQ(fakeclock::to_duration(old_value.it_value), 1s);
+    ASSERT_EQ(getitimer(ITIMER_REAL, &current), 0);
+    EXPECT_EQ(fakeclock::to_duration(current.it_value), 0s);
+
+    value.it_value.tv_usec = 1000000;
+    EXPECT_EQ(setitimer(ITIMER_REAL, &value, nullptr), -1);
+    EXPECT_EQ(errno, EINVAL);
+}
+
+TEST(SignalsTest, sigtimedwait_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigset_t old_set;
+    pthread_sigmask(SIG_BLOCK, &set, &old_set); // inherited by the threads below
+    assert_sleeps_for(clock, 10s, [&] {
+        timespec timeout = {10, 0};
+        EXPECT_EQ(sigtimedwait(&set, nullptr, &timeout), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    std::atomic<bool> waiting = false;
+    std::thread waiter([&] {
+        timespec timeout = {3600, 0};
+        waiting = true;
+        EXPECT_EQ(sigtimedwait(&set, nullptr, &timeout), SIGUSR1);
+    });
+    ASSERT_TRUE(wait_for([&] -> bool { return waiting; }));
+    pthread_kill(waiter.native_handle(), SIGUSR1);
+    waiter.join();
+
+    // Woken at the deadline, even after a long real wait.
+    std::atomic<int> error = 0;
+    std::thread sleeper([&] {
+        timespec timeout = {3600, 0};
+        EXPECT_EQ(sigtimedwait(&set, nullptr, &timeout), -1);
+        error = errno;
+    });
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+    timespec pause = {0, 100000000};
+    fakeclock::real.nanosleep(&pause, nullptr);
+    EXPECT_EQ(error, 0);
+    clock.advance(1h);
+    sleeper.join();
+    EXPECT_EQ(error, EAGAIN);
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+}
@@ -1,5 +1,6 @@
 #include "test_helpers.h"
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <ctime>
 #include <fakeclock/fakeclock.h>
@@ -44,6 +45,18 @@ TEST(FakeClockSleepTest, nanosleep)
     });
 }
 
+TEST(FakeClockSleepTest, nanosleep_without_request_fails)
+{
+    const struct timespec *volatile no_request = nullptr; // volatile, as glibc declares the argument nonnull
+    errno = 0;
+    EXPECT_EQ(nanosleep(no_request, nullptr), -1); // real time
+    EXPECT_EQ(errno, EFAULT);
+    fakeclock::MasterOfTime clock; // Take control of time
+    errno = 0;
+    EXPECT_EQ(nanosleep(no_request, nullptr), -1);
+    EXPECT_EQ(errno, EFAULT);
+}
+
 TEST(FakeClockSleepTest, this_thread_sleep_for)
 {
     fakeclock::MasterOfTime clock; // Take control of time
@@ -0,0 +1,241 @@
+#include "test_helpers.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+namespace
+{
+
+void set_timeout(int fd, int optname, time_t seconds)
+{
+    timeval timeout = {seconds, 0};
+    ASSERT_EQ(setsockopt(fd, SOL_SOCKET, optname, &timeout, sizeof(timeout)), 0);
+}
+
+} // namespace
+
+TEST(SocketsTest, recv_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    set_timeout(fds[0], SO_RCVTIMEO, 5);
+    char buffer[4];
+    assert_sleeps_for(clock, 5s, [&] {
+        EXPECT_EQ(recv(fds[0], buffer, sizeof(buffer), 0), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    // Reads on the socket and its duplicates wait for the same timeout.
+    int duplicate = dup(fds[0]);
+    assert_sleeps_for(clock, 5s, [&] {
+        EXPECT_EQ(read(duplicate, buffer, sizeof(buffer)), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    ASSERT_EQ(send(fds[1], "abc", 3, 0), 3);
+    EXPECT_EQ(recv(duplicate, buffer, sizeof(buffer), 0), 3);
+    close(duplicate);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(SocketsTest, receive_wakes_on_data)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+    set_timeout(fds[0], SO_RCVTIMEO, 3600);
+    std::thread receiver([&] {
+        char buffer[4];
+        sockaddr_storage from;
+        socklen_t from_size = sizeof(from);
+        EXPECT_EQ(recvfrom(fds[0], buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr *>(&from), &from_size), 1);
+    });
+    ASSERT_EQ(send(fds[1], "x", 1, 0), 1);
+    receiver.join();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(SocketsTest, receive_with_waitall_waits_for_all_data)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    set_timeout(fds[0], SO_RCVTIMEO, 5);
+    char buffer[8];
+    ASSERT_EQ(send(fds[1], "ab", 2, 0), 2);
+    assert_sleeps_for(clock, 5s, [&] { EXPECT_EQ(recv(fds[0], buffer, sizeof(buffer), MSG_WAITALL), 2); });
+
+    // Then the data arrives in parts, one per second, before the timeout.
+    clock.setAutoAdvance(true);
+    ASSERT_EQ(send(fds[1], "ab", 2, 0), 2);
+    auto start = fakeclock::FakeClock::now();
+    std::thread sender;
+    {
+        fakeclock::RegisteredThread registered;
+        sender = std::thread([&] {
+            std::this_thread::sleep_for(1s);
+            EXPECT_EQ(send(fds[1], "cdef", 4, 0), 4);
+            std::this_thread::sleep_for(1s);
+            EXPECT_EQ(send(fds[1], "ghij", 4, 0), 4);
+        });
+        iovec parts[2] = {{buffer, 3}, {buffer + 3, 5}};
+        msghdr message = {};
+        message.msg_iov = parts;
+        message.msg_iovlen = 2;
+        EXPECT_EQ(recvmsg(fds[0], &message, MSG_WAITALL), 8);
+    }
+    EXPECT_EQ(fakeclock::FakeClock::now() - start, 2s);
+    EXPECT_EQ(std::string(buffer, 8), "abcdefgh");
+    sender.join();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(SocketsTest, send_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    char chunk[4096] = {};
+    while (send(fds[0], chunk, sizeof(chunk), MSG_DONTWAIT) > 0)
+    {
+    }
+    set_timeout(fds[0], SO_SNDTIMEO, 2);
+    assert_sleeps_for(clock, 2s, [&] {
+        EXPECT_EQ(send(fds[0], chunk, sizeof(chunk), 0), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(SocketsTest, write_writev_and_readv_time_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    char chunk[4096] = {};
+    while (send(fds[0], chunk, sizeof(chunk), MSG_DONTWAIT) > 0)
+    {
+    }
+    set_timeout(fds[0], SO_SNDTIMEO, 2);
+    assert_sleeps_for(clock, 2s, [&] {
+        EXPECT_EQ(write(fds[0], chunk, sizeof(chunk)), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    iovec iov = {chunk, sizeof(chunk)};
+    assert_sleeps_for(clock, 2s, [&] {
+        EXPECT_EQ(writev(fds[0], &iov, 1), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    char buffer[4];
+    iovec received = {buffer, sizeof(buffer)};
+    set_timeout(fds[0], SO_RCVTIMEO, 1);
+    assert_sleeps_for(clock, 1s, [&] {
+        EXPECT_EQ(readv(fds[0], &received, 1), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(SocketsTest, accept_times_out_on_fake_time_and_connect_succeeds)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+    socklen_t address_size = sizeof(address);
+    ASSERT_EQ(getsockname(listener, reinterpret_cast<sockaddr *>(&address), &address_size), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+    set_timeout(listener, SO_RCVTIMEO, 3);
+    assert_sleeps_for(clock, 3s, [&] {
+        EXPECT_EQ(accept(listener, nullptr, nullptr), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    set_timeout(client, SO_SNDTIMEO, 3);
+    ASSERT_EQ(connect(client, reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+    int connection = accept(listener, nullptr, nullptr);
+    ASSERT_GE(connection, 0);
+    // The accepted socket inherits the timeout of the listening socket, but setting its own leaves that unchanged.
+    char buffer[4];
+    assert_sleeps_for(clock, 3s, [&] {
+        EXPECT_EQ(recv(connection, buffer, sizeof(buffer), 0), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    set_timeout(connection, SO_RCVTIMEO, 1);
+    assert_sleeps_for(clock, 3s, [&] {
+        EXPECT_EQ(accept(listener, nullptr, nullptr), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    close(connection);
+    close(client);
+    close(listener);
+}
+
+TEST(SocketsTest, concurrent_accepts_leave_the_socket_blocking)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+    socklen_t address_size = sizeof(address);
+    ASSERT_EQ(getsockname(listener, reinterpret_cast<sockaddr *>(&address), &address_size), 0);
+    static constexpr int CONNECTIONS = 400;
+    ASSERT_EQ(listen(listener, CONNECTIONS), 0);
+    set_timeout(listener, SO_RCVTIMEO, 3);
+    std::vector<int> clients;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        clients.push_back(socket(AF_INET, SOCK_STREAM, 0));
+        ASSERT_EQ(connect(clients.back(), reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+    }
+    // The threads make the listening socket non-blocking during each of their calls, whose windows overlap.
+    static constexpr int THREADS = 4;
+    auto accept_share = [&] {
+        for (int i = 0; i < CONNECTIONS / THREADS; i++)
+        {
+            int connection = accept(listener, nullptr, nullptr);
+            EXPECT_GE(connection, 0);
+            close(connection);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; i++)
+    {
+        threads.emplace_back(accept_share);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(fcntl(listener, F_GETFL) & O_NONBLOCK, 0);
+    assert_sleeps_for(clock, 3s, [&] {
+        EXPECT_EQ(accept(listener, nullptr, nullptr), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    });
+    for (int client : clients)
+    {
+        close(client);
+    }
+    close(listener);
+}
@@ -0,0 +1,88 @@
+#include "test_helpers.h"
+#include <chrono>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <string>
+#include <sys/timerfd.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+TEST(StatsTest, counts_intercepted_operations)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    fakeclock::resetStats();
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time(nullptr);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID - 100, &ts); // an id of a dynamic clock
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    itimerspec spec = {};
+    spec.it_value.tv_sec = 1;
+    timerfd_settime(fd, 0, &spec, nullptr);
+    assert_sleeps_for(clock, 3s, [] { std::this_thread::sleep_for(2s); });
+    EXPECT_EQ(poll(nullptr, 0, 0), 0); // not intercepted: it does not wait
+    close(fd);
+
+    auto stats = fakeclock::stats();
+    EXPECT_EQ(stats.clock_reads[CLOCK_MONOTONIC], 2u);
+    EXPECT_EQ(stats.clock_reads[CLOCK_REALTIME], 1u);
+    EXPECT_EQ(stats.clock_reads[fakeclock::Stats::CLOCK_IDS - 1], 1u);
+    EXPECT_EQ(stats.sleeps, 1u);
+    EXPECT_EQ(stats.sleep_time, 2s);
+    EXPECT_EQ(stats.sleep_durations[7], 1u); // (1 s, 10 s]
+    EXPECT_EQ(stats.timerfd_operations, 2u);
+    EXPECT_EQ(stats.timerfd_expirations, 1u);
+    EXPECT_EQ(stats.fd_waits, 0u);
+    EXPECT_EQ(stats.advances, 1u);
+    EXPECT_EQ(stats.woken_threads, 1u);
+    EXPECT_EQ(stats.fired_timers, 1u);
+    EXPECT_EQ(stats.woken_threads_per_advance[1], 1u);
+    EXPECT_EQ(stats.fired_timers_per_advance[1], 1u);
+}
+
+TEST(StatsTest, counts_fd_wait_timeouts)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    fakeclock::resetStats();
+    assert_sleeps_for(clock, 1s, [] { EXPECT_EQ(poll(nullptr, 0, 1000), 0); });
+    auto stats = fakeclock::stats();
+    EXPECT_EQ(stats.fd_waits, 1u);
+    EXPECT_EQ(stats.fd_wait_timeouts, 1u);
+    EXPECT_EQ(stats.woken_threads, 1u);
+}
+
+TEST(StatsTest, counts_simulated_and_wall_time)
+{
+    fakeclock::resetStats();
+    {
+        fakeclock::MasterOfTime clock; // Take control of time
+        clock.advance(10s);
+    }
+    auto stats = fakeclock::stats();
+    EXPECT_EQ(stats.simulated_time, 10s);
+    EXPECT_GT(stats.wall_time, 0s);
+    EXPECT_LT(stats.wall_time, 10s);
+}
+
+TEST(StatsTest, dumps_prometheus_text)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    fakeclock::resetStats();
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    assert_sleeps_for(clock, 1ms, [] { usleep(500); });
+    auto text = fakeclock::statsText();
+    EXPECT_NE(text.find("# TYPE fakeclock_clock_reads_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_clock_reads_total{clock=\"boottime\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_sleep_duration_seconds_bucket{le=\"0.0001\"} 0\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_sleep_duration_seconds_bucket{le=\"0.001\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_sleep_duration_seconds_bucket{le=\"+Inf\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_sleep_duration_seconds_sum 0.0005\n"), std::string::npos);
+    EXPECT_NE(text.find("fakeclock_advance_woken_threads_count 1\n"), std::string::npos);
+}
@@ -0,0 +1,181 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <pthread.h>
+#include <semaphore.h>
+#include <shared_mutex>
+#include <thread>
+#include <time.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+namespace
+{
+
+/// Absolute time `duration` from now on `clock_id`, as taken by the timed waits.
+timespec deadline_in(clockid_t clock_id, FakeClock::duration duration)
+{
+    timespec now;
+    clock_gettime(clock_id, &now);
+    return fakeclock::to_timespec(fakeclock::to_duration(now) + duration);
+}
+
+} // namespace
+
+TEST(SyncTest, condition_variable_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::mutex mutex;
+    std::condition_variable cv;
+    assert_sleeps_for(clock, 10s, [&] {
+        std::unique_lock lock(mutex);
+        EXPECT_FALSE(cv.wait_for(lock, 10s, [] { return false; }));
+    });
+}
+
+TEST(SyncTest, condition_variable_wakes_on_notify)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool ready = false;
+    std::thread waiter([&] {
+        std::unique_lock lock(mutex);
+        EXPECT_TRUE(cv.wait_for(lock, 1h, [&] { return ready; }));
+    });
+    {
+        std::lock_guard lock(mutex);
+        ready = true;
+    }
+    cv.notify_one();
+    waiter.join();
+}
+
+TEST(SyncTest, cond_timedwait_uses_clock_of_condition_variable)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_t cond;
+    pthread_cond_init(&cond, &attr);
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    assert_sleeps_for(clock, 2s, [&] {
+        auto deadline = deadline_in(CLOCK_MONOTONIC, 2s);
+        pthread_mutex_lock(&mutex);
+        EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &deadline), ETIMEDOUT);
+        pthread_mutex_unlock(&mutex);
+    });
+    // A deadline that has passed times out right away.
+    auto deadline = deadline_in(CLOCK_MONOTONIC, -1s);
+    pthread_mutex_lock(&mutex);
+    EXPECT_EQ(pthread_cond_timedwait(&cond, &mutex, &deadline), ETIMEDOUT);
+    pthread_mutex_unlock(&mutex);
+    pthread_cond_destroy(&cond);
+    pthread_condattr_destroy(&attr);
+}
+
+TEST(SyncTest, cond_timedwait_has_no_spurious_wakeups)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    std::atomic<int> result = -1;
+    std::thread waiter([&] {
+        auto deadline = deadline_in(CLOCK_REALTIME, 1h);
+        pthread_mutex_lock(&mutex);
+        result = pthread_cond_timedwait(&cond, &mutex, &deadline);
+        pthread_mutex_unlock(&mutex);
+    });
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+    timespec pause = {0, 300000000}; // longer than the real slices of the wait
+    fakeclock::real.nanosleep(&pause, nullptr);
+    EXPECT_EQ(result, -1);
+    clock.advance(1h);
+    waiter.join();
+    EXPECT_EQ(result, ETIMEDOUT);
+}
+
+TEST(SyncTest, timed_mutex_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::timed_mutex mutex;
+    mutex.lock();
+    assert_sleeps_for(clock, 5s, [&] { EXPECT_FALSE(mutex.try_lock_for(5s)); });
+    std::thread locker([&] { EXPECT_TRUE(mutex.try_lock_for(1h)); });
+    mutex.unlock();
+    locker.join();
+}
+
+TEST(SyncTest, pthread_mutex_timedlock_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&mutex);
+    assert_sleeps_for(clock, 3s, [&] {
+        auto deadline = deadline_in(CLOCK_REALTIME, 3s);
+        EXPECT_EQ(pthread_mutex_timedlock(&mutex, &deadline), ETIMEDOUT);
+    });
+    pthread_mutex_unlock(&mutex);
+}
+
+TEST(SyncTest, shared_timed_mutex_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::shared_timed_mutex mutex;
+    mutex.lock();
+    assert_sleeps_for(clock, 2s, [&] { EXPECT_FALSE(mutex.try_lock_shared_for(2s)); });
+    mutex.unlock();
+    mutex.lock_shared();
+    assert_sleeps_for(clock, 2s, [&] { EXPECT_FALSE(mutex.try_lock_for(2s)); });
+    mutex.unlock_shared();
+}
+
+TEST(SyncTest, semaphore_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    sem_t sem;
+    sem_init(&sem, 0, 0);
+    assert_sleeps_for(clock, 4s, [&] {
+        auto deadline = deadline_in(CLOCK_REALTIME, 4s);
+        EXPECT_EQ(sem_timedwait(&sem, &deadline), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+    });
+    std::thread waiter([&] {
+        auto deadline = deadline_in(CLOCK_MONOTONIC, 1h);
+        EXPECT_EQ(sem_clockwait(&sem, CLOCK_MONOTONIC, &deadline), 0);
+    });
+    sem_post(&sem);
+    waiter.join();
+    sem_destroy(&sem);
+}
+
+TEST(SyncTest, settles_after_timed_wait_ends)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<int> timeouts = 0;
+    std::thread waiter([&] {
+        std::unique_lock lock(mutex);
+        for (int i = 0; i < 2; i++)
+        {
+            cv.wait_for(lock, 1s, [] { return false; });
+            timeouts++;
+        }
+    });
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+    EXPECT_TRUE(clock.advanceAndSettle(1s));
+    EXPECT_EQ(timeouts, 1);
+    EXPECT_TRUE(clock.advanceAndSettle(1s));
+    EXPECT_EQ(timeouts, 2);
+    waiter.join();
+}
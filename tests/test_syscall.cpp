@@ -0,0 +1,111 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <fakeclock/RealFunctions.h>
+#include <fakeclock/common.h>
+#include <fakeclock/fakeclock.h>
+#include <future>
+#include <gtest/gtest.h>
+#include <linux/futex.h>
+#include <semaphore>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+TEST(SyscallTest, clock_gettime_returns_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    clock.advance(1h);
+    timespec expected;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &expected);
+    ASSERT_EQ(syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts), 0);
+    EXPECT_EQ(fakeclock::to_duration(ts), fakeclock::to_duration(expected));
+}
+
+TEST(SyscallTest, nanosleep_sleeps_in_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    assert_sleeps_for(clock, 2s, [] {
+        timespec request = {2, 0};
+        EXPECT_EQ(syscall(SYS_nanosleep, &request, nullptr), 0);
+    });
+}
+
+TEST(SyscallTest, futex_wait_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    uint32_t word = 0;
+    assert_sleeps_for(clock, 3s, [&] {
+        timespec timeout = {3, 0};
+        EXPECT_EQ(syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, 0, &timeout, nullptr, 0), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+    });
+    std::atomic<bool> woken = false;
+    std::thread waiter([&] {
+        timespec timeout = {3600, 0};
+        while (__atomic_load_n(&word, __ATOMIC_ACQUIRE) == 0)
+        {
+            syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, 0, &timeout, nullptr, 0);
+        }
+        woken = true;
+    });
+    __atomic_store_n(&word, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    waiter.join();
+    EXPECT_TRUE(woken);
+}
+
+TEST(SyscallTest, shared_futex_wait_bitset_times_out_at_fake_deadline)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    uint32_t word = 0;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    auto deadline = fakeclock::to_timespec(fakeclock::to_duration(now) + 1h);
+    std::atomic<int> error = -1;
+    std::thread waiter([&] {
+        EXPECT_EQ(syscall(SYS_futex, &word, FUTEX_WAIT_BITSET, 0, &deadline, nullptr, 1), -1);
+        error = errno;
+    });
+    ASSERT_TRUE(wait_for([&] { return clock.nextEventTime().has_value(); }));
+    timespec pause = {0, 300000000}; // longer than the real slices of the wait
+    fakeclock::real.nanosleep(&pause, nullptr);
+    EXPECT_EQ(error, -1);
+    clock.advance(1h);
+    ASSERT_TRUE(wait_for([&] { return error != -1; })); // woken at the deadline, not at the end of a slice
+    EXPECT_EQ(error, ETIMEDOUT);
+    waiter.join();
+}
+
+TEST(SyscallTest, future_wait_for_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::promise<int> promise;
+    auto future = promise.get_future();
+    assert_sleeps_for(clock, 5s, [&] { EXPECT_EQ(future.wait_for(5s), std::future_status::timeout); });
+    promise.set_value(1);
+    EXPECT_EQ(future.wait_for(1h), std::future_status::ready);
+}
+
+TEST(SyscallTest, semaphore_try_acquire_for_times_out_on_fake_time)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    std::counting_semaphore<1> semaphore(0);
+    assert_sleeps_for(clock, 4s, [&] { EXPECT_FALSE(semaphore.try_acquire_for(4s)); });
+    semaphore.release();
+    EXPECT_TRUE(semaphore.try_acquire_for(1h));
+}
+
+TEST(SyscallTest, passes_other_system_calls_through)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+    EXPECT_EQ(syscall(SYS_getpid), getpid());
+}
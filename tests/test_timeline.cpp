@@ -0,0 +1,125 @@
+#include "test_helpers.h"
+#include <atomic>
+#include <chrono>
+#include <fakeclock/fakeclock.h>
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+
+TEST(TimelineTest, timelines_advance_independently)
+{
+    fakeclock::Timeline first;
+    fakeclock::Timeline second;
+    FakeClock::time_point first_start;
+    FakeClock::time_point second_start;
+    {
+        fakeclock::ScopedTimeline attach(first);
+        fakeclock::MasterOfTime clock;
+        first_start = FakeClock::now();
+        {
+            fakeclock::ScopedTimeline attach_second(second);
+            fakeclock::MasterOfTime second_clock;
+            second_start = FakeClock::now();
+            second_clock.advance(2h);
+            EXPECT_EQ(FakeClock::now(), second_start + 2h);
+        }
+        clock.advance(1h);
+        EXPECT_EQ(FakeClock::now(), first_start + 1h);
+    }
+}
+
+TEST(TimelineTest, default_timeline_is_not_intercepted_by_other_timelines)
+{
+    fakeclock::Timeline timeline;
+    std::thread controller([&] {
+        fakeclock::ScopedTimeline attach(timeline);
+        fakeclock::MasterOfTime clock;
+        clock.advance(24h);
+    });
+    controller.join();
+    auto before = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(1ms); // a real sleep
+    EXPECT_GE(std::chrono::steady_clock::now() - before, 1ms);
+}
+
+TEST(TimelineTest, created_threads_inherit_the_timeline)
+{
+    fakeclock::Timeline timeline;
+    fakeclock::ScopedTimeline attach(timeline);
+    fakeclock::MasterOfTime clock;
+    auto start = FakeClock::now();
+    std::atomic<bool> woke = false;
+    std::thread sleeper([&] {
+        std::this_thread::sleep_for(1min);
+        woke = true;
+    });
+    EXPECT_FALSE(wait_for([&] { return woke.load(); }));
+    clock.advance(1min);
+    EXPECT_TRUE(wait_for([&] { return woke.load(); }));
+    sleeper.join();
+    EXPECT_EQ(FakeClock::now(), start + 1min);
+}
+
+TEST(TimelineTest, scenarios_run_in_parallel)
+{
+    constexpr int scenarios = 4;
+    std::vector<FakeClock::duration> elapsed(scenarios);
+    std::vector<std::thread> shards;
+    for (int i = 0; i < scenarios; i++)
+    {
+        shards.emplace_back([&elapsed, i] {
+            fakeclock::Timeline timeline;
+            fakeclock::ScopedTimeline attach(timeline);
+            fakeclock::MasterOfTime clock;
+            clock.setAutoAdvance(true);
+            auto start = FakeClock::now();
+            {
+                fakeclock::RegisteredThread registered;
+                for (int step = 0; step < 100; step++)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(i + 1));
+                }
+            }
+            elapsed[i] = FakeClock::now() - start;
+        });
+    }
+    for (auto &shard : shards)
+    {
+        shard.join();
+    }
+    for (int i = 0; i < scenarios; i++)
+    {
+        EXPECT_EQ(elapsed[i], std::chrono::seconds(100 * (i + 1)));
+    }
+}
+
+TEST(TimelineTest, timerfds_may_be_closed_from_other_timelines)
+{
+    fakeclock::Timeline timeline;
+    fakeclock::Timeline other;
+    fakeclock::ScopedTimeline attach(timeline);
+    fakeclock::MasterOfTime clock;
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    ASSERT_GE(fd, 0);
+    itimerspec value = {};
+    value.it_value = fakeclock::to_timespec(1s);
+    ASSERT_EQ(timerfd_settime(fd, 0, &value, nullptr), 0);
+    std::thread([&] {
+        fakeclock::ScopedTimeline attach_other(other);
+        close(fd);
+    }).join();
+    // Expirations of the closed timerfd must not reach the file that reuses its number.
+    int reused = eventfd(0, EFD_NONBLOCK);
+    ASSERT_EQ(reused, fd);
+    clock.advance(1s);
+    uint64_t count;
+    EXPECT_EQ(read(reused, &count, sizeof(count)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    close(reused);
+}
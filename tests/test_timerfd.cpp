@@ -3,11 +3,12 @@
 #include <chrono>
 #include <fakeclock/ClockSimulator.h>
 #include <fakeclock/fakeclock.h>
+#include <fcntl.h>
 #include <gtest/gtest.h>
-#include <linux/kcmp.h>
+#include <poll.h>
 #include <sys/eventfd.h>
-#include <sys/syscall.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
 using namespace std::chrono_literals;
@@ -15,24 +16,6 @@ using fakeclock::to_timespec;
 
 static constexpr auto LONG_DURATION = 3s;
 
-TEST(TimerFdUtilsTest, are_fds_equivalent)
-{
-    int fd = eventfd(0, 0);
-    int fd2 = dup(fd);
-    ASSERT_NE(fd2, -1);
-    int fd3 = eventfd(0, 0);
-    ASSERT_NE(fd3, -1);
-    ASSERT_NE(fd, -1);
-    ASSERT_NE(fd2, -1);
-    EXPECT_TRUE(fakeclock::are_fds_equivalent(fd, fd2));
-    EXPECT_FALSE(fakeclock::are_fds_equivalent(fd, fd3));
-    int ret = close(fd);
-    ASSERT_EQ(ret, 0);
-    EXPECT_FALSE(fakeclock::are_fds_equivalent(fd, fd2));
-    ret = close(fd2);
-    ASSERT_EQ(ret, 0);
-}
-
 class TimerFdTest : public ::testing::TestWithParam<int>
 {
 };
@@ -329,3 +312,149 @@ TEST_P(TimerFdTest, timerfd_gettime_interval)
 }
 
 INSTANTIATE_TEST_SUITE_P(TimerFdTests, TimerFdTest, ::testing::Values(CLOCK_MONOTONIC, CLOCK_REALTIME));
+
+static itimerspec one_shot(fakeclock::FakeClock::duration duration)
+{
+    itimerspec value{};
+    value.it_value = to_timespec(duration);
+    return value;
+}
+
+TEST(TimerFdTrackingTest, closed_timerfd_number_can_be_reused)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_NE(timer_fd, -1);
+    auto value = one_shot(1s);
+    ASSERT_EQ(timerfd_settime(timer_fd, 0, &value, nullptr), 0);
+    ASSERT_EQ(close(timer_fd), 0);
+
+    // The kernel hands out the lowest free fd, so the pipe reuses the timerfd number.
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(fds[0], timer_fd);
+    clock.advance(1s);
+
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    EXPECT_EQ(poll(&pfd, 1, 0), 0) << "expiration of a closed timerfd must not be written to the new fd";
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(TimerFdTrackingTest, duplicate_receives_expirations_after_original_is_closed)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_NE(timer_fd, -1);
+    int dup_fd = fcntl(timer_fd, F_DUPFD, 100);
+    ASSERT_GE(dup_fd, 100);
+    ASSERT_EQ(close(timer_fd), 0);
+
+    auto value = one_shot(1s);
+    ASSERT_EQ(timerfd_settime(dup_fd, 0, &value, nullptr), 0);
+    clock.advance(1s);
+
+    uint64_t expirations = 0;
+    ASSERT_EQ(read(dup_fd, &expirations, sizeof(expirations)), sizeof(expirations));
+    EXPECT_EQ(expirations, 1);
+    ASSERT_EQ(close(dup_fd), 0);
+}
+
+TEST(TimerFdTrackingTest, dup2_over_timerfd_closes_it)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_NE(timer_fd, -1);
+    auto value = one_shot(1s);
+    ASSERT_EQ(timerfd_settime(timer_fd, 0, &value, nullptr), 0);
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(dup2(fds[0], timer_fd), timer_fd);
+    clock.advance(1s);
+
+    struct pollfd pfd = {timer_fd, POLLIN, 0};
+    EXPECT_EQ(poll(&pfd, 1, 0), 0);
+    itimerspec curr_value;
+    EXPECT_EQ(timerfd_gettime(timer_fd, &curr_value), -1);
+    EXPECT_EQ(errno, EINVAL);
+    close(timer_fd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(TimerFdFlagsTest, nonblocking_read_fails_until_expiration)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ASSERT_NE(timer_fd, -1);
+    uint64_t expirations = 0;
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    auto value = one_shot(1s);
+    ASSERT_EQ(timerfd_settime(timer_fd, 0, &value, nullptr), 0);
+    clock.advance(500ms);
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    clock.advance(500ms);
+    ASSERT_EQ(read(timer_fd, &expirations, sizeof(expirations)), sizeof(expirations));
+    EXPECT_EQ(expirations, 1);
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    close(timer_fd);
+}
+
+TEST(TimerFdFlagsTest, cancel_on_set_timer_reports_clock_change)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    ASSERT_NE(timer_fd, -1);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    itimerspec value{};
+    value.it_value = to_timespec(fakeclock::to_duration(now) + 1h);
+    ASSERT_EQ(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &value, nullptr), 0);
+
+    struct pollfd pfd = {timer_fd, POLLIN, 0};
+    EXPECT_EQ(poll(&pfd, 1, 0), 0);
+    timespec later = to_timespec(fakeclock::to_duration(now) + 1min);
+    ASSERT_EQ(clock_settime(CLOCK_REALTIME, &later), 0);
+    EXPECT_EQ(poll(&pfd, 1, 0), 1) << "epoll loops must learn about the clock change";
+
+    uint64_t expirations = 0;
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, ECANCELED);
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    clock.advance(1h);
+    ASSERT_EQ(read(timer_fd, &expirations, sizeof(expirations)), sizeof(expirations));
+    EXPECT_EQ(expirations, 1);
+    close(timer_fd);
+}
+
+TEST(TimerFdFlagsTest, timers_without_cancel_on_set_ignore_clock_changes)
+{
+    fakeclock::MasterOfTime clock; // Take control of time
+
+    int timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    ASSERT_NE(timer_fd, -1);
+    auto value = one_shot(1h);
+    // Relative timers never cancel, even with the flag.
+    ASSERT_EQ(timerfd_settime(timer_fd, TFD_TIMER_CANCEL_ON_SET, &value, nullptr), 0);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    timespec later = to_timespec(fakeclock::to_duration(now) + 1min);
+    ASSERT_EQ(clock_settime(CLOCK_REALTIME, &later), 0);
+
+    uint64_t expirations = 0;
+    EXPECT_EQ(read(timer_fd, &expirations, sizeof(expirations)), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    close(timer_fd);
+}
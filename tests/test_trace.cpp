@@ -0,0 +1,200 @@
+#include "test_helpers.h"
+#include <chrono>
+#include <cstdio>
+#include <fakeclock/Trace.h>
+#include <fakeclock/fakeclock.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+
+using fakeclock::FakeClock;
+using fakeclock::TraceOp;
+using fakeclock::TraceRecord;
+
+namespace
+{
+
+class TraceFile
+{
+  public:
+    TraceFile()
+    {
+        char path[] = "/tmp/fakeclock_trace_XXXXXX";
+        int fd = mkstemp(path);
+        EXPECT_NE(fd, -1);
+        close(fd);
+        path_ = path;
+    }
+    ~TraceFile()
+    {
+        unlink(path_.c_str());
+    }
+    const std::string &path() const
+    {
+        return path_;
+    }
+
+    /// Records of thread `tid` in the order they were written.
+    std::vector<TraceRecord> records(pid_t tid) const
+    {
+        std::ifstream file(path_, std::ios::binary | std::ios::ate);
+        std::vector<char> data(file.tellg());
+        file.seekg(0).read(data.data(), std::streamsize(data.size()));
+        std::vector<TraceRecord> result;
+        EXPECT_GE(data.size(), sizeof(fakeclock::TraceFileHeader));
+        const auto *header = reinterpret_cast<const fakeclock::TraceFileHeader *>(data.data());
+        for (uint32_t i = 0; i < std::min(header->threads_used.load(), header->max_threads); i++)
+        {
+            const auto *region = reinterpret_cast<const fakeclock::TraceThreadRegion *>(
+                data.data() + sizeof(fakeclock::TraceFileHeader) + size_t(i) * header->region_size);
+            if (region->tid != uint32_t(tid))
+            {
+                continue;
+            }
+            auto written = region->written.load();
+            auto first = written > header->records_per_thread ? written - header->records_per_thread : 0;
+            for (auto n = first; n < written; n++)
+            {
+                result.push_back(region->records()[n & (header->records_per_thread - 1)]);
+            }
+        }
+        return result;
+    }
+
+  private:
+    std::string path_;
+};
+
+const TraceRecord *find(const std::vector<TraceRecord> &records, TraceOp op)
+{
+    for (const auto &record : records)
+    {
+        if (record.op == op)
+        {
+            return &record;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+TEST(TraceTest, records_operations_of_each_thread)
+{
+    TraceFile file;
+    pid_t sleeper_tid = 0;
+    timespec read_time;
+    int fd;
+    {
+        fakeclock::TraceRecorder recorder(file.path());
+        fakeclock::MasterOfTime clock; // Take control of time
+        clock_gettime(CLOCK_MONOTONIC, &read_time);
+        fd = timerfd_create(CLOCK_MONOTONIC, 0);
+        itimerspec spec = {};
+        spec.it_value.tv_sec = 1;
+        timerfd_settime(fd, 0, &spec, nullptr);
+        assert_sleeps_for(clock, 2s, [&] {
+            sleeper_tid = gettid();
+            std::this_thread::sleep_for(2s);
+        });
+        close(fd);
+    }
+    auto main_records = file.records(gettid());
+    auto *read = find(main_records, TraceOp::ClockGettime);
+    ASSERT_NE(read, nullptr);
+    EXPECT_EQ(read->clock_id, CLOCK_MONOTONIC);
+    EXPECT_EQ(read->args[0], fakeclock::to_duration(read_time).count());
+    EXPECT_GT(read->real_time, 0);
+    auto *settime = find(main_records, TraceOp::TimerfdSettime);
+    ASSERT_NE(settime, nullptr);
+    EXPECT_EQ(settime->args[0], fd);
+    EXPECT_EQ(settime->args[1], settime->fake_time + std::chrono::nanoseconds(1s).count());
+    auto *advance = find(main_records, TraceOp::Advance);
+    ASSERT_NE(advance, nullptr);
+    EXPECT_EQ(advance->args[0], std::chrono::nanoseconds(2s).count());
+    auto *expire = find(main_records, TraceOp::TimerfdExpire);
+    ASSERT_NE(expire, nullptr);
+    EXPECT_EQ(expire->args[0], fd);
+
+    auto sleeper_records = file.records(sleeper_tid);
+    ASSERT_EQ(sleeper_records.size(), 2u);
+    EXPECT_EQ(sleeper_records[0].op, TraceOp::Nanosleep);
+    EXPECT_EQ(sleeper_records[0].args[0], sleeper_records[0].fake_time + std::chrono::nanoseconds(2s).count());
+    EXPECT_EQ(sleeper_records[1].op, TraceOp::Wake);
+    EXPECT_GE(sleeper_records[1].fake_time, sleeper_records[0].args[0]);
+    EXPECT_EQ(sleeper_records[1].tid, uint32_t(sleeper_tid));
+}
+
+TEST(TraceTest, stops_recording_at_destruction)
+{
+    TraceFile file;
+    fakeclock::MasterOfTime clock; // Take control of time
+    timespec ts;
+    {
+        fakeclock::TraceRecorder recorder(file.path());
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        EXPECT_THROW(fakeclock::TraceRecorder(file.path()), std::logic_error);
+    }
+    clock.advance(1s);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    auto records = file.records(gettid());
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].op, TraceOp::ClockGettime);
+}
+
+TEST(TraceTest, keeps_last_records_of_a_thread)
+{
+    TraceFile file;
+    fakeclock::MasterOfTime clock; // Take control of time
+    {
+        fakeclock::TraceRecorder recorder(file.path(), 4);
+        for (int i = 0; i < 10; i++)
+        {
+            clock.advance(std::chrono::seconds(i));
+        }
+    }
+    auto records = file.records(gettid());
+    ASSERT_EQ(records.size(), 4u);
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(records[i].op, TraceOp::Advance);
+        EXPECT_EQ(records[i].args[0], std::chrono::nanoseconds(std::chrono::seconds(6 + i)).count());
+    }
+}
+
+TEST(TraceTest, converts_to_chrome_trace)
+{
+    TraceFile file;
+    {
+        fakeclock::TraceRecorder recorder(file.path());
+        fakeclock::MasterOfTime clock; // Take control of time
+        assert_sleeps_for(clock, 1s, [] { std::this_thread::sleep_for(1s); });
+    }
+    std::string json_path = file.path() + ".json";
+    pid_t converter = fork();
+    ASSERT_NE(converter, -1);
+    if (converter == 0)
+    {
+        execl(FAKECLOCKTRACE_PATH, FAKECLOCKTRACE_PATH, file.path().c_str(), json_path.c_str(), nullptr);
+        _exit(127);
+    }
+    int status;
+    waitpid(converter, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    std::ifstream json_file(json_path);
+    std::string json((std::istreambuf_iterator<char>(json_file)), std::istreambuf_iterator<char>());
+    std::remove(json_path.c_str());
+    EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+    EXPECT_NE(json.find("{\"name\":\"nanosleep\",\"cat\":\"fakeclock\""), std::string::npos);
+    EXPECT_NE(json.find("\"ph\":\"X\",\"dur\":1000000.000"), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"advance\""), std::string::npos);
+}
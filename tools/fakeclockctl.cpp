@@ -0,0 +1,216 @@
+// Controls the time of processes started with LD_PRELOAD=libfakeclock.so FAKECLOCK_CONTROL=<file>.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fakeclock/SharedTime.h>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+using Duration = fakeclock::SharedTime::Duration;
+
+constexpr const char *USAGE = R"(usage: fakeclockctl [-f FILE] COMMAND [ARGS]... [COMMAND [ARGS]...]...
+
+Controls the time of processes started with LD_PRELOAD=libfakeclock.so FAKECLOCK_CONTROL=FILE.
+FILE defaults to $FAKECLOCK_CONTROL. Commands run in the given order; "-" reads more commands from
+stdin, one per line, so a driver can batch thousands of them through a single process.
+
+  freeze               stop the time
+  resume [SCALE]       let the time flow, SCALE times faster than real time (default 1)
+  advance DURATION     jump ahead, e.g. 10s, 1.5h or 250ms (units: ns, us, ms, s, min, h, d)
+  set CLOCK SECONDS    set CLOCK (realtime, monotonic, boottime, tai) to SECONDS since its epoch
+  query [CLOCK]        print the time of CLOCK (default monotonic) and whether the time flows
+)";
+
+struct UsageError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+Duration parse_seconds(const std::string &text, double unit_seconds)
+{
+    char *end;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || *end != '\0' || !std::isfinite(value))
+    {
+        throw UsageError("invalid number: " + text);
+    }
+    return Duration(static_cast<Duration::rep>(std::llround(value * unit_seconds * 1e9)));
+}
+
+Duration parse_duration(const std::string &text)
+{
+    static const std::pair<const char *, double> units[] = {{"ns", 1e-9}, {"us", 1e-6}, {"ms", 1e-3},
+                                                            {"min", 60},  {"s", 1},     {"h", 3600},
+                                                            {"d", 86400}};
+    for (const auto &[suffix, seconds] : units)
+    {
+        auto length = std::strlen(suffix);
+        if (text.size() > length && text.compare(text.size() - length, length, suffix) == 0)
+        {
+            return parse_seconds(text.substr(0, text.size() - length), seconds);
+        }
+    }
+    throw UsageError("duration needs a unit (ns, us, ms, s, min, h, d): " + text);
+}
+
+int parse_clock(const std::string &name)
+{
+    if (name == "realtime")
+    {
+        return CLOCK_REALTIME;
+    }
+    if (name == "monotonic")
+    {
+        return CLOCK_MONOTONIC;
+    }
+    if (name == "boottime")
+    {
+        return CLOCK_BOOTTIME;
+    }
+    if (name == "tai")
+    {
+        return CLOCK_TAI;
+    }
+    throw UsageError("unknown clock: " + name);
+}
+
+/// Runs the commands in `args`, each followed by its arguments.
+void run(fakeclock::SharedTime &shared, const std::vector<std::string> &args)
+{
+    size_t pos = 0;
+    auto optional_arg = [&]() -> const std::string * {
+        static const std::vector<std::string> commands = {"freeze", "resume", "advance", "set", "query", "-"};
+        if (pos < args.size() && std::find(commands.begin(), commands.end(), args[pos]) == commands.end())
+        {
+            return &args[pos++];
+        }
+        return nullptr;
+    };
+    auto required_arg = [&](const char *what) -> const std::string & {
+        if (pos >= args.size())
+        {
+            throw UsageError(std::string("missing ") + what);
+        }
+        return args[pos++];
+    };
+    while (pos < args.size())
+    {
+        const auto &command = args[pos++];
+        if (command == "freeze")
+        {
+            shared.freeze();
+        }
+        else if (command == "resume")
+        {
+            auto *scale = optional_arg();
+            double factor = 1.0;
+            if (scale)
+            {
+                char *end;
+                factor = std::strtod(scale->c_str(), &end);
+                if (*end != '\0' || !(factor > 0) || !std::isfinite(factor))
+                {
+                    throw UsageError("invalid scale: " + *scale);
+                }
+            }
+            shared.resume(factor);
+        }
+        else if (command == "advance")
+        {
+            auto duration = parse_duration(required_arg("DURATION"));
+            if (duration < Duration::zero())
+            {
+                throw UsageError("time cannot go backwards");
+            }
+            shared.advance(duration);
+        }
+        else if (command == "set")
+        {
+            int clk_id = parse_clock(required_arg("CLOCK"));
+            shared.setTime(clk_id, parse_seconds(required_arg("SECONDS"), 1));
+        }
+        else if (command == "query")
+        {
+            auto *clock = optional_arg();
+            auto time = shared.state.loadTime(clock ? parse_clock(*clock) : CLOCK_MONOTONIC).time_since_epoch();
+            auto flow = shared.state.loadFlow();
+            std::printf("%lld.%09lld %s", static_cast<long long>(time.count() / 1000000000),
+                        static_cast<long long>(time.count() % 1000000000),
+                        flow.real_anchor == Duration::zero() ? "frozen" : "flowing");
+            if (flow.real_anchor != Duration::zero())
+            {
+                std::printf(" x%g", flow.scale);
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+        }
+        else if (command == "-")
+        {
+            std::string line;
+            while (std::getline(std::cin, line))
+            {
+                std::istringstream words(line);
+                std::vector<std::string> line_args;
+                for (std::string word; words >> word;)
+                {
+                    line_args.push_back(word);
+                }
+                run(shared, line_args);
+            }
+        }
+        else
+        {
+            throw UsageError("unknown command: " + command);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    const char *path = std::getenv("FAKECLOCK_CONTROL");
+    if (args.size() >= 2 && args[0] == "-f")
+    {
+        path = argv[2];
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    if (args.empty() || args[0] == "-h" || args[0] == "--help")
+    {
+        std::cout << USAGE;
+        return args.empty() ? 2 : 0;
+    }
+    if (!path || !*path)
+    {
+        std::cerr << "fakeclockctl: no control file, use -f FILE or set FAKECLOCK_CONTROL" << std::endl;
+        return 2;
+    }
+    try
+    {
+        auto *shared = fakeclock::SharedTime::open(path);
+        run(*shared, args);
+    }
+    catch (const UsageError &e)
+    {
+        std::cerr << "fakeclockctl: " << e.what() << "\n\n" << USAGE;
+        return 2;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "fakeclockctl: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
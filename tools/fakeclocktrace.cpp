@@ -0,0 +1,256 @@
+// Converts a trace recorded by fakeclock (see fakeclock::TraceRecorder and FAKECLOCK_TRACE) to the Chrome trace event
+// format, which Perfetto (ui.perfetto.dev) and chrome://tracing display.
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fakeclock/Trace.h>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+using fakeclock::TRACE_OP_NAMES;
+using fakeclock::TraceFileHeader;
+using fakeclock::TraceOp;
+using fakeclock::TraceRecord;
+using fakeclock::TraceThreadRegion;
+
+constexpr const char *USAGE = R"(usage: fakeclocktrace [--real-time] TRACE_FILE [OUTPUT_FILE]
+
+Converts a trace recorded by fakeclock (TraceRecorder or FAKECLOCK_TRACE=FILE) to JSON in the Chrome trace event
+format, for ui.perfetto.dev or chrome://tracing. The timeline shows fake time, or real time with --real-time.
+Sleeps, fd waits and timed waits on synchronization objects, futexes and signals become slices that last until the
+thread woke up, everything else is an instant event.
+)";
+
+bool is_wait(TraceOp op)
+{
+    return (op >= TraceOp::Sleep && op <= TraceOp::Pselect) || op >= TraceOp::CondTimedwait;
+}
+
+/// Names of the two arguments of `op`, nullptr if unused.
+std::pair<const char *, const char *> arg_names(TraceOp op)
+{
+    switch (op)
+    {
+    case TraceOp::ClockGettime:
+    case TraceOp::Gettimeofday:
+    case TraceOp::Time:
+    case TraceOp::ClockSettime:
+    case TraceOp::Settimeofday:
+        return {"time_ns", nullptr};
+    case TraceOp::Sleep:
+    case TraceOp::Usleep:
+    case TraceOp::Nanosleep:
+    case TraceOp::ClockNanosleep:
+    case TraceOp::CondTimedwait:
+    case TraceOp::MutexTimedlock:
+    case TraceOp::RwlockTimedlock:
+    case TraceOp::SemTimedwait:
+    case TraceOp::FutexWait:
+    case TraceOp::Sigtimedwait:
+        return {"deadline_ns", nullptr};
+    case TraceOp::Poll:
+    case TraceOp::Ppoll:
+    case TraceOp::Select:
+    case TraceOp::Pselect:
+        return {"timeout_ns", "nfds"};
+    case TraceOp::EpollWait:
+    case TraceOp::EpollPwait:
+    case TraceOp::EpollPwait2:
+        return {"timeout_ns", "epfd"};
+    case TraceOp::Wake:
+        return {"result", nullptr};
+    case TraceOp::TimerfdCreate:
+    case TraceOp::TimerfdGettime:
+        return {"fd", nullptr};
+    case TraceOp::TimerfdSettime:
+    case TraceOp::TimerfdExpire:
+        return {"fd", "expiration_ns"};
+    case TraceOp::TimerCreate:
+    case TraceOp::TimerDelete:
+    case TraceOp::TimerGettime:
+        return {"timer", nullptr};
+    case TraceOp::TimerSettime:
+        return {"timer", "expiration_ns"};
+    case TraceOp::TimerGetoverrun:
+    case TraceOp::TimerExpire:
+        return {"timer", "overrun"};
+    case TraceOp::Advance:
+        return {"duration_ns", nullptr};
+    }
+    return {"arg0", "arg1"};
+}
+
+class Converter
+{
+  public:
+    Converter(const TraceFileHeader &header, FILE *out, bool real_time)
+        : header_(header), out_(out), real_time_(real_time)
+    {
+        std::fprintf(out_, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    }
+    ~Converter()
+    {
+        std::fprintf(out_, "\n]}\n");
+    }
+
+    void thread(const TraceThreadRegion &region)
+    {
+        auto records_per_thread = header_.records_per_thread;
+        auto written = region.written.load(std::memory_order_acquire);
+        // Once the ring is full, the oldest slot may be half overwritten by a write that never completed.
+        uint64_t first = written > records_per_thread ? written - records_per_thread + 1 : 0;
+        std::optional<TraceRecord> wait;
+        for (auto i = first; i < written; i++)
+        {
+            const auto &record = region.records()[i & (records_per_thread - 1)];
+            if (record.op > TraceOp::Sigtimedwait)
+            {
+                continue; // not written completely
+            }
+            if (wait && record.op == TraceOp::Wake)
+            {
+                event(*wait, region.pid, &record);
+                wait.reset();
+                continue;
+            }
+            if (wait)
+            {
+                event(*wait, region.pid, nullptr); // its wake was lost
+                wait.reset();
+            }
+            if (is_wait(record.op))
+            {
+                wait = record;
+            }
+            else
+            {
+                event(record, region.pid, nullptr);
+            }
+        }
+        if (wait)
+        {
+            event(*wait, region.pid, nullptr); // still waiting
+        }
+    }
+
+  private:
+    double timestamp(const TraceRecord &record) const
+    {
+        return static_cast<double>(real_time_ ? header_.toRealTime(record.real_time) : record.fake_time) / 1000.0;
+    }
+
+    /// Writes `record` as a slice that ends at `wake`, or as an instant event without it.
+    void event(const TraceRecord &record, uint32_t pid, const TraceRecord *wake)
+    {
+        auto [name0, name1] = arg_names(record.op);
+        std::fprintf(out_, "%s\n{\"name\":\"%s\",\"cat\":\"fakeclock\",\"pid\":%" PRIu32 ",\"tid\":%" PRIu32
+                           ",\"ts\":%.3f",
+                     first_ ? "" : ",", TRACE_OP_NAMES[size_t(record.op)], pid, record.tid, timestamp(record));
+        first_ = false;
+        if (wake)
+        {
+            std::fprintf(out_, ",\"ph\":\"X\",\"dur\":%.3f", timestamp(*wake) - timestamp(record));
+        }
+        else
+        {
+            // Time jumps concern every thread of the process.
+            std::fprintf(out_, ",\"ph\":\"i\",\"s\":\"%s\"", record.op == TraceOp::Advance ? "p" : "t");
+        }
+        std::fprintf(out_, ",\"args\":{\"%s\":%" PRId64, real_time_ ? "fake_ns" : "real_ns",
+                     real_time_ ? record.fake_time : header_.toRealTime(record.real_time));
+        if (record.clock_id >= 0)
+        {
+            std::fprintf(out_, ",\"clock\":%d", record.clock_id);
+        }
+        if (name0)
+        {
+            std::fprintf(out_, ",\"%s\":%" PRId64, name0, record.args[0]);
+        }
+        if (name1)
+        {
+            std::fprintf(out_, ",\"%s\":%" PRId64, name1, record.args[1]);
+        }
+        if (wake)
+        {
+            std::fprintf(out_, ",\"result\":%" PRId64, wake->args[0]);
+        }
+        std::fprintf(out_, "}}");
+    }
+
+    const TraceFileHeader &header_;
+    FILE *out_;
+    bool real_time_;
+    bool first_ = true;
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    bool real_time = !args.empty() && args[0] == "--real-time";
+    if (real_time)
+    {
+        args.erase(args.begin());
+    }
+    if (args.empty() || args.size() > 2 || args[0] == "-h" || args[0] == "--help")
+    {
+        std::fputs(USAGE, args.empty() || args.size() > 2 ? stderr : stdout);
+        return args.size() == 1 ? 0 : 2;
+    }
+    int fd = open(args[0].c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        std::fprintf(stderr, "fakeclocktrace: cannot open %s: %s\n", args[0].c_str(), std::strerror(errno));
+        return 1;
+    }
+    void *memory = st.st_size >= off_t(sizeof(TraceFileHeader))
+                       ? mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)
+                       : MAP_FAILED;
+    close(fd);
+    auto *header = static_cast<const TraceFileHeader *>(memory);
+    if (memory == MAP_FAILED || std::memcmp(header->magic, TraceFileHeader::MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(TraceRecord) || header->records_per_thread == 0 ||
+        (header->records_per_thread & (header->records_per_thread - 1)) != 0 ||
+        sizeof(TraceFileHeader) + uint64_t(header->max_threads) * header->region_size > uint64_t(st.st_size))
+    {
+        std::fprintf(stderr, "fakeclocktrace: %s is no fakeclock trace\n", args[0].c_str());
+        return 1;
+    }
+    FILE *out = args.size() == 2 ? std::fopen(args[1].c_str(), "w") : stdout;
+    if (!out)
+    {
+        std::fprintf(stderr, "fakeclocktrace: cannot create %s: %s\n", args[1].c_str(), std::strerror(errno));
+        return 1;
+    }
+    auto threads = std::min(header->threads_used.load(), header->max_threads);
+    {
+        Converter converter(*header, out, real_time);
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            auto *region = reinterpret_cast<const TraceThreadRegion *>(reinterpret_cast<const char *>(header) +
+                                                                       sizeof(TraceFileHeader) +
+                                                                       size_t(i) * header->region_size);
+            converter.thread(*region);
+        }
+    }
+    if (header->threads_used.load() > header->max_threads)
+    {
+        std::fprintf(stderr, "fakeclocktrace: %" PRIu32 " threads were not recorded, the trace has room for %" PRIu32
+                             "\n",
+                     header->threads_used.load() - header->max_threads, header->max_threads);
+    }
+    return std::fclose(out) == 0 ? 0 : 1;
+}